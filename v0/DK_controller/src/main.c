@@ -6,24 +6,66 @@
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/printk.h>
+#include <stdlib.h>
 
 #include <zephyr/net/openthread.h>
 #include <openthread/udp.h>
 #include <openthread/message.h>
+#include <openthread/random_noncrypto.h>
+
+#include "light_groups.h"
+#include "light_schedule.h"
+#include "light_state.h"
 
 LOG_MODULE_REGISTER(ot_controller, CONFIG_LOG_DEFAULT_LEVEL);
 
 /* OpenThread networking definitions */
 #define OT_CONNECTION_LED_PORT 1234
 static const char *light_command = "toggle";
+// Group the button toggles, LIGHT_GROUP_ALL toggles every light
+static uint16_t light_group = LIGHT_GROUP_ALL;
+// How far ahead toggles are scheduled, 0 toggles on arrival
+static uint32_t light_lead_ms = LIGHT_SCHEDULE_LEAD_MS;
+
+/* Skew the lights reported for the last toggle */
+static otUdpSocket report_socket;
+static int skew_count;
+static int32_t skew_min_us;
+static int32_t skew_max_us;
+
+/* State commands ("on", "off", "level") set the lights rather than flip
+ * them, so each one is sent LIGHT_RETRIES more times, LIGHT_RETRY_MS apart,
+ * and the lights drop the copies they already have
+ */
+#define LIGHT_RETRIES 3
+#define LIGHT_RETRY_MS 50
+// Starts at random so a rebooted controller is not taken for a stale one
+static uint32_t light_seq;
+static char state_command[24];
+static uint16_t state_group;
+static int state_retries;
+
+/* Lights that answered the last state command, each answers up to twice */
+#define STATE_LIGHTS_MAX 32
+struct state_light {
+    otIp6Address address;
+    bool applied;
+};
+static struct state_light state_lights[STATE_LIGHTS_MAX];
+static int state_reports; // Lights in state_lights
+static int state_applied; // Of those, the ones that applied it
 
 /* GPIO definitions for the button */
 #define SW0_NODE DT_ALIAS(sw0)
 static const struct gpio_dt_spec button = GPIO_DT_SPEC_GET(SW0_NODE, gpios);
 static struct gpio_callback button_cb_data;
 
-/* UDP sending logic */
-void send_light_control_command(void)
+/* UDP sending logic
+ * Sent to the group's multicast address, only its members pass it up
+ */
+static void send_light_command(uint16_t group, const char *command)
 {
     otError error = OT_ERROR_NONE;
     otMessage *message;
@@ -32,7 +74,7 @@ void send_light_control_command(void)
     otUdpSocket udpSocket;
 
     memset(&messageInfo, 0, sizeof(messageInfo));
-    otIp6AddressFromString("ff03::1", &messageInfo.mPeerAddr);
+    light_group_address(group, &messageInfo.mPeerAddr);
     messageInfo.mPeerPort = OT_CONNECTION_LED_PORT;
 
     message = otUdpNewMessage(p_ot_instance, NULL);
@@ -41,7 +83,7 @@ void send_light_control_command(void)
         return;
     }
 
-    error = otMessageAppend(message, light_command, strlen(light_command));
+    error = otMessageAppend(message, command, strlen(command));
     if (error != OT_ERROR_NONE) {
         otMessageFree(message);
         return;
@@ -55,21 +97,268 @@ void send_light_control_command(void)
 
     error = otUdpSend(p_ot_instance, &udpSocket, message, &messageInfo);
     if (error != OT_ERROR_NONE) {
+        // On failure the message is still ours to free
+        otMessageFree(message);
         LOG_ERR("Failed to send UDP message: %d", error);
     } else {
-        LOG_INF("UDP message sent successfully!");
+        LOG_INF("UDP message sent successfully to group %u: %s", group, command);
     }
 
     otUdpClose(p_ot_instance, &udpSocket);
 }
 
+/* With the network time synced the toggle carries its execution time,
+ * light_lead_ms ahead, otherwise the lights toggle on arrival
+ */
+void send_light_control_command(uint16_t group)
+{
+    char command[24];
+    uint64_t now_us;
+
+    if (light_lead_ms > 0 &&
+        light_mesh_time(openthread_get_default_instance(), &now_us) == OT_NETWORK_TIME_SYNCHRONIZED) {
+        snprintk(command, sizeof(command), LIGHT_SCHEDULE_PREFIX "%u",
+                 (uint32_t)(now_us / 1000) + light_lead_ms);
+    } else {
+        snprintk(command, sizeof(command), "%s", light_command);
+    }
+    skew_count = 0;
+    send_light_command(group, command);
+}
+
+/* Sends the retries of the last state command from the system work queue */
+static void state_retry_handler(struct k_work *work)
+{
+    struct openthread_context *context = openthread_get_default_context();
+
+    openthread_api_mutex_lock(context);
+    send_light_command(state_group, state_command);
+    openthread_api_mutex_unlock(context);
+
+    if (--state_retries > 0) {
+        k_work_reschedule(k_work_delayable_from_work(work), K_MSEC(LIGHT_RETRY_MS));
+    }
+}
+
+K_WORK_DELAYABLE_DEFINE(state_retry_work, state_retry_handler);
+
+/* Sets a group to a level, 0 is off and LIGHT_LEVEL_MAX on. A newer
+ * command replaces the retries of the previous one. The OpenThread API
+ * must be locked.
+ */
+static void send_light_state_command(uint16_t group, uint8_t level)
+{
+    light_seq++;
+    if (level == 0) {
+        snprintk(state_command, sizeof(state_command), "off s=%u", light_seq);
+    } else if (level == LIGHT_LEVEL_MAX) {
+        snprintk(state_command, sizeof(state_command), "on s=%u", light_seq);
+    } else {
+        snprintk(state_command, sizeof(state_command), "level %u s=%u", level, light_seq);
+    }
+    state_group = group;
+    state_applied = 0;
+    state_reports = 0;
+
+    send_light_command(group, state_command);
+    state_retries = LIGHT_RETRIES;
+    k_work_reschedule(&state_retry_work, K_MSEC(LIGHT_RETRY_MS));
+}
+
+/* Counts a light once however many of its reports arrive */
+static void count_state_report(const otIp6Address *light, bool applied)
+{
+    int i;
+
+    for (i = 0; i < state_reports; i++) {
+        if (otIp6IsAddressEqual(&state_lights[i].address, light)) {
+            break;
+        }
+    }
+    if (i == state_reports) {
+        if (state_reports == STATE_LIGHTS_MAX) {
+            LOG_WRN("More than %d lights reported, not counted", STATE_LIGHTS_MAX);
+            return;
+        }
+        state_lights[i].address = *light;
+        state_lights[i].applied = false;
+        state_reports++;
+    }
+    if (applied && !state_lights[i].applied) {
+        state_lights[i].applied = true;
+        state_applied++;
+    }
+}
+
+/* Report callback function, "skew <us> <sync state>" after a scheduled
+ * toggle and "state s=<seq> l=<level> <result>" after a state command
+ */
+static void report_receive_callback(void *aContext, otMessage *aMessage, const otMessageInfo *aMessageInfo)
+{
+    OT_UNUSED_VARIABLE(aContext);
+
+    char report[48];
+    char sender[OT_IP6_ADDRESS_STRING_SIZE];
+    int length;
+
+    length = otMessageRead(aMessage, otMessageGetOffset(aMessage), report, sizeof(report) - 1);
+    report[length] = '\0';
+
+    otIp6AddressToString(&aMessageInfo->mPeerAddr, sender, sizeof(sender));
+    LOG_INF("Report from %s: %s", sender, report);
+
+    if (strncmp(report, LIGHT_STATE_PREFIX, strlen(LIGHT_STATE_PREFIX)) == 0) {
+        const char *seq_field = strstr(report, "s=");
+        if (seq_field != NULL && strtoul(seq_field + 2, NULL, 10) == light_seq) {
+            count_state_report(&aMessageInfo->mPeerAddr, strstr(report, " applied") != NULL);
+        }
+        return;
+    }
+    if (strncmp(report, "skew ", 5) != 0) {
+        return;
+    }
+    int32_t skew_us = strtol(report + 5, NULL, 10);
+    if (skew_count == 0 || skew_us < skew_min_us) {
+        skew_min_us = skew_us;
+    }
+    if (skew_count == 0 || skew_us > skew_max_us) {
+        skew_max_us = skew_us;
+    }
+    skew_count++;
+}
+
 /* Button press callback function */
 void button_pressed(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
 {
     LOG_INF("Button pressed, sending command.");
-    send_light_control_command();
+    send_light_control_command(light_group);
+}
+
+/* Shell commands: pick the group the button toggles, or toggle one now */
+static int parse_group(const struct shell *sh, const char *arg, uint16_t *group)
+{
+    char *end;
+    unsigned long value = strtoul(arg, &end, 10);
+
+    if (*end != '\0' || value > UINT16_MAX) {
+        shell_error(sh, "Group must be 0 (all lights) to %u", UINT16_MAX);
+        return -EINVAL;
+    }
+    *group = value;
+    return 0;
+}
+
+static int cmd_light_group(const struct shell *sh, size_t argc, char **argv)
+{
+    if (argc > 1 && parse_group(sh, argv[1], &light_group) != 0) {
+        return -EINVAL;
+    }
+    shell_print(sh, "Button toggles group %u", light_group);
+    return 0;
+}
+
+static int cmd_light_toggle(const struct shell *sh, size_t argc, char **argv)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    uint16_t group = light_group;
+
+    if (argc > 1 && parse_group(sh, argv[1], &group) != 0) {
+        return -EINVAL;
+    }
+
+    openthread_api_mutex_lock(context);
+    send_light_control_command(group);
+    openthread_api_mutex_unlock(context);
+    return 0;
+}
+
+static int send_state_from_shell(const struct shell *sh, size_t argc, char **argv, uint8_t level)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    uint16_t group = light_group;
+
+    if (argc > 1 && parse_group(sh, argv[1], &group) != 0) {
+        return -EINVAL;
+    }
+
+    openthread_api_mutex_lock(context);
+    send_light_state_command(group, level);
+    openthread_api_mutex_unlock(context);
+    return 0;
+}
+
+static int cmd_light_on(const struct shell *sh, size_t argc, char **argv)
+{
+    return send_state_from_shell(sh, argc, argv, LIGHT_LEVEL_MAX);
+}
+
+static int cmd_light_off(const struct shell *sh, size_t argc, char **argv)
+{
+    return send_state_from_shell(sh, argc, argv, 0);
 }
 
+static int cmd_light_level(const struct shell *sh, size_t argc, char **argv)
+{
+    char *end;
+    unsigned long level = strtoul(argv[1], &end, 10);
+
+    if (*end != '\0' || level > LIGHT_LEVEL_MAX) {
+        shell_error(sh, "Level must be 0..%u", LIGHT_LEVEL_MAX);
+        return -EINVAL;
+    }
+    return send_state_from_shell(sh, argc - 1, argv + 1, level);
+}
+
+static int cmd_light_state(const struct shell *sh, size_t argc, char **argv)
+{
+    if (state_command[0] == '\0') {
+        shell_print(sh, "No state command sent yet");
+        return 0;
+    }
+    shell_print(sh, "\"%s\" to group %u: %d lights reported, %d applied it", state_command,
+                state_group, state_reports, state_applied);
+    return 0;
+}
+
+static int cmd_light_lead(const struct shell *sh, size_t argc, char **argv)
+{
+    if (argc > 1) {
+        char *end;
+        unsigned long lead = strtoul(argv[1], &end, 10);
+
+        if (*end != '\0' || lead >= LIGHT_SCHEDULE_MAX_MS) {
+            shell_error(sh, "Lead must be 0 (on arrival) to %u ms", LIGHT_SCHEDULE_MAX_MS - 1);
+            return -EINVAL;
+        }
+        light_lead_ms = lead;
+    }
+    shell_print(sh, "Toggles scheduled %u ms ahead", light_lead_ms);
+    return 0;
+}
+
+static int cmd_light_skew(const struct shell *sh, size_t argc, char **argv)
+{
+    if (skew_count == 0) {
+        shell_print(sh, "No skew reports for the last toggle");
+        return 0;
+    }
+    shell_print(sh, "%d lights, skew %d..%d us, spread %d us", skew_count, skew_min_us,
+                skew_max_us, skew_max_us - skew_min_us);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_light,
+    SHELL_CMD_ARG(group, NULL, "Group the button toggles: group [0..65535]", cmd_light_group, 1, 1),
+    SHELL_CMD_ARG(toggle, NULL, "Toggle a group: toggle [0..65535]", cmd_light_toggle, 1, 1),
+    SHELL_CMD_ARG(on, NULL, "Turn a group on: on [0..65535]", cmd_light_on, 1, 1),
+    SHELL_CMD_ARG(off, NULL, "Turn a group off: off [0..65535]", cmd_light_off, 1, 1),
+    SHELL_CMD_ARG(level, NULL, "Set a group's level: level <0..255> [0..65535]", cmd_light_level, 2, 1),
+    SHELL_CMD(state, NULL, "Replies to the last state command", cmd_light_state),
+    SHELL_CMD_ARG(lead, NULL, "Schedule toggles ahead: lead [ms]", cmd_light_lead, 1, 1),
+    SHELL_CMD(skew, NULL, "Skew the lights reported for the last toggle", cmd_light_skew),
+    SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(light, &sub_light, "Light control", NULL);
+
 int main(void)
 {
     int ret;
@@ -107,5 +396,17 @@ int main(void)
     }
     LOG_INF("OpenThread stack has been started.");
 
+    light_seq = otRandomNonCryptoGetUint32();
+
+    // --- Skew and state reports from the lights ---
+    otSockAddr sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.mPort = LIGHT_REPORT_PORT;
+    otInstance *p_ot_instance = openthread_get_default_instance();
+    if (otUdpOpen(p_ot_instance, &report_socket, report_receive_callback, NULL) != OT_ERROR_NONE ||
+        otUdpBind(p_ot_instance, &report_socket, &sockaddr, OT_NETIF_THREAD) != OT_ERROR_NONE) {
+        LOG_ERR("Failed to open report socket");
+    }
+
     return 0;
 }
\ No newline at end of file
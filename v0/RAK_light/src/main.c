@@ -16,6 +16,10 @@
 #include <openthread/udp.h>
 #include <openthread/message.h>
 
+#include "light_groups.h"
+#include "light_schedule.h"
+#include "light_state.h"
+
 LOG_MODULE_REGISTER(ot_light, CONFIG_LOG_DEFAULT_LEVEL);
 
 /* OpenThread networking definitions */
@@ -27,23 +31,39 @@ static otUdpSocket light_socket;
 static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(LED0_NODE, gpios);
 
 
+/* Drives the LED for the light state, it is not dimmable so any level
+ * above 0 is on. Called from the schedule timer too.
+ */
+static void set_led(uint8_t level)
+{
+    gpio_pin_set_dt(&led, level > 0);
+}
+
 /* UDP Receive Callback function */
 void udp_receive_callback(void *aContext, otMessage *aMessage, const otMessageInfo *aMessageInfo)
 {
     OT_UNUSED_VARIABLE(aContext);
-    OT_UNUSED_VARIABLE(aMessageInfo);
 
     char command[32];
+    char group[OT_IP6_ADDRESS_STRING_SIZE];
     int length;
 
     length = otMessageRead(aMessage, otMessageGetOffset(aMessage), command, sizeof(command) - 1);
     command[length] = '\0';
 
-    LOG_INF("Received UDP message: %s", command);
+    // The destination is ff03::1 or one of this light's groups
+    otIp6AddressToString(&aMessageInfo->mSockAddr, group, sizeof(group));
+    LOG_INF("Received UDP message for %s: %s", group, command);
 
     if (strcmp(command, "toggle") == 0) {
         LOG_INF("Toggle command received, toggling LED.");
-        gpio_pin_toggle_dt(&led);
+        light_state_toggle();
+    } else if (strncmp(command, LIGHT_SCHEDULE_PREFIX, strlen(LIGHT_SCHEDULE_PREFIX)) == 0) {
+        // Carries the network time to toggle at, so every light flips together
+        light_schedule_toggle(command + strlen(LIGHT_SCHEDULE_PREFIX), &aMessageInfo->mPeerAddr);
+    } else {
+        // "on", "off" and "level" set the light and are answered with its state
+        light_state_handle(command, &aMessageInfo->mPeerAddr);
     }
 
     otMessageFree(aMessage);
@@ -82,6 +102,12 @@ int main(void)
     LOG_INF("LED initialized.");
 
 
+    // --- Light Groups, State and Schedule ---
+    // Before the stack starts, so the groups are joined when it comes up
+    light_groups_init();
+    light_state_init(set_led, LIGHT_LEVEL_MAX); // The LED starts on
+    light_schedule_init(light_state_toggle);
+
     // --- OpenThread Stack Initialization ---
     LOG_INF("Starting OpenThread stack...");
     if (openthread_start(openthread_get_default_context()) != 0) {
@@ -0,0 +1,219 @@
+/*
+ * Light Groups
+ */
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include <zephyr/net/openthread.h>
+#include <openthread/ip6.h>
+
+#include "light_groups.h"
+
+LOG_MODULE_REGISTER(light_groups, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define LIGHT_GROUPS_KEY "light/groups"
+
+static uint16_t groups[LIGHT_GROUPS_MAX];
+static int group_count;
+static struct openthread_state_changed_cb state_changed_cb;
+
+static int find_group(uint16_t group)
+{
+    for (int i = 0; i < group_count; i++) {
+        if (groups[i] == group) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void subscribe(otInstance *instance, uint16_t group)
+{
+    otIp6Address address;
+    otError error;
+
+    light_group_address(group, &address);
+    error = otIp6SubscribeMulticastAddress(instance, &address);
+    if (error != OT_ERROR_NONE && error != OT_ERROR_ALREADY) {
+        LOG_ERR("Failed to subscribe to group %u: %d", group, error);
+    }
+}
+
+static void save_groups(void)
+{
+    int ret = settings_save_one(LIGHT_GROUPS_KEY, groups, group_count * sizeof(groups[0]));
+
+    if (ret != 0) {
+        LOG_ERR("Failed to save groups: %d", ret);
+    }
+}
+
+/* --- Settings --- */
+static int light_settings_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    ssize_t read;
+
+    if (strcmp(key, "groups") != 0) {
+        return -ENOENT;
+    }
+    if (len > sizeof(groups) || len % sizeof(groups[0]) != 0) {
+        return -EINVAL;
+    }
+
+    read = read_cb(cb_arg, groups, len);
+    if (read < 0) {
+        return read;
+    }
+    group_count = read / sizeof(groups[0]);
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(light, "light", NULL, light_settings_set, NULL, NULL);
+
+/* --- OpenThread --- */
+// External multicast subscriptions are dropped when the interface goes down,
+// so they are made again every time it comes up
+static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context, void *user_data)
+{
+    ARG_UNUSED(user_data);
+
+    if ((flags & OT_CHANGED_THREAD_NETIF_STATE) && otIp6IsEnabled(ot_context->instance)) {
+        for (int i = 0; i < group_count; i++) {
+            subscribe(ot_context->instance, groups[i]);
+        }
+        LOG_INF("Subscribed to %d light groups", group_count);
+    }
+}
+
+int light_groups_init(void)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    int ret;
+
+    ret = settings_subsys_init();
+    if (ret == 0) {
+        ret = settings_load_subtree("light");
+    }
+    if (ret != 0) {
+        LOG_ERR("Failed to load light groups: %d", ret);
+    }
+
+    state_changed_cb.state_changed_cb = on_thread_state_changed;
+    openthread_state_changed_cb_register(context, &state_changed_cb);
+
+    // The interface may already be up when OpenThread starts on its own
+    openthread_api_mutex_lock(context);
+    on_thread_state_changed(OT_CHANGED_THREAD_NETIF_STATE, context, NULL);
+    openthread_api_mutex_unlock(context);
+    return ret;
+}
+
+int light_group_join(uint16_t group)
+{
+    otInstance *instance = openthread_get_default_instance();
+
+    if (group == LIGHT_GROUP_ALL || find_group(group) >= 0) {
+        return 0;
+    }
+    if (group_count == LIGHT_GROUPS_MAX) {
+        return -ENOMEM;
+    }
+
+    groups[group_count++] = group;
+    if (otIp6IsEnabled(instance)) {
+        subscribe(instance, group);
+    }
+    save_groups();
+    return 0;
+}
+
+int light_group_leave(uint16_t group)
+{
+    otInstance *instance = openthread_get_default_instance();
+    otIp6Address address;
+    int i = find_group(group);
+
+    if (i < 0) {
+        return 0;
+    }
+
+    groups[i] = groups[--group_count];
+    light_group_address(group, &address);
+    otIp6UnsubscribeMulticastAddress(instance, &address);
+    save_groups();
+    return 0;
+}
+
+/* --- Shell --- */
+static int parse_group(const struct shell *sh, const char *arg, uint16_t *group)
+{
+    char *end;
+    unsigned long value = strtoul(arg, &end, 10);
+
+    if (*end != '\0' || value == LIGHT_GROUP_ALL || value > UINT16_MAX) {
+        shell_error(sh, "Group must be 1..%u", UINT16_MAX);
+        return -EINVAL;
+    }
+    *group = value;
+    return 0;
+}
+
+static int cmd_group_join(const struct shell *sh, size_t argc, char **argv)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    uint16_t group;
+    int ret = parse_group(sh, argv[1], &group);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    openthread_api_mutex_lock(context);
+    ret = light_group_join(group);
+    openthread_api_mutex_unlock(context);
+    if (ret == -ENOMEM) {
+        shell_error(sh, "Already in %d groups", LIGHT_GROUPS_MAX);
+    }
+    return ret;
+}
+
+static int cmd_group_leave(const struct shell *sh, size_t argc, char **argv)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    uint16_t group;
+    int ret = parse_group(sh, argv[1], &group);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    openthread_api_mutex_lock(context);
+    ret = light_group_leave(group);
+    openthread_api_mutex_unlock(context);
+    return ret;
+}
+
+static int cmd_group_list(const struct shell *sh, size_t argc, char **argv)
+{
+    otIp6Address address;
+    char address_str[OT_IP6_ADDRESS_STRING_SIZE];
+
+    for (int i = 0; i < group_count; i++) {
+        light_group_address(groups[i], &address);
+        otIp6AddressToString(&address, address_str, sizeof(address_str));
+        shell_print(sh, "group %u %s", groups[i], address_str);
+    }
+    shell_print(sh, "%d of %d groups", group_count, LIGHT_GROUPS_MAX);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_group,
+    SHELL_CMD_ARG(join, NULL, "Join a group: join <1..65535>", cmd_group_join, 2, 0),
+    SHELL_CMD_ARG(leave, NULL, "Leave a group: leave <1..65535>", cmd_group_leave, 2, 0),
+    SHELL_CMD(list, NULL, "List the groups this light is in", cmd_group_list),
+    SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(group, &sub_group, "Light group membership", NULL);
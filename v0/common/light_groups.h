@@ -0,0 +1,44 @@
+/*
+ * Light Groups
+ *
+ * Lights belong to realm-local multicast groups (a room, a zone) so the
+ * controller can address some of them instead of every node on ff03::1.
+ * Group n is ff03::100:n, group 0 stands for every light (ff03::1).
+ * Memberships are kept in settings and survive a reboot.
+ */
+#ifndef LIGHT_GROUPS_H_
+#define LIGHT_GROUPS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <openthread/ip6.h>
+
+#define LIGHT_GROUP_ALL 0
+#define LIGHT_GROUPS_MAX 8
+
+/* Multicast address of a group, shared by the lights and the controller */
+static inline void light_group_address(uint16_t group, otIp6Address *address)
+{
+    memset(address, 0, sizeof(*address));
+    address->mFields.m8[0] = 0xff;
+    address->mFields.m8[1] = 0x03; // Realm-local scope
+    if (group == LIGHT_GROUP_ALL) {
+        address->mFields.m8[15] = 0x01;
+    } else {
+        address->mFields.m8[12] = 0x01;
+        address->mFields.m8[13] = 0x00;
+        address->mFields.m8[14] = group >> 8;
+        address->mFields.m8[15] = group & 0xff;
+    }
+}
+
+/* Loads the memberships from settings and subscribes to them whenever the
+ * Thread interface comes up. Call before starting OpenThread.
+ */
+int light_groups_init(void);
+
+/* Join or leave a group, the OpenThread API must be locked */
+int light_group_join(uint16_t group);
+int light_group_leave(uint16_t group);
+
+#endif /* LIGHT_GROUPS_H_ */
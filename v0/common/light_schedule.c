@@ -0,0 +1,131 @@
+/*
+ * Light Schedule
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/printk.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/net/openthread.h>
+#include <openthread/message.h>
+#include <openthread/random_noncrypto.h>
+#include <openthread/udp.h>
+
+#include "light_schedule.h"
+
+LOG_MODULE_REGISTER(light_schedule, CONFIG_LOG_DEFAULT_LEVEL);
+
+static void (*apply_cb)(void);
+static otUdpSocket report_socket;
+static struct k_timer schedule_timer;
+static struct k_work_delayable report_work;
+
+/* The pending or last command */
+static otIp6Address report_to;
+static bool timed;              // Applied at target_us rather than on arrival
+static uint64_t target_us;      // Network time it was to be applied at
+static uint32_t applied_cycles; // k_cycle_get_32() when it was applied
+static uint32_t jitter_ms;      // Spreads the reports of the lights a toggle reached
+
+/* Sends the skew of the last command back to its sender. The skew is the
+ * network time the command was applied at, worked back from now, against
+ * its target, so it takes in timer latency as well as clock error.
+ */
+static void report_handler(struct k_work *work)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    otInstance *instance = openthread_get_default_instance();
+    otNetworkTimeStatus sync_status;
+    otMessageInfo message_info;
+    otMessage *message;
+    uint64_t now_us;
+    int32_t skew_us = 0;
+    char report[32];
+
+    openthread_api_mutex_lock(context);
+    sync_status = light_mesh_time(instance, &now_us);
+    if (timed && sync_status == OT_NETWORK_TIME_SYNCHRONIZED) {
+        uint64_t applied_us = now_us - k_cyc_to_us_floor32(k_cycle_get_32() - applied_cycles);
+
+        skew_us = (int32_t)(int64_t)(applied_us - target_us);
+    }
+    snprintk(report, sizeof(report), "skew %d %s", skew_us, light_sync_state(sync_status));
+
+    memset(&message_info, 0, sizeof(message_info));
+    message_info.mPeerAddr = report_to;
+    message_info.mPeerPort = LIGHT_REPORT_PORT;
+
+    message = otUdpNewMessage(instance, NULL);
+    if (message == NULL) {
+        LOG_ERR("Failed to allocate skew report.");
+    } else if (otMessageAppend(message, report, strlen(report)) != OT_ERROR_NONE ||
+               otUdpSend(instance, &report_socket, message, &message_info) != OT_ERROR_NONE) {
+        otMessageFree(message);
+        LOG_ERR("Failed to send skew report.");
+    }
+    openthread_api_mutex_unlock(context);
+}
+
+/* Timer expiry, in ISR context */
+static void schedule_expired(struct k_timer *timer)
+{
+    applied_cycles = k_cycle_get_32();
+    apply_cb();
+    k_work_reschedule(&report_work, K_MSEC(jitter_ms));
+}
+
+int light_schedule_init(void (*apply)(void))
+{
+    struct openthread_context *context = openthread_get_default_context();
+    otError error;
+
+    apply_cb = apply;
+    k_timer_init(&schedule_timer, schedule_expired, NULL);
+    k_work_init_delayable(&report_work, report_handler);
+
+    openthread_api_mutex_lock(context);
+    error = otUdpOpen(openthread_get_default_instance(), &report_socket, NULL, NULL);
+    openthread_api_mutex_unlock(context);
+    if (error != OT_ERROR_NONE) {
+        LOG_ERR("Failed to open report socket: %d", error);
+        return -1;
+    }
+    return 0;
+}
+
+void light_schedule_toggle(const char *time_ms, const otIp6Address *sender)
+{
+    uint32_t target_ms = strtoul(time_ms, NULL, 10);
+    otInstance *instance = openthread_get_default_instance();
+    otNetworkTimeStatus sync_status;
+    uint64_t now_us;
+
+    // A newer command replaces one still pending
+    k_timer_stop(&schedule_timer);
+    report_to = *sender;
+    jitter_ms = otRandomNonCryptoGetUint32() % LIGHT_REPORT_JITTER_MS;
+    sync_status = light_mesh_time(instance, &now_us);
+
+    // Relative to now, in ms of the wrapping 32 bit time then down to us,
+    // in 64 bits as a stale or bogus time can be days away
+    int32_t delay_ms = (int32_t)(target_ms - (uint32_t)(now_us / 1000));
+    int64_t delay_us = (int64_t)delay_ms * 1000 - (int64_t)(now_us % 1000);
+
+    target_us = now_us + delay_us;
+    timed = sync_status == OT_NETWORK_TIME_SYNCHRONIZED && delay_ms <= LIGHT_SCHEDULE_MAX_MS;
+
+    if (!timed || delay_ms <= 0) {
+        // Without a synced clock the time means nothing, a late command
+        // reports how late it was applied
+        applied_cycles = k_cycle_get_32();
+        apply_cb();
+        LOG_INF("Toggle for %u applied now (%s)", target_ms, light_sync_state(sync_status));
+        k_work_reschedule(&report_work, K_MSEC(jitter_ms));
+        return;
+    }
+
+    k_timer_start(&schedule_timer, K_USEC(delay_us), K_NO_WAIT);
+    // At most LIGHT_SCHEDULE_MAX_MS away here
+    LOG_INF("Toggle scheduled in %d us", (int32_t)delay_us);
+}
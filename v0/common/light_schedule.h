@@ -0,0 +1,60 @@
+/*
+ * Light Schedule
+ *
+ * A toggle can carry the time it is to be applied, "toggle@<ms>", in
+ * OpenThread network time (CONFIG_OPENTHREAD_TIME_SYNC, kept in step by the
+ * leader). The controller sets it LIGHT_SCHEDULE_LEAD_MS ahead and each light
+ * arms a k_timer for it, so lights several hops away flip together with the
+ * near ones. After applying it a light reports its skew to the sender on
+ * LIGHT_REPORT_PORT, "skew <us> <sync state>", positive when late.
+ */
+#ifndef LIGHT_SCHEDULE_H_
+#define LIGHT_SCHEDULE_H_
+
+#include <stdint.h>
+#include <openthread/instance.h>
+#include <openthread/ip6.h>
+#include <openthread/network_time.h>
+
+#define LIGHT_SCHEDULE_PREFIX "toggle@"
+#define LIGHT_REPORT_PORT 1235
+#define LIGHT_SCHEDULE_LEAD_MS 300
+// A time further ahead is taken as a clock mix-up and applied at once
+#define LIGHT_SCHEDULE_MAX_MS 10000
+/* Reports are sent after a random delay up to this, so the lights a
+ * multicast reached do not all answer in the same instant
+ */
+#define LIGHT_REPORT_JITTER_MS 100
+
+/* Network time in us, only meaningful when OT_NETWORK_TIME_SYNCHRONIZED */
+static inline otNetworkTimeStatus light_mesh_time(otInstance *instance, uint64_t *time_us)
+{
+#if defined(CONFIG_OPENTHREAD_TIME_SYNC)
+    return otNetworkTimeGet(instance, time_us);
+#else
+    *time_us = 0;
+    return OT_NETWORK_TIME_UNSYNCHRONIZED;
+#endif
+}
+
+static inline const char *light_sync_state(otNetworkTimeStatus status)
+{
+    switch (status) {
+    case OT_NETWORK_TIME_SYNCHRONIZED:
+        return "synced";
+    case OT_NETWORK_TIME_RESYNC_NEEDED:
+        return "resync";
+    default:
+        return "unsynced";
+    }
+}
+
+/* Opens the report socket, apply is called from the timer to actuate */
+int light_schedule_init(void (*apply)(void));
+
+/* Handles the time of a "toggle@<ms>" from sender, called from the UDP
+ * receive callback where the OpenThread API is locked.
+ */
+void light_schedule_toggle(const char *time_ms, const otIp6Address *sender);
+
+#endif /* LIGHT_SCHEDULE_H_ */
@@ -0,0 +1,209 @@
+/*
+ * Light State
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/printk.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/net/openthread.h>
+#include <openthread/message.h>
+#include <openthread/random_noncrypto.h>
+#include <openthread/udp.h>
+
+#include "light_schedule.h"
+#include "light_state.h"
+
+LOG_MODULE_REGISTER(light_state, CONFIG_LOG_DEFAULT_LEVEL);
+
+enum seq_result { SEQ_NEW, SEQ_DUPLICATE, SEQ_STALE };
+
+static const char *const seq_results[] = {"applied", "duplicate", "stale"};
+
+struct sender {
+    otIp6Address address;
+    uint32_t last_seq;  // Newest sequence number seen
+    uint32_t seen;      // Bit n set: last_seq - n was seen
+    uint32_t answered;  // Bit n set: a duplicate of last_seq - n was answered
+    int64_t heard_at;   // k_uptime_get(), to forget the oldest sender
+    bool used;
+};
+
+static void (*apply_cb)(uint8_t level);
+static uint8_t level;
+static struct sender senders[LIGHT_SENDERS_MAX];
+static otUdpSocket report_socket;
+
+/* The report waiting out its jitter, a newer one replaces it */
+static struct k_work_delayable report_work;
+static otIp6Address report_to;
+static uint32_t report_seq;
+static enum seq_result report_result;
+
+static struct sender *find_sender(const otIp6Address *address)
+{
+    struct sender *oldest = &senders[0];
+
+    for (int i = 0; i < LIGHT_SENDERS_MAX; i++) {
+        if (senders[i].used && otIp6IsAddressEqual(&senders[i].address, address)) {
+            return &senders[i];
+        }
+        if (!senders[i].used || (oldest->used && senders[i].heard_at < oldest->heard_at)) {
+            oldest = &senders[i];
+        }
+    }
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->address = *address;
+    return oldest;
+}
+
+/* Sliding window over the sender's sequence numbers */
+static enum seq_result check_seq(struct sender *sender, uint32_t seq)
+{
+    int32_t ahead = (int32_t)(seq - sender->last_seq);
+
+    sender->heard_at = k_uptime_get();
+    if (!sender->used || ahead <= -LIGHT_SEQ_WINDOW) {
+        // New sender, or one that restarted its numbering
+        sender->used = true;
+        sender->last_seq = seq;
+        sender->seen = 1;
+        sender->answered = 0;
+        return SEQ_NEW;
+    }
+    if (ahead > 0) {
+        sender->seen = ahead < LIGHT_SEQ_WINDOW ? sender->seen << ahead : 0;
+        sender->seen |= 1;
+        sender->answered = ahead < LIGHT_SEQ_WINDOW ? sender->answered << ahead : 0;
+        sender->last_seq = seq;
+        return SEQ_NEW;
+    }
+
+    // At or behind the newest: a repeat, or overtaken by a newer command
+    uint32_t bit = 1U << -ahead;
+    if (sender->seen & bit) {
+        return SEQ_DUPLICATE;
+    }
+    sender->seen |= bit;
+    return SEQ_STALE;
+}
+
+/* A duplicate is answered once, in case the report on the applied copy
+ * was lost. The rest are dropped silently.
+ */
+static bool answer_duplicate(struct sender *sender, uint32_t seq)
+{
+    uint32_t bit = 1U << (sender->last_seq - seq);
+
+    if (sender->answered & bit) {
+        return false;
+    }
+    sender->answered |= bit;
+    return true;
+}
+
+static void report_handler(struct k_work *work)
+{
+    struct openthread_context *context = openthread_get_default_context();
+    otInstance *instance = openthread_get_default_instance();
+    otMessageInfo message_info;
+    otMessage *message;
+    char report[40];
+
+    // The receive callback fills in the report with the API locked
+    openthread_api_mutex_lock(context);
+    snprintk(report, sizeof(report), LIGHT_STATE_PREFIX "s=%u l=%u %s", report_seq, level,
+             seq_results[report_result]);
+
+    memset(&message_info, 0, sizeof(message_info));
+    message_info.mPeerAddr = report_to;
+    message_info.mPeerPort = LIGHT_REPORT_PORT;
+
+    message = otUdpNewMessage(instance, NULL);
+    if (message == NULL) {
+        LOG_ERR("Failed to allocate state report.");
+    } else if (otMessageAppend(message, report, strlen(report)) != OT_ERROR_NONE ||
+               otUdpSend(instance, &report_socket, message, &message_info) != OT_ERROR_NONE) {
+        otMessageFree(message);
+        LOG_ERR("Failed to send state report.");
+    }
+    openthread_api_mutex_unlock(context);
+}
+
+/* The report on the applied copy, still waiting, answers its duplicates too */
+static bool report_waiting(const otIp6Address *sender, uint32_t seq)
+{
+    return k_work_delayable_is_pending(&report_work) && report_seq == seq &&
+           otIp6IsAddressEqual(&report_to, sender);
+}
+
+/* Sent after a random delay, so the lights of a group do not all answer
+ * one multicast at once
+ */
+static void queue_report(const otIp6Address *sender, uint32_t seq, enum seq_result result)
+{
+    report_to = *sender;
+    report_seq = seq;
+    report_result = result;
+    k_work_reschedule(&report_work, K_MSEC(otRandomNonCryptoGetUint32() % LIGHT_REPORT_JITTER_MS));
+}
+
+void light_state_init(void (*apply)(uint8_t level), uint8_t initial_level)
+{
+    struct openthread_context *context = openthread_get_default_context();
+
+    apply_cb = apply;
+    level = initial_level;
+    k_work_init_delayable(&report_work, report_handler);
+
+    openthread_api_mutex_lock(context);
+    if (otUdpOpen(openthread_get_default_instance(), &report_socket, NULL, NULL) != OT_ERROR_NONE) {
+        LOG_ERR("Failed to open state report socket");
+    }
+    openthread_api_mutex_unlock(context);
+}
+
+bool light_state_handle(const char *command, const otIp6Address *sender)
+{
+    const char *seq_field = strstr(command, " s=");
+    unsigned long new_level;
+
+    if (strncmp(command, "on ", 3) == 0) {
+        new_level = LIGHT_LEVEL_MAX;
+    } else if (strncmp(command, "off ", 4) == 0) {
+        new_level = 0;
+    } else if (strncmp(command, "level ", 6) == 0) {
+        new_level = strtoul(command + 6, NULL, 10);
+    } else {
+        return false;
+    }
+    if (seq_field == NULL || new_level > LIGHT_LEVEL_MAX) {
+        LOG_ERR("Malformed state command: %s", command);
+        return true;
+    }
+
+    uint32_t seq = strtoul(seq_field + 3, NULL, 10);
+    struct sender *from = find_sender(sender);
+    enum seq_result result = check_seq(from, seq);
+
+    if (result == SEQ_NEW) {
+        level = new_level;
+        apply_cb(level);
+    }
+    LOG_INF("State command %u %s, level %u", seq, seq_results[result], level);
+
+    if (result == SEQ_NEW) {
+        queue_report(sender, seq, result);
+    } else if (result == SEQ_DUPLICATE && !report_waiting(sender, seq) && answer_duplicate(from, seq)) {
+        queue_report(sender, seq, result);
+    }
+    return true;
+}
+
+void light_state_toggle(void)
+{
+    level = level > 0 ? 0 : LIGHT_LEVEL_MAX;
+    apply_cb(level);
+}
@@ -0,0 +1,45 @@
+/*
+ * Light State
+ *
+ * State commands set a light instead of flipping it, so the controller can
+ * send every command several times on a lossy mesh:
+ *   "on s=<seq>", "off s=<seq>", "level <0..255> s=<seq>"
+ * Each sender numbers its commands. A light applies a command only if it is
+ * newer than any it has seen from that sender; repeats and commands
+ * overtaken by a newer one are dropped. The applied copy and the first
+ * duplicate after it are answered on LIGHT_REPORT_PORT with the light's
+ * state, after up to LIGHT_REPORT_JITTER_MS:
+ *   "state s=<seq> l=<level> <applied|duplicate>"
+ */
+#ifndef LIGHT_STATE_H_
+#define LIGHT_STATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/ip6.h>
+
+#define LIGHT_LEVEL_MAX 255
+#define LIGHT_STATE_PREFIX "state "
+
+/* Senders tracked at once, the least recently heard one is forgotten */
+#define LIGHT_SENDERS_MAX 4
+/* Sequence numbers remembered per sender. A number further behind is taken
+ * as the sender having restarted.
+ */
+#define LIGHT_SEQ_WINDOW 32
+
+/* apply drives the light, level 0 is off. initial_level is the level the
+ * light was left at.
+ */
+void light_state_init(void (*apply)(uint8_t level), uint8_t initial_level);
+
+/* Handles a state command from sender and queues the reply, called
+ * from the UDP receive callback where the OpenThread API is locked.
+ * Returns false if command is not a state command.
+ */
+bool light_state_handle(const char *command, const otIp6Address *sender);
+
+/* Flips the light for "toggle", safe from the schedule timer */
+void light_state_toggle(void);
+
+#endif /* LIGHT_STATE_H_ */
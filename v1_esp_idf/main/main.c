@@ -1,9 +1,12 @@
 /*
  * ESP32 OpenThread UDP Communication with LED Control
  */
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/param.h>
 #include "sdkconfig.h"
 #include "hal/uart_types.h"
 #include "nvs_flash.h"
@@ -25,11 +28,17 @@
 #include "esp_openthread_netif_glue.h"
 #include "esp_openthread_types.h"
 #include "cli_header.h"
+#include "esp_ot_buf_diag.h"
+#include "frame_budget.h"
 #include "openthread/cli.h"
 #include "openthread/instance.h"
+#include "openthread/link.h"
 #include "openthread/logging.h"
+#include "openthread/message.h"
 #include "openthread/tasklet.h"
+#include "openthread/thread.h"
 #include "openthread/udp.h"
+#include "openthread/platform/radio.h"
 
 // ============================================================================
 // CONFIGURATION CONSTANTS
@@ -39,14 +48,37 @@
 
 #define LED_GPIO_PIN 8
 #define OT_CONNECTION_LED_PORT 1234
-#define HELLO_INTERVAL_MS 1000
+// Adaptive hello interval, CONFIG_HELLO_INTERVAL_MIN_MS..CONFIG_HELLO_INTERVAL_MAX_MS.
+// The target is CONFIG_HELLO_INTERVAL_MS, or this node's share of the fleet rate the
+// controller asks for with "rate <hellos per minute>", the fleet being the routers of
+// the partition. Congestion since the last hello (MAC TX failures, a failed message
+// allocation or send, or few free message buffers) doubles the interval, otherwise it
+// shrinks by HELLO_INTERVAL_STEP_MS per hello back toward the target. Hellos report
+// the interval in use (i=).
+#define HELLO_INTERVAL_STEP_MS 100
+#define RATE_COMMAND_PREFIX "rate "
 #define LED_STRIP_LED_NUM 1
+// Hellos are telemetry and go out at low priority, so commands (high priority, kept by
+// forwarders from the DSCP of the IPv6 header) leave this node's send queues first
+#define HELLO_MESSAGE_PRIORITY OT_MESSAGE_PRIORITY_LOW
+// Hello worst case, every field at its widest. Hellos go out from OpenThread's default
+// source address (the ML-EID), the build fails if one could ever need a second frame,
+// see v2/common/frame_budget.h
+#define HELLO_WORST FRAME_WORST("hello world FFFF p=FFFF r=-128 m=255 n=255 w=-128 i=4294967295")
+FRAME_ASSERT_FITS(HELLO_WORST, FRAME_ADDR_MLEID);
+#define HELLO_INCLUDE_NEIGHBORS 1  // append neighbor count and weakest neighbor RSSI
 
 // ============================================================================
 // GLOBAL VARIABLES
 // ============================================================================
 
 static esp_timer_handle_t hello_timer;
+static uint32_t hello_interval_ms = CONFIG_HELLO_INTERVAL_MS;
+static uint32_t hello_target_ms = CONFIG_HELLO_INTERVAL_MS;
+static bool hello_send_failed = false;
+static uint32_t hello_sent;    // Telemetry counters since streaming started,
+static uint32_t hello_failed;  // logged on "stop"
+static otMacCounters mac_last;  // MAC counters at the last hello
 static bool streaming = false;
 static otUdpSocket udpSocket;
 static led_strip_handle_t led_strip;
@@ -102,42 +134,192 @@ static void get_mac_suffix(char *buf, size_t buflen) {
     snprintf(buf, buflen, "%02X%02X", ext_addr->m8[6], ext_addr->m8[7]);
 }
 
+// Summarize link quality toward the uplink as compact key=value pairs:
+// p = uplink RLOC16, r = average RSSI (dBm), m = link margin (dB),
+// n = neighbor count, w = weakest neighbor average RSSI (dBm).
+// A child reports its parent, a router its strongest router neighbor.
+static void get_link_summary(char *buf, size_t buflen) {
+    otInstance *instance = esp_openthread_get_instance();
+    int8_t noise_floor = otPlatRadioGetReceiveSensitivity(instance);
+    bool is_child = otThreadGetDeviceRole(instance) == OT_DEVICE_ROLE_CHILD;
+    uint16_t uplink = 0;
+    int8_t uplink_rssi = OT_RADIO_RSSI_INVALID;
+    int8_t weakest_rssi = OT_RADIO_RSSI_INVALID;
+    int neighbors = 0;
+    size_t len = 0;
+
+    if (is_child) {
+        otRouterInfo parent;
+        int8_t rssi;
+        if (otThreadGetParentInfo(instance, &parent) == OT_ERROR_NONE &&
+            otThreadGetParentAverageRssi(instance, &rssi) == OT_ERROR_NONE) {
+            uplink = parent.mRloc16;
+            uplink_rssi = rssi;
+        }
+    }
+
+    otNeighborInfoIterator iterator = OT_NEIGHBOR_INFO_ITERATOR_INIT;
+    otNeighborInfo info;
+    while (otThreadGetNextNeighborInfo(instance, &iterator, &info) == OT_ERROR_NONE) {
+        if (info.mAverageRssi == OT_RADIO_RSSI_INVALID) continue;
+        neighbors++;
+        if (weakest_rssi == OT_RADIO_RSSI_INVALID || info.mAverageRssi < weakest_rssi) {
+            weakest_rssi = info.mAverageRssi;
+        }
+        if (!is_child && !info.mIsChild &&
+            (uplink_rssi == OT_RADIO_RSSI_INVALID || info.mAverageRssi > uplink_rssi)) {
+            uplink = info.mRloc16;
+            uplink_rssi = info.mAverageRssi;
+        }
+    }
+
+    buf[0] = 0;
+    if (uplink_rssi != OT_RADIO_RSSI_INVALID) {
+        int margin = uplink_rssi - noise_floor;
+        len += snprintf(buf + len, buflen - len, " p=%04X r=%d m=%d", uplink, uplink_rssi, margin > 0 ? margin : 0);
+    }
+#if HELLO_INCLUDE_NEIGHBORS
+    if (len < buflen) {
+        len += snprintf(buf + len, buflen - len, " n=%d", neighbors);
+    }
+    if (len < buflen && weakest_rssi != OT_RADIO_RSSI_INVALID) {
+        snprintf(buf + len, buflen - len, " w=%d", weakest_rssi);
+    }
+#endif
+}
+
 // ============================================================================
 // LED CONTROL FUNCTIONS
 // ============================================================================
 
 // Turn on LED strip (white color)
+// Called from the OpenThread task, so the frame is sent in the background instead of waiting on the RMT
 static void led_on(void) {
     led_strip_set_pixel(led_strip, 0, 16, 16, 16); // white
-    led_strip_refresh(led_strip);
+    led_strip_refresh_async(led_strip);
 }
 
 // Turn off LED strip
 static void led_off(void) {
-    led_strip_clear(led_strip);
+    led_strip_set_pixel(led_strip, 0, 0, 0, 0);
+    led_strip_refresh_async(led_strip);
 }
 
 // ============================================================================
 // UDP MESSAGING FUNCTIONS
 // ============================================================================
 
-// Send periodic hello messages with device MAC suffix
-static void send_hello(void *arg) {
+// Send a hello message with device MAC suffix, link quality and the hello interval
+static void send_hello(void) {
     otInstance *instance = esp_openthread_get_instance();
     char mac[5];
     get_mac_suffix(mac, sizeof(mac));
-    char msg[32];
-    snprintf(msg, sizeof(msg), "hello world %s", mac);
-
-    otMessage *message = otUdpNewMessage(instance, NULL);
-    if (!message) return;
-    otMessageAppend(message, msg, strlen(msg));
-
+    char link[40];
+    get_link_summary(link, sizeof(link));
+    char msg[HELLO_WORST + 1];
+    snprintf(msg, sizeof(msg), "hello world %s%s i=%" PRIu32, mac, link, hello_interval_ms);
+
+    static const otMessageSettings settings = {
+        .mLinkSecurityEnabled = true,
+        .mPriority = HELLO_MESSAGE_PRIORITY,
+    };
     otMessageInfo msgInfo = {0};
     otIp6AddressFromString("ff03::1", &msgInfo.mPeerAddr);
     msgInfo.mPeerPort = OT_CONNECTION_LED_PORT;
 
-    otUdpSend(instance, &udpSocket, message, &msgInfo);
+    otError error = OT_ERROR_NO_BUFS;
+    otMessage *message = otUdpNewMessage(instance, &settings);
+    if (message) {
+        error = otMessageAppend(message, msg, strlen(msg));
+        if (error == OT_ERROR_NONE) {
+            error = otUdpSend(instance, &udpSocket, message, &msgInfo);
+        }
+        // On failure the message is still ours to free
+        if (error != OT_ERROR_NONE) {
+            otMessageFree(message);
+        }
+    }
+    // Recorded once per hello, from the outcome of the whole send
+    ESP_OT_BUF_DIAG_RECORD(ESP_OT_BUF_CLASS_APP, error == OT_ERROR_NONE);
+    if (error != OT_ERROR_NONE) {
+        hello_send_failed = true;
+        hello_failed++;
+        return;
+    }
+    hello_sent++;
+}
+
+// Routers of the partition, the fleet the controller's rate is shared by
+static int fleet_size(otInstance *instance) {
+    otRouterInfo info;
+    int routers = 0;
+
+    for (uint8_t id = 0; id <= otThreadGetMaxRouterId(instance); id++) {
+        if (otThreadGetRouterInfo(instance, id, &info) == OT_ERROR_NONE && info.mAllocated) {
+            routers++;
+        }
+    }
+    return routers > 0 ? routers : 1;
+}
+
+// One step of the adaptive interval, after every hello
+static void update_hello_interval(void) {
+    otInstance *instance = esp_openthread_get_instance();
+    const otMacCounters *counters = otLinkGetCounters(instance);
+    uint32_t tx_failures = (counters->mTxErrCca - mac_last.mTxErrCca) +
+                           (counters->mTxErrAbort - mac_last.mTxErrAbort) +
+                           (counters->mTxErrBusyChannel - mac_last.mTxErrBusyChannel);
+    mac_last = *counters;
+
+    otBufferInfo buffers;
+    otMessageGetBufferInfo(instance, &buffers);
+    bool low_buffers = buffers.mFreeBuffers * 100 < buffers.mTotalBuffers * CONFIG_HELLO_MIN_FREE_BUFFERS_PCT;
+    uint32_t previous = hello_interval_ms;
+
+    if (tx_failures > 0 || hello_send_failed || low_buffers) {
+        hello_interval_ms = MIN(hello_interval_ms * 2, CONFIG_HELLO_INTERVAL_MAX_MS);
+        if (hello_interval_ms != previous) {
+            ESP_LOGI(TAG, "Hello interval %" PRIu32 " ms: %" PRIu32 " TX failures, %u/%u buffers free%s",
+                     hello_interval_ms, tx_failures, buffers.mFreeBuffers, buffers.mTotalBuffers,
+                     hello_send_failed ? ", send failed" : "");
+        }
+    } else if (hello_interval_ms > hello_target_ms + HELLO_INTERVAL_STEP_MS) {
+        hello_interval_ms -= HELLO_INTERVAL_STEP_MS;
+    } else if (hello_interval_ms != hello_target_ms) {
+        hello_interval_ms = hello_target_ms;
+        ESP_LOGI(TAG, "Hello interval back at its target, %" PRIu32 " ms", hello_interval_ms);
+    }
+    hello_send_failed = false;
+}
+
+// Hello timer callback: runs in the esp_timer task, so the OpenThread lock is taken
+// and the one-shot timer is re-armed with the interval adapted after this hello
+static void hello_timer_cb(void *arg) {
+    esp_openthread_lock_acquire(portMAX_DELAY);
+    if (streaming) {
+        send_hello();
+        update_hello_interval();
+        esp_timer_start_once(hello_timer, (uint64_t)hello_interval_ms * 1000);
+    }
+    esp_openthread_lock_release();
+}
+
+// "rate <n>" shares n hellos per minute across the fleet, 0 goes back to the default
+static void handle_rate_command(const char *arg) {
+    otInstance *instance = esp_openthread_get_instance();
+    uint32_t rate = strtoul(arg, NULL, 10);
+    uint32_t target = CONFIG_HELLO_INTERVAL_MS;
+
+    if (rate > 0) {
+        target = fleet_size(instance) * 60000U / rate;
+    }
+    hello_target_ms = MIN(MAX(target, CONFIG_HELLO_INTERVAL_MIN_MS), CONFIG_HELLO_INTERVAL_MAX_MS);
+    // A slower target applies at once, a faster one is approached step by step
+    if (hello_target_ms > hello_interval_ms) {
+        hello_interval_ms = hello_target_ms;
+    }
+    ESP_LOGI(TAG, "Rate %" PRIu32 "/min over %d routers, hello target %" PRIu32 " ms",
+             rate, fleet_size(instance), hello_target_ms);
 }
 
 // Handle incoming UDP messages - respond to "start" and "stop" commands
@@ -146,14 +328,22 @@ static void udp_receive_cb(void *aContext, otMessage *aMessage, const otMessageI
     int len = otMessageRead(aMessage, 0, buf, sizeof(buf) - 1);
     buf[len] = 0;
 
-    if (strstr(buf, "start") && !streaming) {
+    if (strncmp(buf, RATE_COMMAND_PREFIX, strlen(RATE_COMMAND_PREFIX)) == 0) {
+        handle_rate_command(buf + strlen(RATE_COMMAND_PREFIX));
+    } else if (strstr(buf, "start") && !streaming) {
         streaming = true;
         led_on();
-        esp_timer_start_periodic(hello_timer, HELLO_INTERVAL_MS * 1000);
+        mac_last = *otLinkGetCounters(esp_openthread_get_instance());
+        hello_send_failed = false;
+        hello_sent = 0;
+        hello_failed = 0;
+        esp_timer_start_once(hello_timer, (uint64_t)hello_interval_ms * 1000);
     } else if (strstr(buf, "stop") && streaming) {
         streaming = false;
         led_off();
         esp_timer_stop(hello_timer);
+        ESP_LOGI(TAG, "Telemetry (low priority): %" PRIu32 " hellos sent, %" PRIu32 " failed",
+                 hello_sent, hello_failed);
     }
 }
 
@@ -193,7 +383,7 @@ static void udp_task(void *pvParameters) {
 
     // Create timer for periodic hello messages
     esp_timer_create_args_t timer_args = {
-        .callback = &send_hello,
+        .callback = &hello_timer_cb,
         .name = "hello_timer"
     };
     esp_timer_create(&timer_args, &hello_timer);
@@ -204,6 +394,8 @@ static void udp_task(void *pvParameters) {
     listen_addr.mPort = OT_CONNECTION_LED_PORT;
     otUdpOpen(instance, &udpSocket, udp_receive_cb, NULL);
     otUdpBind(instance, &udpSocket, &listen_addr, OT_NETIF_THREAD_INTERNAL);
+    ESP_LOGI(TAG, "Hello worst case %u B frame, single frame is %u B",
+             (unsigned)frame_size(HELLO_WORST, FRAME_ADDR_MLEID), FRAME_PSDU_MAX);
 
     // Task sleeps - UDP callbacks handle all communication
     while (1) {
@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "stdint.h"
+#include <openthread/error.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Traffic classes that allocate packet buffers, used to attribute allocations and failures.
+ *
+ */
+typedef enum {
+    ESP_OT_BUF_CLASS_APP = 0, /* Application traffic sent through the OpenThread API */
+    ESP_OT_BUF_CLASS_SOCKET,  /* Traffic sent through lwIP sockets */
+    ESP_OT_BUF_CLASS_MAX,
+} esp_ot_buf_class_t;
+
+/**
+ * @brief Record the outcome of a packet buffer allocation.
+ *
+ * Safe to call from any task. Failures are kept with their call site in a ring of
+ * CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE entries.
+ *
+ * @param[in] buf_class The traffic class of the allocation.
+ * @param[in] success   Whether the allocation succeeded.
+ * @param[in] func      The calling function, must point to static storage.
+ * @param[in] line      The calling line.
+ *
+ */
+void esp_ot_buf_diag_record(esp_ot_buf_class_t buf_class, bool success, const char *func, int line);
+
+/**
+ * @brief Record the outcome of a packet buffer allocation, tagged with the current call site.
+ *
+ */
+#define ESP_OT_BUF_DIAG_RECORD(buf_class, success) esp_ot_buf_diag_record((buf_class), (success), __func__, __LINE__)
+
+/**
+ * @brief User command "bufdiag" process.
+ *
+ */
+otError esp_ot_process_buf_diag(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
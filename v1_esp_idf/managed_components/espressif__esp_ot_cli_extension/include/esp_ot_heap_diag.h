@@ -13,6 +13,59 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+#define ESP_OT_HEAP_DIAG_SAMPLE_TASKS 4   /* Largest tasks kept per sample */
+#define ESP_OT_HEAP_DIAG_SAMPLE_VERSION 1 /* Layout version of esp_ot_heap_diag_sample_t in binary dumps */
+
+/**
+ * @brief Heap usage of one task, as recorded in a sample.
+ *
+ */
+typedef struct {
+    char name[12];
+    uint32_t size; /* Internal memory held by the task, in bytes */
+} esp_ot_heap_diag_task_total_t;
+
+/**
+ * @brief One entry of the heap history ring.
+ *
+ * Memory figures cover internal 8-bit capable memory unless stated otherwise. The allocation counters count
+ * the heap calls since the previous sample and stay 0 unless CONFIG_HEAP_USE_HOOKS is enabled, the task
+ * totals stay empty unless CONFIG_HEAP_TASK_TRACKING is enabled.
+ *
+ */
+typedef struct {
+    uint32_t timestamp_ms;
+    uint32_t interval_ms; /* Time since the previous sample */
+    uint32_t free_bytes;
+    uint32_t largest_free_block;
+    uint32_t min_free_bytes;
+    uint32_t free_spiram;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t alloc_bytes;
+    uint16_t frag_permille; /* 1000 * (1 - largest_free_block / free_bytes) */
+    uint16_t num_tasks;
+    esp_ot_heap_diag_task_total_t tasks[ESP_OT_HEAP_DIAG_SAMPLE_TASKS];
+} esp_ot_heap_diag_sample_t;
+
+/**
+ * @brief Callback invoked from the heap recorder task when free memory drops below the alarm threshold.
+ *
+ */
+typedef void (*esp_ot_heap_diag_alarm_cb_t)(const esp_ot_heap_diag_sample_t *sample, void *ctx);
+
+/**
+ * @brief Register a callback for the heap watermark alarm.
+ *
+ * The alarm is evaluated on every sample taken by "heapdiag record", and is re-armed once free memory
+ * recovers above the threshold by 1/8 of it.
+ *
+ * @param[in] cb    The callback, NULL to only log the alarm.
+ * @param[in] ctx   The context passed to the callback.
+ *
+ */
+void esp_ot_heap_diag_register_alarm_callback(esp_ot_heap_diag_alarm_cb_t cb, void *ctx);
 /**
  * @brief User command "heapdiag" process.
  *
@@ -6,8 +6,10 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <openthread/error.h>
+#include "sdkconfig.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,12 +19,24 @@ extern "C" {
 #define TCP_CLIENT_SEND_BIT BIT1
 #define TCP_CLIENT_DELETE_BIT BIT2
 #define TCP_CLIENT_CLOSE_BIT BIT3
+#define TCP_CLIENT_STREAM_BIT BIT4
+#define TCP_CLIENT_STREAM_STOP_BIT BIT5
 #define TCP_SERVER_ADD_BIT BIT0
 #define TCP_SERVER_SEND_BIT BIT1
 #define TCP_SERVER_DELETE_BIT BIT2
 #define TCP_SERVER_CLOSE_BIT BIT3
+#define TCP_SERVER_STREAM_BIT BIT4
+#define TCP_SERVER_STREAM_STOP_BIT BIT5
 #define TCP_SOCKET_RECEIVE_TIMEOUT 1
 
+#ifdef CONFIG_OPENTHREAD_TCP_SOCKET_STREAM_BUFFER_SIZE
+#define TCP_STREAM_BUFFER_SIZE CONFIG_OPENTHREAD_TCP_SOCKET_STREAM_BUFFER_SIZE
+#else
+#define TCP_STREAM_BUFFER_SIZE 1024
+#endif
+#define TCP_STREAM_BUFFER_MIN 64
+#define TCP_STREAM_BUFFER_MAX 16384
+
 /**
  * @brief User command "tcpsockserver" process.
  *
@@ -35,6 +49,26 @@ otError esp_ot_process_tcp_server(void *aContext, uint8_t aArgsLength, char *aAr
  */
 otError esp_ot_process_tcp_client(void *aContext, uint8_t aArgsLength, char *aArgs[]);
 
+typedef struct tcp_stream {
+    /* configuration of the next "stream" command */
+    int streaming;
+    int nodelay;
+    size_t buf_size;
+    uint32_t total_len; /* bytes taken from the generated source */
+    char path[64];      /* file-backed source, empty for the generated one */
+    /* statistics of the current connection */
+    int32_t handshake_ms; /* TCP handshake time measured by connect(), -1 if unknown */
+    uint64_t rx_bytes;
+    int64_t rx_first_us;
+    int64_t rx_last_us;
+    uint64_t tx_bytes;
+    /* result of the last stream */
+    uint64_t last_len;
+    uint32_t last_ms;
+    uint32_t last_kbps;
+    uint32_t last_stalls;
+} TCP_STREAM;
+
 typedef struct tcp_server {
     int exist;
     int listen_sock;
@@ -43,6 +77,7 @@ typedef struct tcp_server {
     char local_ipaddr[128];
     char remote_ipaddr[128];
     char message[128];
+    TCP_STREAM stream;
 } TCP_SERVER;
 
 typedef struct tcp_client {
@@ -51,6 +86,7 @@ typedef struct tcp_client {
     int remote_port;
     char remote_ipaddr[128];
     char message[128];
+    TCP_STREAM stream;
 } TCP_CLIENT;
 
 #ifdef __cplusplus
@@ -6,19 +6,37 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <openthread/error.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
 #include "lwip/sockets.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define UDP_CLIENT_SEND_BIT BIT0
-#define UDP_CLIENT_CLOSE_BIT BIT1
-#define UDP_SERVER_BIND_BIT BIT0
-#define UDP_SERVER_SEND_BIT BIT1
-#define UDP_SERVER_CLOSE_BIT BIT2
+#ifdef CONFIG_OPENTHREAD_UDP_SOCKET_MAX
+#define UDP_SOCKET_MAX CONFIG_OPENTHREAD_UDP_SOCKET_MAX
+#else
+#define UDP_SOCKET_MAX 4
+#endif
+
+#ifdef CONFIG_OPENTHREAD_UDP_SOCKET_RX_BUFFER_SIZE
+#define UDP_SOCKET_RX_BUFFER_SIZE CONFIG_OPENTHREAD_UDP_SOCKET_RX_BUFFER_SIZE
+#else
+#define UDP_SOCKET_RX_BUFFER_SIZE 1280
+#endif
+
+#ifdef CONFIG_OPENTHREAD_UDP_SOCKET_LOG_RATE
+#define UDP_SOCKET_LOG_RATE CONFIG_OPENTHREAD_UDP_SOCKET_LOG_RATE
+#else
+#define UDP_SOCKET_LOG_RATE 5
+#endif
+
+#define UDP_SOCKET_RX_BUFFER_MIN 16
+#define UDP_SOCKET_RX_BUFFER_MAX 65507
 
 /**
  * @brief User command "mcast" process.
@@ -44,23 +62,31 @@ typedef struct send_meaasge {
     char message[128];
 } SEND_MESSAGE;
 
-typedef struct udp_server {
-    int exist;
-    int sock;
-    int local_port;
-    char local_ipaddr[128];
-    struct ifreq ifr;
-    SEND_MESSAGE messagesend;
-} UDP_SERVER;
-
-typedef struct udp_client {
-    int exist;
+typedef struct udp_socket_stats {
+    uint32_t rx_packets;
+    uint64_t rx_bytes;
+    uint32_t rx_truncated; /* datagrams longer than the receive buffer */
+    uint32_t rx_errors;
+    uint32_t tx_packets;
+    uint32_t tx_errors;
+    uint32_t log_suppressed; /* datagrams received but not logged because of the log rate limit */
+    int rx_max_len;
+    int last_port;
+    char last_ipaddr[48];
+} UDP_SOCKET_STATS;
+
+/* One socket served by the UDP socket I/O task, either a server or a client. */
+typedef struct udp_socket {
+    bool in_use;
+    bool is_server;
     int sock;
-    int local_port;
-    char local_ipaddr[128];
-    struct ifreq ifr;
-    SEND_MESSAGE messagesend;
-} UDP_CLIENT;
+    int local_port; /* -1 if the socket is not bound manually */
+    size_t rx_buf_size;
+    char *rx_buffer;
+    uint32_t log_window_start;
+    uint32_t log_window_count;
+    UDP_SOCKET_STATS stats;
+} UDP_SOCKET;
 
 /**
  * @brief Get the Interface name struct.
@@ -0,0 +1,291 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "esp_ot_buf_diag.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_openthread.h"
+#include "esp_openthread_lock.h"
+#include "esp_ot_cli_extension.h"
+#include "string.h"
+#include "openthread/cli.h"
+#include "openthread/message.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/opt.h"
+#if LWIP_STATS && MEMP_STATS
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#endif
+
+#define BUF_DIAG_OT_QUEUES 8
+
+typedef struct {
+    const char *func;
+    int line;
+    uint32_t timestamp_ms;
+    uint16_t free_buffers; // OpenThread buffers free at the last sample before the failure
+    uint8_t buf_class;
+} buf_diag_failure_t;
+
+typedef struct {
+    uint32_t attempts;
+    uint32_t failures;
+    uint16_t peak_used_buffers; // Highest OpenThread buffer usage at an allocation of this class
+} buf_diag_class_stats_t;
+
+static const char *const s_class_names[ESP_OT_BUF_CLASS_MAX] = {"app", "socket"};
+static const char *const s_ot_queue_names[BUF_DIAG_OT_QUEUES] = {
+    "6lo send", "6lo reassembly", "ip6", "mpl", "mle", "coap", "coap secure", "app coap",
+};
+
+#if LWIP_STATS && MEMP_STATS
+static const char *const s_memp_names[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+#include "lwip/priv/memp_std.h"
+};
+#endif
+
+static TaskHandle_t s_buf_diag_task = NULL;
+static volatile bool s_buf_diag_running = false;
+static int s_buf_diag_period_ms = 0;
+static portMUX_TYPE s_buf_diag_lock = portMUX_INITIALIZER_UNLOCKED;
+static buf_diag_class_stats_t s_class_stats[ESP_OT_BUF_CLASS_MAX];
+static buf_diag_failure_t s_failures[CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE];
+static size_t s_failure_head = 0;
+static size_t s_failure_count = 0;
+static uint16_t s_total_buffers = 0;
+static uint16_t s_free_buffers = 0;
+static uint16_t s_min_free_buffers = UINT16_MAX;
+static uint16_t s_peak_queue_buffers[BUF_DIAG_OT_QUEUES];
+static uint16_t s_peak_queue_messages[BUF_DIAG_OT_QUEUES];
+static uint32_t s_samples = 0;
+
+static void buf_diag_queues(const otBufferInfo *info, const otMessageQueueInfo *queues[BUF_DIAG_OT_QUEUES])
+{
+    queues[0] = &info->m6loSendQueue;
+    queues[1] = &info->m6loReassemblyQueue;
+    queues[2] = &info->mIp6Queue;
+    queues[3] = &info->mMplQueue;
+    queues[4] = &info->mMleQueue;
+    queues[5] = &info->mCoapQueue;
+    queues[6] = &info->mCoapSecureQueue;
+    queues[7] = &info->mApplicationCoapQueue;
+}
+
+static bool buf_diag_sample(otBufferInfo *info, TickType_t wait)
+{
+    const otMessageQueueInfo *queues[BUF_DIAG_OT_QUEUES];
+
+    // The stack lock is recursive, so this also works from the CLI which already holds it.
+    if (!esp_openthread_lock_acquire(wait)) {
+        return false;
+    }
+    otMessageGetBufferInfo(esp_openthread_get_instance(), info);
+    esp_openthread_lock_release();
+
+    buf_diag_queues(info, queues);
+    portENTER_CRITICAL(&s_buf_diag_lock);
+    s_total_buffers = info->mTotalBuffers;
+    s_free_buffers = info->mFreeBuffers;
+    if (info->mFreeBuffers < s_min_free_buffers) {
+        s_min_free_buffers = info->mFreeBuffers;
+    }
+    for (int i = 0; i < BUF_DIAG_OT_QUEUES; i++) {
+        if (queues[i]->mNumBuffers > s_peak_queue_buffers[i]) {
+            s_peak_queue_buffers[i] = queues[i]->mNumBuffers;
+        }
+        if (queues[i]->mNumMessages > s_peak_queue_messages[i]) {
+            s_peak_queue_messages[i] = queues[i]->mNumMessages;
+        }
+    }
+    s_samples++;
+    portEXIT_CRITICAL(&s_buf_diag_lock);
+    return true;
+}
+
+static void buf_diag_task_worker(void *aContext)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    otBufferInfo info;
+
+    // Stopped through a flag rather than vTaskDelete(), which could kill the task while it holds the stack lock.
+    while (s_buf_diag_running) {
+        buf_diag_sample(&info, portMAX_DELAY);
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(s_buf_diag_period_ms));
+    }
+    s_buf_diag_task = NULL;
+    vTaskDelete(NULL);
+}
+
+void esp_ot_buf_diag_record(esp_ot_buf_class_t buf_class, bool success, const char *func, int line)
+{
+    otBufferInfo info;
+
+    if (buf_class >= ESP_OT_BUF_CLASS_MAX) {
+        return;
+    }
+    // Sampled here so the class peak does not depend on the daemon. The caller may hold locks the
+    // stack task waits on, so this never blocks on the stack lock, the last sample stands in.
+    buf_diag_sample(&info, 0);
+    portENTER_CRITICAL(&s_buf_diag_lock);
+    buf_diag_class_stats_t *stats = &s_class_stats[buf_class];
+    uint16_t used = s_total_buffers - s_free_buffers;
+    stats->attempts++;
+    if (s_samples > 0 && used > stats->peak_used_buffers) {
+        stats->peak_used_buffers = used;
+    }
+    if (!success) {
+        buf_diag_failure_t *failure = &s_failures[s_failure_head];
+        stats->failures++;
+        failure->func = func;
+        failure->line = line;
+        failure->timestamp_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+        failure->free_buffers = s_free_buffers;
+        failure->buf_class = buf_class;
+        s_failure_head = (s_failure_head + 1) % CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE;
+        if (s_failure_count < CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE) {
+            s_failure_count++;
+        }
+    }
+    portEXIT_CRITICAL(&s_buf_diag_lock);
+}
+
+static void buf_diag_print_ot(void)
+{
+    otBufferInfo info;
+    const otMessageQueueInfo *queues[BUF_DIAG_OT_QUEUES];
+
+    buf_diag_sample(&info, portMAX_DELAY);
+    buf_diag_queues(&info, queues);
+    otCliOutputFormat("OpenThread buffers: total %u, free %u, max used %u, min free sampled %u\n", info.mTotalBuffers,
+                      info.mFreeBuffers, info.mMaxUsedBuffers, s_min_free_buffers);
+    otCliOutputFormat("\tQueue\t\tMessages\tBuffers\tPeak messages\tPeak buffers\n");
+    for (int i = 0; i < BUF_DIAG_OT_QUEUES; i++) {
+        otCliOutputFormat("\t%-14s\t%u\t\t%u\t%u\t\t%u\n", s_ot_queue_names[i], queues[i]->mNumMessages,
+                          queues[i]->mNumBuffers, s_peak_queue_messages[i], s_peak_queue_buffers[i]);
+    }
+}
+
+static void buf_diag_print_lwip(void)
+{
+#if LWIP_STATS && MEMP_STATS
+    otCliOutputFormat("lwIP memory pools:\n");
+    otCliOutputFormat("\tPool\t\t\tAvail\tUsed\tMax\tErr\n");
+    for (int i = 0; i < MEMP_MAX; i++) {
+        const struct stats_mem *mem = lwip_stats.memp[i];
+        if (mem == NULL) {
+            continue;
+        }
+        otCliOutputFormat("\t%-20s\t%u\t%u\t%u\t%u\n", s_memp_names[i], (unsigned)mem->avail, (unsigned)mem->used,
+                          (unsigned)mem->max, (unsigned)mem->err);
+    }
+#else
+    otCliOutputFormat("lwIP memory pools: enable LWIP_STATS in menuconfig\n");
+#endif
+}
+
+static void buf_diag_print_classes(void)
+{
+    buf_diag_class_stats_t stats[ESP_OT_BUF_CLASS_MAX];
+    buf_diag_failure_t failures[CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE];
+    size_t count;
+    size_t oldest;
+
+    portENTER_CRITICAL(&s_buf_diag_lock);
+    memcpy(stats, s_class_stats, sizeof(stats));
+    memcpy(failures, s_failures, sizeof(failures));
+    count = s_failure_count;
+    oldest = (s_failure_head + CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE - s_failure_count) %
+             CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE;
+    portEXIT_CRITICAL(&s_buf_diag_lock);
+
+    otCliOutputFormat("Traffic classes:\n");
+    otCliOutputFormat("\tClass\t\tAllocs\tFailures\tPeak used buffers\n");
+    for (int i = 0; i < ESP_OT_BUF_CLASS_MAX; i++) {
+        otCliOutputFormat("\t%-8s\t%" PRIu32 "\t%" PRIu32 "\t\t%u\n", s_class_names[i], stats[i].attempts,
+                          stats[i].failures, stats[i].peak_used_buffers);
+    }
+    if (count > 0) {
+        otCliOutputFormat("Recent allocation failures:\n");
+    }
+    for (size_t i = 0; i < count; i++) {
+        const buf_diag_failure_t *failure = &failures[(oldest + i) % CONFIG_OPENTHREAD_BUF_DIAG_FAILURE_LOG_SIZE];
+        otCliOutputFormat("\t%" PRIu32 " ms\t%s\t%s:%d\tfree buffers %u\n", failure->timestamp_ms,
+                          s_class_names[failure->buf_class], failure->func, failure->line, failure->free_buffers);
+    }
+}
+
+static void buf_diag_reset(void)
+{
+    portENTER_CRITICAL(&s_buf_diag_lock);
+    memset(s_class_stats, 0, sizeof(s_class_stats));
+    memset(s_peak_queue_buffers, 0, sizeof(s_peak_queue_buffers));
+    memset(s_peak_queue_messages, 0, sizeof(s_peak_queue_messages));
+    s_failure_head = 0;
+    s_failure_count = 0;
+    s_min_free_buffers = UINT16_MAX;
+    portEXIT_CRITICAL(&s_buf_diag_lock);
+
+    esp_openthread_lock_acquire(portMAX_DELAY);
+    otMessageResetBufferInfo(esp_openthread_get_instance());
+    esp_openthread_lock_release();
+}
+
+otError esp_ot_process_buf_diag(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    (void)(aContext);
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---bufdiag command parameter---\n");
+        otCliOutputFormat("print               : print buffer usage, peaks per queue and traffic class, and failures\n");
+        otCliOutputFormat("daemon on <period>  : sample buffer usage per <period> ms to track peaks\n");
+        otCliOutputFormat("daemon off          : stop sampling buffer usage\n");
+        otCliOutputFormat("reset               : reset peaks, counters and the failure log\n");
+        return OT_ERROR_NONE;
+    }
+    if (strcmp(aArgs[0], "print") == 0) {
+        buf_diag_print_ot();
+        buf_diag_print_lwip();
+        buf_diag_print_classes();
+    } else if (strcmp(aArgs[0], "daemon") == 0) {
+        if (aArgsLength <= 1) {
+            return OT_ERROR_INVALID_ARGS;
+        }
+        if (strcmp(aArgs[1], "on") == 0) {
+            if (aArgsLength <= 2) {
+                return OT_ERROR_INVALID_ARGS;
+            }
+            int period = strtol(aArgs[2], NULL, 10);
+            if (period <= 0) {
+                return OT_ERROR_INVALID_ARGS;
+            }
+            s_buf_diag_period_ms = period;
+            s_buf_diag_running = true;
+            if (!s_buf_diag_task) {
+                if (xTaskCreate(buf_diag_task_worker, "buf_diag", 2560, NULL, 6, &s_buf_diag_task) != pdTRUE) {
+                    s_buf_diag_running = false;
+                    ESP_LOGE(OT_EXT_CLI_TAG, "Failed to create buffer diag task");
+                    return OT_ERROR_FAILED;
+                }
+            }
+        } else if (strcmp(aArgs[1], "off") == 0) {
+            if (!s_buf_diag_running) {
+                return OT_ERROR_INVALID_STATE;
+            }
+            s_buf_diag_running = false;
+        } else {
+            return OT_ERROR_INVALID_ARGS;
+        }
+    } else if (strcmp(aArgs[0], "reset") == 0) {
+        buf_diag_reset();
+    } else {
+        return OT_ERROR_INVALID_ARGS;
+    }
+    return OT_ERROR_NONE;
+}
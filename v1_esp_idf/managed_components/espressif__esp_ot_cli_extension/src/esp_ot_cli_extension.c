@@ -6,6 +6,7 @@
 
 #include "esp_ot_cli_extension.h"
 #include "esp_openthread.h"
+#include "esp_ot_buf_diag.h"
 #include "esp_ot_curl.h"
 #include "esp_ot_dns64.h"
 #include "esp_ot_heap_diag.h"
@@ -24,6 +25,7 @@
 #include "openthread/cli.h"
 
 static const otCliCommand kCommands[] = {
+    {"bufdiag", esp_ot_process_buf_diag},
     {"curl", esp_openthread_process_curl},
 #if CONFIG_OPENTHREAD_DNS64_CLIENT
     {"dns64server", esp_openthread_process_dns64_server},
@@ -5,6 +5,8 @@
  */
 
 #include "esp_ot_heap_diag.h"
+#include <inttypes.h>
+#include "esp_attr.h"
 #include "esp_check.h"
 #include "esp_heap_caps.h"
 #if CONFIG_HEAP_TRACING
@@ -22,6 +24,42 @@
 static TaskHandle_t s_heap_daemon_task = NULL;
 static int s_heap_daemon_period_ms = 0;
 
+#if CONFIG_HEAP_TASK_TRACKING
+#define HEAP_TASKS_NUM CONFIG_OPENTHREAD_HEAP_DIAG_MAX_TASKS
+#define HEAP_BLOCKS_NUM 30
+#endif
+
+static TaskHandle_t s_heap_record_task = NULL;
+static volatile bool s_heap_record_running = false;
+static int s_heap_record_period_ms = 0;
+// Guards the running flag together with the task handle, so "on" never sees a task that is about to exit.
+static portMUX_TYPE s_heap_record_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_ot_heap_diag_sample_t *s_heap_ring = NULL;
+static size_t s_heap_ring_head = 0;
+static size_t s_heap_ring_count = 0;
+static portMUX_TYPE s_heap_ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_heap_alarm_threshold = CONFIG_OPENTHREAD_HEAP_DIAG_ALARM_THRESHOLD;
+static bool s_heap_alarm_fired = false;
+static esp_ot_heap_diag_alarm_cb_t s_heap_alarm_cb = NULL;
+static void *s_heap_alarm_ctx = NULL;
+
+#if CONFIG_HEAP_USE_HOOKS
+static uint32_t s_heap_alloc_count = 0;
+static uint32_t s_heap_free_count = 0;
+static uint32_t s_heap_alloc_bytes = 0;
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    __atomic_fetch_add(&s_heap_alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_heap_alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+    __atomic_fetch_add(&s_heap_free_count, 1, __ATOMIC_RELAXED);
+}
+#endif // CONFIG_HEAP_USE_HOOKS
+
 static void print_heap_usage(void)
 {
     printf("\tDescription\tInternal\tSPIRAM\n");
@@ -43,9 +81,187 @@ static void heap_daemon_task_worker(void *aContext)
 }
 
 #if CONFIG_HEAP_TASK_TRACKING
-#define HEAP_TASKS_NUM 10
-#define HEAP_BLOCKS_NUM 30
+static void heap_record_task_totals(esp_ot_heap_diag_sample_t *sample)
+{
+    static heap_task_totals_t s_totals[HEAP_TASKS_NUM];
+    size_t num_totals = 0;
+    heap_task_info_params_t heap_info;
+
+    memset(&heap_info, 0, sizeof(heap_info));
+    heap_info.caps[0] = MALLOC_CAP_INTERNAL;
+    heap_info.mask[0] = MALLOC_CAP_INTERNAL;
+    heap_info.totals = s_totals;
+    heap_info.num_totals = &num_totals;
+    heap_info.max_totals = HEAP_TASKS_NUM;
+    heap_caps_get_per_task_info(&heap_info);
 
+    // Keep the largest holders, sorted by size.
+    for (size_t i = 0; i < num_totals; i++) {
+        uint32_t size = s_totals[i].size[0];
+        int pos = sample->num_tasks;
+        while (pos > 0 && sample->tasks[pos - 1].size < size) {
+            if (pos < ESP_OT_HEAP_DIAG_SAMPLE_TASKS) {
+                sample->tasks[pos] = sample->tasks[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < ESP_OT_HEAP_DIAG_SAMPLE_TASKS) {
+            strlcpy(sample->tasks[pos].name, s_totals[i].task ? pcTaskGetName(s_totals[i].task) : "Pre-Scheduler",
+                    sizeof(sample->tasks[pos].name));
+            sample->tasks[pos].size = size;
+            if (sample->num_tasks < ESP_OT_HEAP_DIAG_SAMPLE_TASKS) {
+                sample->num_tasks++;
+            }
+        }
+    }
+}
+#endif // CONFIG_HEAP_TASK_TRACKING
+
+static void heap_record_take_sample(esp_ot_heap_diag_sample_t *sample, uint32_t interval_ms)
+{
+    multi_heap_info_t info;
+
+    memset(sample, 0, sizeof(*sample));
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    sample->timestamp_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+    sample->interval_ms = interval_ms;
+    sample->free_bytes = info.total_free_bytes;
+    sample->largest_free_block = info.largest_free_block;
+    sample->min_free_bytes = info.minimum_free_bytes;
+    sample->free_spiram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    if (info.total_free_bytes > 0) {
+        sample->frag_permille = 1000 - (uint16_t)((uint64_t)info.largest_free_block * 1000 / info.total_free_bytes);
+    }
+#if CONFIG_HEAP_USE_HOOKS
+    sample->allocs = __atomic_exchange_n(&s_heap_alloc_count, 0, __ATOMIC_RELAXED);
+    sample->frees = __atomic_exchange_n(&s_heap_free_count, 0, __ATOMIC_RELAXED);
+    sample->alloc_bytes = __atomic_exchange_n(&s_heap_alloc_bytes, 0, __ATOMIC_RELAXED);
+#endif
+#if CONFIG_HEAP_TASK_TRACKING
+    heap_record_task_totals(sample);
+#endif
+}
+
+static void heap_record_check_alarm(const esp_ot_heap_diag_sample_t *sample)
+{
+    uint32_t threshold = s_heap_alarm_threshold;
+
+    if (threshold == 0) {
+        s_heap_alarm_fired = false;
+        return;
+    }
+    if (!s_heap_alarm_fired && sample->free_bytes < threshold) {
+        s_heap_alarm_fired = true;
+        ESP_LOGW(OT_EXT_CLI_TAG, "Heap alarm: %" PRIu32 " bytes free (threshold %" PRIu32 "), largest block %" PRIu32
+                 ", fragmentation %u.%u%%", sample->free_bytes, threshold, sample->largest_free_block,
+                 sample->frag_permille / 10, sample->frag_permille % 10);
+        if (s_heap_alarm_cb) {
+            s_heap_alarm_cb(sample, s_heap_alarm_ctx);
+        }
+    } else if (s_heap_alarm_fired && sample->free_bytes >= threshold + threshold / 8) {
+        s_heap_alarm_fired = false;
+        ESP_LOGI(OT_EXT_CLI_TAG, "Heap alarm cleared: %" PRIu32 " bytes free", sample->free_bytes);
+    }
+}
+
+static void heap_record_task_worker(void *aContext)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    uint32_t interval_ms = 0;
+
+    // Stopped through a flag rather than vTaskDelete(), which could kill the task while it holds the heap lock.
+    while (true) {
+        esp_ot_heap_diag_sample_t sample;
+        bool running;
+
+        portENTER_CRITICAL(&s_heap_record_lock);
+        running = s_heap_record_running;
+        if (!running) {
+            s_heap_record_task = NULL;
+        }
+        portEXIT_CRITICAL(&s_heap_record_lock);
+        if (!running) {
+            break;
+        }
+        heap_record_take_sample(&sample, interval_ms);
+
+        portENTER_CRITICAL(&s_heap_ring_lock);
+        s_heap_ring[s_heap_ring_head] = sample;
+        s_heap_ring_head = (s_heap_ring_head + 1) % CONFIG_OPENTHREAD_HEAP_DIAG_RING_SIZE;
+        if (s_heap_ring_count < CONFIG_OPENTHREAD_HEAP_DIAG_RING_SIZE) {
+            s_heap_ring_count++;
+        }
+        portEXIT_CRITICAL(&s_heap_ring_lock);
+        heap_record_check_alarm(&sample);
+
+        interval_ms = s_heap_record_period_ms;
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(s_heap_record_period_ms));
+    }
+    vTaskDelete(NULL);
+}
+
+// Copies the index-th oldest sample, returns false once the ring is exhausted.
+static bool heap_record_get(size_t index, esp_ot_heap_diag_sample_t *sample)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_heap_ring_lock);
+    if (index < s_heap_ring_count) {
+        size_t oldest = (s_heap_ring_head + CONFIG_OPENTHREAD_HEAP_DIAG_RING_SIZE - s_heap_ring_count) %
+                        CONFIG_OPENTHREAD_HEAP_DIAG_RING_SIZE;
+        *sample = s_heap_ring[(oldest + index) % CONFIG_OPENTHREAD_HEAP_DIAG_RING_SIZE];
+        found = true;
+    }
+    portEXIT_CRITICAL(&s_heap_ring_lock);
+    return found;
+}
+
+static uint32_t heap_record_rate(uint32_t count, uint32_t interval_ms)
+{
+    return interval_ms > 0 ? (uint32_t)((uint64_t)count * 1000 / interval_ms) : 0;
+}
+
+static void heap_record_dump_csv(void)
+{
+    esp_ot_heap_diag_sample_t sample;
+
+    otCliOutputFormat("timestamp_ms,free,largest_free_block,min_free,free_spiram,frag_permille,allocs_per_s,"
+                      "frees_per_s,alloc_bytes_per_s,tasks\n");
+    for (size_t i = 0; heap_record_get(i, &sample); i++) {
+        otCliOutputFormat("%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%u,%" PRIu32 ",%" PRIu32
+                          ",%" PRIu32 ",",
+                          sample.timestamp_ms, sample.free_bytes, sample.largest_free_block, sample.min_free_bytes,
+                          sample.free_spiram, sample.frag_permille, heap_record_rate(sample.allocs, sample.interval_ms),
+                          heap_record_rate(sample.frees, sample.interval_ms),
+                          heap_record_rate(sample.alloc_bytes, sample.interval_ms));
+        for (int t = 0; t < sample.num_tasks; t++) {
+            otCliOutputFormat("%s%s:%" PRIu32, t ? ";" : "", sample.tasks[t].name, sample.tasks[t].size);
+        }
+        otCliOutputFormat("\n");
+    }
+}
+
+// The binary dump is the raw sample records, hex encoded since the CLI is a text channel.
+static void heap_record_dump_bin(void)
+{
+    esp_ot_heap_diag_sample_t sample;
+    size_t count;
+
+    portENTER_CRITICAL(&s_heap_ring_lock);
+    count = s_heap_ring_count;
+    portEXIT_CRITICAL(&s_heap_ring_lock);
+    otCliOutputFormat("HEAPDIAG %d %u %u\n", ESP_OT_HEAP_DIAG_SAMPLE_VERSION, (unsigned)sizeof(sample),
+                      (unsigned)count);
+    for (size_t i = 0; heap_record_get(i, &sample); i++) {
+        const uint8_t *bytes = (const uint8_t *)&sample;
+        for (size_t b = 0; b < sizeof(sample); b++) {
+            otCliOutputFormat("%02x", bytes[b]);
+        }
+        otCliOutputFormat("\n");
+    }
+}
+
+#if CONFIG_HEAP_TASK_TRACKING
 static void heap_trace_task_handler(void)
 {
     static size_t num_totals = 0;
@@ -77,6 +293,73 @@ static void heap_trace_task_handler(void)
 }
 #endif // CONFIG_HEAP_TASK_TRACKING
 
+void esp_ot_heap_diag_register_alarm_callback(esp_ot_heap_diag_alarm_cb_t cb, void *ctx)
+{
+    s_heap_alarm_ctx = ctx;
+    s_heap_alarm_cb = cb;
+}
+
+static otError heap_record_process(uint8_t aArgsLength, char *aArgs[])
+{
+    if (aArgsLength <= 1) {
+        return OT_ERROR_INVALID_ARGS;
+    }
+    if (strcmp(aArgs[1], "on") == 0) {
+        if (aArgsLength <= 2) {
+            return OT_ERROR_INVALID_ARGS;
+        }
+        int period = strtol(aArgs[2], NULL, 10);
+        if (period <= 0) {
+            return OT_ERROR_INVALID_ARGS;
+        }
+        if (!s_heap_ring) {
+            s_heap_ring = calloc(CONFIG_OPENTHREAD_HEAP_DIAG_RING_SIZE, sizeof(esp_ot_heap_diag_sample_t));
+            if (!s_heap_ring) {
+                ESP_LOGE(OT_EXT_CLI_TAG, "Failed to allocate heap record ring");
+                return OT_ERROR_NO_BUFS;
+            }
+        }
+        s_heap_record_period_ms = period;
+        // A task still stopping picks the flag up again on its next wakeup, one that already gave up its
+        // handle is replaced.
+        portENTER_CRITICAL(&s_heap_record_lock);
+        s_heap_record_running = true;
+        bool start = s_heap_record_task == NULL;
+        portEXIT_CRITICAL(&s_heap_record_lock);
+        if (start) {
+            if (xTaskCreate(heap_record_task_worker, "heap_record", 3072, NULL, 6, &s_heap_record_task) != pdTRUE) {
+                s_heap_record_running = false;
+                ESP_LOGE(OT_EXT_CLI_TAG, "Failed to create heap record task");
+                return OT_ERROR_FAILED;
+            }
+        }
+    } else if (strcmp(aArgs[1], "off") == 0) {
+        if (!s_heap_record_running) {
+            return OT_ERROR_INVALID_STATE;
+        }
+        s_heap_record_running = false;
+    } else if (strcmp(aArgs[1], "dump") == 0) {
+        if (!s_heap_ring) {
+            return OT_ERROR_INVALID_STATE;
+        }
+        if (aArgsLength == 2 || strcmp(aArgs[2], "csv") == 0) {
+            heap_record_dump_csv();
+        } else if (strcmp(aArgs[2], "bin") == 0) {
+            heap_record_dump_bin();
+        } else {
+            return OT_ERROR_INVALID_ARGS;
+        }
+    } else if (strcmp(aArgs[1], "clear") == 0) {
+        portENTER_CRITICAL(&s_heap_ring_lock);
+        s_heap_ring_head = 0;
+        s_heap_ring_count = 0;
+        portEXIT_CRITICAL(&s_heap_ring_lock);
+    } else {
+        return OT_ERROR_INVALID_ARGS;
+    }
+    return OT_ERROR_NONE;
+}
+
 otError esp_ot_process_heap_diag(void *aContext, uint8_t aArgsLength, char *aArgs[])
 {
     (void)(aContext);
@@ -85,6 +368,11 @@ otError esp_ot_process_heap_diag(void *aContext, uint8_t aArgsLength, char *aArg
         otCliOutputFormat("print               : print current heap usage\n");
         otCliOutputFormat("daemon on <preriod> : start the daemon task to print heap usage per <period> ms\n");
         otCliOutputFormat("daemon off          : stop the daemon task for heap usage print\n");
+        otCliOutputFormat("record on <period>  : record a heap sample into the history ring per <period> ms\n");
+        otCliOutputFormat("record off          : stop recording heap samples\n");
+        otCliOutputFormat("record dump [csv|bin] : dump the history ring as CSV or hex encoded binary records\n");
+        otCliOutputFormat("record clear        : clear the history ring\n");
+        otCliOutputFormat("alarm <bytes>       : warn when free memory drops below <bytes>, 0 to disable\n");
 #if CONFIG_HEAP_TRACING_STANDALONE
         otCliOutputFormat("tracereset          : reset the heap trace baseline\n");
         otCliOutputFormat("tracedump           : dump the last collected heap trace\n");
@@ -95,6 +383,14 @@ otError esp_ot_process_heap_diag(void *aContext, uint8_t aArgsLength, char *aArg
     } else {
         if (strcmp(aArgs[0], "print") == 0) {
             print_heap_usage();
+        } else if (strcmp(aArgs[0], "record") == 0) {
+            return heap_record_process(aArgsLength, aArgs);
+        } else if (strcmp(aArgs[0], "alarm") == 0) {
+            if (aArgsLength != 2) {
+                return OT_ERROR_INVALID_ARGS;
+            }
+            s_heap_alarm_threshold = strtoul(aArgs[1], NULL, 10);
+            s_heap_alarm_fired = false;
         } else if (strcmp(aArgs[0], "daemon") == 0) {
             if (aArgsLength <= 1) {
                 return OT_ERROR_INVALID_ARGS;
@@ -9,6 +9,8 @@
 #include "esp_log.h"
 #include "esp_ot_cli_extension.h"
 #include "iperf.h"
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +19,32 @@
 
 static char s_dest_ip_addr[50];
 
+// Parses a bandwidth like "20K" or "1M" into bits/s, returns 0 when invalid
+static uint32_t esp_ot_iperf_parse_bandwidth(const char *arg)
+{
+    char *end = NULL;
+    uint64_t mult = 1;
+    uint64_t value;
+
+    errno = 0;
+    value = strtoull(arg, &end, 10);
+    if (end == arg || errno == ERANGE) {
+        return 0;
+    }
+    if (*end == 'K' || *end == 'k') {
+        mult = 1000;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        mult = 1000000;
+        end++;
+    }
+    // Checked before multiplying, the product may not fit either
+    if (*end != '\0' || value > UINT32_MAX / mult) {
+        return 0;
+    }
+    return (uint32_t)(value * mult);
+}
+
 otError esp_ot_process_iperf(void *aContext, uint8_t aArgsLength, char *aArgs[])
 {
     (void)(aContext);
@@ -37,15 +65,26 @@ otError esp_ot_process_iperf(void *aContext, uint8_t aArgsLength, char *aArgs[])
         otCliOutputFormat("-s                  :     server mode, only receive\n");
         otCliOutputFormat("-u                  :     upd mode\n");
         otCliOutputFormat("-c <addr>           :     client mode, only transmit\n");
-        otCliOutputFormat("-i <interval>       :     seconds between periodic bandwidth reports\n");
+        otCliOutputFormat("-i <interval>       :     seconds between periodic bandwidth reports, fractions allowed\n");
         otCliOutputFormat("-t <time>           :     time in seconds to transmit for (default 30 secs)\n");
         otCliOutputFormat("-p <port>           :     server port to listen on/connect to\n");
         otCliOutputFormat("-l <len_send_buf>   :     the lenth of send buffer\n");
+        otCliOutputFormat("-b <bandwidth>      :     bandwidth to send at in bits/sec, K/M suffix allowed (paced)\n");
+        otCliOutputFormat("-P <streams>        :     number of parallel streams to run (default 1, max %d)\n",
+                          IPERF_MAX_STREAMS);
+        otCliOutputFormat("-J                  :     print reports as JSON lines\n");
+        otCliOutputFormat("-R                  :     reverse mode, the server sends and the client receives\n");
+        otCliOutputFormat("--bidir             :     send and receive at the same time\n");
         otCliOutputFormat("-f <output_format>  :     the output format of the report (Mbit/sec, Kbit/sec, bit/sec; "
                           "default Mbit/sec)\n");
         otCliOutputFormat("---example---\n");
         otCliOutputFormat("create a tcp server :     iperf -V -s -i 3 -p 5001 -t 60 -f M\n");
         otCliOutputFormat("create a udp client :     iperf -V -c <addr> -u -i 3 -t 60 -p 5001 -l 512 -f B\n");
+        otCliOutputFormat("20 kbit/s udp load  :     iperf -V -c <addr> -u -i 1 -t 60 -l 81 -b 20K\n");
+        otCliOutputFormat("4 parallel streams  :     iperf -V -c <addr> -i 3 -t 60 -P 4\n");
+        otCliOutputFormat("250 ms json reports :     iperf -V -s -u -i 0.25 -t 10 -J\n");
+        otCliOutputFormat("reverse udp test    :     iperf -V -c <addr> -u -i 1 -t 30 -l 81 -b 20K -R\n");
+        otCliOutputFormat("bidirectional test  :     iperf -V -c <addr> -u -i 1 -t 30 -l 81 -b 20K --bidir\n");
     } else {
         for (int i = 0; i < aArgsLength; i++) {
             if (strcmp(aArgs[i], "-c") == 0) {
@@ -75,19 +114,29 @@ otError esp_ot_process_iperf(void *aContext, uint8_t aArgsLength, char *aArgs[])
                 otCliOutputFormat("sp:%d\n", cfg.sport);
             } else if (strcmp(aArgs[i], "-i") == 0) {
                 i++;
-                if (atoi(aArgs[i]) < 0) {
+                if (atof(aArgs[i]) <= 0) {
                     cfg.interval = IPERF_DEFAULT_INTERVAL;
+                    cfg.interval_ms = 0;
                 } else {
-                    cfg.interval = atoi(aArgs[i]);
+                    cfg.interval_ms = (uint32_t)(atof(aArgs[i]) * 1000 + 0.5);
+                    cfg.interval = cfg.interval_ms / 1000;
                 }
-                otCliOutputFormat("i:%d\n", cfg.interval);
+                otCliOutputFormat("i:%s\n", aArgs[i]);
             } else if (strcmp(aArgs[i], "-t") == 0) {
                 i++;
                 cfg.time = atoi(aArgs[i]);
-                if (cfg.time <= cfg.interval) {
+                if (cfg.time * 1000 < cfg.interval_ms) {
+                    cfg.time = (cfg.interval_ms + 999) / 1000;
+                } else if (cfg.time <= cfg.interval) {
                     cfg.time = cfg.interval;
                 }
                 otCliOutputFormat("t:%d\n", cfg.time);
+            } else if (strcmp(aArgs[i], "-J") == 0) {
+                IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_JSON);
+            } else if (strcmp(aArgs[i], "-R") == 0) {
+                IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_REVERSE);
+            } else if (strcmp(aArgs[i], "--bidir") == 0) {
+                IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_BIDIR);
             } else if (strcmp(aArgs[i], "-l") == 0) {
                 i++;
                 if (atoi(aArgs[i]) <= 0) {
@@ -95,6 +144,21 @@ otError esp_ot_process_iperf(void *aContext, uint8_t aArgsLength, char *aArgs[])
                 } else {
                     cfg.len_send_buf = atoi(aArgs[i]);
                 }
+            } else if (strcmp(aArgs[i], "-b") == 0) {
+                i++;
+                if (i >= aArgsLength || (cfg.bw_lim_bps = esp_ot_iperf_parse_bandwidth(aArgs[i])) == 0) {
+                    ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+                    return OT_ERROR_INVALID_ARGS;
+                }
+                otCliOutputFormat("b:%" PRIu32 "bit/s\n", cfg.bw_lim_bps);
+            } else if (strcmp(aArgs[i], "-P") == 0) {
+                i++;
+                if (i >= aArgsLength || atoi(aArgs[i]) <= 0 || atoi(aArgs[i]) > IPERF_MAX_STREAMS) {
+                    ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+                    return OT_ERROR_INVALID_ARGS;
+                }
+                cfg.num_streams = atoi(aArgs[i]);
+                otCliOutputFormat("P:%d\n", cfg.num_streams);
             } else if (strcmp(aArgs[i], "-a") == 0) {
                 iperf_stop();
                 return OT_ERROR_NONE;
@@ -117,6 +181,10 @@ otError esp_ot_process_iperf(void *aContext, uint8_t aArgsLength, char *aArgs[])
                 otCliOutputFormat("f:%sbit/s\n", strcmp(unit[cfg.format], "B") == 0 ? "\0" : unit[cfg.format]);
             }
         }
+        if ((cfg.flag & (IPERF_FLAG_REVERSE | IPERF_FLAG_BIDIR)) && !client_flag) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "-R and --bidir need client mode (-c <addr>).");
+            return OT_ERROR_INVALID_ARGS;
+        }
         if (client_flag) {
             if (cfg.type == IPERF_IP_TYPE_IPV4) {
                 cfg.destination_ip4 = inet_addr(s_dest_ip_addr);
@@ -5,16 +5,72 @@
  */
 
 #include "esp_ot_nvs_diag.h"
+#include <inttypes.h>
+#include <stdlib.h>
 #include "esp_log.h"
 #include "esp_ot_cli_extension.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include <string.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "openthread/cli.h"
 
+// Layout of an NVS page, see nvs_page.hpp: a 32-byte header, a 32-byte entry state table, then 126 entries.
+#define NVS_DIAG_PAGE_SIZE 4096
+#define NVS_DIAG_ENTRY_SIZE 32
+#define NVS_DIAG_ENTRY_COUNT 126
+#define NVS_DIAG_PAGE_STATE_UNINITIALIZED 0xffffffff
+#define NVS_DIAG_ENTRY_STATE_EMPTY 0x3
+
+#define NVS_DIAG_HANDLE_MAX 16
+
+typedef struct {
+    uint32_t state;
+    uint32_t seq;
+    uint16_t used_entries; // written and erased entries, both consumed flash since the last page erase
+    uint32_t erases;
+} nvs_diag_page_t;
+
+typedef struct {
+    char name_space[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint32_t writes;
+    uint32_t burst_writes; // writes within the coalesce window of the previous write of the same key
+    uint32_t bytes;
+    int64_t last_write_us;
+} nvs_diag_key_stats_t;
+
+typedef struct {
+    nvs_handle_t handle;
+    char name_space[NVS_KEY_NAME_MAX_SIZE];
+} nvs_diag_handle_t;
+
 static TaskHandle_t nvs_daemon_task_handle = NULL;
 static uint32_t nvs_print_interval = 0;
 
+static TaskHandle_t s_wear_task = NULL;
+static volatile bool s_wear_running = false;
+static uint32_t s_wear_interval_ms = 0;
+static portMUX_TYPE s_wear_lock = portMUX_INITIALIZER_UNLOCKED;
+static const esp_partition_t *s_wear_partition = NULL;
+static nvs_diag_page_t *s_wear_pages = NULL;
+static size_t s_wear_page_count = 0;
+static uint64_t s_wear_entries_written = 0;
+static uint32_t s_wear_page_erases = 0;
+static uint32_t s_wear_samples = 0;
+static int64_t s_wear_start_us = 0;
+static int64_t s_wear_last_sample_us = 0;
+
+#if CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+static nvs_diag_handle_t s_handles[NVS_DIAG_HANDLE_MAX];
+static uint8_t s_handle_next = 0;
+static nvs_diag_key_stats_t s_keys[CONFIG_OPENTHREAD_NVS_DIAG_TRACKED_KEYS];
+static uint32_t s_untracked_writes = 0;
+static uint64_t s_requested_bytes = 0;
+#endif
+
 extern void nvs_dump(const char *partName);
 
 static void nvs_detail_status_print(void)
@@ -46,6 +102,399 @@ static void nvs_daemon_task_worker(void *pvParameters)
     }
 }
 
+#if CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+// The nvs_* functions below are wrapped with the linker's --wrap option (see CMakeLists.txt), IDF has no write hook.
+
+static void nvs_diag_note_open(const char *part_name, const char *name_space, nvs_handle_t handle)
+{
+    if (strcmp(part_name, NVS_DEFAULT_PART_NAME) != 0) {
+        return;
+    }
+    portENTER_CRITICAL(&s_wear_lock);
+    nvs_diag_handle_t *slot = NULL;
+    for (int i = 0; i < NVS_DIAG_HANDLE_MAX; i++) {
+        if (s_handles[i].handle == 0) {
+            slot = &s_handles[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        // Table full of handles that were never closed, recycle the oldest one.
+        slot = &s_handles[s_handle_next];
+        s_handle_next = (s_handle_next + 1) % NVS_DIAG_HANDLE_MAX;
+    }
+    slot->handle = handle;
+    strlcpy(slot->name_space, name_space, sizeof(slot->name_space));
+    portEXIT_CRITICAL(&s_wear_lock);
+}
+
+static void nvs_diag_note_close(nvs_handle_t handle)
+{
+    portENTER_CRITICAL(&s_wear_lock);
+    for (int i = 0; i < NVS_DIAG_HANDLE_MAX; i++) {
+        if (s_handles[i].handle == handle) {
+            s_handles[i].handle = 0;
+        }
+    }
+    portEXIT_CRITICAL(&s_wear_lock);
+}
+
+static void nvs_diag_note_write(nvs_handle_t handle, const char *key, size_t length, esp_err_t err)
+{
+    if (err != ESP_OK) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    const char *name_space = NULL;
+    nvs_diag_key_stats_t *stats = NULL;
+
+    portENTER_CRITICAL(&s_wear_lock);
+    for (int i = 0; i < NVS_DIAG_HANDLE_MAX; i++) {
+        if (s_handles[i].handle == handle && handle != 0) {
+            name_space = s_handles[i].name_space;
+            break;
+        }
+    }
+    if (name_space == NULL) {
+        // Opened on another partition, which the wear monitor does not cover.
+        portEXIT_CRITICAL(&s_wear_lock);
+        return;
+    }
+    for (int i = 0; i < CONFIG_OPENTHREAD_NVS_DIAG_TRACKED_KEYS; i++) {
+        if (s_keys[i].writes == 0) {
+            if (stats == NULL) {
+                stats = &s_keys[i];
+            }
+        } else if (strcmp(s_keys[i].key, key) == 0 && strcmp(s_keys[i].name_space, name_space) == 0) {
+            stats = &s_keys[i];
+            break;
+        }
+    }
+    s_requested_bytes += length;
+    if (stats == NULL) {
+        s_untracked_writes++;
+    } else {
+        if (stats->writes == 0) {
+            strlcpy(stats->name_space, name_space, sizeof(stats->name_space));
+            strlcpy(stats->key, key, sizeof(stats->key));
+        } else if (now - stats->last_write_us < CONFIG_OPENTHREAD_NVS_DIAG_COALESCE_WINDOW_MS * 1000LL) {
+            stats->burst_writes++;
+        }
+        stats->writes++;
+        stats->bytes += length;
+        stats->last_write_us = now;
+    }
+    portEXIT_CRITICAL(&s_wear_lock);
+}
+
+esp_err_t __real_nvs_open(const char *name_space, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t __wrap_nvs_open(const char *name_space, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    esp_err_t err = __real_nvs_open(name_space, open_mode, out_handle);
+    if (err == ESP_OK) {
+        nvs_diag_note_open(NVS_DEFAULT_PART_NAME, name_space, *out_handle);
+    }
+    return err;
+}
+
+esp_err_t __real_nvs_open_from_partition(const char *part_name, const char *name_space, nvs_open_mode_t open_mode,
+                                         nvs_handle_t *out_handle);
+esp_err_t __wrap_nvs_open_from_partition(const char *part_name, const char *name_space, nvs_open_mode_t open_mode,
+                                         nvs_handle_t *out_handle)
+{
+    esp_err_t err = __real_nvs_open_from_partition(part_name, name_space, open_mode, out_handle);
+    if (err == ESP_OK) {
+        nvs_diag_note_open(part_name, name_space, *out_handle);
+    }
+    return err;
+}
+
+void __real_nvs_close(nvs_handle_t handle);
+void __wrap_nvs_close(nvs_handle_t handle)
+{
+    nvs_diag_note_close(handle);
+    __real_nvs_close(handle);
+}
+
+#define NVS_DIAG_WRAP_SET(type_name, type)                                               \
+    esp_err_t __real_nvs_set_##type_name(nvs_handle_t handle, const char *key, type value); \
+    esp_err_t __wrap_nvs_set_##type_name(nvs_handle_t handle, const char *key, type value)  \
+    {                                                                                    \
+        esp_err_t err = __real_nvs_set_##type_name(handle, key, value);                  \
+        nvs_diag_note_write(handle, key, sizeof(value), err);                            \
+        return err;                                                                      \
+    }
+
+NVS_DIAG_WRAP_SET(i8, int8_t)
+NVS_DIAG_WRAP_SET(u8, uint8_t)
+NVS_DIAG_WRAP_SET(i16, int16_t)
+NVS_DIAG_WRAP_SET(u16, uint16_t)
+NVS_DIAG_WRAP_SET(i32, int32_t)
+NVS_DIAG_WRAP_SET(u32, uint32_t)
+NVS_DIAG_WRAP_SET(i64, int64_t)
+NVS_DIAG_WRAP_SET(u64, uint64_t)
+
+esp_err_t __real_nvs_set_str(nvs_handle_t handle, const char *key, const char *value);
+esp_err_t __wrap_nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    esp_err_t err = __real_nvs_set_str(handle, key, value);
+    nvs_diag_note_write(handle, key, strlen(value) + 1, err);
+    return err;
+}
+
+esp_err_t __real_nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t __wrap_nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    esp_err_t err = __real_nvs_set_blob(handle, key, value, length);
+    nvs_diag_note_write(handle, key, length, err);
+    return err;
+}
+
+esp_err_t __real_nvs_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t __wrap_nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    // Erasing rewrites the entry state table, so it is counted as a write of the key.
+    esp_err_t err = __real_nvs_erase_key(handle, key);
+    nvs_diag_note_write(handle, key, 0, err);
+    return err;
+}
+#endif // CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+
+static uint16_t nvs_diag_count_used_entries(const uint8_t *state_table)
+{
+    uint16_t used = 0;
+    for (int i = 0; i < NVS_DIAG_ENTRY_COUNT; i++) {
+        if (((state_table[i / 4] >> ((i % 4) * 2)) & 0x3) != NVS_DIAG_ENTRY_STATE_EMPTY) {
+            used++;
+        }
+    }
+    return used;
+}
+
+static void nvs_wear_sample(bool baseline)
+{
+    uint8_t buf[2 * NVS_DIAG_ENTRY_SIZE];
+    uint32_t written = 0;
+    uint32_t erases = 0;
+
+    for (size_t i = 0; i < s_wear_page_count; i++) {
+        if (esp_partition_read(s_wear_partition, i * NVS_DIAG_PAGE_SIZE, buf, sizeof(buf)) != ESP_OK) {
+            continue;
+        }
+        nvs_diag_page_t *page = &s_wear_pages[i];
+        uint32_t state, seq;
+        memcpy(&state, &buf[0], sizeof(state));
+        memcpy(&seq, &buf[4], sizeof(seq));
+        uint16_t used = (state == NVS_DIAG_PAGE_STATE_UNINITIALIZED) ? 0 : nvs_diag_count_used_entries(&buf[32]);
+
+        if (!baseline) {
+            if (page->state != NVS_DIAG_PAGE_STATE_UNINITIALIZED &&
+                (state == NVS_DIAG_PAGE_STATE_UNINITIALIZED || seq != page->seq)) {
+                // Garbage collected, and possibly reused, since the last sample. Entries written to the old
+                // incarnation after the last sample are not seen, so short intervals undercount less.
+                page->erases++;
+                erases++;
+                written += used;
+            } else if (page->state == NVS_DIAG_PAGE_STATE_UNINITIALIZED) {
+                written += used;
+            } else if (used > page->used_entries) {
+                written += used - page->used_entries;
+            }
+        }
+        page->state = state;
+        page->seq = seq;
+        page->used_entries = used;
+    }
+
+    portENTER_CRITICAL(&s_wear_lock);
+    s_wear_entries_written += written;
+    s_wear_page_erases += erases;
+    s_wear_samples++;
+    s_wear_last_sample_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&s_wear_lock);
+}
+
+static void nvs_wear_task_worker(void *pvParameters)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+
+    // Stopped through a flag rather than vTaskDelete(), which could kill the task while it holds the flash lock.
+    // The flag is read and the handle cleared under one lock, so a start either finds the task still running or
+    // finds no task and creates one.
+    while (true) {
+        bool running;
+
+        portENTER_CRITICAL(&s_wear_lock);
+        running = s_wear_running;
+        if (!running) {
+            s_wear_task = NULL;
+        }
+        portEXIT_CRITICAL(&s_wear_lock);
+        if (!running) {
+            break;
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(s_wear_interval_ms));
+        if (s_wear_running) {
+            nvs_wear_sample(false);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+static void nvs_wear_reset(void)
+{
+    for (size_t i = 0; i < s_wear_page_count; i++) {
+        s_wear_pages[i].erases = 0;
+    }
+    portENTER_CRITICAL(&s_wear_lock);
+    s_wear_entries_written = 0;
+    s_wear_page_erases = 0;
+    s_wear_samples = 0;
+    s_wear_start_us = esp_timer_get_time();
+    s_wear_last_sample_us = s_wear_start_us;
+#if CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+    memset(s_keys, 0, sizeof(s_keys));
+    s_untracked_writes = 0;
+    s_requested_bytes = 0;
+#endif
+    portEXIT_CRITICAL(&s_wear_lock);
+}
+
+static otError nvs_wear_start(uint32_t interval_ms)
+{
+    if (s_wear_pages == NULL) {
+        s_wear_partition =
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, NVS_DEFAULT_PART_NAME);
+        if (s_wear_partition == NULL) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "Fail to find the nvs partition");
+            return OT_ERROR_NOT_FOUND;
+        }
+        s_wear_page_count = s_wear_partition->size / NVS_DIAG_PAGE_SIZE;
+        s_wear_pages = calloc(s_wear_page_count, sizeof(nvs_diag_page_t));
+        if (s_wear_pages == NULL) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "Fail to allocate nvs wear monitor");
+            return OT_ERROR_NO_BUFS;
+        }
+    }
+    s_wear_interval_ms = interval_ms;
+    portENTER_CRITICAL(&s_wear_lock);
+    bool running = s_wear_task != NULL;
+    if (running) {
+        // Still running, or stopping and picking up the flag again on its next wakeup.
+        s_wear_running = true;
+    }
+    portEXIT_CRITICAL(&s_wear_lock);
+    if (running) {
+        return OT_ERROR_NONE;
+    }
+    nvs_wear_reset();
+    nvs_wear_sample(true);
+    s_wear_running = true;
+    if (pdPASS != xTaskCreate(nvs_wear_task_worker, "nvs_wear", 3072, NULL, 4, &s_wear_task)) {
+        s_wear_running = false;
+        s_wear_task = NULL;
+        ESP_LOGE(OT_EXT_CLI_TAG, "Fail to create nvs wear task");
+        return OT_ERROR_FAILED;
+    }
+    return OT_ERROR_NONE;
+}
+
+#if CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+static int nvs_wear_key_compare(const void *a, const void *b)
+{
+    const nvs_diag_key_stats_t *lhs = a;
+    const nvs_diag_key_stats_t *rhs = b;
+    return (lhs->writes < rhs->writes) - (lhs->writes > rhs->writes);
+}
+
+static void nvs_wear_print_keys(uint64_t elapsed_ms)
+{
+    nvs_diag_key_stats_t *keys = malloc(sizeof(s_keys));
+    if (keys == NULL) {
+        ESP_LOGE(OT_EXT_CLI_TAG, "Fail to allocate key report");
+        return;
+    }
+    portENTER_CRITICAL(&s_wear_lock);
+    memcpy(keys, s_keys, sizeof(s_keys));
+    uint32_t untracked = s_untracked_writes;
+    portEXIT_CRITICAL(&s_wear_lock);
+
+    qsort(keys, CONFIG_OPENTHREAD_NVS_DIAG_TRACKED_KEYS, sizeof(keys[0]), nvs_wear_key_compare);
+    otCliOutputFormat("writes per key:\n");
+    for (int i = 0; i < CONFIG_OPENTHREAD_NVS_DIAG_TRACKED_KEYS && keys[i].writes > 0; i++) {
+        otCliOutputFormat("  %s/%s: writes=%" PRIu32 " (%" PRIu32 "/min) bytes=%" PRIu32 "%s\n", keys[i].name_space,
+                          keys[i].key, keys[i].writes, (uint32_t)(keys[i].writes * 60000ULL / elapsed_ms),
+                          keys[i].bytes, keys[i].burst_writes ? " *" : "");
+    }
+    if (untracked > 0) {
+        otCliOutputFormat("  other keys: writes=%" PRIu32 "\n", untracked);
+    }
+    otCliOutputFormat("coalescing candidates (* above):\n");
+    for (int i = 0; i < CONFIG_OPENTHREAD_NVS_DIAG_TRACKED_KEYS && keys[i].writes > 0; i++) {
+        if (keys[i].burst_writes > 0) {
+            otCliOutputFormat("  %s/%s: %" PRIu32 " of %" PRIu32 " writes within %d ms of the previous one\n",
+                              keys[i].name_space, keys[i].key, keys[i].burst_writes, keys[i].writes,
+                              CONFIG_OPENTHREAD_NVS_DIAG_COALESCE_WINDOW_MS);
+        }
+    }
+    free(keys);
+}
+#endif
+
+static void nvs_wear_print(void)
+{
+    if (s_wear_pages == NULL) {
+        otCliOutputFormat("nvs wear monitor was never started\n");
+        return;
+    }
+    portENTER_CRITICAL(&s_wear_lock);
+    uint64_t entries = s_wear_entries_written;
+    uint32_t erases = s_wear_page_erases;
+    uint32_t samples = s_wear_samples;
+    uint64_t elapsed_ms = (s_wear_last_sample_us - s_wear_start_us) / 1000;
+#if CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+    uint64_t requested_bytes = s_requested_bytes;
+#endif
+    portEXIT_CRITICAL(&s_wear_lock);
+
+    if (elapsed_ms == 0) {
+        elapsed_ms = 1;
+    }
+    otCliOutputFormat("nvs wear monitor: %s, interval %" PRIu32 " ms\n", s_wear_running ? "running" : "stopped",
+                      s_wear_interval_ms);
+    otCliOutputFormat("monitored: %" PRIu32 " s, %" PRIu32 " samples\n", (uint32_t)(elapsed_ms / 1000), samples);
+    uint32_t rate = (uint32_t)(entries * 1000000ULL / elapsed_ms);
+    otCliOutputFormat("entries written: %" PRIu64 " (%" PRIu32 ".%03" PRIu32 " entries/s)\n", entries, rate / 1000,
+                      rate % 1000);
+    otCliOutputFormat("page erases: %" PRIu32 "\n", erases);
+    for (size_t i = 0; i < s_wear_page_count; i++) {
+        if (s_wear_pages[i].state == NVS_DIAG_PAGE_STATE_UNINITIALIZED) {
+            otCliOutputFormat("  page %u: erases=%" PRIu32 " (erased)\n", (unsigned)i, s_wear_pages[i].erases);
+        } else {
+            otCliOutputFormat("  page %u: erases=%" PRIu32 " seq=%" PRIu32 " used=%u/%d\n", (unsigned)i,
+                              s_wear_pages[i].erases, s_wear_pages[i].seq, s_wear_pages[i].used_entries,
+                              NVS_DIAG_ENTRY_COUNT);
+        }
+    }
+    if (erases == 0) {
+        otCliOutputFormat("projected lifetime: no page erase observed yet\n");
+    } else {
+        // NVS rotates pages, so the erases are spread over the whole partition.
+        uint64_t days = (uint64_t)CONFIG_OPENTHREAD_NVS_DIAG_FLASH_ENDURANCE * s_wear_page_count * elapsed_ms /
+                        ((uint64_t)erases * 86400000ULL);
+        otCliOutputFormat("projected lifetime: %" PRIu64 " days at %d erase cycles per page\n", days,
+                          CONFIG_OPENTHREAD_NVS_DIAG_FLASH_ENDURANCE);
+    }
+#if CONFIG_OPENTHREAD_NVS_DIAG_WRITE_TRACKING
+    if (requested_bytes > 0) {
+        uint32_t amplification = (uint32_t)(entries * NVS_DIAG_ENTRY_SIZE * 100 / requested_bytes);
+        otCliOutputFormat("requested bytes: %" PRIu64 ", write amplification: %" PRIu32 ".%02" PRIu32 "\n",
+                          requested_bytes, amplification / 100, amplification % 100);
+    }
+    nvs_wear_print_keys(elapsed_ms);
+#endif
+}
+
 otError esp_ot_process_nvs_diag(void *aContext, uint8_t aArgsLength, char *aArgs[])
 {
     (void)(aContext);
@@ -57,12 +506,19 @@ otError esp_ot_process_nvs_diag(void *aContext, uint8_t aArgsLength, char *aArgs
         otCliOutputFormat("deamon start <interval>                  :     create the daemon task, print nvs status "
                           "every <interval> milliseconds\n");
         otCliOutputFormat("deamon stop                              :     delete the daemon task\n");
+        otCliOutputFormat("wear                                     :     print the nvs wear report\n");
+        otCliOutputFormat("wear start <interval>                    :     start the wear monitor, sample the nvs pages "
+                          "every <interval> milliseconds\n");
+        otCliOutputFormat("wear stop                                :     stop the wear monitor\n");
+        otCliOutputFormat("wear reset                               :     clear the wear counters\n");
         otCliOutputFormat("---example---\n");
         otCliOutputFormat("print the status of nvs                  :     nvsdiag status\n");
         otCliOutputFormat("print detailed usage information of nvs  :     nvsdiag detail\n");
         otCliOutputFormat("print the status of nvs deamon task      :     nvsdiag deamon\n");
         otCliOutputFormat("create a daemon task (interval=1s)       :     nvsdiag deamon start 1000\n");
         otCliOutputFormat("delete the daemon task                   :     nvsdiag deamon stop\n");
+        otCliOutputFormat("monitor nvs wear (interval=1s)           :     nvsdiag wear start 1000\n");
+        otCliOutputFormat("print the nvs wear report                :     nvsdiag wear\n");
     } else {
         if (strcmp(aArgs[0], "status") == 0) {
             nvs_basic_status_print();
@@ -100,6 +556,27 @@ otError esp_ot_process_nvs_diag(void *aContext, uint8_t aArgsLength, char *aArgs
             } else {
                 return OT_ERROR_INVALID_ARGS;
             }
+        } else if (strcmp(aArgs[0], "wear") == 0) {
+            if (aArgsLength == 1) {
+                nvs_wear_print();
+            } else if (aArgsLength == 2 && strcmp(aArgs[1], "stop") == 0) {
+                if (!s_wear_running) {
+                    ESP_LOGE(OT_EXT_CLI_TAG, "nvs wear monitor is not running");
+                    return OT_ERROR_INVALID_STATE;
+                }
+                s_wear_running = false;
+            } else if (aArgsLength == 2 && strcmp(aArgs[1], "reset") == 0) {
+                nvs_wear_reset();
+            } else if (aArgsLength == 3 && strcmp(aArgs[1], "start") == 0) {
+                int interval = atoi(aArgs[2]);
+                if (interval <= 0) {
+                    ESP_LOGE(OT_EXT_CLI_TAG, "Invalid interval");
+                    return OT_ERROR_INVALID_ARGS;
+                }
+                return nvs_wear_start(interval);
+            } else {
+                return OT_ERROR_INVALID_ARGS;
+            }
         } else {
             return OT_ERROR_INVALID_ARGS;
         }
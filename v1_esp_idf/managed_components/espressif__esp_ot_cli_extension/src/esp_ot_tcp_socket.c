@@ -6,11 +6,16 @@
 
 #include "esp_ot_tcp_socket.h"
 
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include "esp_check.h"
 #include "esp_err.h"
 
 #include "esp_log.h"
+#include "esp_ot_buf_diag.h"
 #include "esp_ot_cli_extension.h"
+#include "esp_timer.h"
 #include <sys/unistd.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -24,15 +29,248 @@ static EventGroupHandle_t tcp_server_event_group;
 static _lock_t s_tcp_client_mutex = NULL;
 static _lock_t s_tcp_server_mutex = NULL;
 
+/* Received chunks shorter than this are logged as text, longer ones only feed the progress line. */
+#define TCP_STREAM_LOG_MESSAGE_MAX 128
+#define TCP_STREAM_PROGRESS_INTERVAL_US (1000 * 1000)
+#define TCP_STREAM_WAIT_WRITABLE_MS 100
+#define TCP_STREAM_NOBUFS_BACKOFF_MS 10
+
+static void tcp_stream_reset_stats(TCP_STREAM *stream)
+{
+    stream->handshake_ms = -1;
+    stream->rx_bytes = 0;
+    stream->rx_first_us = 0;
+    stream->rx_last_us = 0;
+    stream->tx_bytes = 0;
+}
+
+static uint32_t tcp_stream_kbps(uint64_t bytes, int64_t elapsed_us)
+{
+    return elapsed_us > 0 ? (uint32_t)(bytes * 8000 / elapsed_us) : 0;
+}
+
+static void tcp_stream_set_nodelay(int sock, int nodelay)
+{
+    if (sock >= 0 && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) != 0) {
+        ESP_LOGW(OT_EXT_CLI_TAG, "Fail to set TCP_NODELAY: errno %d", errno);
+    }
+}
+
+static void tcp_stream_receive(TCP_STREAM *stream, int sock, const char *peer, char *rx_buffer, int len)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t last = stream->rx_last_us;
+
+    if (stream->rx_bytes == 0) {
+        stream->rx_first_us = now;
+    }
+    stream->rx_bytes += len;
+    stream->rx_last_us = now;
+    if (len < TCP_STREAM_LOG_MESSAGE_MAX) {
+        ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %d bytes from %s", sock, len, peer);
+        rx_buffer[len] = '\0';
+        ESP_LOGI(OT_EXT_CLI_TAG, "%s", rx_buffer);
+    } else if (now / TCP_STREAM_PROGRESS_INTERVAL_US != last / TCP_STREAM_PROGRESS_INTERVAL_US) {
+        ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %" PRIu64 " bytes from %s, %" PRIu32 " kbit/s", sock,
+                 stream->rx_bytes, peer, tcp_stream_kbps(stream->rx_bytes, now - stream->rx_first_us));
+    }
+}
+
+static void tcp_stream_wait_writable(int sock)
+{
+    fd_set write_set;
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = TCP_STREAM_WAIT_WRITABLE_MS * 1000};
+
+    FD_ZERO(&write_set);
+    FD_SET(sock, &write_set);
+    select(sock + 1, NULL, &write_set, NULL, &timeout);
+}
+
+/*
+ * Send stream->total_len generated bytes, or the content of stream->path, over a connected socket.
+ * Each send() is non-blocking (MSG_DONTWAIT) so that a full send buffer makes us wait in select()
+ * instead of inside send(), where the stop and close requests in abort_bits could not be noticed.
+ * The socket itself stays blocking, the receive task shares it.
+ */
+static void tcp_stream_send(int sock, TCP_STREAM *stream, EventGroupHandle_t event_group, EventBits_t abort_bits)
+{
+    esp_err_t ret = ESP_OK;
+    char *buffer = NULL;
+    FILE *file = NULL;
+    uint64_t sent = 0;
+    uint32_t stalls = 0;
+    int64_t start_us = 0;
+    int64_t elapsed_us = 0;
+
+    buffer = malloc(stream->buf_size);
+    ESP_GOTO_ON_FALSE(buffer != NULL, ESP_ERR_NO_MEM, exit, OT_EXT_CLI_TAG,
+                      "Unable to allocate a %u byte stream buffer", (unsigned)stream->buf_size);
+    if (stream->path[0] != '\0') {
+        file = fopen(stream->path, "rb");
+        ESP_GOTO_ON_FALSE(file != NULL, ESP_FAIL, exit, OT_EXT_CLI_TAG, "Unable to open %s: errno %d", stream->path,
+                          errno);
+    }
+    tcp_stream_set_nodelay(sock, stream->nodelay);
+
+    ESP_LOGI(OT_EXT_CLI_TAG, "Streaming %s%s with %u byte buffer, TCP_NODELAY %s", file ? "file " : "generated data",
+             file ? stream->path : "", (unsigned)stream->buf_size, stream->nodelay ? "on" : "off");
+    start_us = esp_timer_get_time();
+    while (file != NULL || sent < stream->total_len) {
+        size_t chunk = 0;
+        if (file != NULL) {
+            chunk = fread(buffer, 1, stream->buf_size, file);
+            if (chunk == 0) {
+                break;
+            }
+        } else {
+            chunk = stream->total_len - sent < stream->buf_size ? stream->total_len - sent : stream->buf_size;
+            for (size_t i = 0; i < chunk; i++) {
+                buffer[i] = '0' + (char)((sent + i) % 64);
+            }
+        }
+        size_t offset = 0;
+        while (offset < chunk) {
+            if (xEventGroupGetBits(event_group) & abort_bits) {
+                ESP_LOGW(OT_EXT_CLI_TAG, "Stream stopped");
+                goto done;
+            }
+            int len = send(sock, buffer + offset, chunk - offset, MSG_DONTWAIT);
+            ESP_OT_BUF_DIAG_RECORD(ESP_OT_BUF_CLASS_SOCKET, len >= 0 || (errno != ENOBUFS && errno != ENOMEM));
+            if (len > 0) {
+                offset += len;
+                sent += len;
+            } else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                stalls++;
+                tcp_stream_wait_writable(sock);
+            } else if (len < 0 && (errno == ENOBUFS || errno == ENOMEM)) {
+                // Out of segments or pbufs is backpressure too, but the socket may still select() writable
+                // while the pool is empty, so back off instead of spinning and retry.
+                stalls++;
+                vTaskDelay(pdMS_TO_TICKS(TCP_STREAM_NOBUFS_BACKOFF_MS));
+            } else {
+                ESP_LOGW(OT_EXT_CLI_TAG, "Stream send failed: errno %d", errno);
+                goto done;
+            }
+        }
+    }
+
+done:
+    elapsed_us = esp_timer_get_time() - start_us;
+    stream->tx_bytes += sent;
+    stream->last_len = sent;
+    stream->last_ms = (uint32_t)(elapsed_us / 1000);
+    stream->last_kbps = tcp_stream_kbps(sent, elapsed_us);
+    stream->last_stalls = stalls;
+    ESP_LOGI(OT_EXT_CLI_TAG, "Streamed %" PRIu64 " bytes in %" PRIu32 " ms, goodput %" PRIu32 " kbit/s, %" PRIu32
+             " send stalls", sent, stream->last_ms, stream->last_kbps, stalls);
+
+exit:
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(buffer);
+    if (ret != ESP_OK) {
+        ESP_LOGI(OT_EXT_CLI_TAG, "Fail to stream");
+    }
+}
+
+static otError tcp_stream_parse_args(TCP_STREAM *stream, uint8_t aArgsLength, char *aArgs[])
+{
+    uint8_t index = 2;
+    char *end = NULL;
+
+    if (aArgsLength < 2 || aArgsLength > 4) {
+        ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+        return OT_ERROR_INVALID_ARGS;
+    }
+    if (strcmp(aArgs[1], "file") == 0) {
+        if (aArgsLength < 3 || strlen(aArgs[2]) >= sizeof(stream->path)) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        strcpy(stream->path, aArgs[2]);
+        stream->total_len = 0;
+        index = 3;
+    } else {
+        errno = 0;
+        unsigned long total_len = strtoul(aArgs[1], &end, 10);
+        if (!isdigit((unsigned char)aArgs[1][0]) || *end != '\0' || errno == ERANGE || total_len == 0 ||
+            total_len > UINT32_MAX) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        stream->path[0] = '\0';
+        stream->total_len = (uint32_t)total_len;
+    }
+    stream->buf_size = TCP_STREAM_BUFFER_SIZE;
+    if (aArgsLength == index + 1) {
+        long buf_size = strtol(aArgs[index], &end, 10);
+        if (end == aArgs[index] || *end != '\0' || buf_size < TCP_STREAM_BUFFER_MIN || buf_size > TCP_STREAM_BUFFER_MAX) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "Invalid buffer size, range %d - %d", TCP_STREAM_BUFFER_MIN,
+                     TCP_STREAM_BUFFER_MAX);
+            return OT_ERROR_INVALID_ARGS;
+        }
+        stream->buf_size = (size_t)buf_size;
+    } else if (aArgsLength > index + 1) {
+        ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+        return OT_ERROR_INVALID_ARGS;
+    }
+    return OT_ERROR_NONE;
+}
+
+static otError tcp_stream_parse_nodelay(TCP_STREAM *stream, int sock, uint8_t aArgsLength, char *aArgs[])
+{
+    if (aArgsLength != 2 || (strcmp(aArgs[1], "on") != 0 && strcmp(aArgs[1], "off") != 0)) {
+        ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+        return OT_ERROR_INVALID_ARGS;
+    }
+    stream->nodelay = strcmp(aArgs[1], "on") == 0;
+    tcp_stream_set_nodelay(sock, stream->nodelay);
+    return OT_ERROR_NONE;
+}
+
+static void tcp_stream_print_stats(const TCP_STREAM *stream)
+{
+    otCliOutputFormat("TCP_NODELAY: %s\n", stream->nodelay ? "on" : "off");
+    if (stream->handshake_ms >= 0) {
+        otCliOutputFormat("handshake: %" PRId32 " ms\n", stream->handshake_ms);
+    }
+    otCliOutputFormat("rx: %" PRIu64 " bytes, %" PRIu32 " kbit/s\n", stream->rx_bytes,
+                      tcp_stream_kbps(stream->rx_bytes, stream->rx_last_us - stream->rx_first_us));
+    otCliOutputFormat("tx: %" PRIu64 " bytes\n", stream->tx_bytes);
+    if (stream->streaming) {
+        otCliOutputFormat("stream: running\n");
+    } else if (stream->last_ms > 0 || stream->last_len > 0) {
+        otCliOutputFormat("last stream: %" PRIu64 " bytes in %" PRIu32 " ms, goodput %" PRIu32 " kbit/s, %" PRIu32
+                          " send stalls\n",
+                          stream->last_len, stream->last_ms, stream->last_kbps, stream->last_stalls);
+    }
+}
+
+static char *tcp_receive_buffer_alloc(char *fallback, size_t fallback_size, size_t *rx_size)
+{
+    char *rx_buffer = malloc(TCP_STREAM_BUFFER_SIZE + 1);
+
+    if (rx_buffer == NULL) {
+        ESP_LOGW(OT_EXT_CLI_TAG, "Fail to allocate receive buffer, using %u bytes", (unsigned)fallback_size);
+        *rx_size = fallback_size - 1;
+        return fallback;
+    }
+    *rx_size = TCP_STREAM_BUFFER_SIZE;
+    return rx_buffer;
+}
+
 static void tcp_client_receive_task(void *pvParameters)
 {
-    char rx_buffer[128];
+    char fallback_buffer[128];
+    size_t rx_size = 0;
+    char *rx_buffer = tcp_receive_buffer_alloc(fallback_buffer, sizeof(fallback_buffer), &rx_size);
     int len = 0;
     TCP_CLIENT *tcp_client_member = (TCP_CLIENT *)pvParameters;
     int set_exit = 0;
 
     while (true) {
-        len = recv(tcp_client_member->sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
+        len = recv(tcp_client_member->sock, rx_buffer, rx_size, 0);
         if (len < 0) {
             _lock_acquire_recursive(&s_tcp_client_mutex);
             if (errno == ENOTCONN && !set_exit && tcp_client_member->sock != -1) {
@@ -43,15 +281,16 @@ static void tcp_client_receive_task(void *pvParameters)
             _lock_release_recursive(&s_tcp_client_mutex);
         }
         if (len > 0) {
-            ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %d bytes from %s", tcp_client_member->sock, len,
-                     tcp_client_member->remote_ipaddr);
-            rx_buffer[len] = '\0';
-            ESP_LOGI(OT_EXT_CLI_TAG, "%s", rx_buffer);
+            tcp_stream_receive(&tcp_client_member->stream, tcp_client_member->sock, tcp_client_member->remote_ipaddr,
+                               rx_buffer, len);
         }
         if (tcp_client_member->exist == 0 && tcp_client_member->sock == -1) {
             break;
         }
     }
+    if (rx_buffer != fallback_buffer) {
+        free(rx_buffer);
+    }
     ESP_LOGI(OT_EXT_CLI_TAG, "TCP client receive task exiting");
     vTaskDelete(NULL);
 }
@@ -85,9 +324,14 @@ static void tcp_client_add(TCP_CLIENT *tcp_client_member)
 
     ESP_LOGI(OT_EXT_CLI_TAG, "Socket created, connecting to %s:%d", tcp_client_member->remote_ipaddr,
              tcp_client_member->remote_port);
+    tcp_stream_reset_stats(&tcp_client_member->stream);
+    int64_t connect_start_us = esp_timer_get_time();
     err = connect(tcp_client_member->sock, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr_in6));
     ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Socket unable to connect: errno %d", errno);
-    ESP_LOGI(OT_EXT_CLI_TAG, "Successfully connected");
+    // Only the handshake is timed, lwIP keeps the RTT estimate of the connection to itself.
+    tcp_client_member->stream.handshake_ms = (int32_t)((esp_timer_get_time() - connect_start_us) / 1000);
+    tcp_stream_set_nodelay(tcp_client_member->sock, tcp_client_member->stream.nodelay);
+    ESP_LOGI(OT_EXT_CLI_TAG, "Successfully connected, handshake %" PRId32 " ms", tcp_client_member->stream.handshake_ms);
 
     if (pdPASS != xTaskCreate(tcp_client_receive_task, "tcp_client_receive", 4096, tcp_client_member, 4, NULL)) {
         err = -1;
@@ -112,6 +356,7 @@ static void tcp_client_send(TCP_CLIENT *tcp_client_member)
 {
     int len = 0;
     len = send(tcp_client_member->sock, tcp_client_member->message, strlen(tcp_client_member->message), 0);
+    ESP_OT_BUF_DIAG_RECORD(ESP_OT_BUF_CLASS_SOCKET, len >= 0 || (errno != ENOBUFS && errno != ENOMEM));
     if (len < 0) {
         ESP_LOGI(OT_EXT_CLI_TAG, "Fail to send message");
     }
@@ -133,17 +378,27 @@ static void tcp_socket_client_task(void *pvParameters)
     TCP_CLIENT *tcp_client_member = (TCP_CLIENT *)pvParameters;
 
     while (true) {
-        int bits =
-            xEventGroupWaitBits(tcp_client_event_group,
-                                TCP_CLIENT_ADD_BIT | TCP_CLIENT_SEND_BIT | TCP_CLIENT_DELETE_BIT | TCP_CLIENT_CLOSE_BIT,
-                                pdFALSE, pdFALSE, 10000 / portTICK_PERIOD_MS);
-        int tcp_event = bits & 0x0f;
+        int bits = xEventGroupWaitBits(tcp_client_event_group,
+                                       TCP_CLIENT_ADD_BIT | TCP_CLIENT_SEND_BIT | TCP_CLIENT_DELETE_BIT |
+                                           TCP_CLIENT_CLOSE_BIT | TCP_CLIENT_STREAM_BIT | TCP_CLIENT_STREAM_STOP_BIT,
+                                       pdFALSE, pdFALSE, 10000 / portTICK_PERIOD_MS);
+        int tcp_event = bits & 0x3f;
+        if (tcp_event & TCP_CLIENT_STREAM_STOP_BIT) {
+            // Only meaningful while streaming, a late stop must not block the other events.
+            xEventGroupClearBits(tcp_client_event_group, TCP_CLIENT_STREAM_STOP_BIT);
+            tcp_event &= ~TCP_CLIENT_STREAM_STOP_BIT;
+        }
         if (tcp_event == TCP_CLIENT_ADD_BIT) {
             xEventGroupClearBits(tcp_client_event_group, TCP_CLIENT_ADD_BIT);
             tcp_client_add(tcp_client_member);
         } else if (tcp_event == TCP_CLIENT_SEND_BIT) {
             xEventGroupClearBits(tcp_client_event_group, TCP_CLIENT_SEND_BIT);
             tcp_client_send(tcp_client_member);
+        } else if (tcp_event == TCP_CLIENT_STREAM_BIT) {
+            xEventGroupClearBits(tcp_client_event_group, TCP_CLIENT_STREAM_BIT);
+            tcp_stream_send(tcp_client_member->sock, &tcp_client_member->stream, tcp_client_event_group,
+                            TCP_CLIENT_STREAM_STOP_BIT | TCP_CLIENT_DELETE_BIT | TCP_CLIENT_CLOSE_BIT);
+            tcp_client_member->stream.streaming = 0;
         } else if (tcp_event == TCP_CLIENT_DELETE_BIT) {
             xEventGroupClearBits(tcp_client_event_group, TCP_CLIENT_DELETE_BIT);
             tcp_client_delete(tcp_client_member);
@@ -163,7 +418,7 @@ static void tcp_socket_client_task(void *pvParameters)
 otError esp_ot_process_tcp_client(void *aContext, uint8_t aArgsLength, char *aArgs[])
 {
     static TaskHandle_t tcp_client_handle = NULL;
-    static TCP_CLIENT tcp_client_member = {0, -1, -1, "", ""};
+    static TCP_CLIENT tcp_client_member = {0, -1, -1, "", "", {.handshake_ms = -1}};
 
     if (aArgsLength == 0) {
         otCliOutputFormat("---tcpsockclient parameter---\n");
@@ -171,12 +426,19 @@ otError esp_ot_process_tcp_client(void *aContext, uint8_t aArgsLength, char *aAr
         otCliOutputFormat("open                       :     open TCP client function\n");
         otCliOutputFormat("connect <ipaddr> <port>    :     create a TCP client and connect the server\n");
         otCliOutputFormat("send <message>             :     send a message to the TCP server\n");
+        otCliOutputFormat("stream <len> [<buflen>]    :     stream <len> generated bytes to the TCP server\n");
+        otCliOutputFormat("stream file <path> [<buflen>]:   stream the content of a file to the TCP server\n");
+        otCliOutputFormat("stream stop                :     stop the running stream\n");
+        otCliOutputFormat("nodelay <on|off>           :     enable or disable TCP_NODELAY\n");
+        otCliOutputFormat("stats                      :     show handshake time and throughput statistics\n");
         otCliOutputFormat("close                      :     close TCP client \n");
         otCliOutputFormat("---example---\n");
         otCliOutputFormat("get TCP client status      :     tcpsockclient status\n");
         otCliOutputFormat("open TCP client function   :     tcpsockclient open\n");
         otCliOutputFormat("create a TCP client        :     tcpsockclient connect fd81:984a:b59d:2::c0a8:0166 12345\n");
         otCliOutputFormat("send a message             :     tcpsockclient send hello\n");
+        otCliOutputFormat("stream 100 KB              :     tcpsockclient stream 102400 1024\n");
+        otCliOutputFormat("stream a file              :     tcpsockclient stream file /spiffs/config.bin\n");
         otCliOutputFormat("close TCP client           :     tcpsockclient close\n");
     } else if (strcmp(aArgs[0], "status") == 0) {
         if (tcp_client_handle == NULL) {
@@ -236,6 +498,33 @@ otError esp_ot_process_tcp_client(void *aContext, uint8_t aArgsLength, char *aAr
         }
         strncpy(tcp_client_member.message, aArgs[1], sizeof(tcp_client_member.message));
         xEventGroupSetBits(tcp_client_event_group, TCP_CLIENT_SEND_BIT);
+    } else if (strcmp(aArgs[0], "stream") == 0) {
+        if (tcp_client_handle == NULL) {
+            otCliOutputFormat("TCP client is not open\n");
+            return OT_ERROR_NONE;
+        }
+        if (aArgsLength == 2 && strcmp(aArgs[1], "stop") == 0) {
+            xEventGroupSetBits(tcp_client_event_group, TCP_CLIENT_STREAM_STOP_BIT);
+            return OT_ERROR_NONE;
+        }
+        if (tcp_client_member.exist == 0) {
+            otCliOutputFormat("None TCP client!\n");
+            return OT_ERROR_NONE;
+        }
+        if (tcp_client_member.stream.streaming) {
+            otCliOutputFormat("Stream is running.\n");
+            return OT_ERROR_NONE;
+        }
+        otError error = tcp_stream_parse_args(&tcp_client_member.stream, aArgsLength, aArgs);
+        if (error != OT_ERROR_NONE) {
+            return error;
+        }
+        tcp_client_member.stream.streaming = 1;
+        xEventGroupSetBits(tcp_client_event_group, TCP_CLIENT_STREAM_BIT);
+    } else if (strcmp(aArgs[0], "nodelay") == 0) {
+        return tcp_stream_parse_nodelay(&tcp_client_member.stream, tcp_client_member.sock, aArgsLength, aArgs);
+    } else if (strcmp(aArgs[0], "stats") == 0) {
+        tcp_stream_print_stats(&tcp_client_member.stream);
     } else if (strcmp(aArgs[0], "close") == 0) {
         if (tcp_client_handle == NULL) {
             otCliOutputFormat("TCP client is not open\n");
@@ -252,7 +541,9 @@ otError esp_ot_process_tcp_client(void *aContext, uint8_t aArgsLength, char *aAr
 static void tcp_server_task(void *pvParameters)
 {
     int connect_sock = -1;
-    char rx_buffer[128];
+    char fallback_buffer[128];
+    size_t rx_size = 0;
+    char *rx_buffer = NULL;
     int len = 0;
     char addr_str[128];
     struct sockaddr_storage source_addr;
@@ -276,12 +567,15 @@ static void tcp_server_task(void *pvParameters)
         inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
         ESP_LOGI(OT_EXT_CLI_TAG, "Socket accepted ip address: %s", addr_str);
         strncpy(tcp_server_member->remote_ipaddr, addr_str, strlen(addr_str) + 1);
+        tcp_stream_reset_stats(&tcp_server_member->stream);
+        tcp_stream_set_nodelay(connect_sock, tcp_server_member->stream.nodelay);
+        rx_buffer = tcp_receive_buffer_alloc(fallback_buffer, sizeof(fallback_buffer), &rx_size);
         struct timeval timeout;
         timeout.tv_sec = TCP_SOCKET_RECEIVE_TIMEOUT;
         timeout.tv_usec = 0;
         setsockopt(tcp_server_member->connect_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
         while (true) {
-            len = recv(connect_sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
+            len = recv(connect_sock, rx_buffer, rx_size, 0);
             if (len < 0) {
                 _lock_acquire_recursive(&s_tcp_server_mutex);
                 if (errno == ENOTCONN && !set_exit && tcp_server_member->connect_sock != -1) {
@@ -292,14 +586,15 @@ static void tcp_server_task(void *pvParameters)
                 _lock_release_recursive(&s_tcp_server_mutex);
             }
             if (len > 0) {
-                ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %d bytes from %s", connect_sock, len, addr_str);
-                rx_buffer[len] = '\0';
-                ESP_LOGI(OT_EXT_CLI_TAG, "%s", rx_buffer);
+                tcp_stream_receive(&tcp_server_member->stream, connect_sock, addr_str, rx_buffer, len);
             }
             if (tcp_server_member->exist == 0 && tcp_server_member->connect_sock == -1) {
                 break;
             }
         }
+        if (rx_buffer != fallback_buffer) {
+            free(rx_buffer);
+        }
     }
     ESP_LOGI(OT_EXT_CLI_TAG, "TCP server receive task exiting");
     vTaskDelete(NULL);
@@ -357,6 +652,7 @@ static void tcp_server_send(TCP_SERVER *tcp_server_member)
 {
     int len = 0;
     len = send(tcp_server_member->connect_sock, tcp_server_member->message, strlen(tcp_server_member->message), 0);
+    ESP_OT_BUF_DIAG_RECORD(ESP_OT_BUF_CLASS_SOCKET, len >= 0 || (errno != ENOBUFS && errno != ENOMEM));
     if (len < 0) {
         ESP_LOGI(OT_EXT_CLI_TAG, "Fail to send message");
     }
@@ -386,17 +682,26 @@ static void tcp_socket_server_task(void *pvParameters)
     TCP_SERVER *tcp_server_member = (TCP_SERVER *)pvParameters;
 
     while (true) {
-        int bits =
-            xEventGroupWaitBits(tcp_server_event_group,
-                                TCP_SERVER_ADD_BIT | TCP_SERVER_SEND_BIT | TCP_SERVER_DELETE_BIT | TCP_SERVER_CLOSE_BIT,
-                                pdFALSE, pdFALSE, 10000 / portTICK_PERIOD_MS);
-        int tcp_event = bits & 0x0f;
+        int bits = xEventGroupWaitBits(tcp_server_event_group,
+                                       TCP_SERVER_ADD_BIT | TCP_SERVER_SEND_BIT | TCP_SERVER_DELETE_BIT |
+                                           TCP_SERVER_CLOSE_BIT | TCP_SERVER_STREAM_BIT | TCP_SERVER_STREAM_STOP_BIT,
+                                       pdFALSE, pdFALSE, 10000 / portTICK_PERIOD_MS);
+        int tcp_event = bits & 0x3f;
+        if (tcp_event & TCP_SERVER_STREAM_STOP_BIT) {
+            xEventGroupClearBits(tcp_server_event_group, TCP_SERVER_STREAM_STOP_BIT);
+            tcp_event &= ~TCP_SERVER_STREAM_STOP_BIT;
+        }
         if (tcp_event == TCP_SERVER_ADD_BIT) {
             xEventGroupClearBits(tcp_server_event_group, TCP_SERVER_ADD_BIT);
             tcp_server_add(tcp_server_member);
         } else if (tcp_event == TCP_SERVER_SEND_BIT) {
             xEventGroupClearBits(tcp_server_event_group, TCP_SERVER_SEND_BIT);
             tcp_server_send(tcp_server_member);
+        } else if (tcp_event == TCP_SERVER_STREAM_BIT) {
+            xEventGroupClearBits(tcp_server_event_group, TCP_SERVER_STREAM_BIT);
+            tcp_stream_send(tcp_server_member->connect_sock, &tcp_server_member->stream, tcp_server_event_group,
+                            TCP_SERVER_STREAM_STOP_BIT | TCP_SERVER_DELETE_BIT | TCP_SERVER_CLOSE_BIT);
+            tcp_server_member->stream.streaming = 0;
         } else if (tcp_event == TCP_SERVER_DELETE_BIT) {
             xEventGroupClearBits(tcp_server_event_group, TCP_SERVER_DELETE_BIT);
             tcp_server_delete(tcp_server_member);
@@ -416,7 +721,7 @@ static void tcp_socket_server_task(void *pvParameters)
 otError esp_ot_process_tcp_server(void *aContext, uint8_t aArgsLength, char *aArgs[])
 {
     static TaskHandle_t tcp_server_handle = NULL;
-    static TCP_SERVER tcp_server_member = {0, -1, -1, -1, "", "", ""};
+    static TCP_SERVER tcp_server_member = {0, -1, -1, -1, "", "", "", {.handshake_ms = -1}};
 
     if (aArgsLength == 0) {
         otCliOutputFormat("---tcpsockserver parameter---\n");
@@ -424,12 +729,18 @@ otError esp_ot_process_tcp_server(void *aContext, uint8_t aArgsLength, char *aAr
         otCliOutputFormat("open                       :     open TCP server function\n");
         otCliOutputFormat("bind <ipaddr> <port>       :     create a TCP server with binding the ipaddr and port\n");
         otCliOutputFormat("send <message>             :     send a message to the TCP client\n");
+        otCliOutputFormat("stream <len> [<buflen>]    :     stream <len> generated bytes to the TCP client\n");
+        otCliOutputFormat("stream file <path> [<buflen>]:   stream the content of a file to the TCP client\n");
+        otCliOutputFormat("stream stop                :     stop the running stream\n");
+        otCliOutputFormat("nodelay <on|off>           :     enable or disable TCP_NODELAY\n");
+        otCliOutputFormat("stats                      :     show throughput statistics\n");
         otCliOutputFormat("close                      :     close TCP server\n");
         otCliOutputFormat("---example---\n");
         otCliOutputFormat("get TCP server status      :     tcpsockserver status\n");
         otCliOutputFormat("open TCP server function   :     tcpsockserver open\n");
         otCliOutputFormat("create a TCP server        :     tcpsockserver bind :: 12345\n");
         otCliOutputFormat("send a message             :     tcpsockserver send hello\n");
+        otCliOutputFormat("stream 100 KB              :     tcpsockserver stream 102400 1024\n");
         otCliOutputFormat("close TCP server           :     tcpsockserver close\n");
     } else if (strcmp(aArgs[0], "status") == 0) {
         if (tcp_server_handle == NULL) {
@@ -493,6 +804,33 @@ otError esp_ot_process_tcp_server(void *aContext, uint8_t aArgsLength, char *aAr
         }
         strncpy(tcp_server_member.message, aArgs[1], sizeof(tcp_server_member.message));
         xEventGroupSetBits(tcp_server_event_group, TCP_SERVER_SEND_BIT);
+    } else if (strcmp(aArgs[0], "stream") == 0) {
+        if (tcp_server_handle == NULL) {
+            otCliOutputFormat("TCP server is not open.\n");
+            return OT_ERROR_NONE;
+        }
+        if (aArgsLength == 2 && strcmp(aArgs[1], "stop") == 0) {
+            xEventGroupSetBits(tcp_server_event_group, TCP_SERVER_STREAM_STOP_BIT);
+            return OT_ERROR_NONE;
+        }
+        if (tcp_server_member.exist == 0 || tcp_server_member.connect_sock == -1) {
+            otCliOutputFormat("TCP server is not connected.\n");
+            return OT_ERROR_NONE;
+        }
+        if (tcp_server_member.stream.streaming) {
+            otCliOutputFormat("Stream is running.\n");
+            return OT_ERROR_NONE;
+        }
+        otError error = tcp_stream_parse_args(&tcp_server_member.stream, aArgsLength, aArgs);
+        if (error != OT_ERROR_NONE) {
+            return error;
+        }
+        tcp_server_member.stream.streaming = 1;
+        xEventGroupSetBits(tcp_server_event_group, TCP_SERVER_STREAM_BIT);
+    } else if (strcmp(aArgs[0], "nodelay") == 0) {
+        return tcp_stream_parse_nodelay(&tcp_server_member.stream, tcp_server_member.connect_sock, aArgsLength, aArgs);
+    } else if (strcmp(aArgs[0], "stats") == 0) {
+        tcp_stream_print_stats(&tcp_server_member.stream);
     } else if (strcmp(aArgs[0], "close") == 0) {
         if (tcp_server_handle == NULL) {
             otCliOutputFormat("TCP server is not open.\n");
@@ -6,6 +6,10 @@
 
 #include "esp_ot_udp_socket.h"
 
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/lock.h>
 #include "cc.h"
 #include "esp_check.h"
 #include "esp_err.h"
@@ -14,392 +18,538 @@
 #include "esp_netif_net_stack.h"
 #include "esp_openthread_lock.h"
 #include "esp_openthread_netif_glue.h"
+#include "esp_ot_buf_diag.h"
 #include "esp_ot_cli_extension.h"
 #include <sys/unistd.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
 #include "lwip/err.h"
 #include "lwip/mld6.h"
 #include "lwip/sockets.h"
 #include "openthread/cli.h"
 
-static EventGroupHandle_t udp_server_event_group;
-static EventGroupHandle_t udp_client_event_group;
+/* How long the I/O task waits in select() before picking up new CLI commands. */
+#define UDP_SOCKET_POLL_MS 50
+/* Upper bound on datagrams read from one socket per select() wakeup, so a busy socket cannot starve the others. */
+#define UDP_SOCKET_RX_BATCH 16
+#define UDP_SOCKET_CMD_QUEUE_LEN 4
+
+typedef enum {
+    UDP_CMD_BIND,
+    UDP_CMD_SEND,
+    UDP_CMD_CLOSE,
+} udp_cmd_type_t;
+
+typedef struct {
+    udp_cmd_type_t type;
+    bool is_server;
+    int local_port; /* UDP_CMD_BIND: port to bind, -1 for none. UDP_CMD_SEND: port to send from, -1 for the first
+                       socket. UDP_CMD_CLOSE: port to close, -1 for all. */
+    size_t rx_buf_size;
+    struct ifreq ifr;
+    SEND_MESSAGE messagesend;
+} udp_cmd_t;
+
+static UDP_SOCKET s_udp_sockets[UDP_SOCKET_MAX];
+static QueueHandle_t s_udp_cmd_queue = NULL;
+static TaskHandle_t s_udp_io_handle = NULL;
+static _lock_t s_udp_socket_lock;
+static bool s_udp_server_open = false;
+
+static UDP_SOCKET *udp_socket_find(bool is_server, int local_port)
+{
+    for (int i = 0; i < UDP_SOCKET_MAX; i++) {
+        UDP_SOCKET *udp_sock = &s_udp_sockets[i];
+        if (udp_sock->in_use && udp_sock->is_server == is_server &&
+            (local_port == -1 || udp_sock->local_port == local_port)) {
+            return udp_sock;
+        }
+    }
+    return NULL;
+}
 
-static void udp_server_receive_task(void *pvParameters)
+/* For the CLI. The I/O task owns the table and reads it without the lock, other tasks take it. */
+static bool udp_socket_exists(bool is_server, int local_port)
 {
-    char rx_buffer[128];
-    int len = 0;
-    char addr_str[128];
-    int port = 0;
+    _lock_acquire(&s_udp_socket_lock);
+    bool exists = udp_socket_find(is_server, local_port) != NULL;
+    _lock_release(&s_udp_socket_lock);
+    return exists;
+}
+
+static int udp_socket_count(void)
+{
+    int count = 0;
+    for (int i = 0; i < UDP_SOCKET_MAX; i++) {
+        count += s_udp_sockets[i].in_use ? 1 : 0;
+    }
+    return count;
+}
+
+static bool udp_socket_log_allowed(UDP_SOCKET *udp_sock)
+{
+    uint32_t now = xTaskGetTickCount();
+
+    if (now - udp_sock->log_window_start >= pdMS_TO_TICKS(1000)) {
+        if (udp_sock->log_window_count > UDP_SOCKET_LOG_RATE) {
+            ESP_LOGW(OT_EXT_CLI_TAG, "sock %d: %" PRIu32 " receive events not logged", udp_sock->sock,
+                     udp_sock->log_window_count - UDP_SOCKET_LOG_RATE);
+        }
+        udp_sock->log_window_start = now;
+        udp_sock->log_window_count = 0;
+    }
+    udp_sock->log_window_count++;
+    if (udp_sock->log_window_count <= UDP_SOCKET_LOG_RATE) {
+        return true;
+    }
+    _lock_acquire(&s_udp_socket_lock);
+    udp_sock->stats.log_suppressed++;
+    _lock_release(&s_udp_socket_lock);
+    return false;
+}
+
+static void udp_socket_drain(UDP_SOCKET *udp_sock)
+{
+    char addr_str[48];
     struct sockaddr_storage source_addr;
-    UDP_SERVER *udp_server_member = (UDP_SERVER *)pvParameters;
 
-    while (true) {
+    for (int i = 0; i < UDP_SOCKET_RX_BATCH; i++) {
         socklen_t socklen = sizeof(source_addr);
-        len = recvfrom(udp_server_member->sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr,
-                       &socklen);
+        // Read one byte more than the configured size: if it is filled the datagram did not fit.
+        int len = recvfrom(udp_sock->sock, udp_sock->rx_buffer, udp_sock->rx_buf_size + 1, MSG_DONTWAIT,
+                           (struct sockaddr *)&source_addr, &socklen);
         if (len < 0) {
-            ESP_LOGW(OT_EXT_CLI_TAG, "UDP server fail when receiving message");
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            _lock_acquire(&s_udp_socket_lock);
+            udp_sock->stats.rx_errors++;
+            _lock_release(&s_udp_socket_lock);
+            if (udp_socket_log_allowed(udp_sock)) {
+                ESP_LOGW(OT_EXT_CLI_TAG, "sock %d fail when receiving message: errno %d", udp_sock->sock, errno);
+            }
+            break;
         }
-        if (len > 0) {
-            inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
-            port = ntohs(((struct sockaddr_in6 *)&source_addr)->sin6_port);
-            ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %d bytes from %s : %d", udp_server_member->sock, len, addr_str,
-                     port);
-            rx_buffer[len] = '\0';
-            ESP_LOGI(OT_EXT_CLI_TAG, "%s", rx_buffer);
+        bool truncated = (size_t)len > udp_sock->rx_buf_size;
+        if (truncated) {
+            len = udp_sock->rx_buf_size;
         }
-        if (udp_server_member->exist == 0) {
-            break;
+        inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
+        int port = ntohs(((struct sockaddr_in6 *)&source_addr)->sin6_port);
+
+        _lock_acquire(&s_udp_socket_lock);
+        udp_sock->stats.rx_packets++;
+        udp_sock->stats.rx_bytes += len;
+        udp_sock->stats.rx_truncated += truncated ? 1 : 0;
+        if (len > udp_sock->stats.rx_max_len) {
+            udp_sock->stats.rx_max_len = len;
+        }
+        strlcpy(udp_sock->stats.last_ipaddr, addr_str, sizeof(udp_sock->stats.last_ipaddr));
+        udp_sock->stats.last_port = port;
+        _lock_release(&s_udp_socket_lock);
+
+        if (udp_socket_log_allowed(udp_sock)) {
+            ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %d bytes from %s : %d%s", udp_sock->sock, len, addr_str, port,
+                     truncated ? " (truncated)" : "");
+            udp_sock->rx_buffer[len] = '\0';
+            ESP_LOGI(OT_EXT_CLI_TAG, "%s", udp_sock->rx_buffer);
         }
     }
-    ESP_LOGI(OT_EXT_CLI_TAG, "UDP server receive task exiting");
-    vTaskDelete(NULL);
 }
 
-static void udp_server_bind(UDP_SERVER *udp_server_member)
+static void udp_socket_open(const udp_cmd_t *cmd)
 {
     esp_err_t ret = ESP_OK;
     int err = 0;
     int sock = -1;
-    int err_flag = 0;
+    char *rx_buffer = NULL;
+    UDP_SOCKET *udp_sock = NULL;
+    const char *role = cmd->is_server ? "server" : "client";
+    struct sockaddr_in6 bind_addr = {0};
 
-    struct sockaddr_in6 listen_addr = {0};
+    // The CLI checks this too, but a second open can be queued before the first one is applied.
+    ESP_GOTO_ON_FALSE(udp_socket_find(cmd->is_server, cmd->is_server ? cmd->local_port : -1) == NULL,
+                      ESP_ERR_INVALID_STATE, exit, OT_EXT_CLI_TAG, "UDP %s exists", role);
+    for (int i = 0; i < UDP_SOCKET_MAX && udp_sock == NULL; i++) {
+        if (!s_udp_sockets[i].in_use) {
+            udp_sock = &s_udp_sockets[i];
+        }
+    }
+    ESP_GOTO_ON_FALSE(udp_sock != NULL, ESP_ERR_NO_MEM, exit, OT_EXT_CLI_TAG, "All %d UDP sockets are in use",
+                      UDP_SOCKET_MAX);
 
-    inet6_aton(udp_server_member->local_ipaddr, &listen_addr.sin6_addr);
-    inet6_ntoa_r((&listen_addr)->sin6_addr, udp_server_member->local_ipaddr,
-                 sizeof(udp_server_member->local_ipaddr) - 1);
-    listen_addr.sin6_family = AF_INET6;
-    listen_addr.sin6_port = htons(udp_server_member->local_port);
+    // One extra byte to detect truncation and one for the string terminator used when logging.
+    rx_buffer = malloc(cmd->rx_buf_size + 2);
+    ESP_GOTO_ON_FALSE(rx_buffer != NULL, ESP_ERR_NO_MEM, exit, OT_EXT_CLI_TAG,
+                      "Unable to allocate a %u byte receive buffer", (unsigned)cmd->rx_buf_size);
 
-    sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+    sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
     ESP_GOTO_ON_FALSE((sock >= 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Unable to create socket: errno %d", errno);
     ESP_LOGI(OT_EXT_CLI_TAG, "Socket created");
-    udp_server_member->sock = sock;
-    err_flag = 1;
 
-    err = bind(sock, (struct sockaddr *)&listen_addr, sizeof(struct sockaddr_in6));
-    ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Socket unable to bind: errno %d, IPPROTO: %d", errno,
-                      AF_INET6);
-    ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, ipaddr %s, port %d", udp_server_member->local_ipaddr,
-             udp_server_member->local_port);
+    if (cmd->local_port != -1) {
+        inet6_aton("::", &bind_addr.sin6_addr);
+        bind_addr.sin6_family = AF_INET6;
+        bind_addr.sin6_port = htons(cmd->local_port);
 
-    if (pdPASS != xTaskCreate(udp_server_receive_task, "udp_server_receive", 4096, udp_server_member, 4, NULL)) {
-        err = -1;
+        err = bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr));
+        ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Socket unable to bind: errno %d", errno);
+        ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, ipaddr ::, port %d", cmd->local_port);
     }
-    ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "The UDP server is unable to receive: errno %d",
-                      errno);
+
+    _lock_acquire(&s_udp_socket_lock);
+    memset(udp_sock, 0, sizeof(*udp_sock));
+    udp_sock->is_server = cmd->is_server;
+    udp_sock->sock = sock;
+    udp_sock->local_port = cmd->local_port;
+    udp_sock->rx_buf_size = cmd->rx_buf_size;
+    udp_sock->rx_buffer = rx_buffer;
+    udp_sock->log_window_start = xTaskGetTickCount();
+    udp_sock->stats.last_port = -1;
+    udp_sock->in_use = true;
+    _lock_release(&s_udp_socket_lock);
+    ESP_LOGI(OT_EXT_CLI_TAG, "Successfully created, receive buffer %u bytes", (unsigned)cmd->rx_buf_size);
 
 exit:
     if (ret != ESP_OK) {
-        if (err_flag) {
+        if (sock >= 0) {
             shutdown(sock, 0);
             close(sock);
-            udp_server_member->sock = -1;
         }
-        ESP_LOGI(OT_EXT_CLI_TAG, "Fail to create a UDP server");
-    } else {
-        ESP_LOGI(OT_EXT_CLI_TAG, "Successfully created");
-        udp_server_member->exist = 1;
+        free(rx_buffer);
+        ESP_LOGI(OT_EXT_CLI_TAG, "Fail to create a UDP %s", role);
     }
 }
 
-static void udp_server_send(UDP_SERVER *udp_server_member)
+static void udp_socket_send(const udp_cmd_t *cmd)
 {
     struct sockaddr_in6 dest_addr = {0};
+    struct ifreq ifr = cmd->ifr;
     int len = 0;
+    UDP_SOCKET *udp_sock = udp_socket_find(cmd->is_server, cmd->local_port);
 
-    inet6_aton(udp_server_member->messagesend.ipaddr, &dest_addr.sin6_addr);
+    ESP_RETURN_ON_FALSE(udp_sock != NULL, , OT_EXT_CLI_TAG, "No UDP %s to send from",
+                        cmd->is_server ? "server" : "client");
+    inet6_aton(cmd->messagesend.ipaddr, &dest_addr.sin6_addr);
     dest_addr.sin6_family = AF_INET6;
-    dest_addr.sin6_port = htons(udp_server_member->messagesend.port);
-    ESP_LOGI(OT_EXT_CLI_TAG, "Sending to %s : %d", udp_server_member->messagesend.ipaddr,
-             udp_server_member->messagesend.port);
+    dest_addr.sin6_port = htons(cmd->messagesend.port);
+    ESP_LOGI(OT_EXT_CLI_TAG, "Sending to %s : %d", cmd->messagesend.ipaddr, cmd->messagesend.port);
 
-    esp_err_t err = socket_bind_interface(udp_server_member->sock, &(udp_server_member->ifr));
+    esp_err_t err = socket_bind_interface(udp_sock->sock, &ifr);
     ESP_RETURN_ON_FALSE(err == ESP_OK, , OT_EXT_CLI_TAG, "Stop sending message");
-    len = sendto(udp_server_member->sock, udp_server_member->messagesend.message,
-                 strlen(udp_server_member->messagesend.message), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    len = sendto(udp_sock->sock, cmd->messagesend.message, strlen(cmd->messagesend.message), 0,
+                 (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    ESP_OT_BUF_DIAG_RECORD(ESP_OT_BUF_CLASS_SOCKET, len >= 0 || (errno != ENOBUFS && errno != ENOMEM));
+    _lock_acquire(&s_udp_socket_lock);
+    if (len < 0) {
+        udp_sock->stats.tx_errors++;
+    } else {
+        udp_sock->stats.tx_packets++;
+    }
+    _lock_release(&s_udp_socket_lock);
     if (len < 0) {
         ESP_LOGW(OT_EXT_CLI_TAG, "Fail to send message");
     }
 }
 
-static void udp_server_delete(UDP_SERVER *udp_server_member)
+static void udp_socket_close(UDP_SOCKET *udp_sock)
 {
-    udp_server_member->exist = 0;
-    shutdown(udp_server_member->sock, 0);
-    close(udp_server_member->sock);
-    udp_server_member->sock = -1;
+    int sock = udp_sock->sock;
+    bool is_server = udp_sock->is_server;
+    char *rx_buffer = udp_sock->rx_buffer;
+
+    _lock_acquire(&s_udp_socket_lock);
+    udp_sock->in_use = false;
+    udp_sock->sock = -1;
+    udp_sock->rx_buffer = NULL;
+    _lock_release(&s_udp_socket_lock);
+    shutdown(sock, 0);
+    close(sock);
+    free(rx_buffer);
+    ESP_LOGI(OT_EXT_CLI_TAG, "Closed UDP %s successfully", is_server ? "server" : "client");
 }
 
-static void udp_socket_server_task(void *pvParameters)
+static void udp_socket_handle_cmd(const udp_cmd_t *cmd)
+{
+    UDP_SOCKET *udp_sock = NULL;
+
+    switch (cmd->type) {
+    case UDP_CMD_BIND:
+        udp_socket_open(cmd);
+        break;
+    case UDP_CMD_SEND:
+        udp_socket_send(cmd);
+        break;
+    case UDP_CMD_CLOSE:
+        while ((udp_sock = udp_socket_find(cmd->is_server, cmd->local_port)) != NULL) {
+            udp_socket_close(udp_sock);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * A single task serves every UDP server and client socket: it applies the commands queued by the CLI and
+ * multiplexes the sockets with select(), so adding a socket costs a receive buffer instead of a task.
+ * Only this task creates, reads and closes the sockets; the lock just guards the table against the CLI readers.
+ */
+static void udp_socket_io_task(void *pvParameters)
 {
-    UDP_SERVER *udp_server_member = (UDP_SERVER *)pvParameters;
+    udp_cmd_t cmd;
+    fd_set read_set;
+    struct timeval timeout;
 
     while (true) {
-        int bits = xEventGroupWaitBits(udp_server_event_group,
-                                       UDP_SERVER_BIND_BIT | UDP_SERVER_SEND_BIT | UDP_SERVER_CLOSE_BIT, pdFALSE,
-                                       pdFALSE, 10000 / portTICK_PERIOD_MS);
-        int udp_event = bits & 0x0f;
-        if (udp_event == UDP_SERVER_BIND_BIT) {
-            xEventGroupClearBits(udp_server_event_group, UDP_SERVER_BIND_BIT);
-            udp_server_bind(udp_server_member);
-        } else if (udp_event == UDP_SERVER_SEND_BIT) {
-            xEventGroupClearBits(udp_server_event_group, UDP_SERVER_SEND_BIT);
-            udp_server_send(udp_server_member);
-        } else if (udp_event == UDP_SERVER_CLOSE_BIT) {
-            xEventGroupClearBits(udp_server_event_group, UDP_SERVER_CLOSE_BIT);
-            udp_server_delete(udp_server_member);
-            break;
+        TickType_t wait = udp_socket_count() > 0 ? 0 : portMAX_DELAY;
+        while (xQueueReceive(s_udp_cmd_queue, &cmd, wait) == pdTRUE) {
+            udp_socket_handle_cmd(&cmd);
+            wait = 0;
+        }
+
+        int max_fd = -1;
+        FD_ZERO(&read_set);
+        for (int i = 0; i < UDP_SOCKET_MAX; i++) {
+            if (s_udp_sockets[i].in_use) {
+                FD_SET(s_udp_sockets[i].sock, &read_set);
+                max_fd = s_udp_sockets[i].sock > max_fd ? s_udp_sockets[i].sock : max_fd;
+            }
+        }
+        if (max_fd < 0) {
+            continue;
+        }
+
+        timeout.tv_sec = 0;
+        timeout.tv_usec = UDP_SOCKET_POLL_MS * 1000;
+        int ready = select(max_fd + 1, &read_set, NULL, NULL, &timeout);
+        if (ready < 0) {
+            ESP_LOGW(OT_EXT_CLI_TAG, "UDP socket select failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(UDP_SOCKET_POLL_MS));
+            continue;
+        }
+        for (int i = 0; i < UDP_SOCKET_MAX && ready > 0; i++) {
+            if (s_udp_sockets[i].in_use && FD_ISSET(s_udp_sockets[i].sock, &read_set)) {
+                udp_socket_drain(&s_udp_sockets[i]);
+                ready--;
+            }
         }
     }
-    ESP_LOGI(OT_EXT_CLI_TAG, "Closed UDP server successfully");
-    vEventGroupDelete(udp_server_event_group);
-    vTaskDelete(NULL);
 }
 
-otError esp_ot_process_udp_server(void *aContext, uint8_t aArgsLength, char *aArgs[])
+static esp_err_t udp_socket_io_start(void)
+{
+    if (s_udp_io_handle != NULL) {
+        return ESP_OK;
+    }
+    s_udp_cmd_queue = xQueueCreate(UDP_SOCKET_CMD_QUEUE_LEN, sizeof(udp_cmd_t));
+    ESP_RETURN_ON_FALSE(s_udp_cmd_queue != NULL, ESP_ERR_NO_MEM, OT_EXT_CLI_TAG, "Fail to create UDP command queue");
+    if (pdPASS != xTaskCreate(udp_socket_io_task, "udp_socket_io", 4096, NULL, 4, &s_udp_io_handle)) {
+        s_udp_io_handle = NULL;
+        vQueueDelete(s_udp_cmd_queue);
+        s_udp_cmd_queue = NULL;
+        ESP_LOGE(OT_EXT_CLI_TAG, "Fail to create UDP socket task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static otError udp_socket_post(const udp_cmd_t *cmd)
+{
+    if (xQueueSend(s_udp_cmd_queue, cmd, 0) != pdTRUE) {
+        otCliOutputFormat("UDP socket task is busy, try again\n");
+        return OT_ERROR_BUSY;
+    }
+    return OT_ERROR_NONE;
+}
+
+static bool udp_socket_parse_rx_buf_size(const char *arg, size_t *rx_buf_size)
+{
+    char *end = NULL;
+    long size = strtol(arg, &end, 10);
+
+    if (end == arg || *end != '\0' || size < UDP_SOCKET_RX_BUFFER_MIN || size > UDP_SOCKET_RX_BUFFER_MAX) {
+        ESP_LOGE(OT_EXT_CLI_TAG, "Invalid receive buffer size, range %d - %d", UDP_SOCKET_RX_BUFFER_MIN,
+                 UDP_SOCKET_RX_BUFFER_MAX);
+        return false;
+    }
+    *rx_buf_size = (size_t)size;
+    return true;
+}
+
+static otError udp_socket_post_send(bool is_server, int local_port, uint8_t aArgsLength, char *aArgs[])
 {
-    static TaskHandle_t udp_server_handle = NULL;
-    static UDP_SERVER udp_server_member = {0, -1, -1, "", {""}, {-1, "", ""}};
+    udp_cmd_t cmd = {.type = UDP_CMD_SEND, .is_server = is_server, .local_port = local_port};
+
+    strncpy(cmd.messagesend.ipaddr, aArgs[1], sizeof(cmd.messagesend.ipaddr) - 1);
+    cmd.messagesend.port = atoi(aArgs[2]);
+    strncpy(cmd.messagesend.message, aArgs[3], sizeof(cmd.messagesend.message) - 1);
+    if (aArgsLength == 5 && socket_get_netif_impl_name(aArgs[4], &cmd.ifr) != ESP_OK) {
+        otCliOutputFormat("invalid commands\n");
+        return OT_ERROR_INVALID_ARGS;
+    }
+    return udp_socket_post(&cmd);
+}
+
+static void udp_socket_print_stats(bool is_server)
+{
+    bool found = false;
+
+    for (int i = 0; i < UDP_SOCKET_MAX; i++) {
+        UDP_SOCKET snapshot;
+        _lock_acquire(&s_udp_socket_lock);
+        snapshot = s_udp_sockets[i];
+        _lock_release(&s_udp_socket_lock);
+        if (!snapshot.in_use || snapshot.is_server != is_server) {
+            continue;
+        }
+        found = true;
+        otCliOutputFormat("sock %d\tlocal port: %d\treceive buffer: %u bytes\n", snapshot.sock, snapshot.local_port,
+                          (unsigned)snapshot.rx_buf_size);
+        otCliOutputFormat("  rx: %" PRIu32 " packets, %" PRIu64 " bytes, max %d bytes, %" PRIu32 " truncated, %" PRIu32
+                          " errors\n",
+                          snapshot.stats.rx_packets, snapshot.stats.rx_bytes, snapshot.stats.rx_max_len,
+                          snapshot.stats.rx_truncated, snapshot.stats.rx_errors);
+        otCliOutputFormat("  tx: %" PRIu32 " packets, %" PRIu32 " errors\n", snapshot.stats.tx_packets,
+                          snapshot.stats.tx_errors);
+        otCliOutputFormat("  log suppressed: %" PRIu32 "\n", snapshot.stats.log_suppressed);
+        if (snapshot.stats.last_port != -1) {
+            otCliOutputFormat("  last peer: %s : %d\n", snapshot.stats.last_ipaddr, snapshot.stats.last_port);
+        }
+    }
+    if (!found) {
+        otCliOutputFormat("No UDP %s socket\n", is_server ? "server" : "client");
+    }
+}
 
+otError esp_ot_process_udp_server(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
     if (aArgsLength == 0) {
         otCliOutputFormat("---udpsockserver parameter---\n");
         otCliOutputFormat("status                                   :     get UDP server status\n");
         otCliOutputFormat("open                                     :     open UDP server function\n");
         otCliOutputFormat("bind <port>                              :     create a UDP server with binding the port\n");
+        otCliOutputFormat("bind <port> <rxbuf>                      :     create a UDP server with a <rxbuf> byte "
+                          "receive buffer\n");
         otCliOutputFormat("send <ipaddr> <port> <message>           :     send a message to the UDP client\n");
         otCliOutputFormat("send <ipaddr> <port> <message> <if>      :     send a message to the UDP client via <if>\n");
+        otCliOutputFormat("send -l <lport> <ipaddr> <port> <message>:     send from the UDP server bound to <lport>, "
+                          "the first one otherwise\n");
+        otCliOutputFormat("stats                                    :     show receive statistics of UDP servers\n");
         otCliOutputFormat("close                                    :     close UDP server\n");
+        otCliOutputFormat("close <port>                             :     close the UDP server bound to <port>\n");
         otCliOutputFormat("---example---\n");
         otCliOutputFormat("get UDP server status                    :     udpsockserver status\n");
         otCliOutputFormat("open UDP server function                 :     udpsockserver open\n");
         otCliOutputFormat("create a UDP server                      :     udpsockserver bind 12345\n");
+        otCliOutputFormat("create a UDP server with a large buffer  :     udpsockserver bind 12346 1280\n");
         otCliOutputFormat("send a message                           :     udpsockserver send "
                           "FDDE:AD00:BEEF:CAFE:FD14:30B6:CDA:8A95 51876 hello\n");
         otCliOutputFormat("send a message via Wi-Fi interface       :     udpsockserver send "
                           "FDDE:AD00:BEEF:CAFE:FD14:30B6:CDA:8A95 51876 hello st\n");
         otCliOutputFormat("send a message via OpenThread interface  :     udpsockserver send "
                           "FDDE:AD00:BEEF:CAFE:FD14:30B6:CDA:8A95 51876 hello ot\n");
+        otCliOutputFormat("send a message from port 12346           :     udpsockserver send -l 12346 "
+                          "FDDE:AD00:BEEF:CAFE:FD14:30B6:CDA:8A95 51876 hello\n");
+        otCliOutputFormat("show receive statistics                  :     udpsockserver stats\n");
         otCliOutputFormat("close UDP server                         :     udpsockserver close\n");
     } else if (strcmp(aArgs[0], "status") == 0) {
-        if (udp_server_handle == NULL) {
+        if (!s_udp_server_open) {
             otCliOutputFormat("UDP server is not open\n");
             return OT_ERROR_NONE;
         }
-        if (udp_server_member.exist == 0) {
+        bool bound = false;
+        _lock_acquire(&s_udp_socket_lock);
+        for (int i = 0; i < UDP_SOCKET_MAX; i++) {
+            if (s_udp_sockets[i].in_use && s_udp_sockets[i].is_server) {
+                bound = true;
+                otCliOutputFormat("open\tlocal ipaddr: ::\tlocal port: %d\n", s_udp_sockets[i].local_port);
+            }
+        }
+        _lock_release(&s_udp_socket_lock);
+        if (!bound) {
             otCliOutputFormat("UDP server is not binded!\n");
-            return OT_ERROR_NONE;
         }
-        otCliOutputFormat("open\tlocal ipaddr: %s\tlocal port: %d\n", udp_server_member.local_ipaddr,
-                          udp_server_member.local_port);
     } else if (strcmp(aArgs[0], "open") == 0) {
-        if (udp_server_handle == NULL) {
-            udp_server_event_group = xEventGroupCreate();
-            ESP_RETURN_ON_FALSE(udp_server_event_group != NULL, OT_ERROR_FAILED, OT_EXT_CLI_TAG,
+        if (!s_udp_server_open) {
+            ESP_RETURN_ON_FALSE(udp_socket_io_start() == ESP_OK, OT_ERROR_FAILED, OT_EXT_CLI_TAG,
                                 "Fail to open udp server");
-            if (pdPASS !=
-                xTaskCreate(udp_socket_server_task, "udp_socket_server", 4096, &udp_server_member, 4,
-                            &udp_server_handle)) {
-                udp_server_handle = NULL;
-                vEventGroupDelete(udp_server_event_group);
-                udp_server_event_group = NULL;
-                ESP_LOGE(OT_EXT_CLI_TAG, "Fail to open udp server");
-                return OT_ERROR_FAILED;
-            }
+            s_udp_server_open = true;
         } else {
             otCliOutputFormat("Already!\n");
         }
     } else if (strcmp(aArgs[0], "bind") == 0) {
-        if (udp_server_handle == NULL) {
+        udp_cmd_t cmd = {.type = UDP_CMD_BIND, .is_server = true, .rx_buf_size = UDP_SOCKET_RX_BUFFER_SIZE};
+        if (!s_udp_server_open) {
             otCliOutputFormat("UDP server is not open.\n");
             return OT_ERROR_NONE;
         }
-        if (udp_server_member.exist == 1) {
+        if (aArgsLength != 2 && aArgsLength != 3) {
+            ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        cmd.local_port = atoi(aArgs[1]);
+        if (udp_socket_exists(true, cmd.local_port)) {
             otCliOutputFormat("UDP server exists.\n");
             return OT_ERROR_NONE;
         }
-        if (aArgsLength != 2) {
-            ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+        if (aArgsLength == 3 && !udp_socket_parse_rx_buf_size(aArgs[2], &cmd.rx_buf_size)) {
             return OT_ERROR_INVALID_ARGS;
         }
-        strncpy(udp_server_member.local_ipaddr, "::", sizeof(udp_server_member.local_ipaddr));
-        udp_server_member.local_port = atoi(aArgs[1]);
-        xEventGroupSetBits(udp_server_event_group, UDP_SERVER_BIND_BIT);
+        return udp_socket_post(&cmd);
     } else if (strcmp(aArgs[0], "send") == 0) {
-        if (udp_server_handle == NULL) {
+        int local_port = -1;
+        if (!s_udp_server_open) {
             otCliOutputFormat("UDP server is not open.\n");
             return OT_ERROR_NONE;
         }
-        if (udp_server_member.exist == 0) {
-            otCliOutputFormat("UDP server is not binded!\n");
+        if (aArgsLength > 2 && strcmp(aArgs[1], "-l") == 0) {
+            local_port = atoi(aArgs[2]);
+            aArgs += 2;
+            aArgsLength -= 2;
+        }
+        if (!udp_socket_exists(true, local_port)) {
+            otCliOutputFormat(local_port == -1 ? "UDP server is not binded!\n" : "No UDP server on that port!\n");
             return OT_ERROR_NONE;
         }
         if (aArgsLength != 4 && aArgsLength != 5) {
             ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
             return OT_ERROR_INVALID_ARGS;
         }
-        strncpy(udp_server_member.messagesend.ipaddr, aArgs[1], sizeof(udp_server_member.messagesend.ipaddr));
-        udp_server_member.messagesend.port = atoi(aArgs[2]);
-        strncpy(udp_server_member.messagesend.message, aArgs[3], sizeof(udp_server_member.messagesend.message));
-        strcpy(udp_server_member.ifr.ifr_name, "");
-        if (aArgsLength == 5 && socket_get_netif_impl_name(aArgs[4], &(udp_server_member.ifr)) != ESP_OK) {
-            otCliOutputFormat("invalid commands\n");
-            return OT_ERROR_INVALID_ARGS;
-        }
-        xEventGroupSetBits(udp_server_event_group, UDP_SERVER_SEND_BIT);
+        return udp_socket_post_send(true, local_port, aArgsLength, aArgs);
+    } else if (strcmp(aArgs[0], "stats") == 0) {
+        udp_socket_print_stats(true);
     } else if (strcmp(aArgs[0], "close") == 0) {
-        if (udp_server_handle == NULL) {
+        udp_cmd_t cmd = {.type = UDP_CMD_CLOSE, .is_server = true, .local_port = -1};
+        if (!s_udp_server_open) {
             otCliOutputFormat("UDP server is not open.\n");
             return OT_ERROR_NONE;
         }
-        xEventGroupSetBits(udp_server_event_group, UDP_SERVER_CLOSE_BIT);
-        udp_server_handle = NULL;
+        if (aArgsLength == 2) {
+            cmd.local_port = atoi(aArgs[1]);
+        } else {
+            s_udp_server_open = false;
+        }
+        return udp_socket_post(&cmd);
     } else {
         otCliOutputFormat("invalid commands\n");
     }
     return OT_ERROR_NONE;
 }
 
-static void udp_client_receive_task(void *pvParameters)
-{
-    char rx_buffer[128];
-    int len = 0;
-    char addr_str[128];
-    int port = 0;
-    struct sockaddr_storage source_addr;
-    UDP_CLIENT *udp_client_member = (UDP_CLIENT *)pvParameters;
-
-    while (true) {
-        socklen_t socklen = sizeof(source_addr);
-        len = recvfrom(udp_client_member->sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr,
-                       &socklen);
-        if (len < 0) {
-            ESP_LOGW(OT_EXT_CLI_TAG, "UDP client fail when receiving message");
-        }
-        if (len > 0) {
-            inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
-            port = ntohs(((struct sockaddr_in6 *)&source_addr)->sin6_port);
-            ESP_LOGI(OT_EXT_CLI_TAG, "sock %d Received %d bytes from %s : %d", udp_client_member->sock, len, addr_str,
-                     port);
-            rx_buffer[len] = '\0';
-            ESP_LOGI(OT_EXT_CLI_TAG, "%s", rx_buffer);
-        }
-        if (udp_client_member->exist == 0) {
-            break;
-        }
-    }
-    ESP_LOGI(OT_EXT_CLI_TAG, "UDP client receive task exiting");
-    vTaskDelete(NULL);
-}
-
-static void udp_client_send(UDP_CLIENT *udp_client_member)
-{
-    struct sockaddr_in6 dest_addr = {0};
-    int len = 0;
-
-    inet6_aton(udp_client_member->messagesend.ipaddr, &dest_addr.sin6_addr);
-    dest_addr.sin6_family = AF_INET6;
-    dest_addr.sin6_port = htons(udp_client_member->messagesend.port);
-    ESP_LOGI(OT_EXT_CLI_TAG, "Sending to %s : %d", udp_client_member->messagesend.ipaddr,
-             udp_client_member->messagesend.port);
-    esp_err_t err = socket_bind_interface(udp_client_member->sock, &(udp_client_member->ifr));
-    ESP_RETURN_ON_FALSE(err == ESP_OK, , OT_EXT_CLI_TAG, "Stop sending message");
-    len = sendto(udp_client_member->sock, udp_client_member->messagesend.message,
-                 strlen(udp_client_member->messagesend.message), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    if (len < 0) {
-        ESP_LOGW(OT_EXT_CLI_TAG, "Fail to send message");
-    }
-}
-
-static void udp_client_delete(UDP_CLIENT *udp_client_member)
-{
-    udp_client_member->exist = 0;
-    shutdown(udp_client_member->sock, 0);
-    close(udp_client_member->sock);
-    udp_client_member->sock = -1;
-    udp_client_member->local_port = -1;
-}
-
-static void udp_socket_client_task(void *pvParameters)
-{
-    UDP_CLIENT *udp_client_member = (UDP_CLIENT *)pvParameters;
-
-    esp_err_t ret = ESP_OK;
-    int err = 0;
-    int sock = -1;
-    int err_flag = 0;
-    struct sockaddr_in6 bind_addr = {0};
-
-    sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
-    ESP_GOTO_ON_FALSE((sock >= 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Unable to create socket: errno %d", errno);
-    ESP_LOGI(OT_EXT_CLI_TAG, "Socket created");
-    udp_client_member->sock = sock;
-    err_flag = 1;
-
-    if (udp_client_member->local_port != -1) {
-        inet6_aton(udp_client_member->local_ipaddr, &bind_addr.sin6_addr);
-        inet6_ntoa_r((&bind_addr)->sin6_addr, udp_client_member->local_ipaddr,
-                     sizeof(udp_client_member->local_ipaddr) - 1);
-        bind_addr.sin6_family = AF_INET6;
-        bind_addr.sin6_port = htons(udp_client_member->local_port);
-
-        err = bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr));
-        ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Socket unable to bind: errno %d", errno);
-        ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, port %d", udp_client_member->local_port);
-    }
-
-    if (pdPASS != xTaskCreate(udp_client_receive_task, "udp_client_receive", 4096, udp_client_member, 4, NULL)) {
-        err = -1;
-    }
-    ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "The UDP client is unable to receive: errno %d",
-                      errno);
-    udp_client_member->exist = 1;
-    ESP_LOGI(OT_EXT_CLI_TAG, "Successfully created");
-
-    while (true) {
-        int bits = xEventGroupWaitBits(udp_client_event_group, UDP_CLIENT_SEND_BIT | UDP_CLIENT_CLOSE_BIT, pdFALSE,
-                                       pdFALSE, 10000 / portTICK_PERIOD_MS);
-        int udp_event = bits & 0x0f;
-        if (udp_event == UDP_CLIENT_SEND_BIT) {
-            xEventGroupClearBits(udp_client_event_group, UDP_CLIENT_SEND_BIT);
-            udp_client_send(udp_client_member);
-        } else if (udp_event == UDP_CLIENT_CLOSE_BIT) {
-            xEventGroupClearBits(udp_client_event_group, UDP_CLIENT_CLOSE_BIT);
-            udp_client_delete(udp_client_member);
-            break;
-        }
-    }
-    ESP_LOGI(OT_EXT_CLI_TAG, "Closed UDP client successfully");
-
-exit:
-    if (ret != ESP_OK) {
-        if (err_flag) {
-            udp_client_member->sock = -1;
-            shutdown(sock, 0);
-            close(sock);
-        }
-        udp_client_member->local_port = -1;
-        ESP_LOGI(OT_EXT_CLI_TAG, "Fail to create a UDP client");
-    }
-    vEventGroupDelete(udp_client_event_group);
-    vTaskDelete(NULL);
-}
-
 otError esp_ot_process_udp_client(void *aContext, uint8_t aArgsLength, char *aArgs[])
 {
-    static TaskHandle_t udp_client_handle = NULL;
-    static UDP_CLIENT udp_client_member = {0, -1, -1, "::", {""}, {-1, "", ""}};
-
     if (aArgsLength == 0) {
         otCliOutputFormat("---udpsockclient parameter---\n");
         otCliOutputFormat("status                                   :     get UDP client status\n");
         otCliOutputFormat("open <port>                              :     open UDP client function, create a UDP "
                           "client and bind a local port(optional)\n");
+        otCliOutputFormat("open <port> <rxbuf>                      :     open UDP client function with a <rxbuf> "
+                          "byte receive buffer, port 0 for no binding\n");
         otCliOutputFormat("send <ipaddr> <port> <message>           :     send a message to the UDP server\n");
         otCliOutputFormat("send <ipaddr> <port> <message> <if>      :     send a message to the UDP server via <if>\n");
+        otCliOutputFormat("stats                                    :     show receive statistics of UDP client\n");
         otCliOutputFormat("close                                    :     close UDP client\n");
         otCliOutputFormat("---example---\n");
         otCliOutputFormat("get UDP client status                    :     udpsockclient status\n");
@@ -411,92 +561,72 @@ otError esp_ot_process_udp_client(void *aContext, uint8_t aArgsLength, char *aAr
                           "FDDE:AD00:BEEF:CAFE:FD14:30B6:CDA:8A95 51876 hello st\n");
         otCliOutputFormat("send a message via OpenThread interface  :     udpsockclient send "
                           "FDDE:AD00:BEEF:CAFE:FD14:30B6:CDA:8A95 51876 hello ot\n");
+        otCliOutputFormat("show receive statistics                  :     udpsockclient stats\n");
         otCliOutputFormat("close UDP client                         :     udpsockclient close\n");
     } else if (strcmp(aArgs[0], "status") == 0) {
-        if (udp_client_handle == NULL) {
+        // The client is open once the I/O task has created its socket, an open that failed leaves none.
+        bool open = false;
+        int local_port = -1;
+        _lock_acquire(&s_udp_socket_lock);
+        UDP_SOCKET *udp_sock = udp_socket_find(false, -1);
+        if (udp_sock != NULL) {
+            open = true;
+            local_port = udp_sock->local_port;
+        }
+        _lock_release(&s_udp_socket_lock);
+        if (!open) {
             otCliOutputFormat("UDP client is not open\n");
-            return OT_ERROR_NONE;
-        }
-        if (udp_client_member.local_port != -1) {
-            otCliOutputFormat("open\tlocal port: %d\n", udp_client_member.local_port);
+        } else if (local_port != -1) {
+            otCliOutputFormat("open\tlocal port: %d\n", local_port);
         } else {
             otCliOutputFormat("open\tnot binded manually\n");
         }
-
     } else if (strcmp(aArgs[0], "open") == 0) {
-        if (aArgsLength != 1 && aArgsLength != 2) {
+        udp_cmd_t cmd = {
+            .type = UDP_CMD_BIND, .is_server = false, .local_port = -1, .rx_buf_size = UDP_SOCKET_RX_BUFFER_SIZE};
+        if (aArgsLength < 1 || aArgsLength > 3) {
             ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
             return OT_ERROR_INVALID_ARGS;
         }
-        if (udp_client_handle == NULL) {
-            if (aArgsLength == 2) {
-                udp_client_member.local_port = atoi(aArgs[1]);
-            }
-            udp_client_event_group = xEventGroupCreate();
-            ESP_RETURN_ON_FALSE(udp_client_event_group != NULL, OT_ERROR_FAILED, OT_EXT_CLI_TAG,
-                                "Fail to open udp client");
-            if (pdPASS !=
-                xTaskCreate(udp_socket_client_task, "udp_socket_client", 4096, &udp_client_member, 4,
-                            &udp_client_handle)) {
-                udp_client_handle = NULL;
-                udp_client_member.local_port = -1;
-                vEventGroupDelete(udp_client_event_group);
-                udp_client_event_group = NULL;
-                ESP_LOGE(OT_EXT_CLI_TAG, "Fail to open udp client");
-                return OT_ERROR_FAILED;
-            }
-        } else {
+        if (udp_socket_exists(false, -1)) {
             otCliOutputFormat("Already!\n");
-        }
-
-    } else if (strcmp(aArgs[0], "bind") == 0) {
-        if (udp_client_handle == NULL) {
-            otCliOutputFormat("UDP client is not open.\n");
             return OT_ERROR_NONE;
         }
-        if (udp_client_member.exist == 1) {
-            otCliOutputFormat("UDP client exists.\n");
-            return OT_ERROR_NONE;
+        if (aArgsLength >= 2 && atoi(aArgs[1]) != 0) {
+            cmd.local_port = atoi(aArgs[1]);
         }
-        if (aArgsLength != 2) {
-            ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
+        if (aArgsLength == 3 && !udp_socket_parse_rx_buf_size(aArgs[2], &cmd.rx_buf_size)) {
             return OT_ERROR_INVALID_ARGS;
         }
-
+        ESP_RETURN_ON_FALSE(udp_socket_io_start() == ESP_OK, OT_ERROR_FAILED, OT_EXT_CLI_TAG,
+                            "Fail to open udp client");
+        ESP_RETURN_ON_FALSE(udp_socket_post(&cmd) == OT_ERROR_NONE, OT_ERROR_BUSY, OT_EXT_CLI_TAG,
+                            "Fail to open udp client");
     } else if (strcmp(aArgs[0], "send") == 0) {
-        if (udp_client_handle == NULL) {
+        if (!udp_socket_exists(false, -1)) {
             otCliOutputFormat("UDP client is not open.\n");
             return OT_ERROR_NONE;
         }
-        if (udp_client_member.exist == 0) {
-            otCliOutputFormat("UDP client is not binded!\n");
-            return OT_ERROR_NONE;
-        }
         if (aArgsLength != 4 && aArgsLength != 5) {
             ESP_LOGE(OT_EXT_CLI_TAG, "Invalid arguments.");
             return OT_ERROR_INVALID_ARGS;
         }
-        strncpy(udp_client_member.messagesend.ipaddr, aArgs[1], sizeof(udp_client_member.messagesend.ipaddr));
-        udp_client_member.messagesend.port = atoi(aArgs[2]);
-        strncpy(udp_client_member.messagesend.message, aArgs[3], sizeof(udp_client_member.messagesend.message));
-        strcpy(udp_client_member.ifr.ifr_name, "");
-        if (aArgsLength == 5 && socket_get_netif_impl_name(aArgs[4], &(udp_client_member.ifr)) != ESP_OK) {
-            otCliOutputFormat("invalid commands\n");
-            return OT_ERROR_INVALID_ARGS;
-        }
-        xEventGroupSetBits(udp_client_event_group, UDP_CLIENT_SEND_BIT);
+        return udp_socket_post_send(false, -1, aArgsLength, aArgs);
+    } else if (strcmp(aArgs[0], "stats") == 0) {
+        udp_socket_print_stats(false);
     } else if (strcmp(aArgs[0], "close") == 0) {
-        if (udp_client_handle == NULL) {
+        udp_cmd_t cmd = {.type = UDP_CMD_CLOSE, .is_server = false, .local_port = -1};
+        if (!udp_socket_exists(false, -1)) {
             otCliOutputFormat("UDP client is not open.\n");
             return OT_ERROR_NONE;
         }
-        xEventGroupSetBits(udp_client_event_group, UDP_CLIENT_CLOSE_BIT);
-        udp_client_handle = NULL;
+        return udp_socket_post(&cmd);
     } else {
         otCliOutputFormat("invalid commands\n");
     }
     return OT_ERROR_NONE;
 }
+
 esp_err_t join_ip6_mcast(void *ctx)
 {
     ip6_addr_t *group = ctx;
@@ -0,0 +1,143 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Linux front end of the iperf engine. The options follow the OpenThread CLI `iperf` command:
+ *
+ *   iperf_host -s [-u] [-V] [-p port] [-i interval] [-t time] [-J]
+ *   iperf_host -c addr [-u] [-V] [-p port] [-i interval] [-t time] [-l len] [-b bw[K|M]] [-P streams]
+ *              [-R | --bidir] [-J] [-f M|K]
+ *
+ * The exit status is non-zero when the run moved no data, so CI scripts can gate on it.
+ */
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "iperf.h"
+
+static uint64_t s_total_bytes;
+
+static void iperf_host_report(const iperf_report_t *report)
+{
+    if (report->final && report->stream_id != IPERF_REPORT_SUM) {
+        __atomic_add_fetch(&s_total_bytes, report->bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static uint32_t iperf_host_parse_bandwidth(const char *arg)
+{
+    char *end = NULL;
+    double value = strtod(arg, &end);
+
+    if (end == arg) {
+        return 0;
+    }
+    if (*end == 'K' || *end == 'k') {
+        value *= 1000;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value *= 1000000;
+        end++;
+    }
+    return (*end == '\0' && value > 0 && value <= UINT32_MAX) ? (uint32_t)value : 0;
+}
+
+static void iperf_host_usage(const char *name)
+{
+    fprintf(stderr, "usage: %s -s|-c <addr> [-u] [-V] [-p port] [-i interval] [-t time] [-l len]\n"
+            "       [-b bw[K|M]] [-P streams] [-R|--bidir] [-J] [-f M|K]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    iperf_cfg_t cfg;
+    const char *dest = NULL;
+    uint16_t port = IPERF_DEFAULT_PORT;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    memset(&cfg, 0, sizeof(cfg));
+    IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_TCP);
+    IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_SERVER);
+    cfg.time = IPERF_DEFAULT_TIME;
+    cfg.type = IPERF_IP_TYPE_IPV4;
+    cfg.format = MBITS_PER_SEC;
+    cfg.bw_lim = IPERF_DEFAULT_NO_BW_LIMIT;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-s") == 0) {
+            IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_SERVER);
+            IPERF_FLAG_CLR(cfg.flag, IPERF_FLAG_CLIENT);
+        } else if (strcmp(arg, "-c") == 0 && value) {
+            IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_CLIENT);
+            IPERF_FLAG_CLR(cfg.flag, IPERF_FLAG_SERVER);
+            dest = value;
+            i++;
+        } else if (strcmp(arg, "-u") == 0) {
+            IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_UDP);
+            IPERF_FLAG_CLR(cfg.flag, IPERF_FLAG_TCP);
+        } else if (strcmp(arg, "-V") == 0) {
+            cfg.type = IPERF_IP_TYPE_IPV6;
+        } else if (strcmp(arg, "-p") == 0 && value) {
+            port = atoi(value);
+            i++;
+        } else if (strcmp(arg, "-i") == 0 && value) {
+            cfg.interval_ms = (uint32_t)(atof(value) * 1000 + 0.5);
+            cfg.interval = cfg.interval_ms / 1000;
+            i++;
+        } else if (strcmp(arg, "-t") == 0 && value) {
+            cfg.time = atoi(value);
+            i++;
+        } else if (strcmp(arg, "-l") == 0 && value) {
+            cfg.len_send_buf = atoi(value);
+            i++;
+        } else if (strcmp(arg, "-b") == 0 && value) {
+            cfg.bw_lim_bps = iperf_host_parse_bandwidth(value);
+            i++;
+        } else if (strcmp(arg, "-P") == 0 && value) {
+            cfg.num_streams = atoi(value);
+            i++;
+        } else if (strcmp(arg, "-R") == 0) {
+            IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_REVERSE);
+        } else if (strcmp(arg, "--bidir") == 0) {
+            IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_BIDIR);
+        } else if (strcmp(arg, "-J") == 0) {
+            IPERF_FLAG_SET(cfg.flag, IPERF_FLAG_JSON);
+        } else if (strcmp(arg, "-f") == 0 && value) {
+            cfg.format = (strcmp(value, "K") == 0) ? KBITS_PER_SEC : MBITS_PER_SEC;
+            i++;
+        } else {
+            iperf_host_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (cfg.flag & IPERF_FLAG_CLIENT) {
+        cfg.sport = IPERF_DEFAULT_PORT;
+        cfg.dport = port;
+        if (cfg.type == IPERF_IP_TYPE_IPV6) {
+            cfg.destination_ip6 = (char *)dest;
+        } else {
+            cfg.destination_ip4 = inet_addr(dest);
+        }
+    } else {
+        cfg.sport = port;
+        cfg.dport = IPERF_DEFAULT_PORT;
+    }
+
+    iperf_register_report_func(iperf_host_report);
+    if (iperf_start(&cfg) != ESP_OK) {
+        return 1;
+    }
+    while (g_iperf_is_running) {
+        usleep(100 * 1000);
+    }
+    return s_total_bytes > 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Linux reference receiver for iperf UDP traffic, built on the same batched receive
+ * engine as the device servers. Every shard owns a SO_REUSEPORT socket and a thread,
+ * the kernel hashes each client flow onto one shard.
+ *
+ *   iperf_rx_ref [-6] [-p port] [-P shards] [-i interval] [-t time] [-B batch]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "iperf_rx.h"
+
+#define RX_REF_MAX_SHARDS 16
+#define RX_REF_BUFFER_LEN 65536
+
+typedef struct {
+    int id;
+    int sock;
+    pthread_t thread;
+    uint8_t buffer[RX_REF_BUFFER_LEN];
+    /* updated by the shard thread, sampled by the main thread */
+    uint64_t bytes;
+    uint64_t packets;
+    int64_t lost;
+    uint64_t out_of_order;
+    /* owned by the shard thread */
+    int64_t max_seq;
+} rx_ref_shard_t;
+
+static rx_ref_shard_t s_shards[RX_REF_MAX_SHARDS];
+static volatile int s_finish;
+static int s_batch_reads = 64;
+
+static void rx_ref_account(void *ctx, const uint8_t *buffer, int len, const struct sockaddr_storage *from, socklen_t from_len)
+{
+    rx_ref_shard_t *shard = (rx_ref_shard_t *)ctx;
+    int32_t seq;
+
+    (void)from;
+    (void)from_len;
+    if (len < (int)sizeof(seq)) {
+        return;
+    }
+    memcpy(&seq, buffer, sizeof(seq));
+    seq = (int32_t)ntohl(seq);
+    if (seq < 0) {
+        return;
+    }
+    if (seq > shard->max_seq) {
+        __atomic_add_fetch(&shard->lost, seq - shard->max_seq - 1, __ATOMIC_RELAXED);
+        shard->max_seq = seq;
+    } else {
+        __atomic_add_fetch(&shard->out_of_order, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&shard->lost, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *rx_ref_shard_task(void *arg)
+{
+    rx_ref_shard_t *shard = (rx_ref_shard_t *)arg;
+    iperf_rx_batch_t batch;
+
+    while (!s_finish) {
+        if (iperf_rx_drain(shard->sock, shard->buffer, sizeof(shard->buffer), s_batch_reads, true,
+                           rx_ref_account, shard, &batch) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recvfrom");
+                break;
+            }
+            continue;
+        }
+        __atomic_add_fetch(&shard->bytes, batch.bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shard->packets, batch.reads, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static int rx_ref_open(int ipv6, uint16_t port)
+{
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_len;
+    struct timeval timeout = { .tv_sec = 1 };
+    int opt = 1;
+    int sock = socket(ipv6 ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (sock < 0) {
+        return -1;
+    }
+    if (ipv6) {
+        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&addr;
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_addr = in6addr_any;
+        addr6->sin6_port = htons(port);
+        addr_len = sizeof(*addr6);
+    } else {
+        struct sockaddr_in *addr4 = (struct sockaddr_in *)&addr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_addr.s_addr = htonl(INADDR_ANY);
+        addr4->sin_port = htons(port);
+        addr_len = sizeof(*addr4);
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(sock, (struct sockaddr *)&addr, addr_len) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void rx_ref_show(const char *prefix, double start, double end, uint64_t bytes, uint64_t packets, int64_t lost, uint64_t ooo)
+{
+    int64_t expected = (int64_t)packets + lost;
+
+    printf("%s%6.2f-%6.2f sec  %10.2f Kbits/sec  %8" PRIu64 " pkts  lost %" PRIi64 "/%" PRIi64 " (%.2f%%)  ooo %" PRIu64 "\n",
+           prefix, start, end, (end > start) ? bytes * 8 / 1000.0 / (end - start) : 0.0, packets, lost, expected,
+           expected > 0 ? lost * 100.0 / expected : 0.0, ooo);
+}
+
+static double rx_ref_now(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ipv6 = 0;
+    uint16_t port = 5001;
+    int num_shards = 1;
+    double interval = 1;
+    double time = 30;
+    uint64_t last_bytes[RX_REF_MAX_SHARDS] = { 0 };
+    uint64_t last_packets[RX_REF_MAX_SHARDS] = { 0 };
+    int64_t last_lost[RX_REF_MAX_SHARDS] = { 0 };
+    uint64_t last_ooo[RX_REF_MAX_SHARDS] = { 0 };
+    double start;
+    double cur = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "6p:P:i:t:B:")) != -1) {
+        switch (opt) {
+        case '6':
+            ipv6 = 1;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'P':
+            num_shards = atoi(optarg);
+            break;
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 't':
+            time = atof(optarg);
+            break;
+        case 'B':
+            s_batch_reads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-6] [-p port] [-P shards] [-i interval] [-t time] [-B batch]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_shards < 1 || num_shards > RX_REF_MAX_SHARDS || interval <= 0 || s_batch_reads < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    for (int i = 0; i < num_shards; i++) {
+        s_shards[i].id = i;
+        s_shards[i].max_seq = -1;
+        s_shards[i].sock = rx_ref_open(ipv6, port);
+        if (s_shards[i].sock < 0) {
+            perror("socket");
+            return 1;
+        }
+    }
+    for (int i = 0; i < num_shards; i++) {
+        pthread_create(&s_shards[i].thread, NULL, rx_ref_shard_task, &s_shards[i]);
+    }
+    printf("listening on udp port %d, %d shard(s), batch %d\n", port, num_shards, s_batch_reads);
+
+    start = rx_ref_now();
+    while (cur < time) {
+        uint64_t sum_bytes = 0, sum_packets = 0, sum_ooo = 0;
+        int64_t sum_lost = 0;
+        double next = start + cur + interval;
+
+        while (rx_ref_now() < next) {
+            usleep(1000);
+        }
+        for (int i = 0; i < num_shards; i++) {
+            rx_ref_shard_t *shard = &s_shards[i];
+            uint64_t bytes = __atomic_load_n(&shard->bytes, __ATOMIC_RELAXED);
+            uint64_t packets = __atomic_load_n(&shard->packets, __ATOMIC_RELAXED);
+            int64_t lost = __atomic_load_n(&shard->lost, __ATOMIC_RELAXED);
+            uint64_t ooo = __atomic_load_n(&shard->out_of_order, __ATOMIC_RELAXED);
+            char prefix[8];
+
+            if (num_shards > 1) {
+                snprintf(prefix, sizeof(prefix), "[%3d] ", i);
+                rx_ref_show(prefix, cur, cur + interval, bytes - last_bytes[i], packets - last_packets[i],
+                            lost - last_lost[i], ooo - last_ooo[i]);
+            }
+            sum_bytes += bytes - last_bytes[i];
+            sum_packets += packets - last_packets[i];
+            sum_lost += lost - last_lost[i];
+            sum_ooo += ooo - last_ooo[i];
+            last_bytes[i] = bytes;
+            last_packets[i] = packets;
+            last_lost[i] = lost;
+            last_ooo[i] = ooo;
+        }
+        rx_ref_show(num_shards > 1 ? "[SUM] " : "", cur, cur + interval, sum_bytes, sum_packets, sum_lost, sum_ooo);
+        cur += interval;
+    }
+
+    s_finish = 1;
+    for (int i = 0; i < num_shards; i++) {
+        pthread_join(s_shards[i].thread, NULL);
+        close(s_shards[i].sock);
+    }
+    {
+        uint64_t bytes = 0, packets = 0, ooo = 0;
+        int64_t lost = 0;
+
+        for (int i = 0; i < num_shards; i++) {
+            bytes += s_shards[i].bytes;
+            packets += s_shards[i].packets;
+            lost += s_shards[i].lost;
+            ooo += s_shards[i].out_of_order;
+        }
+        rx_ref_show(num_shards > 1 ? "[SUM] " : "", 0, cur, bytes, packets, lost, ooo);
+    }
+    return 0;
+}
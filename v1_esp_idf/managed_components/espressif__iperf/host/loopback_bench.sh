@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# Loopback throughput/latency runs of the host iperf engine for CI. Every run prints JSON lines
+# (one object per interval plus a summary) and fails when no data moved.
+#
+#   host/loopback_bench.sh [build_dir] [time]
+set -euo pipefail
+
+BUILD_DIR=${1:-build/host}
+TIME=${2:-5}
+IPERF="$BUILD_DIR/iperf_host"
+PORT=15001
+
+run() {
+    local name=$1 server_args=$2 client_args=$3
+    PORT=$((PORT + 10))
+    echo "### $name"
+    "$IPERF" -s -p "$PORT" -t "$TIME" -i 1 -J $server_args > "$BUILD_DIR/$name.server.jsonl" 2>/dev/null &
+    local server=$!
+    sleep 0.5
+    "$IPERF" -c 127.0.0.1 -p "$PORT" -t "$TIME" -i 1 -J $client_args | tee "$BUILD_DIR/$name.client.jsonl"
+    wait "$server" || true
+    grep '"summary"' "$BUILD_DIR/$name.server.jsonl" || true
+}
+
+run tcp "" ""
+run tcp_parallel "-P 4" "-P 4"
+run udp_20k "-u" "-u -l 81 -b 20K"
+run udp_1m "-u" "-u -l 500 -b 1M"
+run udp_bidir "-u" "-u -l 500 -b 1M --bidir"
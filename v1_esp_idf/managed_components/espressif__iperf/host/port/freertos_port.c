@@ -0,0 +1,330 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/* pthread implementation of the FreeRTOS and esp_timer subset used by iperf.c */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "lwip_compat.h"
+
+struct port_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+struct esp_timer {
+    pthread_t thread;
+    esp_timer_cb_t callback;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int64_t deadline_us;
+    bool armed;
+    bool quit;
+};
+
+static __thread struct port_task *s_current_task;
+
+static struct timespec port_abstime(int64_t us)
+{
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+    return ts;
+}
+
+static struct port_task *port_task_new(TaskFunction_t fn, void *arg)
+{
+    struct port_task *task = calloc(1, sizeof(*task));
+    pthread_condattr_t attr;
+
+    if (!task) {
+        return NULL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return task;
+}
+
+static void port_task_free(struct port_task *task)
+{
+    pthread_mutex_destroy(&task->lock);
+    pthread_cond_destroy(&task->cond);
+    free(task);
+}
+
+static void *port_task_entry(void *arg)
+{
+    struct port_task *task = (struct port_task *)arg;
+
+    s_current_task = task;
+    task->fn(task->arg);
+    // FreeRTOS tasks must not return, treat it like vTaskDelete(NULL)
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    struct port_task *task = port_task_new(fn, arg);
+
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+    (void)core_id;
+    if (!task) {
+        return pdFAIL;
+    }
+    if (pthread_create(&task->thread, NULL, port_task_entry, task) != 0) {
+        port_task_free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (created_task) {
+        *created_task = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != s_current_task) {
+        fprintf(stderr, "vTaskDelete: only self deletion is supported on the host\n");
+        abort();
+    }
+    if (s_current_task) {
+        port_task_free(s_current_task);
+        s_current_task = NULL;
+    }
+    pthread_exit(NULL);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = port_abstime((int64_t)ticks * 1000);
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake_time, TickType_t time_increment)
+{
+    TickType_t target = *previous_wake_time + time_increment;
+    TickType_t now = xTaskGetTickCount();
+
+    if ((int32_t)(target - now) > 0) {
+        vTaskDelay(target - now);
+    }
+    *previous_wake_time = target;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    // Threads not created through the port, like main(), get their notification state lazily
+    if (!s_current_task) {
+        s_current_task = port_task_new(NULL, NULL);
+        s_current_task->thread = pthread_self();
+    }
+    return s_current_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    struct port_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    uint32_t value;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline = port_abstime(deadline.tv_sec * 1000000LL + deadline.tv_nsec / 1000 + (int64_t)ticks_to_wait * 1000);
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0) {
+        if (ticks_to_wait == portMAX_DELAY) {
+            pthread_cond_wait(&task->cond, &task->lock);
+        } else if (pthread_cond_timedwait(&task->cond, &task->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    value = task->notify;
+    if (value) {
+        task->notify = clear_count_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static void *port_timer_entry(void *arg)
+{
+    struct esp_timer *timer = (struct esp_timer *)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&timer->lock);
+    while (!timer->quit) {
+        if (!timer->armed) {
+            pthread_cond_wait(&timer->cond, &timer->lock);
+            continue;
+        }
+        deadline = port_abstime(timer->deadline_us);
+        if (pthread_cond_timedwait(&timer->cond, &timer->lock, &deadline) == ETIMEDOUT && timer->armed
+                && esp_timer_get_time() >= timer->deadline_us) {
+            timer->armed = false;
+            pthread_mutex_unlock(&timer->lock);
+            timer->callback(timer->arg);
+            pthread_mutex_lock(&timer->lock);
+        }
+    }
+    pthread_mutex_unlock(&timer->lock);
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    struct esp_timer *timer;
+    pthread_condattr_t attr;
+
+    if (!create_args || !create_args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    timer = calloc(1, sizeof(*timer));
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&timer->thread, NULL, port_timer_entry, timer) != 0) {
+        free(timer);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    esp_err_t ret = ESP_OK;
+
+    pthread_mutex_lock(&timer->lock);
+    if (timer->armed) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->deadline_us = esp_timer_get_time() + timeout_us;
+        timer->armed = true;
+        pthread_cond_signal(&timer->cond);
+    }
+    pthread_mutex_unlock(&timer->lock);
+    return ret;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    esp_err_t ret = ESP_OK;
+
+    pthread_mutex_lock(&timer->lock);
+    if (!timer->armed) {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+    return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timer->lock);
+    timer->quit = true;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+    pthread_join(timer->thread, NULL);
+    pthread_mutex_destroy(&timer->lock);
+    pthread_cond_destroy(&timer->cond);
+    free(timer);
+    return ESP_OK;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    default:
+        return "ERROR";
+    }
+}
+
+char *iperf_port_inet6_ntoa(const struct in6_addr *addr)
+{
+    static __thread char buf[INET6_ADDRSTRLEN];
+
+    return (char *)inet_ntop(AF_INET6, addr, buf, sizeof(buf));
+}
+
+size_t iperf_port_strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
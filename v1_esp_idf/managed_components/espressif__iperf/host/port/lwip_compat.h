@@ -0,0 +1,31 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * lwIP socket extensions used by iperf.c, mapped onto glibc. Force included by the host build
+ * in place of lwip/sockets.h.
+ */
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define inet6_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET6, &(addr), (buf), (buflen))
+#define inet6_ntoa(addr) iperf_port_inet6_ntoa(&(addr))
+
+#define strlcpy iperf_port_strlcpy
+
+static inline int inet6_aton(const char *cp, struct in6_addr *addr)
+{
+    return inet_pton(AF_INET6, cp, addr) == 1;
+}
+
+char *iperf_port_inet6_ntoa(const struct in6_addr *addr);
+size_t iperf_port_strlcpy(char *dst, const char *src, size_t size);
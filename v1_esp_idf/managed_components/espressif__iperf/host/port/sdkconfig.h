@@ -0,0 +1,21 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/* Kconfig defaults of the iperf component for the Linux host build */
+#pragma once
+
+#define CONFIG_IPERF_SOCKET_RX_TIMEOUT 10
+#define CONFIG_IPERF_SOCKET_TCP_TX_TIMEOUT 10
+#define CONFIG_IPERF_TRAFFIC_TASK_PRIORITY 4
+#define CONFIG_IPERF_REPORT_TASK_PRIORITY 6
+#define CONFIG_IPERF_MAX_STREAMS 4
+#define CONFIG_IPERF_PACING_BURST_PKTS 4
+#define CONFIG_IPERF_RX_BATCH_READS 64
+#define CONFIG_IPERF_DEF_TCP_TX_BUFFER_LEN 16384
+#define CONFIG_IPERF_DEF_TCP_RX_BUFFER_LEN 16384
+#define CONFIG_IPERF_DEF_IPV4_UDP_TX_BUFFER_LEN 1470
+#define CONFIG_IPERF_DEF_IPV6_UDP_TX_BUFFER_LEN 1450
+#define CONFIG_IPERF_DEF_UDP_RX_BUFFER_LEN 16384
+#define CONFIG_FREERTOS_NUMBER_OF_CORES 2
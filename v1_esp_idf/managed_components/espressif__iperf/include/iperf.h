@@ -41,6 +41,9 @@ extern "C" {
 #define IPERF_FLAG_SERVER (1 << 1)
 #define IPERF_FLAG_TCP (1 << 2)
 #define IPERF_FLAG_UDP (1 << 3)
+#define IPERF_FLAG_JSON (1 << 4)
+#define IPERF_FLAG_REVERSE (1 << 5)
+#define IPERF_FLAG_BIDIR (1 << 6)
 
 #define IPERF_DEFAULT_PORT 5001
 #define IPERF_DEFAULT_INTERVAL 3
@@ -62,6 +65,12 @@ extern "C" {
 #define IPERF_DEFAULT_TCP_RX_LEN        CONFIG_IPERF_DEF_TCP_RX_BUFFER_LEN
 
 #define IPERF_MAX_DELAY 64
+#define IPERF_MAX_STREAMS CONFIG_IPERF_MAX_STREAMS
+#define IPERF_PACING_BURST_PKTS CONFIG_IPERF_PACING_BURST_PKTS
+#define IPERF_RX_BATCH_READS CONFIG_IPERF_RX_BATCH_READS
+#define IPERF_PACING_HIST_BUCKETS 8
+#define IPERF_LATENCY_HIST_BUCKETS 96
+#define IPERF_REPORT_SUM 0xFF
 
 #define IPERF_SOCKET_RX_TIMEOUT CONFIG_IPERF_SOCKET_RX_TIMEOUT
 #define IPERF_SOCKET_TCP_TX_TIMEOUT CONFIG_IPERF_SOCKET_TCP_TX_TIMEOUT
@@ -96,6 +105,9 @@ typedef struct {
     uint32_t time;         /**< total send time in secs */
     uint16_t len_send_buf; /**< send buffer length in bytes */
     int32_t bw_lim;        /**< bandwidth limit in Mbits/s */
+    uint32_t bw_lim_bps;   /**< bandwidth limit in bits/s, takes precedence over bw_lim when non-zero */
+    uint8_t num_streams;   /**< number of parallel streams (iperf -P), 0 or 1 runs a single stream */
+    uint32_t interval_ms;  /**< report interval in ms, takes precedence over interval when non-zero */
 } iperf_cfg_t;
 
 /**
@@ -136,6 +148,30 @@ esp_err_t iperf_start(iperf_cfg_t *cfg);
 esp_err_t iperf_stop(void);
 
 
+/**
+ * @brief Iperf report of one interval, or of the whole test when final is set
+ */
+typedef struct {
+    iperf_traffic_type_t type; /**< traffic type of the session */
+    uint8_t stream_id;         /**< stream index, IPERF_REPORT_SUM for the sum of parallel streams */
+    bool final;                /**< true for the summary printed at the end of the test */
+    int64_t timestamp_us;      /**< esp_timer time when the report was taken */
+    uint32_t start_ms;         /**< interval start, relative to the start of the test */
+    uint32_t end_ms;           /**< interval end, relative to the start of the test */
+    uint64_t bytes;            /**< bytes moved during the interval */
+    uint32_t packets;          /**< datagrams for UDP, successful send/recv calls for TCP */
+    double bandwidth_bps;      /**< bytes over the measured interval duration, in bits/s */
+    bool has_udp_stats;        /**< the fields below are valid, UDP server only */
+    int32_t lost;              /**< datagrams missing from the sequence */
+    uint32_t out_of_order;     /**< datagrams received behind a later one */
+    uint32_t duplicates;       /**< datagrams received more than once */
+    float jitter_ms;           /**< RFC 3550 interarrival jitter */
+    uint32_t latency_count;    /**< datagrams carrying a send timestamp */
+    float latency_avg_ms;      /**< one-way latency, only meaningful with synchronized clocks */
+    float latency_p50_ms;      /**< latency median */
+    float latency_p99_ms;      /**< latency 99th percentile */
+} iperf_report_t;
+
 /* Support hook functions for performance debug */
 typedef void (*iperf_hook_func_t)(iperf_traffic_type_t type, iperf_status_t status);
 extern iperf_hook_func_t iperf_hook_func;
@@ -145,6 +181,14 @@ extern iperf_hook_func_t iperf_hook_func;
  */
 void iperf_register_hook_func(iperf_hook_func_t func);
 
+/* Receives every interval and final report, called from the iperf report task */
+typedef void (*iperf_report_func_t)(const iperf_report_t *report);
+
+/**
+ * @brief Registers a function receiving structured iperf reports, NULL unregisters
+ */
+void iperf_register_report_func(iperf_report_func_t func);
+
 /* TODO: deprecate app_xxx in v0.2, remove them in v1.0 */
 #define app_register_iperf_hook_func iperf_register_hook_func
 
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/param.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
@@ -14,13 +15,11 @@
 #include "iperf_esp_check.h"
 #include "esp_log.h"
 #include "iperf.h"
+#include "iperf_rx.h"
 #include "esp_attr.h"
 
 #include "esp_idf_version.h"
-
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-#include "esp_rom_sys.h"
-#endif
+#include "esp_timer.h"
 
 
 #ifdef CONFIG_FREERTOS_NUMBER_OF_CORES
@@ -32,37 +31,122 @@
 
 #define TAG "iperf"
 
+/* A bidirectional test runs a receiving and a sending session side by side */
+#define IPERF_MAX_SESSIONS 2
+
+/* Reverse and bidirectional tests are negotiated over TCP on the data port + 1 */
+#define IPERF_CTRL_PORT_OFFSET 1
+#define IPERF_CTRL_MAGIC 0x49505243 /* "IPRC" */
+#define IPERF_CTRL_VERSION 1
+#define IPERF_CTRL_REQ_LEN 24
+#define IPERF_CTRL_ACK_LEN 6
+#define IPERF_CTRL_TASK_NAME "iperf_ctrl"
+#define IPERF_CTRL_TASK_STACK 4096
+
+/* Traffic tasks of the streams after the first, IPERF_TRAFFIC_TASK_NAME plus an index
+ * would not fit configMAX_TASK_NAME_LEN */
+#define IPERF_STREAM_TASK_PREFIX "iperf_s"
+
+typedef struct iperf_session iperf_session_t;
+
+/* iperf2 compatible UDP datagram header, all fields in network byte order */
 typedef struct {
-    iperf_cfg_t cfg;
-    bool finish;
-    uint32_t actual_len;
+    int32_t id;       /* sequence number, negative on the final datagram */
+    uint32_t tv_sec;  /* send time */
+    uint32_t tv_usec;
+} iperf_udp_header_t;
+
+/* Receive side statistics of a UDP server over one interval */
+typedef struct {
+    uint32_t packets;       /* datagrams received, duplicates excluded */
+    int32_t lost;           /* sequence gaps, late arrivals are credited back */
+    uint32_t out_of_order;
+    uint32_t duplicates;
+    double jitter_us;       /* RFC 3550 interarrival jitter, highest of all flows */
+    uint32_t lat_count;
+    int64_t lat_sum_us;
+    int64_t lat_min_us;
+    int64_t lat_max_us;
+    uint32_t lat_hist[IPERF_LATENCY_HIST_BUCKETS];
+} iperf_udp_stats_t;
+
+/* Sequence and jitter state of one client stream seen by the UDP server */
+typedef struct {
+    struct sockaddr_storage addr;
+    bool active;
+    int32_t max_seq;
+    uint64_t window;        /* bit i is set once max_seq - i was received */
+    bool has_transit;
+    int64_t prev_transit_us;
+    double jitter_us;
+} iperf_udp_flow_t;
+
+typedef struct {
+    iperf_session_t *session; /* owning session */
+    uint8_t id;               /* stream index inside the session */
+    uint64_t actual_len;      /* bytes moved during the current report interval */
+    uint32_t actual_pkts;     /* datagrams or send/recv calls during the current report interval */
+    uint64_t total_len;       /* bytes moved since the stream started, kept by the report task */
+    uint32_t total_pkts;
     uint32_t buffer_len;
     uint8_t *buffer;
-    uint32_t sockfd;
-} iperf_ctrl_t;
+} iperf_stream_t;
+
+struct iperf_session {
+    iperf_cfg_t cfg;
+    bool in_use;
+    bool finish;
+    bool report_started;
+    uint8_t num_streams;
+    uint8_t running_streams;  /* traffic tasks still moving data */
+    uint8_t refs;             /* traffic tasks plus the report task, the last one cleans up */
+    int listen_socket;        /* TCP server listen socket shared by all streams */
+    int ctrl_socket;          /* servers: listen socket for reverse/bidir requests */
+    const char *tag;          /* report prefix telling the directions of a bidir test apart */
+    char dest_ip6[48];        /* clients: copy of cfg.destination_ip6 */
+    iperf_stream_t streams[IPERF_MAX_STREAMS];
+    iperf_udp_stats_t udp_batch;      /* UDP server statistics of the current receive batch, owned by the rx task */
+    iperf_udp_stats_t udp_interval;   /* UDP server statistics of the current report interval */
+    iperf_udp_stats_t udp_total;      /* UDP server statistics since the first datagram */
+    iperf_udp_flow_t udp_flows[IPERF_MAX_STREAMS];
+};
 
 bool g_iperf_is_running = false;
-DRAM_ATTR static iperf_ctrl_t s_iperf_ctrl;
+DRAM_ATTR static iperf_session_t s_iperf_sessions[IPERF_MAX_SESSIONS];
+static portMUX_TYPE s_iperf_lock = portMUX_INITIALIZER_UNLOCKED;
 iperf_hook_func_t iperf_hook_func = NULL;
+static iperf_report_func_t s_iperf_report_func = NULL;
 
-inline static bool iperf_is_udp_client(void)
+inline static bool iperf_is_udp_client(const iperf_session_t *session)
 {
-    return ((s_iperf_ctrl.cfg.flag & IPERF_FLAG_CLIENT) && (s_iperf_ctrl.cfg.flag & IPERF_FLAG_UDP));
+    return ((session->cfg.flag & IPERF_FLAG_CLIENT) && (session->cfg.flag & IPERF_FLAG_UDP));
 }
 
-inline static bool iperf_is_udp_server(void)
+inline static bool iperf_is_udp_server(const iperf_session_t *session)
 {
-    return ((s_iperf_ctrl.cfg.flag & IPERF_FLAG_SERVER) && (s_iperf_ctrl.cfg.flag & IPERF_FLAG_UDP));
+    return ((session->cfg.flag & IPERF_FLAG_SERVER) && (session->cfg.flag & IPERF_FLAG_UDP));
 }
 
-inline static bool iperf_is_tcp_client(void)
+inline static bool iperf_is_tcp_client(const iperf_session_t *session)
 {
-    return ((s_iperf_ctrl.cfg.flag & IPERF_FLAG_CLIENT) && (s_iperf_ctrl.cfg.flag & IPERF_FLAG_TCP));
+    return ((session->cfg.flag & IPERF_FLAG_CLIENT) && (session->cfg.flag & IPERF_FLAG_TCP));
 }
 
-inline static bool iperf_is_tcp_server(void)
+inline static bool iperf_is_tcp_server(const iperf_session_t *session)
 {
-    return ((s_iperf_ctrl.cfg.flag & IPERF_FLAG_SERVER) && (s_iperf_ctrl.cfg.flag & IPERF_FLAG_TCP));
+    return ((session->cfg.flag & IPERF_FLAG_SERVER) && (session->cfg.flag & IPERF_FLAG_TCP));
+}
+
+static iperf_traffic_type_t iperf_get_traffic_type(const iperf_session_t *session)
+{
+    if (iperf_is_udp_client(session)) {
+        return IPERF_UDP_CLIENT;
+    } else if (iperf_is_udp_server(session)) {
+        return IPERF_UDP_SERVER;
+    } else if (iperf_is_tcp_client(session)) {
+        return IPERF_TCP_CLIENT;
+    }
+    return IPERF_TCP_SERVER;
 }
 
 inline static int iperf_get_socket_error_code(int sockfd)
@@ -80,111 +164,692 @@ static int iperf_show_socket_error_reason(const char *str, int sockfd)
     return err;
 }
 
+static void iperf_close_socket(int *sock)
+{
+    int listen_socket;
+
+    portENTER_CRITICAL(&s_iperf_lock);
+    listen_socket = *sock;
+    *sock = -1;
+    portEXIT_CRITICAL(&s_iperf_lock);
+
+    if (listen_socket != -1) {
+        shutdown(listen_socket, 0);
+        close(listen_socket);
+        ESP_LOGD(TAG, "TCP listen socket is closed.");
+    }
+}
+
+static void iperf_close_listen_socket(iperf_session_t *session)
+{
+    iperf_close_socket(&session->listen_socket);
+    iperf_close_socket(&session->ctrl_socket);
+}
+
+static iperf_session_t *iperf_session_alloc(void)
+{
+    iperf_session_t *session = NULL;
+
+    portENTER_CRITICAL(&s_iperf_lock);
+    for (int i = 0; i < IPERF_MAX_SESSIONS; i++) {
+        if (!s_iperf_sessions[i].in_use) {
+            session = &s_iperf_sessions[i];
+            memset(session, 0, sizeof(*session));
+            session->in_use = true;
+            break;
+        }
+    }
+    if (session) {
+        g_iperf_is_running = true;
+    }
+    portEXIT_CRITICAL(&s_iperf_lock);
+    return session;
+}
+
+static void iperf_session_free(iperf_session_t *session)
+{
+    bool running = false;
+
+    portENTER_CRITICAL(&s_iperf_lock);
+    session->in_use = false;
+    for (int i = 0; i < IPERF_MAX_SESSIONS; i++) {
+        running |= s_iperf_sessions[i].in_use;
+    }
+    g_iperf_is_running = running;
+    portEXIT_CRITICAL(&s_iperf_lock);
+}
+
+/* Drops one reference to the session, the last holder frees the stream buffers */
+static void iperf_session_release(iperf_session_t *session)
+{
+    bool last;
+
+    portENTER_CRITICAL(&s_iperf_lock);
+    last = (--session->refs == 0);
+    portEXIT_CRITICAL(&s_iperf_lock);
+    if (!last) {
+        return;
+    }
+
+    iperf_close_listen_socket(session);
+    for (int i = 0; i < session->num_streams; i++) {
+        free(session->streams[i].buffer);
+        session->streams[i].buffer = NULL;
+    }
+    if (iperf_hook_func) {
+        iperf_hook_func(iperf_get_traffic_type(session), IPERF_STOPPED);
+    }
+    ESP_LOGI(TAG, "%siperf exit", session->tag);
+    iperf_session_free(session);
+}
+
+/* Marks a stream as done, the session finishes once no stream is moving data */
+static void iperf_stream_done(iperf_stream_t *stream)
+{
+    iperf_session_t *session = stream->session;
+
+    portENTER_CRITICAL(&s_iperf_lock);
+    if (--session->running_streams == 0) {
+        session->finish = true;
+    }
+    portEXIT_CRITICAL(&s_iperf_lock);
+}
+
+/* A 64 bit counter takes two accesses on a 32 bit core, so the traffic tasks add to the interval
+ * counters and the report task takes them under the lock */
+static void iperf_stream_count(iperf_stream_t *stream, uint64_t len, uint32_t pkts)
+{
+    portENTER_CRITICAL(&s_iperf_lock);
+    stream->actual_len += len;
+    stream->actual_pkts += pkts;
+    portEXIT_CRITICAL(&s_iperf_lock);
+}
+
+static double iperf_calc_bps(uint64_t len, int64_t duration_us)
+{
+    return duration_us > 0 ? len * 8 * 1000000.0 / duration_us : 0;
+}
+
+/* Scales bits/s to the unit selected by cfg.format */
+static double iperf_scale_bandwidth(const iperf_session_t *session, double bps)
+{
+    switch (session->cfg.format) {
+    case KBITS_PER_SEC:
+        return bps / 1024.0;
+    case MBITS_PER_SEC:
+        /* pass through */
+    default:
+        return bps / 1024.0 / 1024.0;
+    }
+}
+
+static uint32_t iperf_get_interval_ms(const iperf_cfg_t *cfg)
+{
+    return cfg->interval_ms ? cfg->interval_ms : cfg->interval * 1000;
+}
+
+/*
+ * Log-linear latency histogram: values below 4 us get their own bucket, above
+ * that every power of two is split into 4 buckets, so bucket width stays within
+ * 25% of the value up to 2^24 us.
+ */
+static int iperf_latency_bucket(int64_t us)
+{
+    int msb;
+    int idx;
+
+    if (us < 4) {
+        return us < 0 ? 0 : (int)us;
+    }
+    msb = 63 - __builtin_clzll((uint64_t)us);
+    idx = (msb - 1) * 4 + (int)((us >> (msb - 2)) & 3);
+    return MIN(idx, IPERF_LATENCY_HIST_BUCKETS - 1);
+}
+
+static int64_t iperf_latency_bucket_upper(int idx)
+{
+    int msb;
+
+    if (idx < 4) {
+        return idx;
+    }
+    msb = idx / 4 + 1;
+    return ((int64_t)(4 + idx % 4 + 1) << (msb - 2)) - 1;
+}
+
+static int64_t iperf_latency_percentile(const iperf_udp_stats_t *stats, uint32_t percent)
+{
+    uint32_t target = (stats->lat_count * percent + 99) / 100;
+    uint32_t seen = 0;
+
+    for (int i = 0; i < IPERF_LATENCY_HIST_BUCKETS; i++) {
+        seen += stats->lat_hist[i];
+        if (seen >= target && seen > 0) {
+            return MIN(iperf_latency_bucket_upper(i), stats->lat_max_us);
+        }
+    }
+    return stats->lat_max_us;
+}
+
+static void iperf_udp_stats_merge(iperf_udp_stats_t *total, const iperf_udp_stats_t *interval)
+{
+    total->packets += interval->packets;
+    total->lost += interval->lost;
+    total->out_of_order += interval->out_of_order;
+    total->duplicates += interval->duplicates;
+    if (interval->lat_count) {
+        total->jitter_us = interval->jitter_us;
+        if (total->lat_count == 0 || interval->lat_min_us < total->lat_min_us) {
+            total->lat_min_us = interval->lat_min_us;
+        }
+        if (total->lat_count == 0 || interval->lat_max_us > total->lat_max_us) {
+            total->lat_max_us = interval->lat_max_us;
+        }
+        total->lat_count += interval->lat_count;
+        total->lat_sum_us += interval->lat_sum_us;
+        for (int i = 0; i < IPERF_LATENCY_HIST_BUCKETS; i++) {
+            total->lat_hist[i] += interval->lat_hist[i];
+        }
+    }
+}
+
+static void iperf_udp_stats_show(const iperf_udp_stats_t *stats)
+{
+    int32_t expected = (int32_t)stats->packets + stats->lost;
+
+    printf("  jitter %.3f ms  lost %" PRIi32 "/%" PRIi32 " (%.2f%%)  ooo %" PRIu32 "  dup %" PRIu32,
+           stats->jitter_us / 1000.0, stats->lost, expected,
+           expected > 0 ? stats->lost * 100.0 / expected : 0.0, stats->out_of_order, stats->duplicates);
+    if (stats->lat_count) {
+        printf("  latency avg %.3f min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f ms",
+               stats->lat_sum_us / 1000.0 / stats->lat_count, stats->lat_min_us / 1000.0,
+               iperf_latency_percentile(stats, 50) / 1000.0, iperf_latency_percentile(stats, 90) / 1000.0,
+               iperf_latency_percentile(stats, 99) / 1000.0, stats->lat_max_us / 1000.0);
+    }
+    printf("\n");
+}
+
+static void iperf_report_set_udp_stats(iperf_report_t *report, const iperf_udp_stats_t *stats)
+{
+    report->has_udp_stats = true;
+    report->lost = stats->lost;
+    report->out_of_order = stats->out_of_order;
+    report->duplicates = stats->duplicates;
+    report->jitter_ms = stats->jitter_us / 1000.0;
+    report->latency_count = stats->lat_count;
+    if (stats->lat_count) {
+        report->latency_avg_ms = stats->lat_sum_us / 1000.0 / stats->lat_count;
+        report->latency_p50_ms = iperf_latency_percentile(stats, 50) / 1000.0;
+        report->latency_p99_ms = iperf_latency_percentile(stats, 99) / 1000.0;
+    }
+}
+
+static void iperf_report_json(const iperf_report_t *report)
+{
+    static const char *const type_names[] = { "tcp_server", "tcp_client", "udp_server", "udp_client" };
+    char stream[8];
+
+    if (report->stream_id == IPERF_REPORT_SUM) {
+        strcpy(stream, "\"sum\"");
+    } else {
+        snprintf(stream, sizeof(stream), "%d", report->stream_id);
+    }
+    printf("{\"event\":\"%s\",\"type\":\"%s\",\"stream\":%s,\"time_us\":%" PRIi64 ",\"start\":%.3f,\"end\":%.3f,"
+           "\"bytes\":%" PRIu64 ",\"packets\":%" PRIu32 ",\"bits_per_second\":%.0f",
+           report->final ? "summary" : "interval", type_names[report->type], stream, report->timestamp_us, report->start_ms / 1000.0,
+           report->end_ms / 1000.0, report->bytes, report->packets, report->bandwidth_bps);
+    if (report->has_udp_stats) {
+        printf(",\"jitter_ms\":%.3f,\"lost\":%" PRIi32 ",\"out_of_order\":%" PRIu32 ",\"duplicates\":%" PRIu32,
+               report->jitter_ms, report->lost, report->out_of_order, report->duplicates);
+        if (report->latency_count) {
+            printf(",\"latency_ms\":{\"avg\":%.3f,\"p50\":%.3f,\"p99\":%.3f}",
+                   report->latency_avg_ms, report->latency_p50_ms, report->latency_p99_ms);
+        }
+    }
+    printf("}\n");
+}
+
+/* Hands a report to the registered report function, then prints it as text or a JSON line */
+static void iperf_report_emit(const iperf_session_t *session, const iperf_report_t *report, const iperf_udp_stats_t *udp_stats)
+{
+    char format_ch = (session->cfg.format == KBITS_PER_SEC) ? 'K' : 'M';
+    char prefix[16];
+
+    if (s_iperf_report_func) {
+        s_iperf_report_func(report);
+    }
+    if (session->cfg.flag & IPERF_FLAG_JSON) {
+        iperf_report_json(report);
+        return;
+    }
+
+    if (report->stream_id == IPERF_REPORT_SUM) {
+        snprintf(prefix, sizeof(prefix), "%s[SUM] ", session->tag);
+    } else if (session->num_streams > 1) {
+        snprintf(prefix, sizeof(prefix), "%s[%3d] ", session->tag, report->stream_id);
+    } else {
+        snprintf(prefix, sizeof(prefix), "%s", session->tag);
+    }
+    if (report->start_ms % 1000 == 0 && report->end_ms % 1000 == 0) {
+        printf("%s%2" PRIu32 ".0-%2" PRIu32 ".0 sec", prefix, report->start_ms / 1000, report->end_ms / 1000);
+    } else {
+        printf("%s%5.2f-%5.2f sec", prefix, report->start_ms / 1000.0, report->end_ms / 1000.0);
+    }
+    printf("  %.2f %cbits/sec", iperf_scale_bandwidth(session, report->bandwidth_bps), format_ch);
+    if (udp_stats) {
+        iperf_udp_stats_show(udp_stats);
+    } else {
+        printf("\n");
+    }
+}
+
+static iperf_udp_flow_t *iperf_udp_get_flow(iperf_session_t *session, const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+    iperf_udp_flow_t *free_flow = NULL;
+
+    for (int i = 0; i < IPERF_MAX_STREAMS; i++) {
+        iperf_udp_flow_t *flow = &session->udp_flows[i];
+        if (!flow->active) {
+            free_flow = free_flow ? free_flow : flow;
+        } else if (memcmp(&flow->addr, addr, addr_len) == 0) {
+            return flow;
+        }
+    }
+    if (free_flow) {
+        memset(free_flow, 0, sizeof(*free_flow));
+        memcpy(&free_flow->addr, addr, addr_len);
+    }
+    return free_flow;
+}
+
+/*
+ * Accounts one received datagram into the current batch of the UDP server. The UDP server
+ * runs a single rx task, so the flow table and the batch need no locking here.
+ */
+static void iperf_udp_account(void *ctx, const uint8_t *buffer, int len,
+                              const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+    iperf_session_t *session = (iperf_session_t *)ctx;
+    iperf_udp_header_t hdr;
+    iperf_udp_stats_t *stats = &session->udp_batch;
+    iperf_udp_flow_t *flow;
+    struct timeval now;
+    int64_t transit_us = 0;
+    bool has_ts = len >= (int)sizeof(hdr);
+
+    if (len < (int)sizeof(hdr.id)) {
+        return;
+    }
+    memcpy(&hdr, buffer, MIN(len, (int)sizeof(hdr)));
+    hdr.id = (int32_t)ntohl(hdr.id);
+    if (hdr.id < 0) {
+        // iperf2 marks the end of a stream with negative sequence numbers
+        return;
+    }
+    if (has_ts) {
+        gettimeofday(&now, NULL);
+        transit_us = ((int64_t)now.tv_sec - ntohl(hdr.tv_sec)) * 1000000 + ((int64_t)now.tv_usec - ntohl(hdr.tv_usec));
+    }
+
+    flow = iperf_udp_get_flow(session, addr, addr_len);
+    if (!flow) {
+        return;
+    }
+    if (!flow->active) {
+        flow->active = true;
+        flow->max_seq = hdr.id;
+        flow->window = 1;
+        // datagrams before the first one seen count as lost
+        stats->lost += hdr.id;
+        stats->packets++;
+    } else if (hdr.id > flow->max_seq) {
+        int32_t advance = hdr.id - flow->max_seq;
+        stats->lost += advance - 1;
+        flow->window = (advance >= 64) ? 1 : ((flow->window << advance) | 1);
+        flow->max_seq = hdr.id;
+        stats->packets++;
+    } else {
+        int32_t offset = flow->max_seq - hdr.id;
+        if (offset < 64 && (flow->window & (1ULL << offset))) {
+            stats->duplicates++;
+            return;
+        }
+        if (offset < 64) {
+            flow->window |= 1ULL << offset;
+        }
+        stats->out_of_order++;
+        stats->lost--;
+        stats->packets++;
+    }
+
+    if (has_ts) {
+        if (flow->has_transit) {
+            int64_t d = transit_us - flow->prev_transit_us;
+            flow->jitter_us += ((d < 0 ? -d : d) - flow->jitter_us) / 16.0;
+        }
+        flow->has_transit = true;
+        flow->prev_transit_us = transit_us;
+        if (flow->jitter_us > stats->jitter_us) {
+            stats->jitter_us = flow->jitter_us;
+        }
+        if (stats->lat_count == 0 || transit_us < stats->lat_min_us) {
+            stats->lat_min_us = transit_us;
+        }
+        if (stats->lat_count == 0 || transit_us > stats->lat_max_us) {
+            stats->lat_max_us = transit_us;
+        }
+        stats->lat_count++;
+        stats->lat_sum_us += transit_us;
+        stats->lat_hist[iperf_latency_bucket(transit_us)]++;
+    }
+}
+
+/* Publishes the batch statistics to the report task, one lock round trip per batch */
+static void iperf_udp_flush(iperf_session_t *session)
+{
+    iperf_udp_stats_t *batch = &session->udp_batch;
+
+    if (batch->packets == 0 && batch->duplicates == 0) {
+        return;
+    }
+    portENTER_CRITICAL(&s_iperf_lock);
+    iperf_udp_stats_merge(&session->udp_interval, batch);
+    portEXIT_CRITICAL(&s_iperf_lock);
+    memset(batch, 0, sizeof(*batch));
+}
+
 static void iperf_report_task(void *arg)
 {
-    uint32_t interval = s_iperf_ctrl.cfg.interval;
-    uint32_t time = s_iperf_ctrl.cfg.time;
-    TickType_t delay_interval = (interval * 1000) / portTICK_PERIOD_MS;
+    iperf_session_t *session = (iperf_session_t *)arg;
+    uint32_t interval_ms = iperf_get_interval_ms(&session->cfg);
+    uint32_t time_ms = session->cfg.time * 1000;
+    TickType_t delay_interval = MAX(pdMS_TO_TICKS(interval_ms), 1);
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t start_us = esp_timer_get_time();
+    int64_t last_us = start_us;
+    int64_t now_us;
     uint32_t cur = 0;
-    double average = 0;
-    double actual_bandwidth = 0;
-    int k = 1;
-    char format_ch = 'M';
+    bool parallel = session->num_streams > 1;
+    bool udp_server = iperf_is_udp_server(session);
+    iperf_report_t base = { .type = iperf_get_traffic_type(session) };
+    iperf_report_t report;
+    iperf_report_t sum;
+    iperf_udp_stats_t udp_interval;
 
     /* NOTE: Output is not totally same with linux iperf */
-    printf("\nInterval       Bandwidth\n");
-    while (!s_iperf_ctrl.finish) {
-        vTaskDelay(delay_interval);
-        switch (s_iperf_ctrl.cfg.format) {
-        case KBITS_PER_SEC:
-            actual_bandwidth = (s_iperf_ctrl.actual_len / 1024.0 * 8) / interval;
-            format_ch = 'K';
-            break;
-        case MBITS_PER_SEC:
-            /* pass through */
-        default:
-            actual_bandwidth = (s_iperf_ctrl.actual_len / 1024.0 / 1024.0 * 8) / interval;
-            break;
+    if (!(session->cfg.flag & IPERF_FLAG_JSON)) {
+        printf("\n%s%sInterval       Bandwidth\n", session->tag, parallel ? "[ ID] " : "");
+    }
+    while (!session->finish) {
+        // Wake on a fixed cadence, the bandwidth is computed from the measured time anyway
+        vTaskDelayUntil(&last_wake, delay_interval);
+        now_us = esp_timer_get_time();
+        base.timestamp_us = now_us;
+        base.start_ms = cur;
+        base.end_ms = cur + interval_ms;
+        sum = base;
+        sum.stream_id = parallel ? IPERF_REPORT_SUM : 0;
+        for (int i = 0; i < session->num_streams; i++) {
+            iperf_stream_t *stream = &session->streams[i];
+            portENTER_CRITICAL(&s_iperf_lock);
+            uint64_t len = stream->actual_len;
+            uint32_t pkts = stream->actual_pkts;
+            stream->actual_len = 0;
+            stream->actual_pkts = 0;
+            portEXIT_CRITICAL(&s_iperf_lock);
+            stream->total_len += len;
+            stream->total_pkts += pkts;
+            sum.bytes += len;
+            sum.packets += pkts;
+            if (parallel) {
+                report = base;
+                report.stream_id = i;
+                report.bytes = len;
+                report.packets = pkts;
+                report.bandwidth_bps = iperf_calc_bps(len, now_us - last_us);
+                iperf_report_emit(session, &report, NULL);
+            }
+        }
+        sum.bandwidth_bps = iperf_calc_bps(sum.bytes, now_us - last_us);
+        if (udp_server) {
+            portENTER_CRITICAL(&s_iperf_lock);
+            udp_interval = session->udp_interval;
+            memset(&session->udp_interval, 0, sizeof(session->udp_interval));
+            portEXIT_CRITICAL(&s_iperf_lock);
+            iperf_udp_stats_merge(&session->udp_total, &udp_interval);
+            iperf_report_set_udp_stats(&sum, &udp_interval);
         }
-        printf("%2d.0-%2d.0 sec  %.2f %cbits/sec\n", cur, cur + interval, actual_bandwidth, format_ch);
-        cur += interval;
-        average = ((average * (k - 1) / k) + (actual_bandwidth / k));
-        k++;
-        s_iperf_ctrl.actual_len = 0;
-        if (cur >= time) {
-            printf("%2d.0-%2d.0 sec  %.2f %cbits/sec\n", 0, time, average, format_ch);
+        iperf_report_emit(session, &sum, udp_server ? &udp_interval : NULL);
+        cur += interval_ms;
+        last_us = now_us;
+        if (cur >= time_ms) {
+            base.final = true;
+            base.start_ms = 0;
+            sum.final = true;
+            sum.start_ms = 0;
+            sum.bytes = 0;
+            sum.packets = 0;
+            for (int i = 0; i < session->num_streams; i++) {
+                iperf_stream_t *stream = &session->streams[i];
+                sum.bytes += stream->total_len;
+                sum.packets += stream->total_pkts;
+                if (parallel) {
+                    report = base;
+                    report.stream_id = i;
+                    report.bytes = stream->total_len;
+                    report.packets = stream->total_pkts;
+                    report.bandwidth_bps = iperf_calc_bps(stream->total_len, now_us - start_us);
+                    iperf_report_emit(session, &report, NULL);
+                }
+            }
+            sum.bandwidth_bps = iperf_calc_bps(sum.bytes, now_us - start_us);
+            if (udp_server) {
+                iperf_report_set_udp_stats(&sum, &session->udp_total);
+            }
+            iperf_report_emit(session, &sum, udp_server ? &session->udp_total : NULL);
             break;
         }
     }
 
-    s_iperf_ctrl.finish = true;
+    session->finish = true;
+    iperf_session_release(session);
     vTaskDelete(NULL);
 }
 
-static esp_err_t iperf_start_report(void)
+/* Starts the shared report task once, whichever stream gets traffic first */
+static esp_err_t iperf_start_report(iperf_session_t *session)
 {
     int ret;
 
-    ret = xTaskCreatePinnedToCore(iperf_report_task, IPERF_REPORT_TASK_NAME, IPERF_REPORT_TASK_STACK, NULL, IPERF_REPORT_TASK_PRIORITY, NULL, NUMBER_OF_CORES - 1);
+    portENTER_CRITICAL(&s_iperf_lock);
+    if (session->report_started) {
+        portEXIT_CRITICAL(&s_iperf_lock);
+        return ESP_OK;
+    }
+    session->report_started = true;
+    session->refs++;
+    portEXIT_CRITICAL(&s_iperf_lock);
+
+    ret = xTaskCreatePinnedToCore(iperf_report_task, IPERF_REPORT_TASK_NAME, IPERF_REPORT_TASK_STACK, session, IPERF_REPORT_TASK_PRIORITY, NULL, NUMBER_OF_CORES - 1);
 
     if (ret != pdPASS) {
         ESP_LOGE(TAG, "create task %s failed", IPERF_REPORT_TASK_NAME);
+        iperf_session_release(session);
         return ESP_FAIL;
     }
 
     return ESP_OK;
 }
 
-IRAM_ATTR static void socket_recv(int recv_socket, struct sockaddr_storage listen_addr, uint8_t type)
+/* Upper bounds in us of the pacing error histogram buckets, the last bucket is open ended */
+static const uint32_t s_pacing_hist_bounds_us[IPERF_PACING_HIST_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000,
+};
+
+/*
+ * Token bucket pacer. Tokens are kept in bit-microseconds so refills stay exact
+ * at low rates, an esp_timer one-shot wakes the sending task once enough tokens
+ * are available and the task blocks in between instead of busy waiting.
+ */
+typedef struct {
+    esp_timer_handle_t timer;
+    TaskHandle_t task;
+    uint64_t rate_bps;
+    int64_t tokens;
+    int64_t bucket;
+    int64_t last_refill_us;
+    uint32_t waits;
+    int64_t total_error_us;
+    int64_t max_error_us;
+    uint32_t hist[IPERF_PACING_HIST_BUCKETS];
+} iperf_pacer_t;
+
+static void iperf_pacer_timer_cb(void *arg)
 {
-    bool iperf_recv_start = true;
-    uint8_t *buffer;
-    int want_recv = 0;
-    int actual_recv = 0;
+    iperf_pacer_t *pacer = (iperf_pacer_t *)arg;
+    xTaskNotifyGive(pacer->task);
+}
 
-#if IPERF_IPV6_ENABLED && IPERF_IPV4_ENABLED
-    socklen_t socklen = (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
-#elif IPERF_IPV6_ENABLED
-    socklen_t socklen = sizeof(struct sockaddr_in6);
-#else
-    socklen_t socklen = sizeof(struct sockaddr_in);
-#endif
-    const char *error_log = (type == IPERF_TRANS_TYPE_TCP) ? "tcp server recv" : "udp server recv";
+static uint64_t iperf_get_rate_bps(const iperf_cfg_t *cfg)
+{
+    if (cfg->bw_lim_bps > 0) {
+        return cfg->bw_lim_bps;
+    }
+    return (cfg->bw_lim > 0) ? (uint64_t)cfg->bw_lim * 1000000 : 0;
+}
 
-    buffer = s_iperf_ctrl.buffer;
-    want_recv = s_iperf_ctrl.buffer_len;
-    while (!s_iperf_ctrl.finish) {
-        actual_recv = recvfrom(recv_socket, buffer, want_recv, 0, (struct sockaddr *)&listen_addr, &socklen);
-        if (actual_recv < 0) {
-            iperf_show_socket_error_reason(error_log, recv_socket);
-            s_iperf_ctrl.finish = true;
-            break;
+static esp_err_t iperf_pacer_init(iperf_pacer_t *pacer, uint64_t rate_bps, uint32_t pkt_len)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = iperf_pacer_timer_cb,
+        .arg = pacer,
+        .name = "iperf_pacer",
+    };
+
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->task = xTaskGetCurrentTaskHandle();
+    pacer->rate_bps = rate_bps;
+    pacer->bucket = (int64_t)pkt_len * 8 * 1000000 * IPERF_PACING_BURST_PKTS;
+    pacer->last_refill_us = esp_timer_get_time();
+    return esp_timer_create(&timer_args, &pacer->timer);
+}
+
+static void iperf_pacer_deinit(iperf_pacer_t *pacer)
+{
+    esp_timer_stop(pacer->timer);
+    esp_timer_delete(pacer->timer);
+}
+
+static void iperf_pacer_refill(iperf_pacer_t *pacer, int64_t now_us)
+{
+    pacer->tokens += (now_us - pacer->last_refill_us) * (int64_t)pacer->rate_bps;
+    pacer->last_refill_us = now_us;
+    if (pacer->tokens > pacer->bucket) {
+        pacer->tokens = pacer->bucket;
+    }
+}
+
+static void iperf_pacer_record(iperf_pacer_t *pacer, int64_t error_us)
+{
+    int bucket = 0;
+
+    if (error_us < 0) {
+        error_us = 0;
+    }
+    while (bucket < IPERF_PACING_HIST_BUCKETS - 1 && error_us >= s_pacing_hist_bounds_us[bucket]) {
+        bucket++;
+    }
+    pacer->hist[bucket]++;
+    pacer->waits++;
+    pacer->total_error_us += error_us;
+    if (error_us > pacer->max_error_us) {
+        pacer->max_error_us = error_us;
+    }
+}
+
+/* Blocks until the bucket holds enough tokens for len bytes, then takes them */
+static void iperf_pacer_wait(iperf_pacer_t *pacer, uint32_t len)
+{
+    int64_t need = (int64_t)len * 8 * 1000000;
+    int64_t now_us = esp_timer_get_time();
+
+    iperf_pacer_refill(pacer, now_us);
+    if (pacer->tokens < need) {
+        int64_t wait_us = (need - pacer->tokens + pacer->rate_bps - 1) / pacer->rate_bps;
+        int64_t deadline_us = now_us + wait_us;
+        if (esp_timer_start_once(pacer->timer, wait_us) == ESP_OK) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         } else {
-            if (iperf_recv_start) {
-                iperf_start_report();
-                iperf_recv_start = false;
-            }
-            s_iperf_ctrl.actual_len += actual_recv;
+            vTaskDelay(1);
+        }
+        now_us = esp_timer_get_time();
+        iperf_pacer_record(pacer, now_us - deadline_us);
+        iperf_pacer_refill(pacer, now_us);
+    }
+    pacer->tokens -= need;
+}
+
+static void iperf_pacer_show(const iperf_pacer_t *pacer, uint8_t id)
+{
+    if (pacer->waits == 0) {
+        return;
+    }
+    printf("[%3d] pacing error: avg %" PRIi64 " us, max %" PRIi64 " us over %" PRIu32 " waits\n", id,
+           pacer->total_error_us / pacer->waits, pacer->max_error_us, pacer->waits);
+    for (int i = 0; i < IPERF_PACING_HIST_BUCKETS; i++) {
+        if (i < IPERF_PACING_HIST_BUCKETS - 1) {
+            printf("      < %5" PRIu32 " us: %" PRIu32 "\n", s_pacing_hist_bounds_us[i], pacer->hist[i]);
+        } else {
+            printf("      >= %4" PRIu32 " us: %" PRIu32 "\n", s_pacing_hist_bounds_us[i - 1], pacer->hist[i]);
+        }
+    }
+}
+
+IRAM_ATTR static void socket_recv(iperf_stream_t *stream, int recv_socket, uint8_t type)
+{
+    iperf_session_t *session = stream->session;
+    bool datagram = (type == IPERF_TRANS_TYPE_UDP);
+    iperf_rx_batch_t batch;
+    int ret;
+    const char *error_log = (type == IPERF_TRANS_TYPE_TCP) ? "tcp server recv" : "udp server recv";
+
+    // The report clock starts with the first data, not when the socket opens
+    ret = iperf_rx_drain(recv_socket, stream->buffer, stream->buffer_len, IPERF_RX_BATCH_READS, datagram,
+                         datagram ? iperf_udp_account : NULL, session, &batch);
+    if (ret == 0 && batch.reads > 0) {
+        iperf_start_report(session);
+    }
+    while (ret == 0) {
+        iperf_stream_count(stream, batch.bytes, batch.reads);
+        if (datagram) {
+            iperf_udp_flush(session);
         }
+        if (batch.closed || session->finish) {
+            // The peer closed this stream, the other streams keep running
+            return;
+        }
+        ret = iperf_rx_drain(recv_socket, stream->buffer, stream->buffer_len, IPERF_RX_BATCH_READS, datagram,
+                             datagram ? iperf_udp_account : NULL, session, &batch);
     }
+    iperf_show_socket_error_reason(error_log, recv_socket);
 }
 
-IRAM_ATTR static void socket_send(int send_socket, struct sockaddr_storage dest_addr, uint8_t type, int bw_lim)
+IRAM_ATTR static void socket_send(iperf_stream_t *stream, int send_socket, struct sockaddr_storage dest_addr, uint8_t type)
 {
+    iperf_session_t *session = stream->session;
     uint8_t *buffer;
-    uint32_t *pkt_id_p;
+    iperf_udp_header_t *hdr;
     uint32_t pkt_cnt = 0;
+    struct timeval ts_now;
     int actual_send = 0;
     int want_send = 0;
-    int period_us = -1;
-    int delay_us = 0;
-    int64_t prev_time = 0;
-    int64_t send_time = 0;
     int err = 0;
-    struct timeval ts_now;
+    uint64_t rate_bps = iperf_get_rate_bps(&session->cfg);
+    bool paced = false;
+    iperf_pacer_t pacer;
 
 #if IPERF_IPV6_ENABLED && IPERF_IPV4_ENABLED
-    const socklen_t socklen = (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    const socklen_t socklen = (session->cfg.type == IPERF_IP_TYPE_IPV6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
 #elif IPERF_IPV6_ENABLED
     const socklen_t socklen = sizeof(struct sockaddr_in6);
 #else
@@ -192,33 +857,31 @@ IRAM_ATTR static void socket_send(int send_socket, struct sockaddr_storage dest_
 #endif
     const char *error_log = (type == IPERF_TRANS_TYPE_TCP) ? "tcp client send" : "udp client send";
 
-    buffer = s_iperf_ctrl.buffer;
-    pkt_id_p = (uint32_t *)s_iperf_ctrl.buffer;
-    want_send = s_iperf_ctrl.buffer_len;
-    iperf_start_report();
+    buffer = stream->buffer;
+    hdr = (iperf_udp_header_t *)stream->buffer;
+    want_send = stream->buffer_len;
 
-    if (bw_lim > 0) {
-        period_us = want_send * 8 / bw_lim;
+    if (rate_bps > 0) {
+        if (iperf_pacer_init(&pacer, rate_bps, want_send) == ESP_OK) {
+            paced = true;
+        } else {
+            ESP_LOGE(TAG, "create pacing timer failed, sending unpaced");
+        }
     }
+    iperf_start_report(session);
 
-    while (!s_iperf_ctrl.finish) {
-        if (period_us > 0) {
+    while (!session->finish) {
+        if (paced) {
+            // A failed send still spends its tokens, backing off while the stack is out of buffers
+            iperf_pacer_wait(&pacer, want_send);
+        }
+        hdr->id = htonl(pkt_cnt++); // datagrams need to be sequentially numbered
+        if (type == IPERF_TRANS_TYPE_UDP && want_send >= sizeof(*hdr)) {
+            // iperf2 send timestamp, lets the server measure jitter and one-way latency
             gettimeofday(&ts_now, NULL);
-            send_time = ts_now.tv_sec * 1000000L + ts_now.tv_usec;
-            if (actual_send > 0) {
-                // Last packet "send" was successful, check how much off the previous loop duration was to the ideal send period. Result will adjust the
-                // next send delay.
-                delay_us += period_us + (int32_t)(prev_time - send_time);
-            } else {
-                // Last packet "send" was not successful. Ideally we should try to catch up the whole previous loop duration (e.g. prev_time - send_time).
-                // However, that's not possible since the most probable reason why the send was unsuccessful is the HW was not able to process the packet.
-                // Hence, we cannot queue more packets with shorter (or no) delay to catch up since we are already at the performance edge. The best we
-                // can do is to reset the send delay (which is probably big negative number) and start all over again.
-                delay_us = 0;
-            }
-            prev_time = send_time;
+            hdr->tv_sec = htonl(ts_now.tv_sec);
+            hdr->tv_usec = htonl(ts_now.tv_usec);
         }
-        *pkt_id_p = htonl(pkt_cnt++); // datagrams need to be sequentially numbered
         actual_send = sendto(send_socket, buffer, want_send, 0, (struct sockaddr *)&dest_addr, socklen);
         if (actual_send != want_send) {
             if (type == IPERF_TRANS_TYPE_UDP) {
@@ -232,96 +895,108 @@ IRAM_ATTR static void socket_send(int send_socket, struct sockaddr_storage dest_
                 break;
             }
         } else {
-            s_iperf_ctrl.actual_len += actual_send;
-        }
-        // The send delay may be negative, it indicates we are trying to catch up and hence to not delay the loop at all.
-        if (delay_us > 0) {
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-            esp_rom_delay_us(delay_us);
-#else
-            ets_delay_us(delay_us);
-#endif
+            iperf_stream_count(stream, actual_send, 1);
         }
     }
+
+    if (paced) {
+        iperf_pacer_show(&pacer, stream->id);
+        iperf_pacer_deinit(&pacer);
+    }
 }
 
-static int tcp_listen_socket = -1;
-static esp_err_t iperf_run_tcp_server(void)
+static esp_err_t iperf_tcp_listen(iperf_session_t *session)
 {
-    int client_socket = -1;
+    int listen_socket = -1;
     int opt = 1;
     int err = 0;
     esp_err_t ret = ESP_OK;
     struct timeval timeout = { 0 };
-    socklen_t addr_len = sizeof(struct sockaddr);
-    struct sockaddr_storage listen_addr = { 0 };
 #if IPERF_IPV4_ENABLED
     struct sockaddr_in listen_addr4 = { 0 };
-    struct sockaddr_in remote_addr = { 0 };
 #endif
 #if IPERF_IPV6_ENABLED
     struct sockaddr_in6 listen_addr6 = { 0 };
-    struct sockaddr_in6 remote_addr6 = { 0 };
 #endif
-    if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) {
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
 #if IPERF_IPV6_ENABLED
         // The TCP server listen at the address "::", which means all addresses can be listened to.
         inet6_aton("::", &listen_addr6.sin6_addr);
         listen_addr6.sin6_family = AF_INET6;
-        listen_addr6.sin6_port = htons(s_iperf_ctrl.cfg.sport);
+        listen_addr6.sin6_port = htons(session->cfg.sport);
 
-        tcp_listen_socket = socket(AF_INET6, SOCK_STREAM, IPPROTO_IPV6);
-        ESP_GOTO_ON_FALSE((tcp_listen_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
+        listen_socket = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+        ESP_GOTO_ON_FALSE((listen_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
 
-        setsockopt(tcp_listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-        setsockopt(tcp_listen_socket, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+        setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        setsockopt(listen_socket, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
 
         ESP_LOGI(TAG, "Socket created");
 
-        err = bind(tcp_listen_socket, (struct sockaddr *)&listen_addr6, sizeof(listen_addr6));
+        err = bind(listen_socket, (struct sockaddr *)&listen_addr6, sizeof(listen_addr6));
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Socket unable to bind: errno %d, IPPROTO: %d", errno, AF_INET6);
-        err = listen(tcp_listen_socket, 1);
+        err = listen(listen_socket, session->num_streams);
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Error occurred during listen: errno %d", errno);
-
-        memcpy(&listen_addr, &listen_addr6, sizeof(listen_addr6));
 #else
         ESP_GOTO_ON_FALSE(false, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
 #endif
-    } else if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV4) {
+    } else if (session->cfg.type == IPERF_IP_TYPE_IPV4) {
 #if IPERF_IPV4_ENABLED
         listen_addr4.sin_family = AF_INET;
-        listen_addr4.sin_port = htons(s_iperf_ctrl.cfg.sport);
-        listen_addr4.sin_addr.s_addr = s_iperf_ctrl.cfg.source_ip4;
+        listen_addr4.sin_port = htons(session->cfg.sport);
+        listen_addr4.sin_addr.s_addr = session->cfg.source_ip4;
 
-        tcp_listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        ESP_GOTO_ON_FALSE((tcp_listen_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
+        listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        ESP_GOTO_ON_FALSE((listen_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
 
-        setsockopt(tcp_listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
         ESP_LOGI(TAG, "Socket created");
 
-        err = bind(tcp_listen_socket, (struct sockaddr *)&listen_addr4, sizeof(listen_addr4));
+        err = bind(listen_socket, (struct sockaddr *)&listen_addr4, sizeof(listen_addr4));
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Socket unable to bind: errno %d, IPPROTO: %d", errno, AF_INET);
 
-        err = listen(tcp_listen_socket, 5);
+        err = listen(listen_socket, MAX(5, session->num_streams));
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Error occurred during listen: errno %d", errno);
-        memcpy(&listen_addr, &listen_addr4, sizeof(listen_addr4));
 #else
         ESP_GOTO_ON_FALSE(false, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
 #endif
     }
     timeout.tv_sec = IPERF_SOCKET_RX_TIMEOUT;
-    setsockopt(tcp_listen_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(listen_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    session->listen_socket = listen_socket;
+    return ESP_OK;
 
-    if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) {
+exit:
+    if (listen_socket != -1) {
+        close(listen_socket);
+    }
+    return ret;
+}
+
+static esp_err_t iperf_run_tcp_server(iperf_stream_t *stream)
+{
+    iperf_session_t *session = stream->session;
+    int client_socket = -1;
+    esp_err_t ret = ESP_OK;
+    struct timeval timeout = { 0 };
+    socklen_t addr_len = sizeof(struct sockaddr);
+#if IPERF_IPV4_ENABLED
+    struct sockaddr_in remote_addr = { 0 };
+#endif
 #if IPERF_IPV6_ENABLED
-        client_socket = accept(tcp_listen_socket, (struct sockaddr *)&remote_addr6, &addr_len);
+    struct sockaddr_in6 remote_addr6 = { 0 };
+#endif
+
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
+#if IPERF_IPV6_ENABLED
+        client_socket = accept(session->listen_socket, (struct sockaddr *)&remote_addr6, &addr_len);
         ESP_GOTO_ON_FALSE((client_socket >= 0), ESP_FAIL, exit, TAG, "Unable to accept connection: errno %d", errno);
         ESP_LOGI(TAG, "accept: %s,%d", inet6_ntoa(remote_addr6.sin6_addr), htons(remote_addr6.sin6_port));
 #endif
-    } else if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV4) {
+    } else if (session->cfg.type == IPERF_IP_TYPE_IPV4) {
 #if IPERF_IPV4_ENABLED
-        client_socket = accept(tcp_listen_socket, (struct sockaddr *)&remote_addr, &addr_len);
+        client_socket = accept(session->listen_socket, (struct sockaddr *)&remote_addr, &addr_len);
         ESP_GOTO_ON_FALSE((client_socket >= 0), ESP_FAIL, exit, TAG, "Unable to accept connection: errno %d", errno);
         ESP_LOGI(TAG, "accept: %s,%d", inet_ntoa(remote_addr.sin_addr), htons(remote_addr.sin_port));
 #endif
@@ -330,31 +1005,22 @@ static esp_err_t iperf_run_tcp_server(void)
     timeout.tv_sec = IPERF_SOCKET_RX_TIMEOUT;
     setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-    if (iperf_hook_func) {
+    if (iperf_hook_func && stream->id == 0) {
         iperf_hook_func(IPERF_TCP_SERVER, IPERF_STARTED);
     }
-    socket_recv(client_socket, listen_addr, IPERF_TRANS_TYPE_TCP);
+    socket_recv(stream, client_socket, IPERF_TRANS_TYPE_TCP);
 
 exit:
     if (client_socket != -1) {
         close(client_socket);
         ESP_LOGI(TAG, "TCP Socket server is closed.");
     }
-
-    if (tcp_listen_socket != -1) {
-        shutdown(tcp_listen_socket, 0);
-        close(tcp_listen_socket);
-        ESP_LOGD(TAG, "TCP listen socket is closed.");
-    }
-    if (iperf_hook_func) {
-        iperf_hook_func(IPERF_TCP_SERVER, IPERF_STOPPED);
-    }
-    s_iperf_ctrl.finish = true;
     return ret;
 }
 
-static esp_err_t iperf_run_tcp_client(void)
+static esp_err_t iperf_run_tcp_client(iperf_stream_t *stream)
 {
+    iperf_session_t *session = stream->session;
     int client_socket = -1;
     int err = 0;
     esp_err_t ret = ESP_OK;
@@ -366,14 +1032,14 @@ static esp_err_t iperf_run_tcp_client(void)
 #if IPERF_IPV6_ENABLED
     struct sockaddr_in6 dest_addr6 = { 0 };
 #endif
-    if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) {
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
 #if IPERF_IPV6_ENABLED
-        client_socket = socket(AF_INET6, SOCK_STREAM, IPPROTO_IPV6);
+        client_socket = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
         ESP_GOTO_ON_FALSE((client_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
 
-        inet6_aton(s_iperf_ctrl.cfg.destination_ip6, &dest_addr6.sin6_addr);
+        inet6_aton(session->cfg.destination_ip6, &dest_addr6.sin6_addr);
         dest_addr6.sin6_family = AF_INET6;
-        dest_addr6.sin6_port = htons(s_iperf_ctrl.cfg.dport);
+        dest_addr6.sin6_port = htons(session->cfg.dport);
 
         err = connect(client_socket, (struct sockaddr *)&dest_addr6, sizeof(struct sockaddr_in6));
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Socket unable to connect: errno %d", errno);
@@ -382,14 +1048,14 @@ static esp_err_t iperf_run_tcp_client(void)
 #else
         ESP_GOTO_ON_FALSE(false, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
 #endif
-    } else if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV4) {
+    } else if (session->cfg.type == IPERF_IP_TYPE_IPV4) {
 #if IPERF_IPV4_ENABLED
         client_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
         ESP_GOTO_ON_FALSE((client_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
 
         dest_addr4.sin_family = AF_INET;
-        dest_addr4.sin_port = htons(s_iperf_ctrl.cfg.dport);
-        dest_addr4.sin_addr.s_addr = s_iperf_ctrl.cfg.destination_ip4;
+        dest_addr4.sin_port = htons(session->cfg.dport);
+        dest_addr4.sin_addr.s_addr = session->cfg.destination_ip4;
         err = connect(client_socket, (struct sockaddr *)&dest_addr4, sizeof(struct sockaddr_in));
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Socket unable to connect: errno %d", errno);
         ESP_LOGI(TAG, "Successfully connected");
@@ -401,10 +1067,10 @@ static esp_err_t iperf_run_tcp_client(void)
     timeout.tv_sec = IPERF_SOCKET_TCP_TX_TIMEOUT;
     setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
-    if (iperf_hook_func) {
+    if (iperf_hook_func && stream->id == 0) {
         iperf_hook_func(IPERF_TCP_CLIENT, IPERF_STARTED);
     }
-    socket_send(client_socket, dest_addr, IPERF_TRANS_TYPE_TCP, s_iperf_ctrl.cfg.bw_lim);
+    socket_send(stream, client_socket, dest_addr, IPERF_TRANS_TYPE_TCP);
 
 exit:
     if (client_socket != -1) {
@@ -412,21 +1078,17 @@ exit:
         close(client_socket);
         ESP_LOGI(TAG, "TCP Socket client is closed.");
     }
-    if (iperf_hook_func) {
-        iperf_hook_func(IPERF_TCP_CLIENT, IPERF_STOPPED);
-    }
-    s_iperf_ctrl.finish = true;
     return ret;
 }
 
-static esp_err_t iperf_run_udp_server(void)
+static esp_err_t iperf_run_udp_server(iperf_stream_t *stream)
 {
+    iperf_session_t *session = stream->session;
     int listen_socket = -1;
     int opt = 1;
     int err = 0;
     esp_err_t ret = ESP_OK;
     struct timeval timeout = { 0 };
-    struct sockaddr_storage listen_addr = { 0 };
 #if IPERF_IPV4_ENABLED
     struct sockaddr_in listen_addr4 = { 0 };
 #endif
@@ -434,12 +1096,12 @@ static esp_err_t iperf_run_udp_server(void)
     struct sockaddr_in6 listen_addr6 = { 0 };
 #endif
 
-    if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) {
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
 #if IPERF_IPV6_ENABLED
         // The UDP server listen at the address "::", which means all addresses can be listened to.
         inet6_aton("::", &listen_addr6.sin6_addr);
         listen_addr6.sin6_family = AF_INET6;
-        listen_addr6.sin6_port = htons(s_iperf_ctrl.cfg.sport);
+        listen_addr6.sin6_port = htons(session->cfg.sport);
 
         listen_socket = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
         ESP_GOTO_ON_FALSE((listen_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
@@ -451,15 +1113,14 @@ static esp_err_t iperf_run_udp_server(void)
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Socket unable to bind: errno %d", errno);
         ESP_LOGI(TAG, "Socket bound, port %" PRIu16, listen_addr6.sin6_port);
 
-        memcpy(&listen_addr, &listen_addr6, sizeof(listen_addr6));
 #else
         ESP_GOTO_ON_FALSE(false, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
 #endif
-    } else if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV4) {
+    } else if (session->cfg.type == IPERF_IP_TYPE_IPV4) {
 #if IPERF_IPV4_ENABLED
         listen_addr4.sin_family = AF_INET;
-        listen_addr4.sin_port = htons(s_iperf_ctrl.cfg.sport);
-        listen_addr4.sin_addr.s_addr = s_iperf_ctrl.cfg.source_ip4;
+        listen_addr4.sin_port = htons(session->cfg.sport);
+        listen_addr4.sin_addr.s_addr = session->cfg.source_ip4;
 
         listen_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
         ESP_GOTO_ON_FALSE((listen_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
@@ -470,7 +1131,6 @@ static esp_err_t iperf_run_udp_server(void)
         err = bind(listen_socket, (struct sockaddr *)&listen_addr4, sizeof(struct sockaddr_in));
         ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Socket unable to bind: errno %d", errno);
         ESP_LOGI(TAG, "Socket bound, port %d", listen_addr4.sin_port);
-        memcpy(&listen_addr, &listen_addr4, sizeof(listen_addr4));
 #else
         ESP_GOTO_ON_FALSE(false, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
 #endif
@@ -479,10 +1139,10 @@ static esp_err_t iperf_run_udp_server(void)
     timeout.tv_sec = IPERF_SOCKET_RX_TIMEOUT;
     setsockopt(listen_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-    if (iperf_hook_func) {
+    if (iperf_hook_func && stream->id == 0) {
         iperf_hook_func(IPERF_UDP_SERVER, IPERF_STARTED);
     }
-    socket_recv(listen_socket, listen_addr, IPERF_TRANS_TYPE_UDP);
+    socket_recv(stream, listen_socket, IPERF_TRANS_TYPE_UDP);
 
 exit:
     if (listen_socket != -1) {
@@ -490,15 +1150,12 @@ exit:
         close(listen_socket);
     }
     ESP_LOGI(TAG, "Udp socket server is closed.");
-    if (iperf_hook_func) {
-        iperf_hook_func(IPERF_UDP_SERVER, IPERF_STOPPED);
-    }
-    s_iperf_ctrl.finish = true;
     return ret;
 }
 
-static esp_err_t iperf_run_udp_client(void)
+static esp_err_t iperf_run_udp_client(iperf_stream_t *stream)
 {
+    iperf_session_t *session = stream->session;
     int client_socket = -1;
     int opt = 1;
     esp_err_t ret = ESP_OK;
@@ -510,30 +1167,30 @@ static esp_err_t iperf_run_udp_client(void)
     struct sockaddr_in6 dest_addr6 = { 0 };
 #endif
 
-    if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) {
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
 #if IPERF_IPV6_ENABLED
-        inet6_aton(s_iperf_ctrl.cfg.destination_ip6, &dest_addr6.sin6_addr);
+        inet6_aton(session->cfg.destination_ip6, &dest_addr6.sin6_addr);
         dest_addr6.sin6_family = AF_INET6;
-        dest_addr6.sin6_port = htons(s_iperf_ctrl.cfg.dport);
+        dest_addr6.sin6_port = htons(session->cfg.dport);
 
-        client_socket = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+        client_socket = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
         ESP_GOTO_ON_FALSE((client_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
-        ESP_LOGI(TAG, "Socket created, sending to %s:%d", s_iperf_ctrl.cfg.destination_ip6, s_iperf_ctrl.cfg.dport);
+        ESP_LOGI(TAG, "Socket created, sending to %s:%d", session->cfg.destination_ip6, session->cfg.dport);
 
         setsockopt(client_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
         memcpy(&dest_addr, &dest_addr6, sizeof(dest_addr6));
 #else
         ESP_GOTO_ON_FALSE(false, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
 #endif
-    } else if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV4) {
+    } else if (session->cfg.type == IPERF_IP_TYPE_IPV4) {
 #if IPERF_IPV4_ENABLED
         dest_addr4.sin_family = AF_INET;
-        dest_addr4.sin_port = htons(s_iperf_ctrl.cfg.dport);
-        dest_addr4.sin_addr.s_addr = s_iperf_ctrl.cfg.destination_ip4;
+        dest_addr4.sin_port = htons(session->cfg.dport);
+        dest_addr4.sin_addr.s_addr = session->cfg.destination_ip4;
 
         client_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
         ESP_GOTO_ON_FALSE((client_socket >= 0), ESP_FAIL, exit, TAG, "Unable to create socket: errno %d", errno);
-        ESP_LOGI(TAG, "Socket created, sending to %d:%d", s_iperf_ctrl.cfg.destination_ip4, s_iperf_ctrl.cfg.dport);
+        ESP_LOGI(TAG, "Socket created, sending to %d:%d", session->cfg.destination_ip4, session->cfg.dport);
 
         setsockopt(client_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
         memcpy(&dest_addr, &dest_addr4, sizeof(dest_addr4));
@@ -542,10 +1199,10 @@ static esp_err_t iperf_run_udp_client(void)
 #endif
     }
 
-    if (iperf_hook_func) {
+    if (iperf_hook_func && stream->id == 0) {
         iperf_hook_func(IPERF_UDP_CLIENT, IPERF_STARTED);
     }
-    socket_send(client_socket, dest_addr, IPERF_TRANS_TYPE_UDP, s_iperf_ctrl.cfg.bw_lim);
+    socket_send(stream, client_socket, dest_addr, IPERF_TRANS_TYPE_UDP);
 
 exit:
     if (client_socket != -1) {
@@ -553,52 +1210,47 @@ exit:
         close(client_socket);
     }
     ESP_LOGI(TAG, "UDP Socket client is closed");
-    if (iperf_hook_func) {
-        iperf_hook_func(IPERF_UDP_CLIENT, IPERF_STOPPED);
-    }
-    s_iperf_ctrl.finish = true;
     return ret;
 }
 
 static void iperf_task_traffic(void *arg)
 {
-    if (iperf_is_udp_client()) {
-        iperf_run_udp_client();
-    } else if (iperf_is_udp_server()) {
-        iperf_run_udp_server();
-    } else if (iperf_is_tcp_client()) {
-        iperf_run_tcp_client();
+    iperf_stream_t *stream = (iperf_stream_t *)arg;
+    iperf_session_t *session = stream->session;
+
+    if (iperf_is_udp_client(session)) {
+        iperf_run_udp_client(stream);
+    } else if (iperf_is_udp_server(session)) {
+        iperf_run_udp_server(stream);
+    } else if (iperf_is_tcp_client(session)) {
+        iperf_run_tcp_client(stream);
     } else {
-        iperf_run_tcp_server();
+        iperf_run_tcp_server(stream);
     }
 
-    if (s_iperf_ctrl.buffer) {
-        free(s_iperf_ctrl.buffer);
-        s_iperf_ctrl.buffer = NULL;
-    }
-    ESP_LOGI(TAG, "iperf exit");
-    g_iperf_is_running = false;
+    iperf_stream_done(stream);
+    iperf_session_release(session);
     vTaskDelete(NULL);
 }
 
-static uint32_t iperf_get_buffer_len(void)
+static uint32_t iperf_get_buffer_len(const iperf_session_t *session)
 {
-    if (iperf_is_udp_client()) {
+    if (iperf_is_udp_client(session)) {
 #if IPERF_IPV6_ENABLED
-        if (s_iperf_ctrl.cfg.len_send_buf) {
-            return s_iperf_ctrl.cfg.len_send_buf;
-        } else if (s_iperf_ctrl.cfg.type == IPERF_IP_TYPE_IPV6) {
+        if (session->cfg.len_send_buf) {
+            return session->cfg.len_send_buf;
+        } else if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
             return IPERF_DEFAULT_IPV6_UDP_TX_LEN;
         } else {
             return IPERF_DEFAULT_IPV4_UDP_TX_LEN;
         }
 #else
-        return (s_iperf_ctrl.cfg.len_send_buf == 0 ? IPERF_DEFAULT_IPV4_UDP_TX_LEN : s_iperf_ctrl.cfg.len_send_buf);
+        return (session->cfg.len_send_buf == 0 ? IPERF_DEFAULT_IPV4_UDP_TX_LEN : session->cfg.len_send_buf);
 #endif
-    } else if (iperf_is_udp_server()) {
+    } else if (iperf_is_udp_server(session)) {
         return IPERF_DEFAULT_UDP_RX_LEN;
-    } else if (iperf_is_tcp_client()) {
-        return (s_iperf_ctrl.cfg.len_send_buf == 0 ? IPERF_DEFAULT_TCP_TX_LEN : s_iperf_ctrl.cfg.len_send_buf);
+    } else if (iperf_is_tcp_client(session)) {
+        return (session->cfg.len_send_buf == 0 ? IPERF_DEFAULT_TCP_TX_LEN : session->cfg.len_send_buf);
     } else {
         return IPERF_DEFAULT_TCP_RX_LEN;
     }
@@ -606,50 +1258,488 @@ static uint32_t iperf_get_buffer_len(void)
 
 }
 
-esp_err_t iperf_start(iperf_cfg_t *cfg)
+static uint8_t iperf_get_num_streams(const iperf_session_t *session)
 {
-    BaseType_t ret;
+    uint8_t num_streams = session->cfg.num_streams;
 
-    if (!cfg) {
-        return ESP_FAIL;
+    if (num_streams == 0) {
+        return 1;
+    }
+    if (num_streams > IPERF_MAX_STREAMS) {
+        ESP_LOGW(TAG, "limit parallel streams to %d", IPERF_MAX_STREAMS);
+        num_streams = IPERF_MAX_STREAMS;
     }
+    /* A single UDP server socket already receives every client stream */
+    if (iperf_is_udp_server(session) && num_streams > 1) {
+        ESP_LOGW(TAG, "udp server receives all streams on one socket");
+        num_streams = 1;
+    }
+    return num_streams;
+}
 
-    if (g_iperf_is_running) {
+/* Streams spread round robin over the cores, starting from the last core */
+static BaseType_t iperf_get_stream_core(uint8_t id)
+{
+    return (NUMBER_OF_CORES - 1 + id) % NUMBER_OF_CORES;
+}
+
+static esp_err_t iperf_ctrl_start_listen(iperf_session_t *session);
+
+/*
+ * Starts one session. Servers that are not part of a reverse/bidir test of their own also
+ * listen for control requests, so a peer can ask them to send traffic back.
+ */
+static esp_err_t iperf_session_start(const iperf_cfg_t *cfg, bool peer_test)
+{
+    BaseType_t ret;
+    iperf_session_t *session;
+    char task_name[configMAX_TASK_NAME_LEN];
+    uint8_t created = 0;
+
+    session = iperf_session_alloc();
+    if (!session) {
         ESP_LOGW(TAG, "iperf is running");
         return ESP_FAIL;
     }
 
-    memset(&s_iperf_ctrl, 0, sizeof(s_iperf_ctrl));
-    memcpy(&s_iperf_ctrl.cfg, cfg, sizeof(*cfg));
-    g_iperf_is_running = true;
-    s_iperf_ctrl.finish = false;
-    s_iperf_ctrl.buffer_len = iperf_get_buffer_len();
-    s_iperf_ctrl.buffer = (uint8_t *)malloc(s_iperf_ctrl.buffer_len);
-    if (!s_iperf_ctrl.buffer) {
-        ESP_LOGE(TAG, "create buffer: not enough memory");
+    memcpy(&session->cfg, cfg, sizeof(*cfg));
+    IPERF_FLAG_CLR(session->cfg.flag, IPERF_FLAG_REVERSE | IPERF_FLAG_BIDIR);
+    if (session->cfg.interval == 0 && session->cfg.interval_ms == 0) {
+        session->cfg.interval = IPERF_DEFAULT_INTERVAL;
+    }
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6 && (session->cfg.flag & IPERF_FLAG_CLIENT) && session->cfg.destination_ip6) {
+        strlcpy(session->dest_ip6, session->cfg.destination_ip6, sizeof(session->dest_ip6));
+        session->cfg.destination_ip6 = session->dest_ip6;
+    }
+    session->tag = peer_test ? ((session->cfg.flag & IPERF_FLAG_CLIENT) ? "[TX] " : "[RX] ") : "";
+    session->listen_socket = -1;
+    session->ctrl_socket = -1;
+    session->finish = false;
+    session->num_streams = iperf_get_num_streams(session);
+    for (int i = 0; i < session->num_streams; i++) {
+        iperf_stream_t *stream = &session->streams[i];
+        stream->session = session;
+        stream->id = i;
+        stream->buffer_len = iperf_get_buffer_len(session);
+        stream->buffer = (uint8_t *)malloc(stream->buffer_len);
+        if (!stream->buffer) {
+            ESP_LOGE(TAG, "create buffer: not enough memory");
+            goto err;
+        }
+        memset(stream->buffer, 0, stream->buffer_len);
+    }
+    if (iperf_is_tcp_server(session) && iperf_tcp_listen(session) != ESP_OK) {
+        goto err;
+    }
+
+    session->running_streams = session->num_streams;
+    session->refs = session->num_streams;
+    for (created = 0; created < session->num_streams; created++) {
+        if (created == 0) {
+            strlcpy(task_name, IPERF_TRAFFIC_TASK_NAME, sizeof(task_name));
+        } else {
+            snprintf(task_name, sizeof(task_name), IPERF_STREAM_TASK_PREFIX "%u", created);
+        }
+        ret = xTaskCreatePinnedToCore(iperf_task_traffic, task_name, IPERF_TRAFFIC_TASK_STACK, &session->streams[created], IPERF_TRAFFIC_TASK_PRIORITY, NULL, iperf_get_stream_core(created));
+        if (ret != pdPASS) {
+            ESP_LOGE(TAG, "create task %s failed", task_name);
+            break;
+        }
+    }
+    if (created < session->num_streams) {
+        if (created == 0) {
+            goto err;
+        }
+        /* Hand the references of the streams that never started back, the running ones clean up */
+        session->finish = true;
+        for (uint8_t i = created; i < session->num_streams; i++) {
+            iperf_stream_done(&session->streams[i]);
+            iperf_session_release(session);
+        }
         return ESP_FAIL;
     }
-    memset(s_iperf_ctrl.buffer, 0, s_iperf_ctrl.buffer_len);
-    ret = xTaskCreatePinnedToCore(iperf_task_traffic, IPERF_TRAFFIC_TASK_NAME, IPERF_TRAFFIC_TASK_STACK, NULL, IPERF_TRAFFIC_TASK_PRIORITY, NULL, NUMBER_OF_CORES - 1);
-    if (ret != pdPASS) {
-        ESP_LOGE(TAG, "create task %s failed", IPERF_TRAFFIC_TASK_NAME);
-        free(s_iperf_ctrl.buffer);
-        s_iperf_ctrl.buffer = NULL;
+    if (!peer_test && (session->cfg.flag & IPERF_FLAG_SERVER)) {
+        // Not fatal, plain iperf clients never use the control channel
+        iperf_ctrl_start_listen(session);
+    }
+    return ESP_OK;
+
+err:
+    iperf_close_listen_socket(session);
+    for (int i = 0; i < session->num_streams; i++) {
+        free(session->streams[i].buffer);
+        session->streams[i].buffer = NULL;
+    }
+    iperf_session_free(session);
+    return ESP_FAIL;
+}
+
+// ================================ Control channel ================================
+
+typedef struct {
+    uint8_t flag;          /* IPERF_FLAG_REVERSE or IPERF_FLAG_BIDIR */
+    uint8_t trans_type;    /* IPERF_TRANS_TYPE_TCP or IPERF_TRANS_TYPE_UDP */
+    uint8_t num_streams;
+    uint16_t port;         /* data port the requester receives on */
+    uint16_t len_send_buf;
+    uint32_t time;
+    uint32_t bw_lim_bps;
+    uint32_t interval_ms;
+} iperf_ctrl_req_t;
+
+static void iperf_ctrl_put_u16(uint8_t *buf, uint16_t value)
+{
+    value = htons(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+static void iperf_ctrl_put_u32(uint8_t *buf, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+static uint16_t iperf_ctrl_get_u16(const uint8_t *buf)
+{
+    uint16_t value;
+    memcpy(&value, buf, sizeof(value));
+    return ntohs(value);
+}
+
+static uint32_t iperf_ctrl_get_u32(const uint8_t *buf)
+{
+    uint32_t value;
+    memcpy(&value, buf, sizeof(value));
+    return ntohl(value);
+}
+
+static void iperf_ctrl_encode_req(const iperf_ctrl_req_t *req, uint8_t *buf)
+{
+    iperf_ctrl_put_u32(&buf[0], IPERF_CTRL_MAGIC);
+    buf[4] = IPERF_CTRL_VERSION;
+    buf[5] = req->flag;
+    buf[6] = req->trans_type;
+    buf[7] = req->num_streams;
+    iperf_ctrl_put_u16(&buf[8], req->port);
+    iperf_ctrl_put_u16(&buf[10], req->len_send_buf);
+    iperf_ctrl_put_u32(&buf[12], req->time);
+    iperf_ctrl_put_u32(&buf[16], req->bw_lim_bps);
+    iperf_ctrl_put_u32(&buf[20], req->interval_ms);
+}
+
+static esp_err_t iperf_ctrl_decode_req(const uint8_t *buf, iperf_ctrl_req_t *req)
+{
+    if (iperf_ctrl_get_u32(&buf[0]) != IPERF_CTRL_MAGIC || buf[4] != IPERF_CTRL_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    req->flag = buf[5];
+    req->trans_type = buf[6];
+    req->num_streams = buf[7];
+    req->port = iperf_ctrl_get_u16(&buf[8]);
+    req->len_send_buf = iperf_ctrl_get_u16(&buf[10]);
+    req->time = iperf_ctrl_get_u32(&buf[12]);
+    req->bw_lim_bps = iperf_ctrl_get_u32(&buf[16]);
+    req->interval_ms = iperf_ctrl_get_u32(&buf[20]);
+    if (req->port == 0 || req->time == 0 || req->trans_type > IPERF_TRANS_TYPE_UDP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t iperf_ctrl_recv_all(int sock, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        int ret = recv(sock, buf + got, len - got, 0);
+        if (ret <= 0) {
+            return ESP_FAIL;
+        }
+        got += ret;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t iperf_ctrl_send_all(int sock, const uint8_t *buf, size_t len)
+{
+    return send(sock, buf, len, 0) == (int)len ? ESP_OK : ESP_FAIL;
+}
+
+static uint16_t iperf_ctrl_port(uint16_t data_port)
+{
+    return (data_port ? data_port : IPERF_DEFAULT_PORT) + IPERF_CTRL_PORT_OFFSET;
+}
+
+/* The requester of a reverse/bidir test receives on its source port, or on the peer's data port */
+static uint16_t iperf_ctrl_rx_port(const iperf_cfg_t *cfg)
+{
+    return cfg->sport ? cfg->sport : cfg->dport;
+}
+
+/* Serves one control request: starts a client sending back to the requester */
+static void iperf_ctrl_serve(iperf_session_t *session, int sock, const struct sockaddr_storage *peer)
+{
+    uint8_t buf[IPERF_CTRL_REQ_LEN];
+    iperf_ctrl_req_t req;
+    iperf_cfg_t cfg;
+#if IPERF_IPV6_ENABLED
+    char peer_ip6[48];
+#endif
+    esp_err_t err;
+
+    err = iperf_ctrl_recv_all(sock, buf, IPERF_CTRL_REQ_LEN);
+    if (err == ESP_OK) {
+        err = iperf_ctrl_decode_req(buf, &req);
+    }
+    if (err == ESP_OK) {
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.flag = IPERF_FLAG_CLIENT | (req.trans_type == IPERF_TRANS_TYPE_UDP ? IPERF_FLAG_UDP : IPERF_FLAG_TCP);
+        cfg.flag |= session->cfg.flag & IPERF_FLAG_JSON;
+        cfg.type = session->cfg.type;
+        cfg.format = session->cfg.format;
+        cfg.sport = IPERF_DEFAULT_PORT;
+        cfg.dport = req.port;
+        cfg.time = req.time;
+        cfg.len_send_buf = req.len_send_buf;
+        cfg.bw_lim = IPERF_DEFAULT_NO_BW_LIMIT;
+        cfg.bw_lim_bps = req.bw_lim_bps;
+        cfg.num_streams = req.num_streams;
+        cfg.interval_ms = req.interval_ms;
+#if IPERF_IPV6_ENABLED
+        if (peer->ss_family == AF_INET6) {
+            inet6_ntoa_r(((const struct sockaddr_in6 *)peer)->sin6_addr, peer_ip6, sizeof(peer_ip6));
+            cfg.destination_ip6 = peer_ip6;
+        }
+#endif
+#if IPERF_IPV4_ENABLED
+        if (peer->ss_family == AF_INET) {
+            cfg.destination_ip4 = ((const struct sockaddr_in *)peer)->sin_addr.s_addr;
+        }
+#endif
+        ESP_LOGI(TAG, "%s test requested, sending %s back on port %d", (req.flag & IPERF_FLAG_BIDIR) ? "bidir" : "reverse",
+                 req.trans_type == IPERF_TRANS_TYPE_UDP ? "udp" : "tcp", req.port);
+        err = iperf_session_start(&cfg, true);
+    }
+
+    iperf_ctrl_put_u32(&buf[0], IPERF_CTRL_MAGIC);
+    buf[4] = IPERF_CTRL_VERSION;
+    buf[5] = (err == ESP_OK) ? 0 : 1;
+    iperf_ctrl_send_all(sock, buf, IPERF_CTRL_ACK_LEN);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "control request rejected: %s", esp_err_to_name(err));
+    }
+}
+
+static void iperf_ctrl_listen_task(void *arg)
+{
+    iperf_session_t *session = (iperf_session_t *)arg;
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    struct timeval timeout = { .tv_sec = IPERF_SOCKET_RX_TIMEOUT };
+    int sock;
+
+    while (!session->finish) {
+        peer_len = sizeof(peer);
+        sock = accept(session->ctrl_socket, (struct sockaddr *)&peer, &peer_len);
+        if (sock < 0) {
+            // accept times out periodically, the listen socket is closed on stop
+            continue;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        iperf_ctrl_serve(session, sock, &peer);
+        close(sock);
+    }
+    iperf_session_release(session);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t iperf_ctrl_start_listen(iperf_session_t *session)
+{
+    int sock = -1;
+    int opt = 1;
+    int err;
+    esp_err_t ret = ESP_OK;
+    struct timeval timeout = { .tv_sec = IPERF_SOCKET_ACCEPT_TIMEOUT };
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_len = 0;
+    uint16_t port = iperf_ctrl_port(session->cfg.sport);
+
+#if IPERF_IPV6_ENABLED
+    if (session->cfg.type == IPERF_IP_TYPE_IPV6) {
+        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&addr;
+        inet6_aton("::", &addr6->sin6_addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(port);
+        addr_len = sizeof(*addr6);
+    }
+#endif
+#if IPERF_IPV4_ENABLED
+    if (session->cfg.type == IPERF_IP_TYPE_IPV4) {
+        struct sockaddr_in *addr4 = (struct sockaddr_in *)&addr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(port);
+        addr4->sin_addr.s_addr = session->cfg.source_ip4;
+        addr_len = sizeof(*addr4);
+    }
+#endif
+    ESP_GOTO_ON_FALSE(addr_len, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
+
+    sock = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    ESP_GOTO_ON_FALSE((sock >= 0), ESP_FAIL, exit, TAG, "Unable to create control socket: errno %d", errno);
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    err = bind(sock, (struct sockaddr *)&addr, addr_len);
+    ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Control socket unable to bind: errno %d", errno);
+    err = listen(sock, 1);
+    ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, TAG, "Error occurred during control listen: errno %d", errno);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    portENTER_CRITICAL(&s_iperf_lock);
+    session->ctrl_socket = sock;
+    session->refs++;
+    portEXIT_CRITICAL(&s_iperf_lock);
+    if (xTaskCreatePinnedToCore(iperf_ctrl_listen_task, IPERF_CTRL_TASK_NAME, IPERF_CTRL_TASK_STACK, session,
+                                IPERF_REPORT_TASK_PRIORITY, NULL, NUMBER_OF_CORES - 1) != pdPASS) {
+        ESP_LOGE(TAG, "create task %s failed", IPERF_CTRL_TASK_NAME);
+        iperf_close_socket(&session->ctrl_socket);
+        iperf_session_release(session);
         return ESP_FAIL;
     }
+    ESP_LOGI(TAG, "control channel listening on port %d", port);
     return ESP_OK;
+
+exit:
+    if (sock != -1) {
+        close(sock);
+    }
+    return ret;
 }
 
-esp_err_t iperf_stop(void)
+/* Asks the peer to send back to us, then starts our own sending half of a bidir test */
+static void iperf_ctrl_request_task(void *arg)
 {
-    /* close listen socket to stop tcp server */
-    if (tcp_listen_socket != -1) {
-        shutdown(tcp_listen_socket, 0);
-        close(tcp_listen_socket);
-        ESP_LOGD(TAG, "TCP listen socket is closed.");
+    iperf_cfg_t *cfg = (iperf_cfg_t *)arg;
+    iperf_ctrl_req_t req = {
+        .flag = cfg->flag & (IPERF_FLAG_REVERSE | IPERF_FLAG_BIDIR),
+        .trans_type = (cfg->flag & IPERF_FLAG_UDP) ? IPERF_TRANS_TYPE_UDP : IPERF_TRANS_TYPE_TCP,
+        .num_streams = cfg->num_streams,
+        .port = iperf_ctrl_rx_port(cfg),
+        .len_send_buf = cfg->len_send_buf,
+        .time = cfg->time,
+        .bw_lim_bps = iperf_get_rate_bps(cfg) > UINT32_MAX ? UINT32_MAX : iperf_get_rate_bps(cfg),
+        .interval_ms = iperf_get_interval_ms(cfg),
+    };
+    uint8_t buf[IPERF_CTRL_REQ_LEN];
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_len = 0;
+    struct timeval timeout = { .tv_sec = IPERF_SOCKET_RX_TIMEOUT };
+    int sock = -1;
+    esp_err_t ret = ESP_OK;
+
+    if (req.interval_ms == 0) {
+        req.interval_ms = IPERF_DEFAULT_INTERVAL * 1000;
+    }
+#if IPERF_IPV6_ENABLED
+    if (cfg->type == IPERF_IP_TYPE_IPV6) {
+        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&addr;
+        inet6_aton(cfg->destination_ip6, &addr6->sin6_addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(iperf_ctrl_port(cfg->dport));
+        addr_len = sizeof(*addr6);
+    }
+#endif
+#if IPERF_IPV4_ENABLED
+    if (cfg->type == IPERF_IP_TYPE_IPV4) {
+        struct sockaddr_in *addr4 = (struct sockaddr_in *)&addr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(iperf_ctrl_port(cfg->dport));
+        addr4->sin_addr.s_addr = cfg->destination_ip4;
+        addr_len = sizeof(*addr4);
+    }
+#endif
+    ESP_GOTO_ON_FALSE(addr_len, ESP_ERR_INVALID_ARG, exit, TAG, "Invalid iperf address type!");
+
+    sock = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    ESP_GOTO_ON_FALSE((sock >= 0), ESP_FAIL, exit, TAG, "Unable to create control socket: errno %d", errno);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ESP_GOTO_ON_FALSE(connect(sock, (struct sockaddr *)&addr, addr_len) == 0, ESP_FAIL, exit, TAG,
+                      "Control channel unable to connect: errno %d", errno);
+
+    iperf_ctrl_encode_req(&req, buf);
+    ESP_GOTO_ON_ERROR(iperf_ctrl_send_all(sock, buf, IPERF_CTRL_REQ_LEN), exit, TAG, "Control request send failed");
+    ESP_GOTO_ON_ERROR(iperf_ctrl_recv_all(sock, buf, IPERF_CTRL_ACK_LEN), exit, TAG, "No control reply from peer");
+    ESP_GOTO_ON_FALSE(iperf_ctrl_get_u32(&buf[0]) == IPERF_CTRL_MAGIC && buf[5] == 0, ESP_FAIL, exit, TAG,
+                      "Peer rejected the %s test", (req.flag & IPERF_FLAG_BIDIR) ? "bidir" : "reverse");
+
+    if (req.flag & IPERF_FLAG_BIDIR) {
+        ret = iperf_session_start(cfg, true);
+    }
+
+exit:
+    if (sock != -1) {
+        close(sock);
+    }
+    if (ret != ESP_OK) {
+        // Nobody will send to the receiving half, stop it instead of waiting for its timeout
+        iperf_stop();
+    }
+    free(cfg);
+    vTaskDelete(NULL);
+}
+
+/* Reverse and bidir tests: receive locally, then ask the peer over the control channel to send */
+static esp_err_t iperf_start_peer_test(const iperf_cfg_t *cfg)
+{
+    iperf_cfg_t rx_cfg = *cfg;
+    iperf_cfg_t *req_cfg;
+    esp_err_t ret = ESP_OK;
+
+    IPERF_FLAG_CLR(rx_cfg.flag, IPERF_FLAG_CLIENT);
+    IPERF_FLAG_SET(rx_cfg.flag, IPERF_FLAG_SERVER);
+    rx_cfg.sport = iperf_ctrl_rx_port(cfg);
+    ESP_RETURN_ON_ERROR(iperf_session_start(&rx_cfg, true), TAG, "start receiving half failed");
+
+    req_cfg = (iperf_cfg_t *)malloc(sizeof(*req_cfg));
+    ESP_GOTO_ON_FALSE(req_cfg, ESP_ERR_NO_MEM, err, TAG, "create control request: not enough memory");
+    memcpy(req_cfg, cfg, sizeof(*req_cfg));
+    if (xTaskCreatePinnedToCore(iperf_ctrl_request_task, IPERF_CTRL_TASK_NAME, IPERF_CTRL_TASK_STACK, req_cfg,
+                                IPERF_REPORT_TASK_PRIORITY, NULL, NUMBER_OF_CORES - 1) != pdPASS) {
+        free(req_cfg);
+        ESP_LOGE(TAG, "create task %s failed", IPERF_CTRL_TASK_NAME);
+        goto err;
+    }
+    return ESP_OK;
+
+err:
+    iperf_stop();
+    return ret == ESP_OK ? ESP_FAIL : ret;
+}
+
+esp_err_t iperf_start(iperf_cfg_t *cfg)
+{
+    if (!cfg) {
+        return ESP_FAIL;
     }
+
     if (g_iperf_is_running) {
-        s_iperf_ctrl.finish = true;
+        ESP_LOGW(TAG, "iperf is running");
+        return ESP_FAIL;
+    }
+
+    if ((cfg->flag & IPERF_FLAG_CLIENT) && (cfg->flag & (IPERF_FLAG_REVERSE | IPERF_FLAG_BIDIR))) {
+        return iperf_start_peer_test(cfg);
+    }
+    return iperf_session_start(cfg, false);
+}
+
+esp_err_t iperf_stop(void)
+{
+    for (int i = 0; i < IPERF_MAX_SESSIONS; i++) {
+        iperf_session_t *session = &s_iperf_sessions[i];
+        if (session->in_use) {
+            /* close listen sockets to stop tcp servers and the control channel */
+            iperf_close_listen_socket(session);
+            session->finish = true;
+        }
     }
 
     for (int i = 0; i < 10; i ++) {
@@ -672,3 +1762,8 @@ void iperf_register_hook_func(iperf_hook_func_t func)
 {
     iperf_hook_func = func;
 }
+
+void iperf_register_report_func(iperf_report_func_t func)
+{
+    s_iperf_report_func = func;
+}
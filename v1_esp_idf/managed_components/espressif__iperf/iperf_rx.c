@@ -0,0 +1,48 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <string.h>
+#include "iperf_rx.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+IRAM_ATTR int iperf_rx_drain(int sock, uint8_t *buffer, size_t buffer_len, uint32_t max_reads, bool datagram,
+                             iperf_rx_datagram_func_t func, void *ctx, iperf_rx_batch_t *batch)
+{
+    struct sockaddr_storage from;
+    socklen_t from_len;
+    int flags = 0;
+    int len;
+
+    memset(batch, 0, sizeof(*batch));
+    while (batch->reads < max_reads) {
+        from_len = sizeof(from);
+        len = recvfrom(sock, buffer, buffer_len, flags, (struct sockaddr *)&from, &from_len);
+        if (len < 0) {
+            if (batch->reads == 0) {
+                return -1;
+            }
+            // EAGAIN ends the batch, any other error shows up again on the next blocking read
+            break;
+        }
+        if (len == 0 && !datagram) {
+            batch->closed = true;
+            break;
+        }
+        batch->bytes += len;
+        batch->reads++;
+        if (func) {
+            func(ctx, buffer, len, &from, from_len);
+        }
+        // The socket is drained without blocking once the first read woke us up
+        flags = MSG_DONTWAIT;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Batched receive engine shared by the iperf servers and the host reference receiver.
+ * It only depends on BSD sockets, so the same code runs on lwIP and on Linux.
+ */
+
+/* Called for every datagram of a batch, before the buffer is reused by the next read */
+typedef void (*iperf_rx_datagram_func_t)(void *ctx, const uint8_t *buffer, int len,
+                                         const struct sockaddr_storage *from, socklen_t from_len);
+
+typedef struct {
+    uint64_t bytes;  /* bytes received by the batch */
+    uint32_t reads;  /* successful reads, one per datagram on UDP sockets */
+    bool closed;     /* the peer closed the stream socket */
+} iperf_rx_batch_t;
+
+/**
+ * @brief Blocks for the first read (bounded by the socket receive timeout), then
+ *        drains up to max_reads - 1 more reads without blocking
+ *
+ * @param[in] sock socket to read from
+ * @param[in] buffer buffer reused by every read of the batch
+ * @param[in] buffer_len size of buffer
+ * @param[in] max_reads upper bound of reads in one batch
+ * @param[in] datagram true for UDP sockets, where a zero length read is a valid datagram
+ * @param[in] func called for every datagram, may be NULL
+ * @param[in] ctx passed to func
+ * @param[out] batch totals of the batch
+ *
+ * @return 0 when the batch read data or the peer closed the socket, -1 with errno set otherwise
+ */
+int iperf_rx_drain(int sock, uint8_t *buffer, size_t buffer_len, uint32_t max_reads, bool datagram,
+                   iperf_rx_datagram_func_t func, void *ctx, iperf_rx_batch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,164 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Host micro-benchmark of the SPI backend pixel encoding. The bitwise encoder the backend used before is kept
+ * here as the reference, the table driven one is checked against it for every byte value before timing.
+ *
+ *   led_strip_spi_bench [-n pixels] [-i iterations] [-w]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "led_strip_spi_encoder.h"
+
+#define BIT(nr) (1UL << (nr))
+
+// please make sure to zero-initialize the buf before calling this function
+static void __led_strip_spi_bit(uint8_t data, uint8_t *buf)
+{
+    // Each color of 1 bit is represented by 3 bits of SPI, low_level:100 ,high_level:110
+    // So a color byte occupies 3 bytes of SPI.
+    *(buf + 2) |= data & BIT(0) ? BIT(2) | BIT(1) : BIT(2);
+    *(buf + 2) |= data & BIT(1) ? BIT(5) | BIT(4) : BIT(5);
+    *(buf + 2) |= data & BIT(2) ? BIT(7) : 0x00;
+    *(buf + 1) |= BIT(0);
+    *(buf + 1) |= data & BIT(3) ? BIT(3) | BIT(2) : BIT(3);
+    *(buf + 1) |= data & BIT(4) ? BIT(6) | BIT(5) : BIT(6);
+    *(buf + 0) |= data & BIT(5) ? BIT(1) | BIT(0) : BIT(1);
+    *(buf + 0) |= data & BIT(6) ? BIT(4) | BIT(3) : BIT(4);
+    *(buf + 0) |= data & BIT(7) ? BIT(7) | BIT(6) : BIT(7);
+}
+
+// The former led_strip_spi_set_pixel()/led_strip_spi_set_pixel_rgbw() body
+static void reference_set_pixel(uint8_t *pixel_buf, uint32_t index, uint8_t bytes_per_pixel, const uint8_t *rgbw)
+{
+    uint32_t start = index * bytes_per_pixel * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE;
+    memset(pixel_buf + start, 0, bytes_per_pixel * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE);
+    __led_strip_spi_bit(rgbw[1], &pixel_buf[start]);
+    __led_strip_spi_bit(rgbw[0], &pixel_buf[start + LED_STRIP_SPI_BYTES_PER_COLOR_BYTE]);
+    __led_strip_spi_bit(rgbw[2], &pixel_buf[start + LED_STRIP_SPI_BYTES_PER_COLOR_BYTE * 2]);
+    if (bytes_per_pixel > 3) {
+        __led_strip_spi_bit(rgbw[3], &pixel_buf[start + LED_STRIP_SPI_BYTES_PER_COLOR_BYTE * 3]);
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int check_encoder(uint8_t bytes_per_pixel)
+{
+    uint8_t pixel[4];
+    uint8_t expected[4 * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE];
+    uint8_t actual[4 * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE];
+
+    for (int value = 0; value < 256; value++) {
+        // each component gets a different value, so a wrong component order is caught as well
+        for (int c = 0; c < 4; c++) {
+            pixel[c] = value + c * 67;
+        }
+        reference_set_pixel(expected, 0, bytes_per_pixel, pixel);
+        led_strip_spi_encode_pixels(pixel, 1, bytes_per_pixel, actual);
+        if (memcmp(expected, actual, bytes_per_pixel * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE) != 0) {
+            fprintf(stderr, "mismatch for %d bytes per pixel at value %d\n", bytes_per_pixel, value);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t pixels = 1000;
+    uint32_t iterations = 2000;
+    uint8_t bytes_per_pixel = 3;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:w")) != -1) {
+        switch (opt) {
+        case 'n':
+            pixels = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            bytes_per_pixel = 4;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n pixels] [-i iterations] [-w]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (pixels == 0 || iterations == 0) {
+        fprintf(stderr, "pixels and iterations must be positive\n");
+        return 2;
+    }
+    if (check_encoder(3) != 0 || check_encoder(4) != 0) {
+        return 1;
+    }
+
+    size_t frame_size = (size_t)pixels * bytes_per_pixel;
+    uint8_t *frame = malloc(frame_size);
+    uint8_t *expected = malloc(frame_size * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE);
+    uint8_t *buf = malloc(frame_size * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE);
+    if (!frame || !expected || !buf) {
+        fprintf(stderr, "no memory for %u pixels\n", (unsigned)pixels);
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < frame_size; i++) {
+        frame[i] = rand();
+    }
+
+    uint64_t start = now_ns();
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t p = 0; p < pixels; p++) {
+            reference_set_pixel(expected, p, bytes_per_pixel, &frame[p * bytes_per_pixel]);
+        }
+        __asm__ volatile("" ::"r"(expected) : "memory");
+    }
+    uint64_t bitwise_ns = now_ns() - start;
+
+    start = now_ns();
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t p = 0; p < pixels; p++) {
+            led_strip_spi_encode_pixels(&frame[p * bytes_per_pixel], 1, bytes_per_pixel,
+                                        &buf[p * bytes_per_pixel * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE]);
+        }
+        __asm__ volatile("" ::"r"(buf) : "memory");
+    }
+    uint64_t table_ns = now_ns() - start;
+
+    start = now_ns();
+    for (uint32_t it = 0; it < iterations; it++) {
+        led_strip_spi_encode_pixels(frame, pixels, bytes_per_pixel, buf);
+        __asm__ volatile("" ::"r"(buf) : "memory");
+    }
+    uint64_t bulk_ns = now_ns() - start;
+
+    if (memcmp(expected, buf, frame_size * LED_STRIP_SPI_BYTES_PER_COLOR_BYTE) != 0) {
+        fprintf(stderr, "bulk encoding differs from the reference\n");
+        return 1;
+    }
+
+    double total = (double)pixels * iterations;
+    printf("%u pixels x %u iterations, %u bytes per pixel\n", (unsigned)pixels, (unsigned)iterations, bytes_per_pixel);
+    printf("bitwise set_pixel: %8.2f ns/pixel\n", bitwise_ns / total);
+    printf("table set_pixel:   %8.2f ns/pixel\n", table_ns / total);
+    printf("table set_pixels:  %8.2f ns/pixel (%.1fx)\n", bulk_ns / total, (double)bitwise_ns / bulk_ns);
+
+    free(frame);
+    free(expected);
+    free(buf);
+    return 0;
+}
@@ -54,6 +54,24 @@ esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index, uint32_t
  */
 esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white);
 
+/**
+ * @brief Set a range of pixels in one pass
+ *
+ * @note Cheaper than one `led_strip_set_pixel` call per pixel when a whole frame changes, the SPI backend encodes
+ *       the range in a single loop.
+ *
+ * @param strip: LED strip
+ * @param start: index of the first pixel to set
+ * @param count: number of pixels to set
+ * @param pixels: colors in RGB order, or RGBW for LED_PIXEL_FORMAT_GRBW strips, one byte per component
+ *
+ * @return
+ *      - ESP_OK: Set the pixels successfully
+ *      - ESP_ERR_INVALID_ARG: Set the pixels failed because of invalid parameters
+ *      - ESP_FAIL: Set the pixels failed because other error occurred
+ */
+esp_err_t led_strip_set_pixels(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint8_t *pixels);
+
 /**
  * @brief Set HSV for a specific pixel
  *
@@ -84,6 +102,57 @@ esp_err_t led_strip_set_pixel_hsv(led_strip_handle_t strip, uint32_t index, uint
  */
 esp_err_t led_strip_refresh(led_strip_handle_t strip);
 
+/**
+ * @brief Start refreshing memory colors to LEDs without waiting for the transfer to finish
+ *
+ * The colors are copied to a second buffer that is sent out in the background, so the next frame can be prepared
+ * with the set_pixel functions while this one is still on the wire. A refresh that is still in progress is waited
+ * for first.
+ *
+ * @param strip: LED strip
+ *
+ * @return
+ *      - ESP_OK: Refresh started successfully
+ *      - ESP_ERR_NOT_SUPPORTED: The backend does not support asynchronous refresh
+ *      - ESP_FAIL: Refresh failed because some other error occurred
+ *
+ * @note:
+ *      With `partial_refresh` set in the strip configuration, only the pixels up to the last one changed since
+ *      the previous refresh are sent, the LEDs after it keep their colors.
+ */
+esp_err_t led_strip_refresh_async(led_strip_handle_t strip);
+
+/**
+ * @brief Wait for the refresh started by `led_strip_refresh_async` to finish
+ *
+ * @param strip: LED strip
+ * @param timeout_ms: timeout in milliseconds, -1 waits forever
+ *
+ * @return
+ *      - ESP_OK: No refresh is in progress any more
+ *      - ESP_ERR_TIMEOUT: The refresh did not finish in time
+ *      - ESP_ERR_NOT_SUPPORTED: The backend does not support asynchronous refresh
+ *      - ESP_FAIL: Wait failed because some other error occurred
+ */
+esp_err_t led_strip_wait_refresh_done(led_strip_handle_t strip, int timeout_ms);
+
+/**
+ * @brief Register the callback invoked when a refresh has been sent out
+ *
+ * @param strip: LED strip
+ * @param cb: callback invoked from ISR context, NULL to unregister
+ * @param user_ctx: user context passed to the callback
+ *
+ * @return
+ *      - ESP_OK: Register the callback successfully
+ *      - ESP_ERR_NOT_SUPPORTED: The backend does not support asynchronous refresh
+ *      - ESP_FAIL: Register the callback failed because some other error occurred
+ *
+ * @note:
+ *      The callback is invoked for frames sent by `led_strip_refresh_async`, `led_strip_refresh` and `led_strip_clear`.
+ */
+esp_err_t led_strip_register_refresh_done_callback(led_strip_handle_t strip, led_strip_refresh_done_cb_t cb, void *user_ctx);
+
 /**
  * @brief Clear LED strip (turn off all LEDs)
  *
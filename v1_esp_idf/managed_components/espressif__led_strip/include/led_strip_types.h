@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -46,9 +47,22 @@ typedef struct {
 
     struct {
         uint32_t invert_out: 1; /*!< Invert output signal */
+        uint32_t partial_refresh: 1; /*!< Only send the pixels up to the last one changed since the previous refresh */
     } flags;                    /*!< Extra driver flags */
 } led_strip_config_t;
 
+/**
+ * @brief Type of the callback invoked when a refresh started by `led_strip_refresh_async` has been sent out
+ *
+ * @param strip: LED strip
+ * @param user_ctx: user context passed to `led_strip_register_refresh_done_callback`
+ *
+ * @return Whether a high priority task has been woken up by this callback
+ *
+ * @note The callback runs in ISR context, it must not block.
+ */
+typedef bool (*led_strip_refresh_done_cb_t)(led_strip_handle_t strip, void *user_ctx);
+
 #ifdef __cplusplus
 }
 #endif
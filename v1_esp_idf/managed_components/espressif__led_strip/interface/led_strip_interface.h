@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "led_strip_types.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,6 +52,21 @@ struct led_strip_t {
      */
     esp_err_t (*set_pixel_rgbw)(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white);
 
+    /**
+     * @brief Set a range of pixels in one pass
+     *
+     * @param strip: LED strip
+     * @param start: index of the first pixel to set
+     * @param count: number of pixels to set
+     * @param pixels: colors in RGB order, or RGBW for strips with a white component, one byte per component
+     *
+     * @return
+     *      - ESP_OK: Set the pixels successfully
+     *      - ESP_ERR_INVALID_ARG: Set the pixels failed because the range is out of the strip
+     *      - ESP_FAIL: Set the pixels failed because other error occurred
+     */
+    esp_err_t (*set_pixels)(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels);
+
     /**
      * @brief Refresh memory colors to LEDs
      *
@@ -66,6 +82,46 @@ struct led_strip_t {
      */
     esp_err_t (*refresh)(led_strip_t *strip);
 
+    /**
+     * @brief Start sending memory colors to LEDs without waiting for the transfer to finish
+     *
+     * @param strip: LED strip
+     *
+     * @return
+     *      - ESP_OK: Refresh started successfully
+     *      - ESP_FAIL: Refresh failed because some other error occurred
+     *
+     * @note:
+     *      Pixels set after this call go to the next frame, the frame on the wire is not affected.
+     */
+    esp_err_t (*refresh_async)(led_strip_t *strip);
+
+    /**
+     * @brief Wait for the refresh started by `refresh_async` to finish
+     *
+     * @param strip: LED strip
+     * @param timeout_ms: timeout in milliseconds, -1 waits forever
+     *
+     * @return
+     *      - ESP_OK: No refresh is in progress any more
+     *      - ESP_ERR_TIMEOUT: The refresh did not finish in time
+     *      - ESP_FAIL: Wait failed because some other error occurred
+     */
+    esp_err_t (*wait_refresh_done)(led_strip_t *strip, int timeout_ms);
+
+    /**
+     * @brief Register the callback invoked from ISR context when a refresh has been sent out
+     *
+     * @param strip: LED strip
+     * @param cb: callback, NULL to unregister
+     * @param user_ctx: user context passed to the callback
+     *
+     * @return
+     *      - ESP_OK: Register the callback successfully
+     *      - ESP_FAIL: Register the callback failed because some other error occurred
+     */
+    esp_err_t (*register_refresh_done_callback)(led_strip_t *strip, led_strip_refresh_done_cb_t cb, void *user_ctx);
+
     /**
      * @brief Clear LED strip (turn off all LEDs)
      *
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_check.h"
 #include "driver/rmt_tx.h"
@@ -28,15 +29,33 @@ typedef struct {
     led_strip_t base;
     rmt_channel_handle_t rmt_chan;
     rmt_encoder_handle_t strip_encoder;
+    led_strip_refresh_done_cb_t done_cb;
+    void *done_cb_ctx;
     uint32_t strip_len;
+    uint32_t dirty_start; // first pixel changed since the last refresh
+    uint32_t dirty_end;   // one past the last pixel changed since the last refresh
     uint8_t bytes_per_pixel;
+    bool partial_refresh;
+    bool enabled;
+    uint8_t *front_buf;   // the frame on the wire, pixel_buf is the one being prepared
     uint8_t pixel_buf[];
 } led_strip_rmt_obj;
 
+static void led_strip_rmt_mark_dirty(led_strip_rmt_obj *rmt_strip, uint32_t index)
+{
+    if (index < rmt_strip->dirty_start) {
+        rmt_strip->dirty_start = index;
+    }
+    if (index >= rmt_strip->dirty_end) {
+        rmt_strip->dirty_end = index + 1;
+    }
+}
+
 static esp_err_t led_strip_rmt_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     ESP_RETURN_ON_FALSE(index < rmt_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    led_strip_rmt_mark_dirty(rmt_strip, index);
     uint32_t start = index * rmt_strip->bytes_per_pixel;
     // In thr order of GRB, as LED strip like WS2812 sends out pixels in this order
     rmt_strip->pixel_buf[start + 0] = green & 0xFF;
@@ -53,6 +72,7 @@ static esp_err_t led_strip_rmt_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     ESP_RETURN_ON_FALSE(index < rmt_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
     ESP_RETURN_ON_FALSE(rmt_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    led_strip_rmt_mark_dirty(rmt_strip, index);
     uint8_t *buf_start = rmt_strip->pixel_buf + index * 4;
     // SK6812 component order is GRBW
     *buf_start = green & 0xFF;
@@ -62,18 +82,104 @@ static esp_err_t led_strip_rmt_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     return ESP_OK;
 }
 
-static esp_err_t led_strip_rmt_refresh(led_strip_t *strip)
+static esp_err_t led_strip_rmt_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    ESP_RETURN_ON_FALSE(start < rmt_strip->strip_len && count <= rmt_strip->strip_len - start, ESP_ERR_INVALID_ARG, TAG,
+                        "range out of maximum number of LEDs");
+    if (count == 0) {
+        return ESP_OK;
+    }
+    led_strip_rmt_mark_dirty(rmt_strip, start);
+    led_strip_rmt_mark_dirty(rmt_strip, start + count - 1);
+    uint8_t bytes_per_pixel = rmt_strip->bytes_per_pixel;
+    uint8_t *buf = rmt_strip->pixel_buf + start * bytes_per_pixel;
+    for (uint32_t i = 0; i < count; i++, pixels += bytes_per_pixel, buf += bytes_per_pixel) {
+        // RGB(W) in, GRB(W) on the wire
+        buf[0] = pixels[1];
+        buf[1] = pixels[0];
+        buf[2] = pixels[2];
+        if (bytes_per_pixel > 3) {
+            buf[3] = pixels[3];
+        }
+    }
+    return ESP_OK;
+}
+
+static bool IRAM_ATTR led_strip_rmt_trans_done(rmt_channel_handle_t tx_chan, const rmt_tx_done_event_data_t *edata, void *user_ctx)
+{
+    led_strip_rmt_obj *rmt_strip = (led_strip_rmt_obj *)user_ctx;
+    led_strip_refresh_done_cb_t cb = rmt_strip->done_cb;
+    return cb ? cb(&rmt_strip->base, rmt_strip->done_cb_ctx) : false;
+}
+
+// Copy the pixels changed since the last refresh to the front buffer, returns the number of bytes to send
+static size_t led_strip_rmt_prepare_frame(led_strip_rmt_obj *rmt_strip)
+{
+    uint32_t frame_len = rmt_strip->strip_len;
+    if (rmt_strip->dirty_start < rmt_strip->dirty_end) {
+        uint32_t start = rmt_strip->dirty_start * rmt_strip->bytes_per_pixel;
+        memcpy(rmt_strip->front_buf + start, rmt_strip->pixel_buf + start,
+               rmt_strip->dirty_end * rmt_strip->bytes_per_pixel - start);
+    }
+    if (rmt_strip->partial_refresh) {
+        // LEDs latch the first pixel they receive and pass the rest on, so the ones after the last changed pixel
+        // keep their colors. At least one pixel is sent, so that every refresh completes with a callback.
+        frame_len = rmt_strip->dirty_end ? rmt_strip->dirty_end : 1;
+    }
+    rmt_strip->dirty_start = UINT32_MAX;
+    rmt_strip->dirty_end = 0;
+    return frame_len * rmt_strip->bytes_per_pixel;
+}
+
+static esp_err_t led_strip_rmt_refresh_async(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     rmt_transmit_config_t tx_conf = {
         .loop_count = 0,
     };
 
-    ESP_RETURN_ON_ERROR(rmt_enable(rmt_strip->rmt_chan), TAG, "enable RMT channel failed");
-    ESP_RETURN_ON_ERROR(rmt_transmit(rmt_strip->rmt_chan, rmt_strip->strip_encoder, rmt_strip->pixel_buf,
-                                     rmt_strip->strip_len * rmt_strip->bytes_per_pixel, &tx_conf), TAG, "transmit pixels by RMT failed");
+    if (rmt_strip->enabled) {
+        // the front buffer may still be on the wire
+        ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
+    } else {
+        ESP_RETURN_ON_ERROR(rmt_enable(rmt_strip->rmt_chan), TAG, "enable RMT channel failed");
+        rmt_strip->enabled = true;
+    }
+    size_t frame_size = led_strip_rmt_prepare_frame(rmt_strip);
+    ESP_RETURN_ON_ERROR(rmt_transmit(rmt_strip->rmt_chan, rmt_strip->strip_encoder, rmt_strip->front_buf,
+                                     frame_size, &tx_conf), TAG, "transmit pixels by RMT failed");
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_rmt_wait_refresh_done(led_strip_t *strip, int timeout_ms)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    if (!rmt_strip->enabled) {
+        return ESP_OK;
+    }
+    return rmt_tx_wait_all_done(rmt_strip->rmt_chan, timeout_ms);
+}
+
+static esp_err_t led_strip_rmt_register_refresh_done_callback(led_strip_t *strip, led_strip_refresh_done_cb_t cb, void *user_ctx)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    // the RMT callback is registered once at creation and reads these fields, clear the callback first so that
+    // it is never invoked with the context of another one
+    rmt_strip->done_cb = NULL;
+    rmt_strip->done_cb_ctx = user_ctx;
+    rmt_strip->done_cb = cb;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_rmt_refresh(led_strip_t *strip)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+
+    ESP_RETURN_ON_ERROR(led_strip_rmt_refresh_async(strip), TAG, "refresh pixels failed");
     ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
     ESP_RETURN_ON_ERROR(rmt_disable(rmt_strip->rmt_chan), TAG, "disable RMT channel failed");
+    rmt_strip->enabled = false;
     return ESP_OK;
 }
 
@@ -82,12 +188,19 @@ static esp_err_t led_strip_rmt_clear(led_strip_t *strip)
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     // Write zero to turn off all leds
     memset(rmt_strip->pixel_buf, 0, rmt_strip->strip_len * rmt_strip->bytes_per_pixel);
+    rmt_strip->dirty_start = 0;
+    rmt_strip->dirty_end = rmt_strip->strip_len;
     return led_strip_rmt_refresh(strip);
 }
 
 static esp_err_t led_strip_rmt_del(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    if (rmt_strip->enabled) {
+        ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
+        ESP_RETURN_ON_ERROR(rmt_disable(rmt_strip->rmt_chan), TAG, "disable RMT channel failed");
+        rmt_strip->enabled = false;
+    }
     ESP_RETURN_ON_ERROR(rmt_del_channel(rmt_strip->rmt_chan), TAG, "delete RMT channel failed");
     ESP_RETURN_ON_ERROR(rmt_del_encoder(rmt_strip->strip_encoder), TAG, "delete strip encoder failed");
     free(rmt_strip);
@@ -108,7 +221,8 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     } else {
         assert(false);
     }
-    rmt_strip = calloc(1, sizeof(led_strip_rmt_obj) + led_config->max_leds * bytes_per_pixel);
+    // the back buffer (pixel_buf) is followed by the front buffer
+    rmt_strip = calloc(1, sizeof(led_strip_rmt_obj) + 2 * led_config->max_leds * bytes_per_pixel);
     ESP_GOTO_ON_FALSE(rmt_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for rmt strip");
     uint32_t resolution = rmt_config->resolution_hz ? rmt_config->resolution_hz : LED_STRIP_RMT_DEFAULT_RESOLUTION;
 
@@ -139,12 +253,23 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     };
     ESP_GOTO_ON_ERROR(rmt_new_led_strip_encoder(&strip_encoder_conf, &rmt_strip->strip_encoder), err, TAG, "create LED strip encoder failed");
 
+    rmt_tx_event_callbacks_t cbs = {
+        .on_trans_done = led_strip_rmt_trans_done,
+    };
+    ESP_GOTO_ON_ERROR(rmt_tx_register_event_callbacks(rmt_strip->rmt_chan, &cbs, rmt_strip), err, TAG, "register RMT callbacks failed");
 
     rmt_strip->bytes_per_pixel = bytes_per_pixel;
     rmt_strip->strip_len = led_config->max_leds;
+    rmt_strip->front_buf = rmt_strip->pixel_buf + led_config->max_leds * bytes_per_pixel;
+    rmt_strip->dirty_start = UINT32_MAX;
+    rmt_strip->partial_refresh = led_config->flags.partial_refresh;
     rmt_strip->base.set_pixel = led_strip_rmt_set_pixel;
     rmt_strip->base.set_pixel_rgbw = led_strip_rmt_set_pixel_rgbw;
+    rmt_strip->base.set_pixels = led_strip_rmt_set_pixels;
     rmt_strip->base.refresh = led_strip_rmt_refresh;
+    rmt_strip->base.refresh_async = led_strip_rmt_refresh_async;
+    rmt_strip->base.wait_refresh_done = led_strip_rmt_wait_refresh_done;
+    rmt_strip->base.register_refresh_done_callback = led_strip_rmt_register_refresh_done_callback;
     rmt_strip->base.clear = led_strip_rmt_clear;
     rmt_strip->base.del = led_strip_rmt_del;
 
@@ -6,18 +6,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_check.h"
 #include "esp_rom_gpio.h"
 #include "soc/spi_periph.h"
 #include "led_strip.h"
 #include "led_strip_interface.h"
+#include "led_strip_spi_encoder.h"
 #include "hal/spi_hal.h"
 
 #define LED_STRIP_SPI_DEFAULT_RESOLUTION (2.5 * 1000 * 1000) // 2.5MHz resolution
 #define LED_STRIP_SPI_DEFAULT_TRANS_QUEUE_SIZE 4
 
-#define SPI_BYTES_PER_COLOR_BYTE 3
+#define SPI_BYTES_PER_COLOR_BYTE LED_STRIP_SPI_BYTES_PER_COLOR_BYTE
 #define SPI_BITS_PER_COLOR_BYTE (SPI_BYTES_PER_COLOR_BYTE * 8)
 
 static const char *TAG = "led_strip_spi";
@@ -26,40 +28,38 @@ typedef struct {
     led_strip_t base;
     spi_host_device_t spi_host;
     spi_device_handle_t spi_device;
+    spi_transaction_t trans; // the queued transaction, must outlive the transfer
+    led_strip_refresh_done_cb_t done_cb;
+    void *done_cb_ctx;
     uint32_t strip_len;
+    uint32_t dirty_start; // first pixel changed since the last refresh
+    uint32_t dirty_end;   // one past the last pixel changed since the last refresh
     uint8_t bytes_per_pixel;
+    bool partial_refresh;
+    bool in_flight;
+    uint8_t *front_buf;   // the frame on the wire, pixel_buf is the one being prepared
     uint8_t pixel_buf[];
 } led_strip_spi_obj;
 
-// please make sure to zero-initialize the buf before calling this function
-static void __led_strip_spi_bit(uint8_t data, uint8_t *buf)
+static void led_strip_spi_mark_dirty(led_strip_spi_obj *spi_strip, uint32_t index)
 {
-    // Each color of 1 bit is represented by 3 bits of SPI, low_level:100 ,high_level:110
-    // So a color byte occupies 3 bytes of SPI.
-    *(buf + 2) |= data & BIT(0) ? BIT(2) | BIT(1) : BIT(2);
-    *(buf + 2) |= data & BIT(1) ? BIT(5) | BIT(4) : BIT(5);
-    *(buf + 2) |= data & BIT(2) ? BIT(7) : 0x00;
-    *(buf + 1) |= BIT(0);
-    *(buf + 1) |= data & BIT(3) ? BIT(3) | BIT(2) : BIT(3);
-    *(buf + 1) |= data & BIT(4) ? BIT(6) | BIT(5) : BIT(6);
-    *(buf + 0) |= data & BIT(5) ? BIT(1) | BIT(0) : BIT(1);
-    *(buf + 0) |= data & BIT(6) ? BIT(4) | BIT(3) : BIT(4);
-    *(buf + 0) |= data & BIT(7) ? BIT(7) | BIT(6) : BIT(7);
+    if (index < spi_strip->dirty_start) {
+        spi_strip->dirty_start = index;
+    }
+    if (index >= spi_strip->dirty_end) {
+        spi_strip->dirty_end = index + 1;
+    }
 }
 
 static esp_err_t led_strip_spi_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
     ESP_RETURN_ON_FALSE(index < spi_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    led_strip_spi_mark_dirty(spi_strip, index);
     // LED_PIXEL_FORMAT_GRB takes 72bits(9bytes)
     uint32_t start = index * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
-    memset(spi_strip->pixel_buf + start, 0, spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE);
-    __led_strip_spi_bit(green, &spi_strip->pixel_buf[start]);
-    __led_strip_spi_bit(red, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE]);
-    __led_strip_spi_bit(blue, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 2]);
-    if (spi_strip->bytes_per_pixel > 3) {
-        __led_strip_spi_bit(0, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 3]);
-    }
+    uint8_t pixel[4] = {red, green, blue, 0};
+    led_strip_spi_encode_pixels(pixel, 1, spi_strip->bytes_per_pixel, &spi_strip->pixel_buf[start]);
     return ESP_OK;
 }
 
@@ -68,42 +68,117 @@ static esp_err_t led_strip_spi_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
     ESP_RETURN_ON_FALSE(index < spi_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
     ESP_RETURN_ON_FALSE(spi_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    led_strip_spi_mark_dirty(spi_strip, index);
     // LED_PIXEL_FORMAT_GRBW takes 96bits(12bytes)
     uint32_t start = index * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
-    // SK6812 component order is GRBW
-    memset(spi_strip->pixel_buf + start, 0, spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE);
-    __led_strip_spi_bit(green, &spi_strip->pixel_buf[start]);
-    __led_strip_spi_bit(red, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE]);
-    __led_strip_spi_bit(blue, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 2]);
-    __led_strip_spi_bit(white, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 3]);
+    uint8_t pixel[4] = {red, green, blue, white};
+    led_strip_spi_encode_pixels(pixel, 1, 4, &spi_strip->pixel_buf[start]);
+    return ESP_OK;
+}
 
+static esp_err_t led_strip_spi_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    ESP_RETURN_ON_FALSE(start < spi_strip->strip_len && count <= spi_strip->strip_len - start, ESP_ERR_INVALID_ARG, TAG,
+                        "range out of maximum number of LEDs");
+    if (count == 0) {
+        return ESP_OK;
+    }
+    led_strip_spi_mark_dirty(spi_strip, start);
+    led_strip_spi_mark_dirty(spi_strip, start + count - 1);
+    led_strip_spi_encode_pixels(pixels, count, spi_strip->bytes_per_pixel,
+                                &spi_strip->pixel_buf[start * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE]);
     return ESP_OK;
 }
 
-static esp_err_t led_strip_spi_refresh(led_strip_t *strip)
+static void IRAM_ATTR led_strip_spi_trans_done(spi_transaction_t *trans)
+{
+    led_strip_spi_obj *spi_strip = (led_strip_spi_obj *)trans->user;
+    led_strip_refresh_done_cb_t cb = spi_strip->done_cb;
+    if (cb && cb(&spi_strip->base, spi_strip->done_cb_ctx)) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+// Copy the pixels changed since the last refresh to the front buffer, returns the number of bytes to send
+static size_t led_strip_spi_prepare_frame(led_strip_spi_obj *spi_strip)
+{
+    uint32_t pixel_size = spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+    uint32_t frame_len = spi_strip->strip_len;
+    if (spi_strip->dirty_start < spi_strip->dirty_end) {
+        uint32_t start = spi_strip->dirty_start * pixel_size;
+        memcpy(spi_strip->front_buf + start, spi_strip->pixel_buf + start, spi_strip->dirty_end * pixel_size - start);
+    }
+    if (spi_strip->partial_refresh) {
+        // LEDs latch the first pixel they receive and pass the rest on, so the ones after the last changed pixel
+        // keep their colors. At least one pixel is sent, so that every refresh completes with a callback.
+        frame_len = spi_strip->dirty_end ? spi_strip->dirty_end : 1;
+    }
+    spi_strip->dirty_start = UINT32_MAX;
+    spi_strip->dirty_end = 0;
+    return frame_len * pixel_size;
+}
+
+static esp_err_t led_strip_spi_wait_refresh_done(led_strip_t *strip, int timeout_ms)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    spi_transaction_t *done_trans = NULL;
+    if (!spi_strip->in_flight) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(spi_device_get_trans_result(spi_strip->spi_device, &done_trans,
+                                                    timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)),
+                        TAG, "wait for SPI transaction failed");
+    spi_strip->in_flight = false;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_refresh_async(led_strip_t *strip)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
-    spi_transaction_t tx_conf;
-    memset(&tx_conf, 0, sizeof(tx_conf));
 
-    tx_conf.length = spi_strip->strip_len * spi_strip->bytes_per_pixel * SPI_BITS_PER_COLOR_BYTE;
-    tx_conf.tx_buffer = spi_strip->pixel_buf;
-    tx_conf.rx_buffer = NULL;
-    ESP_RETURN_ON_ERROR(spi_device_transmit(spi_strip->spi_device, &tx_conf), TAG, "transmit pixels by SPI failed");
+    // the front buffer may still be on the wire
+    ESP_RETURN_ON_ERROR(led_strip_spi_wait_refresh_done(strip, -1), TAG, "flush SPI device failed");
+    size_t frame_size = led_strip_spi_prepare_frame(spi_strip);
+    memset(&spi_strip->trans, 0, sizeof(spi_strip->trans));
+    spi_strip->trans.length = frame_size * 8;
+    spi_strip->trans.tx_buffer = spi_strip->front_buf;
+    spi_strip->trans.rx_buffer = NULL;
+    spi_strip->trans.user = spi_strip;
+    ESP_RETURN_ON_ERROR(spi_device_queue_trans(spi_strip->spi_device, &spi_strip->trans, portMAX_DELAY), TAG, "transmit pixels by SPI failed");
+    spi_strip->in_flight = true;
+    return ESP_OK;
+}
 
+static esp_err_t led_strip_spi_register_refresh_done_callback(led_strip_t *strip, led_strip_refresh_done_cb_t cb, void *user_ctx)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    // the post transaction callback reads these fields, clear the callback first so that it is never invoked with
+    // the context of another one
+    spi_strip->done_cb = NULL;
+    spi_strip->done_cb_ctx = user_ctx;
+    spi_strip->done_cb = cb;
     return ESP_OK;
 }
 
+static esp_err_t led_strip_spi_refresh(led_strip_t *strip)
+{
+    ESP_RETURN_ON_ERROR(led_strip_spi_refresh_async(strip), TAG, "refresh pixels failed");
+    return led_strip_spi_wait_refresh_done(strip, -1);
+}
+
 static esp_err_t led_strip_spi_clear(led_strip_t *strip)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
     //Write zero to turn off all leds
-    memset(spi_strip->pixel_buf, 0, spi_strip->strip_len * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE);
+    static const uint8_t off[4] = {0};
     uint8_t *buf = spi_strip->pixel_buf;
-    for (int index = 0; index < spi_strip->strip_len * spi_strip->bytes_per_pixel; index++) {
-        __led_strip_spi_bit(0, buf);
-        buf += SPI_BYTES_PER_COLOR_BYTE;
+    for (int index = 0; index < spi_strip->strip_len; index++) {
+        led_strip_spi_encode_pixels(off, 1, spi_strip->bytes_per_pixel, buf);
+        buf += spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
     }
+    spi_strip->dirty_start = 0;
+    spi_strip->dirty_end = spi_strip->strip_len;
 
     return led_strip_spi_refresh(strip);
 }
@@ -112,6 +187,8 @@ static esp_err_t led_strip_spi_del(led_strip_t *strip)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
 
+    ESP_RETURN_ON_ERROR(led_strip_spi_wait_refresh_done(strip, -1), TAG, "flush SPI device failed");
+
     ESP_RETURN_ON_ERROR(spi_bus_remove_device(spi_strip->spi_device), TAG, "delete spi device failed");
     ESP_RETURN_ON_ERROR(spi_bus_free(spi_strip->spi_host), TAG, "free spi bus failed");
 
@@ -138,7 +215,9 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
         // DMA buffer must be placed in internal SRAM
         mem_caps |= MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA;
     }
-    spi_strip = heap_caps_calloc(1, sizeof(led_strip_spi_obj) + led_config->max_leds * bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE, mem_caps);
+    // the back buffer (pixel_buf) is followed by the front buffer, which starts word aligned for DMA
+    size_t buf_size = (led_config->max_leds * bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE + 3) & ~3;
+    spi_strip = heap_caps_calloc(1, sizeof(led_strip_spi_obj) + 2 * buf_size, mem_caps);
 
     ESP_GOTO_ON_FALSE(spi_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for spi strip");
 
@@ -174,6 +253,7 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
         //set -1 when CS is not used
         .spics_io_num = -1,
         .queue_size = LED_STRIP_SPI_DEFAULT_TRANS_QUEUE_SIZE,
+        .post_cb = led_strip_spi_trans_done,
     };
 
     ESP_GOTO_ON_ERROR(spi_bus_add_device(spi_strip->spi_host, &spi_dev_cfg, &spi_strip->spi_device), err, TAG, "Failed to add spi device");
@@ -189,9 +269,16 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
 
     spi_strip->bytes_per_pixel = bytes_per_pixel;
     spi_strip->strip_len = led_config->max_leds;
+    spi_strip->front_buf = spi_strip->pixel_buf + buf_size;
+    spi_strip->dirty_start = UINT32_MAX;
+    spi_strip->partial_refresh = led_config->flags.partial_refresh;
     spi_strip->base.set_pixel = led_strip_spi_set_pixel;
     spi_strip->base.set_pixel_rgbw = led_strip_spi_set_pixel_rgbw;
+    spi_strip->base.set_pixels = led_strip_spi_set_pixels;
     spi_strip->base.refresh = led_strip_spi_refresh;
+    spi_strip->base.refresh_async = led_strip_spi_refresh_async;
+    spi_strip->base.wait_refresh_done = led_strip_spi_wait_refresh_done;
+    spi_strip->base.register_refresh_done_callback = led_strip_spi_register_refresh_done_callback;
     spi_strip->base.clear = led_strip_spi_clear;
     spi_strip->base.del = led_strip_spi_del;
 
@@ -0,0 +1,46 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "led_strip_spi_encoder.h"
+
+// Bit k of a color byte goes to bit 3k+1 of the 24-bit SPI word, on top of the 100 pattern of every bit
+#define SPI_EXPAND(d) (0x924924 | ((d) & 0x01) << 1 | ((d) & 0x02) << 3 | ((d) & 0x04) << 5 | ((d) & 0x08) << 7 | \
+                       ((d) & 0x10) << 9 | ((d) & 0x20) << 11 | ((d) & 0x40) << 13 | ((d) & 0x80) << 15)
+#define SPI_EXPAND_4(d) SPI_EXPAND(d), SPI_EXPAND((d) + 1), SPI_EXPAND((d) + 2), SPI_EXPAND((d) + 3)
+#define SPI_EXPAND_16(d) SPI_EXPAND_4(d), SPI_EXPAND_4((d) + 4), SPI_EXPAND_4((d) + 8), SPI_EXPAND_4((d) + 12)
+#define SPI_EXPAND_64(d) SPI_EXPAND_16(d), SPI_EXPAND_16((d) + 16), SPI_EXPAND_16((d) + 32), SPI_EXPAND_16((d) + 48)
+
+// Generated at compile time, replaces 8 conditional ORs per color byte with one lookup
+static const uint32_t s_spi_expand[256] = {
+    SPI_EXPAND_64(0), SPI_EXPAND_64(64), SPI_EXPAND_64(128), SPI_EXPAND_64(192),
+};
+
+static inline uint8_t *led_strip_spi_encode_byte(uint8_t data, uint8_t *buf)
+{
+    uint32_t bits = s_spi_expand[data];
+    buf[0] = bits >> 16;
+    buf[1] = bits >> 8;
+    buf[2] = bits;
+    return buf + LED_STRIP_SPI_BYTES_PER_COLOR_BYTE;
+}
+
+void led_strip_spi_encode_pixels(const uint8_t *pixels, uint32_t count, uint8_t bytes_per_pixel, uint8_t *buf)
+{
+    if (bytes_per_pixel == 4) {
+        for (uint32_t i = 0; i < count; i++, pixels += 4) {
+            // SK6812 component order is GRBW
+            buf = led_strip_spi_encode_byte(pixels[1], buf);
+            buf = led_strip_spi_encode_byte(pixels[0], buf);
+            buf = led_strip_spi_encode_byte(pixels[2], buf);
+            buf = led_strip_spi_encode_byte(pixels[3], buf);
+        }
+    } else {
+        for (uint32_t i = 0; i < count; i++, pixels += 3) {
+            buf = led_strip_spi_encode_byte(pixels[1], buf);
+            buf = led_strip_spi_encode_byte(pixels[0], buf);
+            buf = led_strip_spi_encode_byte(pixels[2], buf);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of SPI bytes a color byte is expanded to, each color bit takes 3 SPI bits (0: 100, 1: 110)
+ */
+#define LED_STRIP_SPI_BYTES_PER_COLOR_BYTE 3
+
+/**
+ * @brief Encode pixels into the SPI bit stream
+ *
+ * @note Has no driver dependency, so it can also be built on the host, see host/led_strip_spi_bench.c
+ *
+ * @param[in] pixels Colors in RGB order (RGBW if bytes_per_pixel is 4), bytes_per_pixel bytes per pixel
+ * @param[in] count Number of pixels
+ * @param[in] bytes_per_pixel 3 for GRB strips, 4 for GRBW strips
+ * @param[out] buf Encoded pixels in the strip's GRB(W) order, count * bytes_per_pixel * 3 bytes
+ */
+void led_strip_spi_encode_pixels(const uint8_t *pixels, uint32_t count, uint8_t bytes_per_pixel, uint8_t *buf);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,128 @@
+/* Single frame payload budget for the mesh's UDP multicasts
+An 802.15.4 frame carries 127 bytes. A multicast to ff03::1 port 1234 that
+does not fit after its MAC, 6LoWPAN, MPL and UDP headers is fragmented, and a
+lost fragment loses the whole message, so every message is built to fit one
+frame. Shared by the v2 apps, the v3 collector and the v1 ESP node, so it is
+plain C without Zephyr or ESP-IDF dependencies
+
+Worst case header sizes for a secured data frame from an attached node
+(short MAC source), Thread key id mode 1:
+  MAC      frame control 2, sequence 1, PAN ID 2, broadcast destination 2,
+           short source 2, aux security header 6, MIC 4, FCS 2       = 21
+  IPHC     dispatch 2, traffic class (the DSCP carries the priority) 1,
+           destination ff03::1 as ffXX::00XX:XXXX 4                   = 7
+           source RLOC, inline as 16 bits (SAM=10): it is only
+           derived from the MAC source on the first hop, a router
+           forwarding the MPL copy sends from its own short address   + 2
+           source ML-EID, random interface identifier                 + 8
+  MPL      realm-local multicast carries a hop-by-hop MPL option:
+           NHC 1, length 1, option 2, flags 1, sequence 1             = 6
+           seed, unless derived from an RLOC source                   + 2
+  UDP      NHC 1, ports 4 (1234 is not compressible), checksum 2      = 7 */
+#ifndef FRAME_BUDGET_H_
+#define FRAME_BUDGET_H_
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define FRAME_PSDU_MAX 127
+#define FRAME_MAC_OVERHEAD 21
+#define FRAME_IPHC_OVERHEAD 7
+#define FRAME_MPL_OVERHEAD 6
+#define FRAME_UDP_OVERHEAD 7
+
+/* Source address of the multicast, it decides what 6LoWPAN can elide */
+enum frame_addressing {
+  FRAME_ADDR_RLOC,  // Source in 16 bits, MPL seed elided
+  FRAME_ADDR_MLEID, // OpenThread's default source for mesh-local scope
+};
+
+#define FRAME_OVERHEAD(addr)                                                   \
+  (FRAME_MAC_OVERHEAD + FRAME_IPHC_OVERHEAD + FRAME_MPL_OVERHEAD +             \
+   FRAME_UDP_OVERHEAD + ((addr) == FRAME_ADDR_RLOC ? 2 : 8 + 2))
+#define FRAME_PAYLOAD_MAX(addr) (FRAME_PSDU_MAX - FRAME_OVERHEAD(addr))
+/* Buffer for any single frame payload, plus its terminator */
+#define FRAME_PAYLOAD_BUF (FRAME_PAYLOAD_MAX(FRAME_ADDR_RLOC) + 1)
+
+/* Worst case length of a message type, from a string literal with every
+field at its widest, e.g. FRAME_WORST("rate 4294967295") */
+#define FRAME_WORST(literal) (sizeof(literal) - 1)
+
+/* Fails the build when a message type could ever need a second frame */
+#define FRAME_ASSERT_FITS(worst, addr)                                         \
+  _Static_assert((worst) <= FRAME_PAYLOAD_MAX(addr),                           \
+                 #worst " does not fit a single frame")
+
+/* Builds a message field by field within a frame budget
+A required field that does not fit rejects the record, an optional field
+that does not fit is left out and counted, so they go last, most wanted
+first */
+struct frame_encoder {
+  char *buf;      // At least budget + 1 bytes
+  size_t budget;  // Payload bytes that fit in one frame
+  size_t len;
+  int dropped;    // Optional fields left out
+  bool rejected;  // A required field did not fit
+};
+
+static inline void frame_init(struct frame_encoder *enc, char *buf,
+                              size_t budget) {
+  enc->buf = buf;
+  enc->budget = budget;
+  enc->len = 0;
+  enc->dropped = 0;
+  enc->rejected = false;
+  buf[0] = 0;
+}
+
+static inline bool frame_vput(struct frame_encoder *enc, const char *fmt,
+                              va_list args) {
+  size_t room = enc->budget - enc->len;
+  int n = vsnprintf(enc->buf + enc->len, room + 1, fmt, args);
+
+  if (n < 0 || (size_t)n > room) {
+    enc->buf[enc->len] = 0; // Drop the partial field
+    return false;
+  }
+  enc->len += n;
+  return true;
+}
+
+static inline void frame_put(struct frame_encoder *enc, const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  if (!enc->rejected && !frame_vput(enc, fmt, args)) {
+    enc->rejected = true;
+  }
+  va_end(args);
+}
+
+static inline bool frame_put_opt(struct frame_encoder *enc, const char *fmt,
+                                 ...) {
+  va_list args;
+  bool fits;
+
+  va_start(args, fmt);
+  fits = !enc->rejected && frame_vput(enc, fmt, args);
+  va_end(args);
+  if (!fits) {
+    enc->dropped++;
+  }
+  return fits;
+}
+
+/* The message, or NULL when the record was rejected */
+static inline const char *frame_finish(const struct frame_encoder *enc) {
+  return enc->rejected ? NULL : enc->buf;
+}
+
+/* Frame size a payload of len bytes goes out in, above FRAME_PSDU_MAX it is
+fragmented */
+static inline size_t frame_size(size_t len, enum frame_addressing addr) {
+  return FRAME_OVERHEAD(addr) + len;
+}
+
+#endif /* FRAME_BUDGET_H_ */
@@ -0,0 +1,130 @@
+/* Traffic classes, see traffic_class.h */
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+#include <openthread/message.h>
+#include <openthread/thread.h>
+#include <openthread/udp.h>
+
+#include "traffic_class.h"
+
+struct tc_message {
+  uint32_t queued; // k_cycle_get_32() when queued
+  uint16_t len;
+  char payload[TC_PAYLOAD_MAX];
+};
+
+static const char *const tc_names[TC_COUNT] = {"control", "telemetry"};
+static const otMessageSettings tc_settings[TC_COUNT] = {
+    {.mLinkSecurityEnabled = true, .mPriority = OT_MESSAGE_PRIORITY_HIGH},
+    {.mLinkSecurityEnabled = true, .mPriority = OT_MESSAGE_PRIORITY_LOW},
+};
+K_MSGQ_DEFINE(tc_control_queue, sizeof(struct tc_message), 4, 4);
+K_MSGQ_DEFINE(tc_telemetry_queue, sizeof(struct tc_message), 4, 4);
+static struct k_msgq *const tc_queues[TC_COUNT] = {&tc_control_queue,
+                                                   &tc_telemetry_queue};
+static struct tc_counters tc_counters[TC_COUNT];
+static otUdpSocket tc_socket;
+static uint16_t tc_port;
+
+static void tc_send_now(enum traffic_class tc, const struct tc_message *msg) {
+  otInstance *instance = openthread_get_default_instance();
+  struct tc_counters *counters = &tc_counters[tc];
+  uint32_t wait_us = k_cyc_to_us_floor32(k_cycle_get_32() - msg->queued);
+
+  counters->wait_total_us += wait_us;
+  counters->wait_max_us = MAX(counters->wait_max_us, wait_us);
+
+  otMessage *message = otUdpNewMessage(instance, &tc_settings[tc]);
+  if (!message) {
+    counters->failed++;
+    return;
+  }
+  if (otMessageAppend(message, msg->payload, msg->len) != OT_ERROR_NONE) {
+    otMessageFree(message);
+    counters->failed++;
+    return;
+  }
+
+  otMessageInfo msgInfo = {0};
+  otIp6AddressFromString("ff03::1", &msgInfo.mPeerAddr); // Mesh-local multicast
+  msgInfo.mPeerPort = tc_port;
+  // From the RLOC, so 6LoWPAN carries the source in 16 bits and elides the
+  // MPL seed
+  msgInfo.mSockAddr = *otThreadGetRloc(instance);
+
+  // On failure the message is still ours to free
+  if (otUdpSend(instance, &tc_socket, message, &msgInfo) != OT_ERROR_NONE) {
+    otMessageFree(message);
+    counters->failed++;
+    return;
+  }
+  counters->sent++;
+}
+
+static void tc_work_handler(struct k_work *work) {
+  struct openthread_context *context = openthread_get_default_context();
+  struct tc_message msg;
+
+  openthread_api_mutex_lock(context);
+  for (;;) {
+    if (k_msgq_get(&tc_control_queue, &msg, K_NO_WAIT) == 0) {
+      tc_send_now(TC_CONTROL, &msg);
+    } else if (k_msgq_get(&tc_telemetry_queue, &msg, K_NO_WAIT) == 0) {
+      tc_send_now(TC_TELEMETRY, &msg);
+    } else {
+      break;
+    }
+  }
+  openthread_api_mutex_unlock(context);
+}
+
+K_WORK_DEFINE(tc_work, tc_work_handler);
+
+void tc_send(enum traffic_class tc, const char *payload) {
+  struct tc_message msg;
+
+  size_t len = strlen(payload);
+  if (len > sizeof(msg.payload)) {
+    tc_counters[tc].oversize++;
+    return;
+  }
+  msg.len = len;
+  memcpy(msg.payload, payload, msg.len);
+  msg.queued = k_cycle_get_32();
+  if (k_msgq_put(tc_queues[tc], &msg, K_NO_WAIT) != 0) {
+    tc_counters[tc].dropped++;
+    return;
+  }
+  k_work_submit(&tc_work);
+}
+
+void tc_init(otInstance *instance, uint16_t port) {
+  tc_port = port;
+  otUdpOpen(instance, &tc_socket, NULL, NULL);
+}
+
+const struct tc_counters *tc_get_counters(enum traffic_class tc) {
+  return &tc_counters[tc];
+}
+
+static int cmd_tc(const struct shell *sh, size_t argc, char **argv) {
+  for (int tc = 0; tc < TC_COUNT; tc++) {
+    const struct tc_counters *counters = &tc_counters[tc];
+    uint32_t handled = counters->sent + counters->failed;
+
+    shell_print(sh,
+                "%-9s sent %u dropped %u oversize %u failed %u queued %u, "
+                "wait avg %u us max %u us",
+                tc_names[tc], counters->sent, counters->dropped,
+                counters->oversize, counters->failed,
+                k_msgq_num_used_get(tc_queues[tc]),
+                handled ? (uint32_t)(counters->wait_total_us / handled) : 0,
+                counters->wait_max_us);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(tc, NULL, "Traffic class counters", cmd_tc);
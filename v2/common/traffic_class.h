@@ -0,0 +1,38 @@
+/* Traffic classes for the mesh's UDP multicasts
+Commands go out at high priority and telemetry at low priority. OpenThread
+keeps a send queue per priority, and forwarders keep the priority too, as it
+travels in the DSCP of the IPv6 header. Sends are first queued here per class
+and made from the system work queue, control always first, so a telemetry
+burst cannot hold up a command. Shared by the v2 apps and the v3 collector,
+the "tc" shell command shows per class counts and how long messages waited
+here */
+#ifndef TRAFFIC_CLASS_H_
+#define TRAFFIC_CLASS_H_
+
+#include <stdint.h>
+#include <openthread/instance.h>
+
+#include "frame_budget.h"
+
+enum traffic_class { TC_CONTROL, TC_TELEMETRY, TC_COUNT };
+
+#define TC_PAYLOAD_MAX FRAME_PAYLOAD_MAX(FRAME_ADDR_RLOC)
+
+struct tc_counters {
+  uint32_t sent;
+  uint32_t dropped;  // Queue full
+  uint32_t oversize; // Longer than one frame, never queued
+  uint32_t failed;   // No message buffer or send error
+  uint32_t wait_max_us;
+  uint64_t wait_total_us;
+};
+
+/* Opens the socket the classes send from, multicasts go to ff03::1 on port */
+void tc_init(otInstance *instance, uint16_t port);
+
+/* Queues a multicast to all nodes, callable from any context, ISRs included */
+void tc_send(enum traffic_class tc, const char *payload);
+
+const struct tc_counters *tc_get_counters(enum traffic_class tc);
+
+#endif /* TRAFFIC_CLASS_H_ */
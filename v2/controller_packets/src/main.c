@@ -1,11 +1,15 @@
 /*
  * Controller Application Main
  */
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <zephyr/device.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/net/openthread.h>
@@ -17,6 +21,9 @@
 #include <openthread/udp.h>
 #include <openthread/border_router.h>
 
+#include "frame_budget.h"
+#include "traffic_class.h"
+
 /* Sets name inside of shell to see which messages come from that*/
 LOG_MODULE_REGISTER(ot_controller, CONFIG_LOG_DEFAULT_LEVEL);
 
@@ -32,6 +39,15 @@ static const char *light_command = "toggle";
 static bool streaming = false;
 static const char *CMD_START = "start";
 static const char *CMD_STOP = "stop";
+/* Longest command ("slot <mac> <n>", "rate <n>") plus its terminator, the
+build fails if one could ever need a second frame */
+#define CMD_MAX 24
+FRAME_ASSERT_FITS(CMD_MAX - 1, FRAME_ADDR_RLOC);
+// Hello slots per interval, as on the routers
+#define HELLO_SLOT_COUNT 50
+/* Highest fleet rate worth asking for, a full partition of 32 routers each at
+the routers' 500 ms floor */
+#define HELLO_RATE_MAX (32 * 120)
 
 /* GPIO definitions for the button
 Callback executed when button is pressed */
@@ -75,41 +91,23 @@ static otUdpSocket rxSocket;
 
 static void udp_receive_cb(void *aContext, otMessage *aMessage,
                            const otMessageInfo *aMessageInfo) {
-  char buf[32];
+  uint16_t length = otMessageGetLength(aMessage);
+  char buf[FRAME_PAYLOAD_BUF];
   int len = otMessageRead(aMessage, 0, buf, sizeof(buf) - 1);
   buf[len] = 0;
+  // No single frame carries more, the sender's message was fragmented
+  if (length > FRAME_PAYLOAD_MAX(FRAME_ADDR_RLOC)) {
+    LOG_WRN("Fragmented payload of %u B, first %d B kept", length, len);
+  }
   LOG_INF("Received UDP packet: %s", buf);
 }
 
-/* Constructs and sends a UDP packet
-gets default OpenThread instance and sends a message
-Sets destination to all other thread devices
-cleans up message buffer*/
-void send_multicast_command(const char *cmd) {
-  otInstance *instance = openthread_get_default_instance();
-  otMessage *message = otUdpNewMessage(instance, NULL);
-  if (!message)
-    return;
-  otMessageAppend(message, cmd, strlen(cmd));
-
-  otMessageInfo msgInfo = {0};
-  otIp6AddressFromString("ff03::1", &msgInfo.mPeerAddr); // Mesh-local multicast
-  msgInfo.mPeerPort = OT_CONNECTION_LED_PORT;
-
-  otUdpSocket udpSocket;
-  if (otUdpOpen(instance, &udpSocket, NULL, NULL) == OT_ERROR_NONE) {
-    otUdpSend(instance, &udpSocket, message, &msgInfo);
-    otUdpClose(instance, &udpSocket);
-  } else {
-    otMessageFree(message);
-  }
-}
+/* Sends a command to all other thread devices, from any context */
+void send_multicast_command(const char *cmd) { tc_send(TC_CONTROL, cmd); }
 
-/*Interrupt Service Routine (callback)
-if/else either turns LED on or off and starts or stops streaming */
-void button_pressed(const struct device *dev, struct gpio_callback *cb,
-                    uint32_t pins) {
-  streaming = !streaming;
+/* Turns the LED on or off and starts or stops streaming */
+static void set_streaming(bool enable) {
+  streaming = enable;
   if (streaming) {
     gpio_pin_set_dt(&led, 1);
     printk("Streaming started\n");
@@ -123,46 +121,94 @@ void button_pressed(const struct device *dev, struct gpio_callback *cb,
   }
 }
 
+/*Interrupt Service Routine (callback)
+toggles streaming */
+void button_pressed(const struct device *dev, struct gpio_callback *cb,
+                    uint32_t pins) {
+  set_streaming(!streaming);
+}
+
 /* UDP sending logic */
 void send_light_control_command(void) {
-  otError error = OT_ERROR_NONE;
-  otMessage *message;
-  otMessageInfo messageInfo;
-  otInstance *p_ot_instance = openthread_get_default_instance();
-  otUdpSocket udpSocket;
-
-  memset(&messageInfo, 0, sizeof(messageInfo));
-  otIp6AddressFromString("ff03::1", &messageInfo.mPeerAddr);
-  messageInfo.mPeerPort = OT_CONNECTION_LED_PORT;
-
-  message = otUdpNewMessage(p_ot_instance, NULL);
-  if (message == NULL) {
-    LOG_ERR("Failed to allocate new UDP message.");
-    return;
-  }
+  send_multicast_command(light_command);
+  LOG_INF("Light toggle sent");
+}
 
-  error = otMessageAppend(message, light_command, strlen(light_command));
-  if (error != OT_ERROR_NONE) {
-    otMessageFree(message);
-    return;
+/* Shell commands doing what the button and light control do, so a test
+harness (v2/sim) or a shell session can drive the controller */
+static int cmd_ctl_stream(const struct shell *sh, bool enable) {
+  if (streaming == enable) {
+    shell_print(sh, "Streaming already %s", enable ? "started" : "stopped");
+    return 0;
   }
+  set_streaming(enable);
+  return 0;
+}
 
-  error = otUdpOpen(p_ot_instance, &udpSocket, NULL, NULL);
-  if (error != OT_ERROR_NONE) {
-    otMessageFree(message);
-    return;
-  }
+static int cmd_ctl_start(const struct shell *sh, size_t argc, char **argv) {
+  return cmd_ctl_stream(sh, true);
+}
 
-  error = otUdpSend(p_ot_instance, &udpSocket, message, &messageInfo);
-  if (error != OT_ERROR_NONE) {
-    LOG_ERR("Failed to send UDP message: %d", error);
-  } else {
-    LOG_INF("UDP message sent successfully!");
+static int cmd_ctl_stop(const struct shell *sh, size_t argc, char **argv) {
+  return cmd_ctl_stream(sh, false);
+}
+
+static int cmd_ctl_toggle(const struct shell *sh, size_t argc, char **argv) {
+  send_light_control_command();
+  return 0;
+}
+
+/* Assigns a hello slot to one router, overriding the slot it derives from
+its extended address, "auto" goes back to the derived one */
+static int cmd_ctl_slot(const struct shell *sh, size_t argc, char **argv) {
+  char cmd[CMD_MAX];
+  char *end;
+
+  if (strlen(argv[1]) != 4) {
+    shell_error(sh, "MAC suffix must be 4 hex digits, as in the hellos");
+    return -EINVAL;
+  }
+  if (strcmp(argv[2], "auto") != 0 &&
+      (!isdigit((unsigned char)argv[2][0]) ||
+       strtoul(argv[2], &end, 10) >= HELLO_SLOT_COUNT || *end != 0)) {
+    shell_error(sh, "Slot must be 0..%d or auto", HELLO_SLOT_COUNT - 1);
+    return -EINVAL;
   }
+  snprintk(cmd, sizeof(cmd), "slot %s %s", argv[1], argv[2]);
+  send_multicast_command(cmd);
+  return 0;
+}
 
-  otUdpClose(p_ot_instance, &udpSocket);
+/* Asks the routers for a fleet-wide hello rate, each takes its share */
+static int cmd_ctl_rate(const struct shell *sh, size_t argc, char **argv) {
+  char *end;
+  unsigned long rate;
+  char cmd[CMD_MAX];
+
+  errno = 0;
+  rate = strtoul(argv[1], &end, 10);
+  if (!isdigit((unsigned char)argv[1][0]) || *end != 0 || errno == ERANGE ||
+      rate > HELLO_RATE_MAX) {
+    shell_error(sh, "Rate must be 0..%d hellos per minute, 0 for the default",
+                HELLO_RATE_MAX);
+    return -EINVAL;
+  }
+  snprintk(cmd, sizeof(cmd), "rate %lu", rate);
+  send_multicast_command(cmd);
+  return 0;
 }
 
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    sub_ctl, SHELL_CMD(start, NULL, "Start streaming on all nodes", cmd_ctl_start),
+    SHELL_CMD(stop, NULL, "Stop streaming on all nodes", cmd_ctl_stop),
+    SHELL_CMD(toggle, NULL, "Toggle all lights", cmd_ctl_toggle),
+    SHELL_CMD_ARG(slot, NULL, "Assign a hello slot: slot <mac> <n|auto>",
+                  cmd_ctl_slot, 3, 0),
+    SHELL_CMD_ARG(rate, NULL, "Fleet hello rate: rate <hellos per minute>",
+                  cmd_ctl_rate, 2, 0),
+    SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(ctl, &sub_ctl, "Controller commands", NULL);
+
 int main(void) {
   k_sleep(K_MSEC(500)); // Short sleep to allow debug in shell
 
@@ -212,6 +258,9 @@ int main(void) {
     return -1;
   }
   LOG_INF("OpenThread stack has been started.");
+  tc_init(instance, OT_CONNECTION_LED_PORT);
+  LOG_INF("Command worst case %zu B frame, single frame is %u B",
+          frame_size(CMD_MAX - 1, FRAME_ADDR_RLOC), FRAME_PSDU_MAX);
 
   // Open UDP socket for multicast commands
   otSockAddr listen_addr = {0};
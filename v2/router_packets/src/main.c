@@ -1,21 +1,30 @@
 /*
  * Transmitter Application Main
  */
+#include <ctype.h>
+#include <stdlib.h>
 #include <zephyr/device.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/sys/util.h>
 #include <openthread/dataset_ftd.h>
 #include <openthread/link.h>
 #include <openthread/message.h>
+#include <openthread/network_time.h>
 #include <openthread/platform/radio.h>
+#include <openthread/random_noncrypto.h>
+#include <openthread/thread.h>
 #include <openthread/thread_ftd.h>
 #include <openthread/udp.h>
 
+#include "frame_budget.h"
+#include "traffic_class.h"
+
 /* Sets name inside of shell to see which messages come from that*/
 LOG_MODULE_REGISTER(ot_end_device, CONFIG_LOG_DEFAULT_LEVEL);
 
@@ -28,9 +37,103 @@ UDP port defined for messages at specified interval*/
 #define OT_CONNECTION_LED_PORT 1234
 #define HELLO_INTERVAL_MS 1000
 
+/* Appends neighbor count and weakest neighbor RSSI to every hello,
+set to 0 to only report the uplink */
+#define HELLO_INCLUDE_NEIGHBORS 1
+
+/* Adaptive hello interval, within HELLO_INTERVAL_MIN_MS..HELLO_INTERVAL_MAX_MS
+The target is HELLO_INTERVAL_MS, or this node's share of the fleet rate the
+controller asks for with "rate <hellos per minute>", the fleet being the
+routers of the partition. Congestion since the last hello (MAC TX failures,
+a failed message allocation or send, or less than HELLO_MIN_FREE_BUFFERS_PCT
+of the message buffers free) doubles the interval, otherwise it shrinks by
+HELLO_INTERVAL_STEP_MS per hello back toward the target. The interval in use
+is reported in every hello (i=) */
+#define HELLO_INTERVAL_MIN_MS 500
+#define HELLO_INTERVAL_MAX_MS 10000
+#define HELLO_INTERVAL_STEP_MS 100
+#define HELLO_MIN_FREE_BUFFERS_PCT 25
+#define RATE_COMMAND_PREFIX "rate "
+
+/* Slotted hello schedule
+The hello interval is split in HELLO_SLOT_COUNT slots and every node sends
+in its own slot, derived from its extended address or assigned by the
+controller ("slot <mac> <n>"), so nodes that heard the same "start" do not
+all transmit in phase. Random jitter of up to hello_jitter_ms is added to
+every hello, the window doubles while CCA failures or MAC retries keep
+rising and halves when they stop, up to half a slot, or never with
+HELLO_JITTER 0 */
+#define HELLO_SLOT_COUNT 50
+#define HELLO_JITTER 1
+#define SLOT_COMMAND_PREFIX "slot "
+
 static struct k_timer hello_timer;
+static struct k_work hello_work;
+static uint32_t hello_interval_ms = HELLO_INTERVAL_MS;
+static uint32_t hello_target_ms = HELLO_INTERVAL_MS;
+/* Telemetry drops and send failures at the last hello */
+static uint32_t hello_tc_errors;
+static int hello_slot = -1; // Assigned slot, -1 derives it from the address
+static uint32_t hello_period_ms; // Uptime at which the next period starts
+static uint32_t hello_jitter_ms;
+/* MAC counters when streaming started and at the last hello */
+static otMacCounters mac_base;
+static otMacCounters mac_last;
 static bool streaming = false;
 static otUdpSocket udpSocket;
+/* Hello sequence number (s=), lets the receiver count lost hellos */
+static uint32_t hello_seq;
+/* Optional hello fields left out to keep the hello in one frame */
+static uint32_t hello_trimmed;
+
+/* Mesh time, kept in step with the collector by its "time <ms>" beacons
+time_offset = collector time - local uptime, estimated from the beacons
+A beacon that took longer to arrive gives a smaller offset, so a larger one
+is taken at once and a smaller one only pulls the estimate down by 1/4,
+which follows crystal drift without following the mesh delay jitter */
+#define TIME_BEACON_PREFIX "time "
+static int32_t time_offset;
+static bool time_synced = false;
+static uint32_t time_last_sync;
+
+/* Mesh time in ms, Thread network time when the stack provides it */
+static uint32_t mesh_time_ms(void) {
+#if defined(CONFIG_OPENTHREAD_TIME_SYNC)
+  uint64_t network_time;
+  if (otNetworkTimeGet(openthread_get_default_instance(), &network_time) ==
+      OT_NETWORK_TIME_SYNCHRONIZED) {
+    return (uint32_t)(network_time / 1000);
+  }
+#endif
+  return k_uptime_get_32() + time_offset;
+}
+
+/* Seconds since the mesh time was last synced, -1 if it never was */
+static int mesh_time_age(void) {
+#if defined(CONFIG_OPENTHREAD_TIME_SYNC)
+  uint64_t network_time;
+  if (otNetworkTimeGet(openthread_get_default_instance(), &network_time) ==
+      OT_NETWORK_TIME_SYNCHRONIZED) {
+    return 0;
+  }
+#endif
+  if (!time_synced)
+    return -1;
+  return (k_uptime_get_32() - time_last_sync) / MSEC_PER_SEC;
+}
+
+static void handle_time_beacon(const char *arg) {
+  uint32_t now = k_uptime_get_32();
+  int32_t offset = (int32_t)(strtoul(arg, NULL, 10) - now);
+
+  if (!time_synced || offset > time_offset) {
+    time_offset = offset;
+  } else {
+    time_offset += (offset - time_offset) / 4;
+  }
+  time_synced = true;
+  time_last_sync = now;
+}
 
 static void get_mac_suffix(char *buf, size_t buflen) {
   otInstance *instance = openthread_get_default_instance();
@@ -39,45 +142,310 @@ static void get_mac_suffix(char *buf, size_t buflen) {
   snprintk(buf, buflen, "%02X%02X", ext_addr->m8[6], ext_addr->m8[7]);
 }
 
-static void send_hello(void) {
+/* Link quality toward the uplink as compact key=value pairs
+p = uplink RLOC16, r = average RSSI (dBm), m = link margin (dB)
+n = neighbor count, w = weakest neighbor average RSSI (dBm)
+A child reports its parent, a router reports its strongest router neighbor
+The fields are optional, whatever does not fit the frame is left out */
+static void put_link_summary(struct frame_encoder *enc) {
   otInstance *instance = openthread_get_default_instance();
+  int8_t noise_floor = otPlatRadioGetReceiveSensitivity(instance);
+  bool is_child = otThreadGetDeviceRole(instance) == OT_DEVICE_ROLE_CHILD;
+  uint16_t uplink = 0;
+  int8_t uplink_rssi = OT_RADIO_RSSI_INVALID;
+  int8_t weakest_rssi = OT_RADIO_RSSI_INVALID;
+  int neighbors = 0;
+
+  if (is_child) {
+    otRouterInfo parent;
+    int8_t rssi;
+    if (otThreadGetParentInfo(instance, &parent) == OT_ERROR_NONE &&
+        otThreadGetParentAverageRssi(instance, &rssi) == OT_ERROR_NONE) {
+      uplink = parent.mRloc16;
+      uplink_rssi = rssi;
+    }
+  }
+
+  otNeighborInfoIterator iterator = OT_NEIGHBOR_INFO_ITERATOR_INIT;
+  otNeighborInfo info;
+  while (otThreadGetNextNeighborInfo(instance, &iterator, &info) ==
+         OT_ERROR_NONE) {
+    if (info.mAverageRssi == OT_RADIO_RSSI_INVALID)
+      continue;
+    neighbors++;
+    if (weakest_rssi == OT_RADIO_RSSI_INVALID ||
+        info.mAverageRssi < weakest_rssi)
+      weakest_rssi = info.mAverageRssi;
+    if (!is_child && !info.mIsChild &&
+        (uplink_rssi == OT_RADIO_RSSI_INVALID ||
+         info.mAverageRssi > uplink_rssi)) {
+      uplink = info.mRloc16;
+      uplink_rssi = info.mAverageRssi;
+    }
+  }
+
+  if (uplink_rssi != OT_RADIO_RSSI_INVALID) {
+    int margin = uplink_rssi - noise_floor;
+    frame_put_opt(enc, " p=%04X r=%d m=%d", uplink, uplink_rssi,
+                  margin > 0 ? margin : 0);
+  }
+#if HELLO_INCLUDE_NEIGHBORS
+  frame_put_opt(enc, " n=%d", neighbors);
+  if (weakest_rssi != OT_RADIO_RSSI_INVALID) {
+    frame_put_opt(enc, " w=%d", weakest_rssi);
+  }
+#endif
+}
+
+/* Hello worst cases, every field at its widest
+The required fields always fit a frame, the optional ones (sync age, then
+the link summary) are left out when they do not, see frame_budget.h */
+#define HELLO_REQUIRED_WORST                                                   \
+  FRAME_WORST("hello world FFFF s=4294967295 i=" STRINGIFY(                    \
+      HELLO_INTERVAL_MAX_MS) " t=4294967295")
+#define HELLO_WORST                                                            \
+  (HELLO_REQUIRED_WORST +                                                      \
+   FRAME_WORST(" y=2147483647 p=FFFF r=-128 m=255 n=255 w=-128"))
+FRAME_ASSERT_FITS(HELLO_REQUIRED_WORST, FRAME_ADDR_RLOC);
+
+/* Every hello carries its send time (t=, mesh time in ms) so the dashboard
+can trace its latency through the collector and the bridge
+y = seconds since the last sync, only sent once the mesh time is synced,
+without it t= is plain uptime */
+static void send_hello(void) {
   char mac[5];
   get_mac_suffix(mac, sizeof(mac));
-  char msg[32];
-  snprintk(msg, sizeof(msg), "hello world %s", mac);
+  char msg[FRAME_PAYLOAD_BUF];
+  struct frame_encoder enc;
+  frame_init(&enc, msg, TC_PAYLOAD_MAX);
+  frame_put(&enc, "hello world %s s=%u i=%u t=%u", mac, hello_seq++,
+            hello_interval_ms, mesh_time_ms());
+  int age = mesh_time_age();
+  if (age >= 0) {
+    frame_put_opt(&enc, " y=%d", age);
+  }
+  put_link_summary(&enc);
+  hello_trimmed += enc.dropped;
 
   LOG_INF("Sending: %s", msg);
 
-  otMessage *message = otUdpNewMessage(instance, NULL);
-  if (!message)
-    return;
-  otMessageAppend(message, msg, strlen(msg));
+  // Send Hello World message to all devices in the Thread network. As
+  // telemetry it goes out at low priority, behind the commands this router
+  // forwards
+  tc_send(TC_TELEMETRY, msg);
+}
+
+/* FNV-1a over the extended address, stable across reboots */
+static int derived_slot(void) {
+  const otExtAddress *ext_addr =
+      otLinkGetExtendedAddress(openthread_get_default_instance());
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < OT_EXT_ADDRESS_SIZE; i++) {
+    hash ^= ext_addr->m8[i];
+    hash *= 16777619u;
+  }
+  return hash % HELLO_SLOT_COUNT;
+}
+
+static int current_slot(void) {
+  return hello_slot >= 0 ? hello_slot : derived_slot();
+}
+
+/* Arms the one-shot hello timer for our slot in the next period that has
+not passed yet, plus jitter */
+static void schedule_next_hello(void) {
+  uint32_t now = k_uptime_get_32();
+  uint32_t at =
+      hello_period_ms + current_slot() * hello_interval_ms / HELLO_SLOT_COUNT;
+
+  while ((int32_t)(at - now) < 0) {
+    hello_period_ms += hello_interval_ms;
+    at += hello_interval_ms;
+  }
+  hello_period_ms += hello_interval_ms;
+  if (hello_jitter_ms > 0) {
+    at += otRandomNonCryptoGetUint32() % (hello_jitter_ms + 1);
+  }
+  k_timer_start(&hello_timer, K_MSEC(at - now), K_NO_WAIT);
+}
+
+/* Contention since the last hello steers the jitter window
+Returns the MAC TX failures since the last hello */
+static uint32_t update_mac_counters(void) {
+  const otMacCounters *counters =
+      otLinkGetCounters(openthread_get_default_instance());
+  uint32_t contention = (counters->mTxErrCca - mac_last.mTxErrCca) +
+                        (counters->mTxRetry - mac_last.mTxRetry);
+  uint32_t failures = (counters->mTxErrCca - mac_last.mTxErrCca) +
+                      (counters->mTxErrAbort - mac_last.mTxErrAbort) +
+                      (counters->mTxErrBusyChannel - mac_last.mTxErrBusyChannel);
+
+  mac_last = *counters;
+#if HELLO_JITTER
+  uint32_t jitter_max = hello_interval_ms / HELLO_SLOT_COUNT / 2;
+  if (contention > 0) {
+    hello_jitter_ms =
+        MIN(jitter_max, hello_jitter_ms > 0 ? hello_jitter_ms * 2 : 1);
+  } else {
+    hello_jitter_ms /= 2;
+  }
+#endif
+  return failures;
+}
+
+/* Routers of the partition, the fleet the controller's rate is shared by */
+static int fleet_size(otInstance *instance) {
+  otRouterInfo info;
+  int routers = 0;
+
+  for (uint8_t id = 0; id <= otThreadGetMaxRouterId(instance); id++) {
+    if (otThreadGetRouterInfo(instance, id, &info) == OT_ERROR_NONE &&
+        info.mAllocated) {
+      routers++;
+    }
+  }
+  return MAX(routers, 1);
+}
+
+/* Drops and send failures of telemetry since the last call, the hello is
+sent after the work that queued it so its outcome is seen one hello late */
+static bool hello_send_failed(void) {
+  const struct tc_counters *telemetry = tc_get_counters(TC_TELEMETRY);
+  uint32_t errors = telemetry->dropped + telemetry->failed;
+  bool failed = errors != hello_tc_errors;
+
+  hello_tc_errors = errors;
+  return failed;
+}
+
+/* One step of the adaptive interval, after every hello */
+static void update_hello_interval(uint32_t tx_failures) {
+  otInstance *instance = openthread_get_default_instance();
+  otBufferInfo buffers;
+  uint32_t previous = hello_interval_ms;
+  bool send_failed = hello_send_failed();
 
-  otMessageInfo msgInfo = {0};
-  // Send Hello World message to all devices in the Thread network
-  otIp6AddressFromString("ff03::1", &msgInfo.mPeerAddr);
-  msgInfo.mPeerPort = OT_CONNECTION_LED_PORT;
+  otMessageGetBufferInfo(instance, &buffers);
+  bool low_buffers = buffers.mFreeBuffers * 100 <
+                     buffers.mTotalBuffers * HELLO_MIN_FREE_BUFFERS_PCT;
 
-  otUdpSend(instance, &udpSocket, message, &msgInfo);
+  if (tx_failures > 0 || send_failed || low_buffers) {
+    hello_interval_ms = MIN(hello_interval_ms * 2, HELLO_INTERVAL_MAX_MS);
+    if (hello_interval_ms != previous) {
+      LOG_INF("Hello interval %u ms: %u TX failures, %u/%u buffers free%s",
+              hello_interval_ms, tx_failures, buffers.mFreeBuffers,
+              buffers.mTotalBuffers, send_failed ? ", send failed" : "");
+    }
+  } else if (hello_interval_ms > hello_target_ms + HELLO_INTERVAL_STEP_MS) {
+    hello_interval_ms -= HELLO_INTERVAL_STEP_MS;
+  } else if (hello_interval_ms != hello_target_ms) {
+    hello_interval_ms = hello_target_ms;
+    LOG_INF("Hello interval back at its target, %u ms", hello_interval_ms);
+  }
 }
 
-/* UDP & Message implementation */
-static void hello_timer_handler(struct k_timer *timer_id) { send_hello(); }
+/* "rate <n>" shares n hellos per minute across the fleet, 0 goes back to
+HELLO_INTERVAL_MS */
+static void handle_rate_command(const char *arg) {
+  otInstance *instance = openthread_get_default_instance();
+  uint32_t rate = strtoul(arg, NULL, 10);
+  uint32_t target = HELLO_INTERVAL_MS;
+
+  if (rate > 0) {
+    target = fleet_size(instance) * 60000U / rate;
+  }
+  hello_target_ms = CLAMP(target, HELLO_INTERVAL_MIN_MS, HELLO_INTERVAL_MAX_MS);
+  // A slower target applies at once, a faster one is approached step by step
+  if (hello_target_ms > hello_interval_ms) {
+    hello_interval_ms = hello_target_ms;
+  }
+  LOG_INF("Rate %u/min over %d routers, hello target %u ms", rate,
+          fleet_size(instance), hello_target_ms);
+}
+
+/* UDP & Message implementation
+The timer only submits the work, the hello is sent from the system work
+queue where the OpenThread API can be locked */
+static void hello_work_handler(struct k_work *work) {
+  struct openthread_context *context = openthread_get_default_context();
+
+  openthread_api_mutex_lock(context);
+  if (streaming) {
+    send_hello();
+    update_hello_interval(update_mac_counters());
+    schedule_next_hello();
+  }
+  openthread_api_mutex_unlock(context);
+}
+
+static void hello_timer_handler(struct k_timer *timer_id) {
+  k_work_submit(&hello_work);
+}
+
+static void start_streaming(void) {
+  mac_base = *otLinkGetCounters(openthread_get_default_instance());
+  mac_last = mac_base;
+  hello_jitter_ms = 0;
+  hello_send_failed();
+  hello_period_ms = k_uptime_get_32();
+  schedule_next_hello();
+}
+
+/* "slot <mac> <n>" assigns slot n to the node with that MAC suffix,
+"slot <mac> auto" returns it to the slot derived from its address. Anything
+else, or a command cut short by the receive buffer, leaves the slot as is */
+static void handle_slot_command(const char *arg, bool truncated) {
+  char mac[5];
+  get_mac_suffix(mac, sizeof(mac));
+  if (strncmp(arg, mac, 4) != 0 || arg[4] != ' ')
+    return;
+
+  const char *slot = arg + 5;
+  if (truncated) {
+    LOG_WRN("Slot command too long, ignored");
+    return;
+  }
+  if (strcmp(slot, "auto") == 0) {
+    hello_slot = -1;
+  } else {
+    char *end;
+    unsigned long n = strtoul(slot, &end, 10);
+    if (!isdigit((unsigned char)slot[0]) || *end != 0 ||
+        n >= HELLO_SLOT_COUNT) {
+      LOG_WRN("Slot must be 0..%d or auto: %s", HELLO_SLOT_COUNT - 1, slot);
+      return;
+    }
+    hello_slot = n;
+  }
+  LOG_INF("Hello slot %d (%s)", current_slot(),
+          hello_slot >= 0 ? "assigned" : "derived");
+}
 
 static void udp_receive_cb(void *aContext, otMessage *aMessage,
                            const otMessageInfo *aMessageInfo) {
-  char buf[16];
+  char buf[24];
   int len = otMessageRead(aMessage, 0, buf, sizeof(buf) - 1);
   buf[len] = 0;
 
+  // Time beacons arrive every few seconds, keep them out of the log
+  if (strncmp(buf, TIME_BEACON_PREFIX, strlen(TIME_BEACON_PREFIX)) == 0) {
+    handle_time_beacon(buf + strlen(TIME_BEACON_PREFIX));
+    return;
+  }
+
   LOG_INF("UDP received, payload=%s", buf);
 
-  if (strcmp(buf, "start") == 0 && !streaming) {
+  if (strncmp(buf, SLOT_COMMAND_PREFIX, strlen(SLOT_COMMAND_PREFIX)) == 0) {
+    handle_slot_command(buf + strlen(SLOT_COMMAND_PREFIX),
+                        otMessageGetLength(aMessage) > len);
+  } else if (strncmp(buf, RATE_COMMAND_PREFIX, strlen(RATE_COMMAND_PREFIX)) ==
+             0) {
+    handle_rate_command(buf + strlen(RATE_COMMAND_PREFIX));
+  } else if (strcmp(buf, "start") == 0 && !streaming) {
     streaming = true;
     gpio_pin_set_dt(&led, 1);
-    k_timer_start(&hello_timer, K_MSEC(HELLO_INTERVAL_MS),
-                  K_MSEC(HELLO_INTERVAL_MS));
-    LOG_INF("Received start, streaming...");
+    start_streaming();
+    LOG_INF("Received start, streaming in slot %d...", current_slot());
   } else if (strcmp(buf, "stop") == 0 && streaming) {
     streaming = false;
     gpio_pin_set_dt(&led, 0);
@@ -86,6 +454,44 @@ static void udp_receive_cb(void *aContext, otMessage *aMessage,
   }
 }
 
+/* "hello" shell command: interval, schedule and MAC contention since
+streaming started */
+static int cmd_hello(const struct shell *sh, size_t argc, char **argv) {
+  struct openthread_context *context = openthread_get_default_context();
+  otMacCounters now;
+
+  openthread_api_mutex_lock(context);
+  now = *otLinkGetCounters(openthread_get_default_instance());
+  shell_print(sh, "interval %u ms (target %u ms, %u..%u ms)",
+              hello_interval_ms, hello_target_ms, HELLO_INTERVAL_MIN_MS,
+              HELLO_INTERVAL_MAX_MS);
+  shell_print(sh, "slot %d of %d (%s), %u ms into the period, jitter %u ms",
+              current_slot(), HELLO_SLOT_COUNT,
+              hello_slot >= 0 ? "assigned" : "derived",
+              current_slot() * hello_interval_ms / HELLO_SLOT_COUNT,
+              hello_jitter_ms);
+  openthread_api_mutex_unlock(context);
+
+  uint32_t tx = now.mTxTotal - mac_base.mTxTotal;
+  uint32_t cca = now.mTxErrCca - mac_base.mTxErrCca;
+  uint32_t retries = now.mTxRetry - mac_base.mTxRetry;
+  shell_print(sh, "%s, %u hellos since boot, %u tx frames, %u CCA failures, %u retries",
+              streaming ? "streaming" : "stopped", hello_seq, tx, cca,
+              retries);
+  shell_print(sh, "worst case %zu B frame, %zu B required, %u fields trimmed",
+              frame_size(HELLO_WORST, FRAME_ADDR_RLOC),
+              frame_size(HELLO_REQUIRED_WORST, FRAME_ADDR_RLOC),
+              hello_trimmed);
+  if (tx > 0) {
+    shell_print(sh, "per 100 tx frames: %u CCA failures, %u retries",
+                cca * 100 / tx, retries * 100 / tx);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(hello, NULL, "Hello schedule and MAC contention counters",
+                   cmd_hello);
+
 /* Dataset from Thread library that holds parameters to define
 a thread network
 Memset fills potential garbage data with all zeros
@@ -150,8 +556,13 @@ int main(void) {
   listen_addr.mPort = OT_CONNECTION_LED_PORT;
   otUdpOpen(instance, &udpSocket, udp_receive_cb, NULL);
   otUdpBind(instance, &udpSocket, &listen_addr, OT_NETIF_THREAD);
+  tc_init(instance, OT_CONNECTION_LED_PORT);
+  LOG_INF("Hello worst case %zu B frame (%zu B required), single frame is %u B",
+          frame_size(HELLO_WORST, FRAME_ADDR_RLOC),
+          frame_size(HELLO_REQUIRED_WORST, FRAME_ADDR_RLOC), FRAME_PSDU_MAX);
 
   k_timer_init(&hello_timer, hello_timer_handler, NULL);
+  k_work_init(&hello_work, hello_work_handler);
 
   LOG_INF("End device ready.");
   return 0;  //Function returns but is driven by interrupts and network events
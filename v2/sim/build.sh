@@ -0,0 +1,12 @@
+#!/bin/sh
+# Builds the v2 controller and router for native_sim into v2/build/sim, where mesh_sim.py looks for them.
+# Run from a west workspace shell (ZEPHYR_BASE set). BOARD=native_sim/native/64 avoids needing 32-bit libraries.
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+board=${BOARD:-native_sim}
+
+for app in controller_packets router_packets; do
+  west build -p auto -b "$board" -d "$here/../build/sim/$app" "$here/../$app" -- \
+    -DCONF_FILE=prj_native_sim.conf -DDTC_OVERLAY_FILE=boards/native_sim.overlay
+done
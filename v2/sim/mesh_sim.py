@@ -0,0 +1,474 @@
+# File: mesh_sim.py
+"""Multi-node mesh simulation of the v2 router/controller firmware.
+
+Runs one controller and N routers built for Zephyr native_sim (see build.sh)
+as Linux processes. Each node's 802.15.4 radio is the uart pipe driver on its
+uart_1 pseudo-terminal, and this script is the medium between them: it forwards
+every frame to the node's neighbors in the chosen topology, drops frames with the
+configured loss, and optionally drops frames that overlap at a receiver.
+
+The run is scripted over the nodes' shells: let the mesh settle, "ctl start" on
+the controller, stream for a while, "ctl stop", then report the packet delivery
+ratio (PDR) and latency of the router hellos at the controller, and the airtime
+every node spent transmitting.
+
+    ./build.sh
+    ./mesh_sim.py -n 6 -t line --loss 0.05 --collisions -d 120 --json report.json
+
+Limitations: the medium has no notion of ACKs, CCA or backoff, the radio driver
+acknowledges every frame itself, so MAC retries are not exercised and collisions
+only show up as lost frames. Latency is measured between the log lines of the
+sender and the controller, so it includes console and host scheduling delays.
+"""
+import argparse
+import heapq
+import json
+import math
+import os
+import pty
+import random
+import re
+import selectors
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+import tty
+
+# ieee802154_uart_pipe.c frames every PSDU as UART_PIPE_RADIO_15_4_FRAME_TYPE, length, bytes
+PIPE_FRAME_TYPE = 0xF0
+# Preamble, SFD and PHR ahead of every PSDU on the air
+PHY_OVERHEAD_BYTES = 6
+# 250 kbit/s O-QPSK in the 2.4 GHz band
+BYTE_AIRTIME_S = 32e-6
+
+ROLES = ('leader', 'router', 'child', 'detached', 'disabled')
+
+ansi_escape = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
+pty_pattern = re.compile(r'uart_1 connected to pseudotty: (\S+)')
+sent_pattern = re.compile(r'Sending: hello world (\w+)\b.*? s=(\d+)')
+received_pattern = re.compile(r'Received UDP packet: hello world (\w+)\b.*? s=(\d+)')
+
+
+def percentile(values, fraction):
+    """Nearest-rank percentile of an unsorted list, None when empty"""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(0, math.ceil(fraction * len(ordered)) - 1)
+    return ordered[rank]
+
+
+def ms(seconds):
+    return None if seconds is None else round(seconds * 1000, 2)
+
+
+class Node:
+    """One native_sim process, its console and its radio pseudo-terminal"""
+
+    def __init__(self, index, name, exe, seed, log_dir):
+        self.index = index
+        self.name = name
+        self.exe = exe
+        self.seed = seed
+        self.log_path = os.path.join(log_dir, f'{name}.log')
+        self.proc = None
+        self.console_fd = None
+        self.radio_fd = None
+        self.console_buf = b''
+        self.radio_buf = b''
+        self.role = None
+        self.mac = None
+        self.log = None
+        # medium statistics
+        self.tx_frames = 0
+        self.tx_bytes = 0
+        self.airtime = 0.0
+        # telemetry: (mac, seq) -> time the router logged the send
+        self.sent = {}
+
+    def start(self):
+        self.log = open(self.log_path, 'w')
+        master, slave = pty.openpty()
+        # Raw, so that commands are not echoed back into the log
+        tty.setraw(slave)
+        self.proc = subprocess.Popen(
+            [self.exe, '--rt', f'-seed={self.seed}'],
+            stdin=slave, stdout=slave, stderr=slave,
+            close_fds=True, start_new_session=True)
+        os.close(slave)
+        os.set_blocking(master, False)
+        self.console_fd = master
+
+    def open_radio(self, path):
+        fd = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        tty.setraw(fd)
+        self.radio_fd = fd
+
+    def command(self, line):
+        if self.console_fd is not None:
+            os.write(self.console_fd, line.encode() + b'\n')
+
+    def read_console(self):
+        """Returns the complete lines read from the console, None once it is closed"""
+        try:
+            data = os.read(self.console_fd, 4096)
+        except BlockingIOError:
+            return []
+        except OSError:
+            data = b''
+        if not data:
+            return None
+        self.console_buf += data
+        *lines, self.console_buf = self.console_buf.split(b'\n')
+        return [ansi_escape.sub('', line.decode(errors='replace')).strip() for line in lines]
+
+    def read_frames(self):
+        """Returns the PSDUs read from the radio, None once it is closed"""
+        try:
+            data = os.read(self.radio_fd, 4096)
+        except BlockingIOError:
+            return []
+        except OSError:
+            data = b''
+        if not data:
+            return None
+        self.radio_buf += data
+        frames = []
+        while self.radio_buf:
+            start = self.radio_buf.find(bytes([PIPE_FRAME_TYPE]))
+            if start < 0:
+                self.radio_buf = b''
+                break
+            if len(self.radio_buf) < start + 2:
+                self.radio_buf = self.radio_buf[start:]
+                break
+            length = self.radio_buf[start + 1]
+            if len(self.radio_buf) < start + 2 + length:
+                self.radio_buf = self.radio_buf[start:]
+                break
+            frames.append(self.radio_buf[start + 2:start + 2 + length])
+            self.radio_buf = self.radio_buf[start + 2 + length:]
+        return frames
+
+    def write_frame(self, psdu):
+        if self.radio_fd is None:
+            return
+        try:
+            os.write(self.radio_fd, bytes([PIPE_FRAME_TYPE, len(psdu)]) + psdu)
+        except (BlockingIOError, OSError):
+            pass
+
+    def stop(self):
+        if self.proc and self.proc.poll() is None:
+            os.killpg(self.proc.pid, signal.SIGTERM)
+            try:
+                self.proc.wait(timeout=2)
+            except subprocess.TimeoutExpired:
+                os.killpg(self.proc.pid, signal.SIGKILL)
+                self.proc.wait()
+        for fd in (self.console_fd, self.radio_fd):
+            if fd is not None:
+                os.close(fd)
+        self.console_fd = self.radio_fd = None
+        if self.log:
+            self.log.close()
+
+
+class Medium:
+    """Shared 802.15.4 channel: per-link loss and, optionally, collisions at the receiver"""
+
+    def __init__(self, links, collisions, rng):
+        self.links = links          # src index -> {dst index: loss probability}
+        self.collisions = collisions
+        self.rng = rng
+        self.pending = []           # heap of (end time, order, dst, psdu, reception)
+        self.receiving = {}         # dst index -> receptions still on the air
+        self.order = 0
+        self.delivered = 0
+        self.lost = 0
+        self.collided = 0
+
+    def transmit(self, src, psdu, now):
+        airtime = (len(psdu) + PHY_OVERHEAD_BYTES) * BYTE_AIRTIME_S
+        src.tx_frames += 1
+        src.tx_bytes += len(psdu)
+        src.airtime += airtime
+        end = now + airtime
+        for dst, loss in self.links.get(src.index, {}).items():
+            if self.rng.random() < loss:
+                self.lost += 1
+                continue
+            reception = {'start': now, 'end': end, 'collided': False}
+            if self.collisions:
+                on_air = [r for r in self.receiving.get(dst, []) if r['end'] > now]
+                for other in on_air:
+                    other['collided'] = True
+                    reception['collided'] = True
+                self.receiving[dst] = on_air + [reception]
+            # Delivered once the whole frame is on the air, like a real receiver
+            heapq.heappush(self.pending, (end, self.order, dst, psdu, reception))
+            self.order += 1
+
+    def next_deadline(self):
+        return self.pending[0][0] if self.pending else None
+
+    def deliver_due(self, nodes, now):
+        while self.pending and self.pending[0][0] <= now:
+            _, _, dst, psdu, reception = heapq.heappop(self.pending)
+            if reception['collided']:
+                self.collided += 1
+                continue
+            nodes[dst].write_frame(psdu)
+            self.delivered += 1
+
+
+def build_links(kind, count, loss, topology_file=None):
+    """Adjacency of the nodes, node 0 is the controller, 1..count-1 the routers"""
+    links = {i: {} for i in range(count)}
+
+    def connect(a, b, link_loss=loss):
+        links[a][b] = link_loss
+        links[b][a] = link_loss
+
+    if topology_file:
+        with open(topology_file) as f:
+            spec = json.load(f)
+        for link in spec['links']:
+            if isinstance(link, dict):
+                connect(link['a'], link['b'], link.get('loss', loss))
+            else:
+                connect(link[0], link[1], link[2] if len(link) > 2 else loss)
+        return links
+
+    name, _, arg = kind.partition(':')
+    if name == 'full':
+        for a in range(count):
+            for b in range(a + 1, count):
+                connect(a, b)
+    elif name == 'line':
+        for a in range(count - 1):
+            connect(a, a + 1)
+    elif name == 'star':
+        for b in range(1, count):
+            connect(0, b)
+    elif name == 'grid':
+        width = int(arg) if arg else math.ceil(math.sqrt(count))
+        for a in range(count):
+            if (a + 1) % width and a + 1 < count:
+                connect(a, a + 1)
+            if a + width < count:
+                connect(a, a + width)
+    else:
+        raise ValueError(f'unknown topology {kind}')
+    return links
+
+
+class MeshSim:
+    def __init__(self, args):
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.log_dir = args.log_dir or tempfile.mkdtemp(prefix='mesh_sim_')
+        os.makedirs(self.log_dir, exist_ok=True)
+        self.nodes = [Node(0, 'controller', args.controller_exe, args.seed * 1000 + 1, self.log_dir)]
+        for i in range(1, args.routers + 1):
+            self.nodes.append(Node(i, f'router{i}', args.router_exe, args.seed * 1000 + 1 + i, self.log_dir))
+        links = build_links(args.topology, len(self.nodes), args.loss, args.topology_file)
+        self.medium = Medium(links, args.collisions, self.rng)
+        self.selector = selectors.DefaultSelector()
+        self.received = {}      # (mac, seq) -> time the controller logged it
+        self.start_time = None
+
+    def now(self):
+        return time.monotonic() - self.start_time
+
+    def handle_line(self, node, line):
+        node.log.write(f'{self.now():10.3f} {line}\n')
+        match = pty_pattern.search(line)
+        if match and node.radio_fd is None:
+            node.open_radio(match.group(1))
+            self.selector.register(node.radio_fd, selectors.EVENT_READ, (node, 'radio'))
+            return
+        if line in ROLES:
+            node.role = line
+            return
+        match = sent_pattern.search(line)
+        if match:
+            node.mac = match.group(1)
+            node.sent[(match.group(1), int(match.group(2)))] = self.now()
+            return
+        match = received_pattern.search(line)
+        if match and node.index == 0:
+            self.received.setdefault((match.group(1), int(match.group(2))), self.now())
+
+    def poll(self, until):
+        """Runs the medium and the consoles until the given simulation time"""
+        while True:
+            now = self.now()
+            if now >= until:
+                return
+            timeout = until - now
+            deadline = self.medium.next_deadline()
+            if deadline is not None:
+                timeout = min(timeout, max(0.0, deadline - now))
+            for key, _ in self.selector.select(timeout):
+                node, kind = key.data
+                if kind == 'console':
+                    lines = node.read_console()
+                    if lines is None:
+                        self.selector.unregister(key.fd)
+                        print(f'{node.name} exited', file=sys.stderr)
+                        continue
+                    for line in lines:
+                        self.handle_line(node, line)
+                else:
+                    frames = node.read_frames()
+                    if frames is None:
+                        self.selector.unregister(key.fd)
+                        continue
+                    for psdu in frames:
+                        self.medium.transmit(node, psdu, self.now())
+            self.medium.deliver_due(self.nodes, self.now())
+
+    def run_script(self):
+        """Returns the scripted (time, node names, command) steps in order"""
+        args = self.args
+        start = args.settle
+        stop = args.settle + args.duration
+        steps = [(start - 1, 'all', 'ot state'),
+                 (start, 'controller', 'ctl start'),
+                 (stop, 'controller', 'ctl stop')]
+        for item in args.at:
+            at, target, command = item.split(':', 2)
+            steps.append((float(at), target, command))
+        return sorted(steps, key=lambda step: step[0]), stop + args.drain
+
+    def run(self):
+        self.start_time = time.monotonic()
+        for node in self.nodes:
+            node.start()
+            self.selector.register(node.console_fd, selectors.EVENT_READ, (node, 'console'))
+        steps, end = self.run_script()
+        try:
+            for at, target, command in steps:
+                self.poll(at)
+                for node in self.nodes:
+                    if target in ('all', node.name):
+                        node.command(command)
+            self.poll(end)
+        finally:
+            for node in self.nodes:
+                node.stop()
+        return self.report()
+
+    def report(self):
+        args = self.args
+        latencies = []
+        routers = []
+        for node in self.nodes[1:]:
+            node_latencies = [self.received[key] - sent_at
+                              for key, sent_at in node.sent.items() if key in self.received]
+            latencies += node_latencies
+            sent = len(node.sent)
+            routers.append({
+                'name': node.name,
+                'mac': node.mac,
+                'role': node.role,
+                'sent': sent,
+                'received': len(node_latencies),
+                'pdr': round(len(node_latencies) / sent, 4) if sent else None,
+                'latency_ms': {'p50': ms(percentile(node_latencies, 0.5)),
+                               'p95': ms(percentile(node_latencies, 0.95)),
+                               'max': ms(max(node_latencies, default=None))},
+                'tx_frames': node.tx_frames,
+                'tx_bytes': node.tx_bytes,
+                'airtime_ms': ms(node.airtime),
+            })
+        controller = self.nodes[0]
+        total_sent = sum(r['sent'] for r in routers)
+        total_airtime = sum(node.airtime for node in self.nodes)
+        elapsed = self.now()
+        return {
+            'topology': args.topology_file or args.topology,
+            'routers': args.routers,
+            'loss': args.loss,
+            'collisions': args.collisions,
+            'duration_s': args.duration,
+            'log_dir': self.log_dir,
+            'controller': {'role': controller.role, 'tx_frames': controller.tx_frames,
+                           'airtime_ms': ms(controller.airtime)},
+            'nodes': routers,
+            'total': {
+                'sent': total_sent,
+                'received': len(latencies),
+                'pdr': round(len(latencies) / total_sent, 4) if total_sent else None,
+                'latency_ms': {'p50': ms(percentile(latencies, 0.5)),
+                               'p95': ms(percentile(latencies, 0.95)),
+                               'p99': ms(percentile(latencies, 0.99)),
+                               'max': ms(max(latencies, default=None))},
+                'airtime_ms': ms(total_airtime),
+                # Upper bound, assumes every node shares one collision domain
+                'channel_utilization': round(total_airtime / elapsed, 4) if elapsed else None,
+                'frames_delivered': self.medium.delivered,
+                'frames_lost': self.medium.lost,
+                'frames_collided': self.medium.collided,
+            },
+        }
+
+
+def print_report(report):
+    total = report['total']
+    print(f"topology {report['topology']}, {report['routers']} routers, loss {report['loss']:.0%}, "
+          f"collisions {'on' if report['collisions'] else 'off'}, logs in {report['log_dir']}")
+    print(f"controller: role={report['controller']['role']} airtime={report['controller']['airtime_ms']} ms")
+    print(f"{'node':<10} {'mac':<6} {'role':<9} {'sent':>6} {'recv':>6} {'pdr':>7} "
+          f"{'p50 ms':>8} {'p95 ms':>8} {'max ms':>8} {'frames':>7} {'air ms':>8}")
+    for node in report['nodes']:
+        latency = node['latency_ms']
+        pdr = f"{node['pdr']:.1%}" if node['pdr'] is not None else '-'
+        print(f"{node['name']:<10} {node['mac'] or '-':<6} {node['role'] or '-':<9} {node['sent']:>6} "
+              f"{node['received']:>6} {pdr:>7} {latency['p50'] or '-':>8} {latency['p95'] or '-':>8} "
+              f"{latency['max'] or '-':>8} {node['tx_frames']:>7} {node['airtime_ms']:>8}")
+    latency = total['latency_ms']
+    pdr = f"{total['pdr']:.1%}" if total['pdr'] is not None else '-'
+    print(f"total: sent {total['sent']} received {total['received']} PDR {pdr}, latency p50 {latency['p50']} "
+          f"p95 {latency['p95']} p99 {latency['p99']} max {latency['max']} ms")
+    print(f"air: {total['airtime_ms']} ms, utilization {total['channel_utilization']:.2%}, frames delivered "
+          f"{total['frames_delivered']} lost {total['frames_lost']} collided {total['frames_collided']}")
+
+
+if __name__ == "__main__":
+    here = os.path.dirname(os.path.abspath(__file__))
+    build = os.path.join(here, '..', 'build', 'sim')
+
+    parser = argparse.ArgumentParser(description='v2 mesh simulation on native_sim')
+    parser.add_argument('--routers', '-n', type=int, default=4, help='Number of router instances')
+    parser.add_argument('--topology', '-t', default='full',
+                        help='full, line, star or grid[:width], node 0 is the controller')
+    parser.add_argument('--topology-file', help='JSON {"links": [[a, b, loss], ...]}, overrides --topology')
+    parser.add_argument('--loss', type=float, default=0.0, help='Frame loss probability of every link')
+    parser.add_argument('--collisions', action='store_true', help='Drop frames that overlap at a receiver')
+    parser.add_argument('--settle', type=float, default=30.0, help='Seconds for the mesh to form before start')
+    parser.add_argument('--duration', '-d', type=float, default=60.0, help='Seconds of streaming')
+    parser.add_argument('--drain', type=float, default=3.0, help='Seconds to wait for late packets after stop')
+    parser.add_argument('--at', action='append', default=[], metavar='SECONDS:NODE:COMMAND',
+                        help='Extra shell command, NODE is controller, routerN or all (repeatable)')
+    parser.add_argument('--seed', type=int, default=1, help='Seed of the medium and the nodes')
+    parser.add_argument('--router-exe', default=os.path.join(build, 'router_packets', 'zephyr', 'zephyr.exe'))
+    parser.add_argument('--controller-exe',
+                        default=os.path.join(build, 'controller_packets', 'zephyr', 'zephyr.exe'))
+    parser.add_argument('--log-dir', help='Directory for the node logs (default: a new temporary one)')
+    parser.add_argument('--json', help='Also write the report to this file')
+
+    args = parser.parse_args()
+    for exe in (args.router_exe, args.controller_exe):
+        if not os.access(exe, os.X_OK):
+            print(f"{exe} not found, build the apps with build.sh first")
+            exit(1)
+
+    report = MeshSim(args).run()
+    print_report(report)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(report, f, indent=2)
@@ -5,6 +5,51 @@ import threading
 import time
 import re
 import json # We will use JSON to send structured data
+from collections import deque
+from datetime import datetime, timezone
+
+class MeshClock:
+    """Maps the collector's mesh time (ms) to wall clock with drift estimation.
+
+    Fed with the time beacons the collector logs. The rate is a least squares fit
+    over the recent beacons, the offset is the lower envelope of them, so the
+    line follows the beacons that reached the host with the least delay."""
+
+    def __init__(self, window=32, min_span_seconds=30.0):
+        self.points = deque(maxlen=window)  # (mesh time s, host time s)
+        self.min_span_seconds = min_span_seconds
+        self.rate = 1.0
+        self.base = None
+
+    def add(self, mesh_ms, host_time):
+        mesh = mesh_ms / 1000.0
+        if self.points and mesh < self.points[-1][0]:
+            # The collector rebooted or its 32 bit ms counter wrapped
+            self.points.clear()
+            self.rate = 1.0
+        self.points.append((mesh, host_time))
+        first_mesh, first_host = self.points[0]
+        if mesh - first_mesh >= self.min_span_seconds:
+            n = len(self.points)
+            mean_mesh = sum(m for m, _ in self.points) / n
+            mean_host = sum(h for _, h in self.points) / n
+            var = sum((m - mean_mesh) ** 2 for m, _ in self.points)
+            cov = sum((m - mean_mesh) * (h - mean_host) for m, h in self.points)
+            self.rate = cov / var
+        self.base = min(h - self.rate * m for m, h in self.points)
+
+    @property
+    def synced(self):
+        return self.base is not None
+
+    @property
+    def drift_ppm(self):
+        return (self.rate - 1.0) * 1e6
+
+    def to_wall(self, mesh_ms):
+        if self.base is None:
+            return None
+        return self.base + self.rate * mesh_ms / 1000.0
 
 class SerialBridge:
     def __init__(self, serial_port='/dev/ttyACM0', baud_rate=115200, 
@@ -19,6 +64,14 @@ class SerialBridge:
         self.running = False
         # Regex to remove ANSI escape codes (for colors, etc.)
         self.ansi_escape = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
+        # Regex for the key=value fields nodes append after the MAC suffix
+        self.field_pattern = re.compile(r'\b([a-z]+)=(-?[0-9A-Fa-f]+)\b')
+        # Collector RX stamp of the last parsed line
+        self.collector_rx = None
+        # Time beacons logged by the collector and the mesh time of a received packet
+        self.beacon_pattern = re.compile(r'Sent multicast command: time (\d+)')
+        self.rx_pattern = re.compile(r'Received UDP packet \(rx=(\d+)\)')
+        self.mesh_clock = MeshClock()
         
     def init_serial(self):
         """Initialize serial connection"""
@@ -44,7 +97,8 @@ class SerialBridge:
             print(f"Failed to create web socket: {e}")
             return False
     
-    def send_to_web(self, device_id, message, device_ts=None):
+    def send_to_web(self, device_id, message, device_ts=None, link=None, trace=None, device_time=None,
+                    interval_ms=None):
         """Send structured JSON message to web dashboard"""
         if self.web_socket:
             try:
@@ -54,6 +108,15 @@ class SerialBridge:
                 }
                 if device_ts:
                     payload['device_ts'] = device_ts
+                if link:
+                    payload['link'] = link
+                if device_time:
+                    payload['device_time'] = device_time
+                if interval_ms:
+                    payload['interval_ms'] = interval_ms
+                if trace:
+                    trace['bridge_forward'] = time.time()
+                    payload['trace'] = trace
                 self.web_socket.sendto(
                     json.dumps(payload).encode('utf-8'),
                     (self.web_server_ip, self.web_server_port)
@@ -61,20 +124,87 @@ class SerialBridge:
             except Exception as e:
                 print(f"Failed to send to web: {e}")
     
+    def parse_link_fields(self, message):
+        """Decodes the link-quality fields of a hello message
+        p = uplink RLOC16 (hex), r = average RSSI, m = link margin,
+        n = neighbor count, w = weakest neighbor RSSI"""
+        fields = dict(self.field_pattern.findall(message))
+        link = {}
+        try:
+            if 'p' in fields:
+                link['parent'] = fields['p'].upper()
+            if 'r' in fields:
+                link['rssi'] = int(fields['r'])
+            if 'm' in fields:
+                link['margin'] = int(fields['m'])
+            if 'n' in fields:
+                link['neighbors'] = int(fields['n'])
+            if 'w' in fields:
+                link['weakest_rssi'] = int(fields['w'])
+        except ValueError:
+            pass
+        return link
+
+    def parse_interval_field(self, message):
+        """Decodes the hello interval the node is using (i, ms), it adapts it to
+        the controller's rate and to congestion"""
+        fields = dict(self.field_pattern.findall(message))
+        try:
+            return int(fields['i']) if 'i' in fields else None
+        except ValueError:
+            return None
+
+    def parse_trace_fields(self, message):
+        """Decodes the tracing fields of a hello message
+        s = sequence number, t = send time (ms), y = seconds since the node
+        last synced its mesh time, without y the send time is node uptime"""
+        fields = dict(self.field_pattern.findall(message))
+        trace = {}
+        try:
+            if 's' in fields:
+                trace['seq'] = int(fields['s'])
+            if 't' in fields:
+                trace['node_tx'] = int(fields['t']) / 1000.0
+                if 'y' in fields:
+                    trace['node_tx_mesh'] = int(fields['t'])
+                    trace['sync_age'] = int(fields['y'])
+        except ValueError:
+            pass
+        return trace
+
+    def map_to_wall_clock(self, trace):
+        """Replaces the mesh time stamps of a trace with wall clock ones.
+
+        Only done when the node and the collector are both in the mesh time
+        domain, trace['synced'] then tells the server it can subtract them."""
+        node_tx_mesh = trace.pop('node_tx_mesh', None)
+        rx_mesh = trace.pop('collector_rx_mesh', None)
+        if not self.mesh_clock.synced or node_tx_mesh is None or rx_mesh is None:
+            return None
+        trace['node_tx'] = self.mesh_clock.to_wall(node_tx_mesh)
+        trace['collector_rx'] = self.mesh_clock.to_wall(rx_mesh)
+        trace['synced'] = True
+        trace['drift_ppm'] = round(self.mesh_clock.drift_ppm, 2)
+        return datetime.fromtimestamp(trace['node_tx'], timezone.utc).isoformat()
+
     def parse_and_clean_line(self, line):
         """Cleans line, parses for relevant data, and extracts device ID and timestamp"""
         # 1. Clean the line by removing ANSI escape codes
         cleaned_line = self.ansi_escape.sub('', line).strip()
         
         # 2. Extract Zephyr timestamp (e.g., [00:18:20.910,888])
-        ts_match = re.match(r'\[(\d{2}:\d{2}:\d{2}\.\d{3}),\d+\]', cleaned_line)
+        ts_match = re.match(r'\[((\d{2}):(\d{2}):(\d{2})\.(\d{3})),(\d+)\]', cleaned_line)
         if ts_match:
             device_ts = ts_match.group(1)  # e.g., "00:18:20.910"
+            # Collector uptime (s) when it logged the packet, i.e. its RX stamp
+            hours, minutes, seconds, millis, micros = (int(g) for g in ts_match.groups()[1:])
+            self.collector_rx = hours * 3600 + minutes * 60 + seconds + millis / 1e3 + micros / 1e6
         else:
             device_ts = None
+            self.collector_rx = None
 
         # 3. Find our message and device ID
-        match = re.search(r'hello world (\w+)', cleaned_line)
+        match = re.search(r'hello world (\w+)((?: [a-z]+=-?[0-9A-Fa-f]+)*)', cleaned_line)
         if match:
             full_message = match.group(0)
             device_id = match.group(1)
@@ -88,10 +218,30 @@ class SerialBridge:
             try:
                 if self.serial_conn and self.serial_conn.in_waiting > 0:
                     line = self.serial_conn.readline().decode('utf-8', errors='ignore')
+                    read_time = time.time()
                     if line:
+                        beacon = self.beacon_pattern.search(line)
+                        if beacon:
+                            # Take out the time the line spent on the wire (10 bits per byte)
+                            wire_time = len(line) * 10 / self.baud_rate
+                            self.mesh_clock.add(int(beacon.group(1)), read_time - wire_time)
+                            continue
                         device_id, message, device_ts = self.parse_and_clean_line(line)
                         if device_id and message:
-                            self.send_to_web(device_id, message, device_ts)
+                            link = self.parse_link_fields(message)
+                            # Stamps of every stage so far, the server adds its own
+                            trace = self.parse_trace_fields(message)
+                            if self.collector_rx is not None:
+                                trace['collector_rx'] = self.collector_rx
+                            rx = self.rx_pattern.search(line)
+                            if rx:
+                                trace['collector_rx_mesh'] = int(rx.group(1))
+                            device_time = self.map_to_wall_clock(trace)
+                            trace['bridge_read'] = read_time
+                            trace['bridge_parse'] = time.time()
+                            interval_ms = self.parse_interval_field(message)
+                            self.send_to_web(device_id, message, device_ts, link, trace, device_time,
+                                             interval_ms)
                 
                 time.sleep(0.01)
                 
@@ -1,12 +1,12 @@
 # File: web_server.py (FINAL VERSION)
-from flask import Flask, render_template
+from flask import Flask, render_template, request, Response
 from flask_socketio import SocketIO, emit
 import socket
 import threading
 from datetime import datetime, timezone, timedelta
 import time
 import json
-from collections import deque
+from collections import deque, OrderedDict
 
 # --- Configuration ---
 HOST_IP = '0.0.0.0'
@@ -14,6 +14,9 @@ WEB_SERVER_PORT = 8080
 UDP_LISTENER_PORT = 5000
 # If a device is silent for this many seconds, we count a failed packet.
 PACKET_TIMEOUT_SECONDS = 2.0 
+# Devices that number their packets (s=) count losses from sequence gaps
+# instead; a jump back or beyond this many packets means the device rebooted.
+MAX_SEQUENCE_GAP = 1000
 
 # --- State Management (to store data) ---
 data_lock = threading.Lock()
@@ -27,6 +30,33 @@ total_stats = {
 
 packet_timestamps = deque()  # Store up to 10 minutes at 1Hz
 
+# --- Latency Tracing ---
+# Hops of a hello from the node to the browser, in pipeline order, as
+# (name, start stamp, end stamp). The bridge maps the node and collector stamps
+# to wall clock once they share the collector's mesh time (trace['synced']),
+# before that they are in their own uptime. The browser reports its hops.
+TRACE_HOPS = [
+    ('mesh', 'node_tx', 'collector_rx'),
+    ('serial', 'collector_rx', 'bridge_read'),
+    ('bridge', 'bridge_read', 'bridge_forward'),
+    ('udp', 'bridge_forward', 'server_ingest'),
+    ('server', 'server_ingest', 'server_emit'),
+    ('socket', None, None),
+    ('render', None, None),
+]
+# Histogram bucket upper bounds (ms), the last bucket catches the rest
+TRACE_BUCKETS_MS = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000]
+TRACE_SAMPLES = 1000      # Recent samples per hop kept for percentiles
+TRACE_HISTORY = 2000      # Recent traces kept for export
+# A stamp pair this much later than the fastest seen means a device rebooted
+TRACE_OFFSET_RESET_SECONDS = 60.0
+
+trace_hops = {hop: {'buckets': [0] * (len(TRACE_BUCKETS_MS) + 1),
+                    'samples': deque(maxlen=TRACE_SAMPLES)}
+              for hop, _, _ in TRACE_HOPS}
+trace_history = OrderedDict()   # (device_id, seq or ingest time) -> trace
+clock_offsets = {}              # (hop, device_id) -> smallest end - start seen
+
 # --- Flask & SocketIO Setup ---
 app = Flask(__name__)
 app.config['SECRET_KEY'] = 'a_very_secret_key!'
@@ -51,6 +81,122 @@ def handle_connect():
             'total_stats': total_stats
         })
 
+# --- Latency Tracing Helpers ---
+def record_hop(hop, latency_ms):
+    """Adds one latency sample to a hop's histogram and percentile window"""
+    stats = trace_hops[hop]
+    bucket = next((i for i, bound in enumerate(TRACE_BUCKETS_MS) if latency_ms <= bound),
+                  len(TRACE_BUCKETS_MS))
+    stats['buckets'][bucket] += 1
+    stats['samples'].append(latency_ms)
+
+
+def cross_clock_latency(hop, device_id, start, end):
+    """Latency between stamps of two unsynchronized clocks, in seconds.
+
+    Without a shared time base only the variable part is measurable: the result
+    is relative to the fastest packet seen on this hop, so it shows queueing and
+    retries but not the fixed propagation delay."""
+    key = (hop, device_id)
+    delta = end - start
+    offset = clock_offsets.get(key)
+    if offset is None or delta < offset or delta - offset > TRACE_OFFSET_RESET_SECONDS:
+        clock_offsets[key] = offset = delta
+    return delta - offset
+
+
+def record_trace(device_id, trace):
+    """Computes the pipeline hops of a trace and keeps it for export"""
+    trace['hops'] = {}
+    for hop, start, end in TRACE_HOPS:
+        if start not in trace or end not in trace:
+            continue
+        if hop in ('mesh', 'serial') and trace.get('synced'):
+            latency = max(0.0, trace[end] - trace[start])
+        elif hop == 'mesh':
+            latency = cross_clock_latency(hop, device_id, trace[start], trace[end])
+        elif hop == 'serial':
+            # One collector feeds the bridge, so its offset is shared by all devices
+            latency = cross_clock_latency(hop, None, trace[start], trace[end])
+        else:
+            latency = trace[end] - trace[start]
+        trace['hops'][hop] = round(latency * 1000, 3)
+        record_hop(hop, latency * 1000)
+
+    key = (device_id, trace.get('seq', trace['server_ingest']))
+    trace_history[key] = dict(trace, device_id=device_id)
+    while len(trace_history) > TRACE_HISTORY:
+        trace_history.popitem(last=False)
+
+
+def percentile(values, fraction):
+    if not values:
+        return None
+    ordered = sorted(values)
+    return round(ordered[min(len(ordered) - 1, int(fraction * len(ordered)))], 3)
+
+
+def trace_summary():
+    """Per-hop histograms and percentiles, and the hop with the worst p95"""
+    hops = []
+    for hop, _, _ in TRACE_HOPS:
+        samples = list(trace_hops[hop]['samples'])
+        hops.append({
+            'hop': hop,
+            'count': sum(trace_hops[hop]['buckets']),
+            'p50': percentile(samples, 0.50),
+            'p95': percentile(samples, 0.95),
+            'max': round(max(samples), 3) if samples else None,
+            'buckets': list(trace_hops[hop]['buckets']),
+        })
+    measured = [h for h in hops if h['p95'] is not None]
+    bottleneck = max(measured, key=lambda h: h['p95'])['hop'] if measured else None
+    return {'bucket_bounds_ms': TRACE_BUCKETS_MS, 'hops': hops, 'bottleneck': bottleneck}
+
+
+# --- Trace Export Route ---
+@app.route('/trace/export')
+def trace_export():
+    """Per-hop summary and recent traces as JSON, or the traces as CSV with ?format=csv"""
+    with data_lock:
+        summary = trace_summary()
+        traces = list(trace_history.values())
+    if request.args.get('format') == 'csv':
+        hop_names = [hop for hop, _, _ in TRACE_HOPS]
+        lines = ['device_id,seq,server_ingest,' + ','.join(f'{hop}_ms' for hop in hop_names)]
+        for trace in traces:
+            hops = trace.get('hops', {})
+            lines.append(','.join([trace['device_id'], str(trace.get('seq', '')), f"{trace['server_ingest']:.6f}"] +
+                                  [str(hops.get(hop, '')) for hop in hop_names]))
+        return Response('\n'.join(lines) + '\n', mimetype='text/csv',
+                        headers={'Content-Disposition': 'attachment; filename=trace.csv'})
+    return {'summary': summary, 'traces': traces}
+
+
+@socketio.on('trace_render')
+def handle_trace_render(data):
+    """Browser side of a trace: delivery from the server emit and the time to render"""
+    with data_lock:
+        trace = trace_history.get((data.get('device_id'), data.get('seq')))
+        for hop in ('socket', 'render'):
+            latency_ms = data.get(f'{hop}_ms')
+            if not isinstance(latency_ms, (int, float)):
+                continue
+            # Browser and server clocks only agree if they share a host or NTP
+            latency_ms = max(0.0, latency_ms)
+            record_hop(hop, latency_ms)
+            if trace is not None:
+                trace['hops'][hop] = round(latency_ms, 3)
+
+
+def trace_reporter():
+    """Pushes the per-hop latency summary to the dashboards every 2 seconds"""
+    while True:
+        time.sleep(2)
+        with data_lock:
+            summary = trace_summary()
+        socketio.emit('trace_update', summary)
+
 # --- Background Task for Missed Packets ---
 def check_for_missed_packets():
     while True:
@@ -74,11 +220,19 @@ def check_for_missed_packets():
                     last_seen_dt = datetime.fromisoformat(stats['last_seen'])
                     elapsed = (now - last_seen_dt).total_seconds()
                     
-                    expected_interval = avg_interval * 2  # tolerate 2×
+                    # Nodes adapt their interval, trust the one they report
+                    if 'last_seq' in stats and stats.get('interval_ms'):
+                        interval = stats['interval_ms'] / 1000
+                    else:
+                        interval = max(avg_interval, stats.get('interval_ms', 0) / 1000)
+                    expected_interval = interval * 2  # tolerate 2×
                     missed = int(elapsed // expected_interval)
                     
                     if missed > 0:
                         stats['failed_packets'] += missed
+                        if 'last_seq' in stats:
+                            # Settled against the sequence gap once the node is heard again
+                            stats['timeout_missed'] = stats.get('timeout_missed', 0) + missed
                         stats['last_seen'] = now.isoformat()
                         print(f"Device {device_id} missed {missed} packet(s).")
                         socketio.emit('stats_update', {'total_stats': total_stats, 'device_stats': device_stats})
@@ -94,16 +248,25 @@ def udp_listener():
     while True:
         try:
             data, addr = udp_socket.recvfrom(1024)
+            ingest_time = time.time()
             payload = json.loads(data.decode('utf-8'))
             device_id = payload['device_id']
             message = payload['message']
             device_ts = payload.get('device_ts')  # <-- NEW
+            device_time = payload.get('device_time')
+            link = payload.get('link')
+            trace = payload.get('trace')
+            interval_ms = payload.get('interval_ms')
 
             with data_lock:
                 now = datetime.now(timezone.utc)
                 now_iso = now.isoformat()
-                # Use device_ts if present, else fallback to now_iso
-                msg_timestamp = device_ts if device_ts else now_iso
+                # Shown with the message: the node's send time mapped to wall clock
+                # when its clock is synced, else the collector's uptime, else now_iso.
+                # last_seen always stays in the server's clock, check_for_missed_packets
+                # compares it with its own now.
+                msg_timestamp = device_time or device_ts or now_iso
+                seq = trace.get('seq') if trace else None
 
                 # Track packet timestamps for rate calculation
                 packet_timestamps.append(now)
@@ -113,12 +276,12 @@ def udp_listener():
                     now = datetime.now(timezone.utc)
                     elapsed = (now - datetime.fromisoformat(total_stats['start_time'])).total_seconds()
                     expected_interval = PACKET_TIMEOUT_SECONDS
-                    estimated_missed = int(elapsed // expected_interval)
+                    estimated_missed = int(elapsed // expected_interval) if seq is None else 0
     
                     device_stats[device_id] = {
                         'total_packets': 0,
                         'failed_packets': estimated_missed,
-                        'last_seen': msg_timestamp,
+                        'last_seen': now_iso,
                         'failure_counted': False
                 }
                 total_stats['total_devices'] = len(device_data)
@@ -133,8 +296,20 @@ def udp_listener():
                 if len(device_data[device_id]) > 50: device_data[device_id].pop(0)
 
                 device_stats[device_id]['total_packets'] += 1
-                device_stats[device_id]['last_seen'] = msg_timestamp
+                device_stats[device_id]['last_seen'] = now_iso
+                if seq is not None:
+                    last_seq = device_stats[device_id].get('last_seq')
+                    timeout_missed = device_stats[device_id].pop('timeout_missed', 0)
+                    if last_seq is not None and 0 < seq - last_seq <= MAX_SEQUENCE_GAP:
+                        # The gap is exact, it replaces what the timeout estimated
+                        gap = seq - last_seq - 1
+                        device_stats[device_id]['failed_packets'] += gap - timeout_missed
+                    device_stats[device_id]['last_seq'] = seq
                 device_stats[device_id]['failure_counted'] = False
+                if link:
+                    device_stats[device_id]['link'] = link
+                if interval_ms:
+                    device_stats[device_id]['interval_ms'] = interval_ms
                 total_stats['total_packets'] += 1
 
                 # Calculate packets/min for the last 60 seconds
@@ -142,6 +317,16 @@ def udp_listener():
                 packets_last_min = sum(1 for t in packet_timestamps if t > cutoff)
                 total_stats['packets_per_min'] = packets_last_min
 
+                if trace is not None:
+                    trace['server_ingest'] = ingest_time
+                    trace['server_emit'] = time.time()
+                    record_trace(device_id, trace)
+                    if 'mesh' in trace['hops'] and trace.get('synced'):
+                        device_stats[device_id]['latency_ms'] = trace['hops']['mesh']
+                    # The browser reports its hops back with the sequence number
+                    message_payload['trace'] = {'seq': trace.get('seq', ingest_time),
+                                                'server_emit': trace['server_emit']}
+
             update_package = {
                 'device_mac': device_id,
                 'stats': device_stats[device_id],
@@ -165,6 +350,10 @@ if __name__ == '__main__':
     failure_checker_thread = threading.Thread(target=check_for_missed_packets, daemon=True)
     failure_checker_thread.start()
 
+    # Push the per-hop latency summary in a background thread
+    trace_thread = threading.Thread(target=trace_reporter, daemon=True)
+    trace_thread.start()
+
     # Start the main UDP listener in a background thread
     listener_thread = threading.Thread(target=udp_listener, daemon=True)
     listener_thread.start()
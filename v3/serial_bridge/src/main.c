@@ -8,6 +8,7 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/net/openthread.h>
@@ -16,9 +17,13 @@
 #include <openthread/link.h>
 #include <openthread/thread_ftd.h>
 #include <openthread/message.h>
+#include <openthread/network_time.h>
 #include <openthread/udp.h>
 #include <openthread/border_router.h>
 
+#include "frame_budget.h"
+#include "traffic_class.h"
+
 /* Sets name inside of shell to see which messages come from that*/
 LOG_MODULE_REGISTER(ot_controller, CONFIG_LOG_DEFAULT_LEVEL);
 
@@ -72,49 +77,71 @@ static void set_thread_network_config(otInstance *instance) {
   otDatasetSetActive(instance, &dataset);
 }
 
+/* Time source of the mesh
+Every TIME_BEACON_INTERVAL_MS the collector multicasts "time <ms>" with its
+mesh time, the routers keep their clocks in step with it and stamp their
+hellos in that domain. The bridge maps the mesh time to wall clock from the
+logged beacons and the rx= stamp of every received packet */
+#define TIME_BEACON_INTERVAL_MS 5000
+#define TIME_BEACON_WORST FRAME_WORST("time 4294967295")
+FRAME_ASSERT_FITS(TIME_BEACON_WORST, FRAME_ADDR_RLOC);
+
+/* Mesh time in ms, Thread network time when the stack provides it */
+static uint32_t mesh_time_ms(void) {
+#if defined(CONFIG_OPENTHREAD_TIME_SYNC)
+  uint64_t network_time;
+  if (otNetworkTimeGet(openthread_get_default_instance(), &network_time) ==
+      OT_NETWORK_TIME_SYNCHRONIZED) {
+    return (uint32_t)(network_time / 1000);
+  }
+#endif
+  return k_uptime_get_32();
+}
+
 /* UDP implementation */
 static otUdpSocket rxSocket;
 
 static void udp_receive_cb(void *aContext, otMessage *aMessage,
                            const otMessageInfo *aMessageInfo) {
-  char buf[128];
+  uint16_t length = otMessageGetLength(aMessage);
+  char buf[FRAME_PAYLOAD_BUF];
   int len = otMessageRead(aMessage, 0, buf, sizeof(buf) - 1);
   buf[len] = 0;
+
+  // No single frame carries more, the sender's message was fragmented
+  if (length > FRAME_PAYLOAD_MAX(FRAME_ADDR_RLOC)) {
+    LOG_WRN("Fragmented payload of %u B, first %d B kept", length, len);
+  }
   
   // Log the received message - this will be captured by the serial bridge
-  LOG_INF("Received UDP packet: %s", buf);
+  LOG_INF("Received UDP packet (rx=%u): %s", mesh_time_ms(), buf);
   
   // Also print to console for immediate visibility
   printk("UDP RX: %s\n", buf);
 }
 
-/* Constructs and sends a UDP packet
-gets default OpenThread instance and sends a message
-Sets destination to all other thread devices
-cleans up message buffer*/
+/* Sends a command to all other thread devices, from any context */
 void send_multicast_command(const char *cmd) {
-  otInstance *instance = openthread_get_default_instance();
-  otMessage *message = otUdpNewMessage(instance, NULL);
-  if (!message)
-    return;
-  otMessageAppend(message, cmd, strlen(cmd));
-
-  otMessageInfo msgInfo = {0};
-  otIp6AddressFromString("ff03::1", &msgInfo.mPeerAddr); // Mesh-local multicast
-  msgInfo.mPeerPort = OT_CONNECTION_LED_PORT;
-
-  otUdpSocket udpSocket;
-  if (otUdpOpen(instance, &udpSocket, NULL, NULL) == OT_ERROR_NONE) {
-    otUdpSend(instance, &udpSocket, message, &msgInfo);
-    otUdpClose(instance, &udpSocket);
-    
-    // Log the sent command
-    LOG_INF("Sent multicast command: %s", cmd);
-  } else {
-    otMessageFree(message);
-  }
+  tc_send(TC_CONTROL, cmd);
+
+  // Log the sent command
+  LOG_INF("Sent multicast command: %s", cmd);
+}
+
+/* Sends the time beacon, a control message so that queued telemetry does
+not delay it and skew the routers' clocks */
+static void time_beacon_handler(struct k_work *work) {
+  char cmd[TIME_BEACON_WORST + 1];
+
+  snprintk(cmd, sizeof(cmd), "time %u", mesh_time_ms());
+  send_multicast_command(cmd);
+
+  k_work_reschedule(k_work_delayable_from_work(work),
+                    K_MSEC(TIME_BEACON_INTERVAL_MS));
 }
 
+K_WORK_DELAYABLE_DEFINE(time_beacon_work, time_beacon_handler);
+
 /*Interrupt Service Routine (callback)
 if/else either turns LED on or off and starts or stops streaming */
 void button_pressed(const struct device *dev, struct gpio_callback *cb,
@@ -134,44 +161,7 @@ void button_pressed(const struct device *dev, struct gpio_callback *cb,
 }
 
 /* UDP sending logic */
-void send_light_control_command(void) {
-  otError error = OT_ERROR_NONE;
-  otMessage *message;
-  otMessageInfo messageInfo;
-  otInstance *p_ot_instance = openthread_get_default_instance();
-  otUdpSocket udpSocket;
-
-  memset(&messageInfo, 0, sizeof(messageInfo));
-  otIp6AddressFromString("ff03::1", &messageInfo.mPeerAddr);
-  messageInfo.mPeerPort = OT_CONNECTION_LED_PORT;
-
-  message = otUdpNewMessage(p_ot_instance, NULL);
-  if (message == NULL) {
-    LOG_ERR("Failed to allocate new UDP message.");
-    return;
-  }
-
-  error = otMessageAppend(message, light_command, strlen(light_command));
-  if (error != OT_ERROR_NONE) {
-    otMessageFree(message);
-    return;
-  }
-
-  error = otUdpOpen(p_ot_instance, &udpSocket, NULL, NULL);
-  if (error != OT_ERROR_NONE) {
-    otMessageFree(message);
-    return;
-  }
-
-  error = otUdpSend(p_ot_instance, &udpSocket, message, &messageInfo);
-  if (error != OT_ERROR_NONE) {
-    LOG_ERR("Failed to send UDP message: %d", error);
-  } else {
-    LOG_INF("UDP message sent successfully!");
-  }
-
-  otUdpClose(p_ot_instance, &udpSocket);
-}
+void send_light_control_command(void) { send_multicast_command(light_command); }
 
 /* Network status monitoring function */
 void print_network_status(void) {
@@ -253,6 +243,9 @@ int main(void) {
     return -1;
   }
   LOG_INF("OpenThread stack has been started.");
+  tc_init(instance, OT_CONNECTION_LED_PORT);
+  LOG_INF("Time beacon worst case %zu B frame, single frame is %u B",
+          frame_size(TIME_BEACON_WORST, FRAME_ADDR_RLOC), FRAME_PSDU_MAX);
 
   // Open UDP socket for multicast commands
   otSockAddr listen_addr = {0};
@@ -260,6 +253,9 @@ int main(void) {
   otUdpOpen(instance, &rxSocket, udp_receive_cb, NULL);
   otUdpBind(instance, &rxSocket, &listen_addr, OT_NETIF_THREAD);
 
+  // Start the time beacons
+  k_work_schedule(&time_beacon_work, K_MSEC(TIME_BEACON_INTERVAL_MS));
+
   // Start network status monitoring (every 30 seconds)
   k_timer_start(&network_timer, K_SECONDS(10), K_SECONDS(30));
 